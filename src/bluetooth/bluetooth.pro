@@ -31,7 +31,8 @@ PUBLIC_HEADERS += \
     qlowenergyadvertisingdata.h \
     qlowenergyadvertisingparameters.h \
     qlowenergyconnectionparameters.h \
-    qlowenergycontroller.h
+    qlowenergycontroller.h \
+    qlowenergycontrollerstatistics.h
 
 PRIVATE_HEADERS += \
     qbluetoothaddress_p.h\
@@ -47,6 +48,7 @@ PRIVATE_HEADERS += \
     qprivatelinearbuffer_p.h \
     qbluetoothlocaldevice_p.h \
     qlowenergycontroller_p.h \
+    qlowenergycontrollerstatistics_p.h \
     qlowenergyserviceprivate_p.h \
     qleadvertiser_p.h \
     lecmaccalculator_p.h
@@ -69,6 +71,7 @@ SOURCES += \
     qlowenergyadvertisingdata.cpp \
     qlowenergyadvertisingparameters.cpp \
     qlowenergyconnectionparameters.cpp \
+    qlowenergycontrollerstatistics.cpp \
     qlowenergyservice.cpp \
     qlowenergyservicedata.cpp \
     qlowenergycharacteristic.cpp \
@@ -99,12 +102,28 @@ config_bluez:qtHaveModule(dbus) {
 
     # old versions of Bluez do not have the required BTLE symbols
     config_bluez_le {
+        PRIVATE_HEADERS += \
+            btsnoopwriter_p.h \
+            leattreceiver_p.h \
+            leattributecache_p.h \
+            lebondstore_p.h \
+            leconnectionmanager_p.h \
+            lerawscanner_p.h \
+            qlowenergycharacteristicwriter_p.h
+
         SOURCES +=  \
+            btsnoopwriter.cpp \
+            leattreceiver.cpp \
+            leattributecache.cpp \
+            lebondstore.cpp \
+            leconnectionmanager.cpp \
+            lerawscanner.cpp \
             qleadvertiser_bluez.cpp \
+            qlowenergycharacteristicwriter_bluez.cpp \
             qlowenergycontroller_bluez.cpp \
             lecmaccalculator.cpp
         config_linux_crypto_api:DEFINES += CONFIG_LINUX_CRYPTO_API
-        else:message("Linux crypto API not present, signed writes will not work.")
+        else:message("Linux crypto API not present, signed writes use the built-in AES-CMAC.")
     } else {
         message("Bluez version is too old to support Bluetooth Low Energy.")
         message("Only classic Bluetooth will be available.")
@@ -347,6 +347,13 @@ struct evt_cmd_complete {
     quint16 opcode;
 } __attribute__ ((packed));
 
+#define EVT_CMD_STATUS                  0x0F
+struct evt_cmd_status {
+    quint8 status;
+    quint8 ncmd;
+    quint16 opcode;
+} __attribute__ ((packed));
+
 struct AclData {
     quint16 handle: 12;
     quint16 pbFlag: 2;
@@ -374,9 +381,19 @@ enum OpCodeCommandField {
     OcfLeSetAdvData = 0x8,
     OcfLeSetScanResponseData = 0x9,
     OcfLeSetAdvEnable = 0xa,
+    OcfLeSetScanParameters = 0xb,
+    OcfLeSetScanEnable = 0xc,
     OcfLeClearWhiteList = 0x10,
     OcfLeAddToWhiteList = 0x11,
     OcfLeConnectionUpdate = 0x13,
+    OcfLeSetDataLength = 0x22,
+    OcfLeSetPhy = 0x32,
+    OcfLeSetExtAdvParams = 0x36,
+    OcfLeSetExtAdvData = 0x37,
+    OcfLeSetExtScanResponseData = 0x38,
+    OcfLeSetExtAdvEnable = 0x39,
+    OcfLeReadMaxAdvDataLength = 0x3a,
+    OcfLeRemoveAdvSet = 0x3c,
 };
 
 /* Command opcode pack/unpack */
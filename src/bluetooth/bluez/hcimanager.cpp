@@ -43,8 +43,11 @@
 #include "qbluetoothsocket_p.h"
 #include "qlowenergyconnectionparameters.h"
 
+#include <QtCore/qelapsedtimer.h>
 #include <QtCore/qloggingcategory.h>
+#include <QtCore/qpointer.h>
 
+#include <algorithm>
 #include <cstring>
 #include <errno.h>
 #include <sys/types.h>
@@ -52,15 +55,57 @@
 #include <sys/ioctl.h>
 #include <sys/uio.h>
 #include <unistd.h>
+#include <linux/filter.h>
 
 #define HCIGETCONNLIST  _IOR('H', 212, int)
 #define HCIGETDEVINFO   _IOR('H', 211, int)
 #define HCIGETDEVLIST   _IOR('H', 210, int)
 
+// recvmmsg() is available since glibc 2.12 and Linux 2.6.33
+#if defined(__GLIBC__) && defined(__GLIBC_PREREQ)
+#  if __GLIBC_PREREQ(2, 12)
+#    define QT_BT_HAVE_RECVMMSG
+#  endif
+#endif
+
 QT_BEGIN_NAMESPACE
 
 Q_DECLARE_LOGGING_CATEGORY(QT_BT_BLUEZ)
 
+const int HciManager::ReadBatchSize;
+
+namespace {
+const int packetBufferSize = qMax<int>(HCI_MAX_EVENT_SIZE, sizeof(AclData));
+
+// Upper limit of packets handled per wakeup, so that a flood of packets
+// cannot starve the other sockets of the event loop.
+const int maxPacketsPerWakeup = 256;
+
+/*
+ * Events which only report the current state of a connection. If a batch holds
+ * several of them for the same connection, all but the last one are outdated.
+ * Returns a key identifying event type and connection or 0 for all other packets.
+ */
+quint32 supersedableEventKey(const quint8 *packet, int size)
+{
+    // packet type, event code, parameter length, subevent code, parameters
+    if (size < 7 || packet[0] != HCI_EVENT_PKT || packet[1] != HciManager::LeMetaEvent)
+        return 0;
+    const quint8 * const data = packet + 3;
+    switch (data[0]) {
+    case 0x3: // connection update complete
+    case 0xc: // PHY update complete
+        if (data[1] != 0) // status
+            return 0;
+        return 0x1000000 | (quint32(data[0]) << 16) | bt_get_le16(data + 2);
+    case 0x7: // data length change
+        return 0x1000000 | (quint32(data[0]) << 16) | bt_get_le16(data + 1);
+    default:
+        return 0;
+    }
+}
+}
+
 HciManager::HciManager(const QBluetoothAddress& deviceAdapter, QObject *parent) :
     QObject(parent), hciSocket(-1), hciDev(-1), notifier(0)
 {
@@ -91,6 +136,7 @@ HciManager::HciManager(const QBluetoothAddress& deviceAdapter, QObject *parent)
         return;
     }
 
+    readBuffer.resize(ReadBatchSize * packetBufferSize);
     notifier = new QSocketNotifier(hciSocket, QSocketNotifier::Read, this);
     connect(notifier, SIGNAL(activated(int)), this, SLOT(_q_readNotify()));
 
@@ -203,9 +249,48 @@ bool HciManager::monitorAclPackets()
         return false;
     }
 
+    attachAclFilter();
     return true;
 }
 
+/*
+ * The HCI filter above lets through all ACL data of the adapter, including bulk
+ * GATT and RFCOMM transfers, while we are only interested in the SMP Signing
+ * Information (see handleHciAclPacket()). This attaches a socket filter which
+ * drops everything else in the kernel. Events are not affected by it. Without
+ * the filter, the other packets are dropped in userspace instead.
+ */
+void HciManager::attachAclFilter()
+{
+    // The socket sees the packet type followed by the ACL header, the L2CAP header
+    // and the payload. The loads of the BPF machine are big endian.
+    sock_filter instructions[] = {
+        // accept all events, the HCI filter has selected those already
+        BPF_STMT(BPF_LD | BPF_B | BPF_ABS, 0),
+        BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, HCI_EVENT_PKT, 8, 0),
+        BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, HCI_ACL_PKT, 0, 8),
+        // start of a directed L2CAP frame: PB flag 0 or 2, BC flag 0
+        BPF_STMT(BPF_LD | BPF_B | BPF_ABS, 2),
+        BPF_JUMP(BPF_JMP | BPF_JSET | BPF_K, 0xd0, 6, 0),
+        // on the security manager channel
+        BPF_STMT(BPF_LD | BPF_H | BPF_ABS, 1 + sizeof(AclData) + 2),
+        BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, qbswap<quint16>(SECURITY_CHANNEL_ID), 0, 4),
+        // carrying Signing Information
+        BPF_STMT(BPF_LD | BPF_B | BPF_ABS, 1 + sizeof(AclData) + sizeof(L2CapHeader)),
+        BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, 0x0a, 0, 2),
+        BPF_STMT(BPF_RET | BPF_K, 0xffffffff), // accept ACL
+        BPF_STMT(BPF_RET | BPF_K, 0xffffffff), // accept event
+        BPF_STMT(BPF_RET | BPF_K, 0), // drop
+    };
+    sock_fprog program;
+    program.len = sizeof instructions / sizeof *instructions;
+    program.filter = instructions;
+    if (setsockopt(hciSocket, SOL_SOCKET, SO_ATTACH_FILTER, &program, sizeof program) < 0) {
+        qCDebug(QT_BT_BLUEZ) << "Cannot attach ACL socket filter, filtering in userspace:"
+                             << strerror(errno);
+    }
+}
+
 bool HciManager::sendCommand(OpCodeGroupField ogf, OpCodeCommandField ocf, const QByteArray &parameters)
 {
     qCDebug(QT_BT_BLUEZ) << "sending command; ogf:" << ogf << "ocf:" << ocf;
@@ -263,7 +348,8 @@ QBluetoothAddress HciManager::addressForConnectionHandle(quint16 handle) const
     hci_conn_info *info;
     hci_conn_list_req *infoList;
 
-    const int maxNoOfConnections = 20;
+    // the HCI socket is shared by all LE connections of the adapter
+    const int maxNoOfConnections = 64;
     infoList = (hci_conn_list_req *)
             malloc(sizeof(hci_conn_list_req) + maxNoOfConnections * sizeof(hci_conn_info));
 
@@ -332,6 +418,79 @@ bool HciManager::sendConnectionUpdateCommand(quint16 handle,
     return sendCommand(OgfLinkControl, OcfLeConnectionUpdate, data);
 }
 
+bool HciManager::sendSetDataLengthCommand(quint16 handle, quint16 txOctets, quint16 txTime)
+{
+    // Spec v4.2, Vol 2, Part E, 7.8.46
+    struct CommandParams {
+        quint16 handle;
+        quint16 txOctets;
+        quint16 txTime;
+    } __attribute__ ((packed)) commandParams;
+    commandParams.handle = qToLittleEndian(handle);
+    commandParams.txOctets = qToLittleEndian(txOctets);
+    commandParams.txTime = qToLittleEndian(txTime);
+    const QByteArray data = QByteArray::fromRawData(reinterpret_cast<char *>(&commandParams),
+                                                    sizeof commandParams);
+    return sendCommand(OgfLinkControl, OcfLeSetDataLength, data);
+}
+
+bool HciManager::sendSetPhyCommand(quint16 handle, quint8 txPhys, quint8 rxPhys)
+{
+    // Spec v5.0, Vol 2, Part E, 7.8.49
+    struct CommandParams {
+        quint16 handle;
+        quint8 allPhys;
+        quint8 txPhys;
+        quint8 rxPhys;
+        quint16 phyOptions;
+    } __attribute__ ((packed)) commandParams;
+    commandParams.handle = qToLittleEndian(handle);
+    commandParams.allPhys = 0; // we have preferences for both directions
+    commandParams.txPhys = txPhys;
+    commandParams.rxPhys = rxPhys;
+    commandParams.phyOptions = 0;
+    const QByteArray data = QByteArray::fromRawData(reinterpret_cast<char *>(&commandParams),
+                                                    sizeof commandParams);
+    return sendCommand(OgfLinkControl, OcfLeSetPhy, data);
+}
+
+/*
+ * Sets up the scan the controller runs once enabled. It always scans with the public
+ * address and accepts all advertisements. Both times are in units of 0.625 ms.
+ */
+bool HciManager::sendSetScanParametersCommand(bool active, quint16 interval, quint16 window)
+{
+    // Spec v4.2, Vol 2, Part E, 7.8.10
+    struct ScanParams {
+        quint8 type;
+        quint16 interval;
+        quint16 window;
+        quint8 ownAddrType;
+        quint8 filterPolicy;
+    } __attribute__ ((packed));
+    ScanParams params;
+    static_assert(sizeof params == 7, "unexpected struct size");
+    params.type = active ? 0x01 : 0x00;
+    params.interval = qToLittleEndian(interval);
+    params.window = qToLittleEndian(window);
+    params.ownAddrType = 0; // public
+    params.filterPolicy = 0; // accept all advertisements
+    const QByteArray data(reinterpret_cast<const char *>(&params), sizeof params);
+    return sendCommand(OgfLinkControl, OcfLeSetScanParameters, data);
+}
+
+/*
+ * Starts or stops the scan. The reports arrive as advertisingReportsReceived().
+ */
+bool HciManager::sendSetScanEnableCommand(bool enable, bool filterDuplicates)
+{
+    // Spec v4.2, Vol 2, Part E, 7.8.11
+    QByteArray data(2, Qt::Uninitialized);
+    data[0] = enable;
+    data[1] = filterDuplicates;
+    return sendCommand(OgfLinkControl, OcfLeSetScanEnable, data);
+}
+
 bool HciManager::sendConnectionParameterUpdateRequest(quint16 handle,
                                                       const QLowEnergyConnectionParameters &params)
 {
@@ -382,34 +541,141 @@ bool HciManager::sendConnectionParameterUpdateRequest(quint16 handle,
     return true;
 }
 
-/*!
- * Process all incoming HCI events. Function cannot process anything else but events.
+/*
+ * Drains the socket, so that a busy adapter does not cost one wakeup per packet.
+ * The packets are read in batches into readBuffer and dispatched batch by batch.
+ * A receiver of our signals may run a nested event loop. The notifier is disabled
+ * meanwhile, so that readBuffer cannot be overwritten while it is dispatched.
  */
 void HciManager::_q_readNotify()
 {
-    unsigned char buffer[qMax<int>(HCI_MAX_EVENT_SIZE, sizeof(AclData))];
-    int size;
+    notifier->setEnabled(false);
+    const QPointer<HciManager> guard(this);
+    int packetSizes[ReadBatchSize];
+    int packetsHandled = 0;
+    while (packetsHandled < maxPacketsPerWakeup) {
+        const int count = readPackets(packetSizes);
+        if (count <= 0)
+            break;
+        dispatchPackets(packetSizes, count);
+        if (!guard)
+            return; // deleted by a receiver of one of our signals
+        if (count < ReadBatchSize)
+            break; // nothing left
+        packetsHandled += count;
+    }
+    notifier->setEnabled(true);
+}
 
-    size = ::read(hciSocket, buffer, sizeof(buffer));
-    if (size < 0) {
-        if (errno != EAGAIN && errno != EINTR)
-            qCWarning(QT_BT_BLUEZ) << "Failed reading HCI events:" << qt_error_string(errno);
+/*
+ * Reads up to ReadBatchSize packets without blocking and returns their number,
+ * or -1 on error.
+ */
+int HciManager::readPackets(int *sizes)
+{
+    char * const buffer = readBuffer.data();
+#ifdef QT_BT_HAVE_RECVMMSG
+    static bool recvmmsgAvailable = true;
+    if (recvmmsgAvailable) {
+        mmsghdr messages[ReadBatchSize];
+        iovec vectors[ReadBatchSize];
+        memset(messages, 0, sizeof messages);
+        for (int i = 0; i < ReadBatchSize; ++i) {
+            vectors[i].iov_base = buffer + i * packetBufferSize;
+            vectors[i].iov_len = packetBufferSize;
+            messages[i].msg_hdr.msg_iov = &vectors[i];
+            messages[i].msg_hdr.msg_iovlen = 1;
+        }
+        const int count = ::recvmmsg(hciSocket, messages, ReadBatchSize, MSG_DONTWAIT, nullptr);
+        if (count >= 0) {
+            for (int i = 0; i < count; ++i)
+                sizes[i] = int(messages[i].msg_len);
+            return count;
+        }
+        if (errno != ENOSYS) {
+            if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)
+                qCWarning(QT_BT_BLUEZ) << "Failed reading HCI events:" << qt_error_string(errno);
+            return -1;
+        }
+        // The kernel predates recvmmsg(), read the packets one by one.
+        recvmmsgAvailable = false;
+    }
+#endif
+
+    int count = 0;
+    for (; count < ReadBatchSize; ++count) {
+        const int size = ::recv(hciSocket, buffer + count * packetBufferSize, packetBufferSize,
+                                MSG_DONTWAIT);
+        if (size < 0) {
+            if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)
+                qCWarning(QT_BT_BLUEZ) << "Failed reading HCI events:" << qt_error_string(errno);
+            break;
+        }
+        sizes[count] = size;
+    }
+    return count == 0 ? -1 : count;
+}
 
-        return;
+void HciManager::dispatchPackets(const int *sizes, int count)
+{
+    const quint8 * const buffer = reinterpret_cast<const quint8 *>(readBuffer.constData());
+    quint32 keys[ReadBatchSize];
+    for (int i = 0; i < count; ++i)
+        keys[i] = supersedableEventKey(buffer + i * packetBufferSize, sizes[i]);
+
+    QElapsedTimer clock;
+    clock.start();
+    batchTimestamp = clock.msecsSinceReference();
+
+    const QPointer<HciManager> guard(this);
+    for (int i = 0; i < count; ++i) {
+        if (keys[i] && std::find(keys + i + 1, keys + count, keys[i]) != keys + count)
+            continue; // a later event in this batch supersedes this one
+
+        const quint8 * const packet = buffer + i * packetBufferSize;
+        const int size = sizes[i];
+        if (size < 1)
+            continue;
+        switch (packet[0]) {
+        case HCI_EVENT_PKT:
+            handleHciEventPacket(packet + 1, size - 1);
+            break;
+        case HCI_ACL_PKT:
+            handleHciAclPacket(packet + 1, size - 1);
+            break;
+        default:
+            qCWarning(QT_BT_BLUEZ) << "Ignoring unexpected HCI packet type" << packet[0];
+        }
+        if (!guard)
+            return;
     }
 
-    switch (buffer[0]) {
-    case HCI_EVENT_PKT:
-        handleHciEventPacket(buffer + 1, size - 1);
-        break;
-    case HCI_ACL_PKT:
-        handleHciAclPacket(buffer + 1, size - 1);
-        break;
-    default:
-        qCWarning(QT_BT_BLUEZ) << "Ignoring unexpected HCI packet type" << buffer[0];
+    if (!advertisingReports.isEmpty()) {
+        emit advertisingReportsReceived(advertisingReports);
+        if (guard)
+            advertisingReports.resize(0); // keeps the capacity
     }
 }
 
+#ifdef QT_BUILD_INTERNAL
+/*
+ * Dispatches packets as if they had been read from the socket in one batch.
+ * Lets autotests feed canned events to managers without an adapter.
+ */
+void HciManager::dispatchPackets(const QVector<QByteArray> &packets)
+{
+    Q_ASSERT(packets.size() <= ReadBatchSize);
+    if (readBuffer.isEmpty())
+        readBuffer.resize(ReadBatchSize * packetBufferSize);
+    int sizes[ReadBatchSize];
+    for (int i = 0; i < packets.size(); ++i) {
+        sizes[i] = qMin(packets.at(i).size(), packetBufferSize);
+        memcpy(readBuffer.data() + i * packetBufferSize, packets.at(i).constData(), sizes[i]);
+    }
+    dispatchPackets(sizes, packets.size());
+}
+#endif
+
 void HciManager::handleHciEventPacket(const quint8 *data, int size)
 {
     if (size < HCI_EVENT_HDR_SIZE) {
@@ -455,8 +721,16 @@ void HciManager::handleHciEventPacket(const quint8 *data, int size)
         emit commandCompleted(event->opcode, status, additionalData);
     }
         break;
+    case EVT_CMD_STATUS: {
+        // Spec v4.2, Vol 2, Part E, 7.7.15
+        if (size < static_cast<int>(sizeof(evt_cmd_status)))
+            break;
+        auto * const event = reinterpret_cast<const evt_cmd_status *>(data);
+        emit commandStatusReceived(event->opcode, event->status);
+    }
+        break;
     case LeMetaEvent:
-        handleLeMetaEvent(data);
+        handleLeMetaEvent(data, size);
         break;
     default:
         break;
@@ -521,13 +795,21 @@ void HciManager::handleHciAclPacket(const quint8 *data, int size)
     emit signatureResolvingKeyReceived(aclData->handle, isRemoteKey, csrk);
 }
 
-void HciManager::handleLeMetaEvent(const quint8 *data)
+void HciManager::handleLeMetaEvent(const quint8 *data, int size)
 {
     // Spec v4.2, Vol 2, part E, 7.7.65ff
     switch (*data) {
+    case 0x2:
+        handleAdvertisingReports(data + 1, size - 1);
+        break;
     case 0x1: {
+        if (data[1] != 0) // status
+            break;
         const quint16 handle = bt_get_le16(data + 2);
-        emit connectionComplete(handle);
+        const bool isCentral = data[4] == 0;
+        quint8 peerAddress[6];
+        memcpy(peerAddress, data + 6, sizeof peerAddress);
+        emit connectionComplete(handle, isCentral, QBluetoothAddress(convertAddress(peerAddress)));
         break;
     }
     case 0x3: {
@@ -551,9 +833,60 @@ void HciManager::handleLeMetaEvent(const quint8 *data)
         }
         break;
     }
+    case 0x7: {
+        // Spec v4.2, Vol 2, Part E, 7.7.65.7
+        const quint16 handle = bt_get_le16(data + 1);
+        const quint16 maxTxOctets = bt_get_le16(data + 3);
+        const quint16 maxRxOctets = bt_get_le16(data + 7);
+        emit dataLengthChanged(handle, maxTxOctets, maxRxOctets);
+        break;
+    }
+    case 0xc: {
+        // Spec v5.0, Vol 2, Part E, 7.7.65.12
+        if (data[1] == 0)
+            emit phyUpdated(bt_get_le16(data + 2), data[4], data[5]);
+        break;
+    }
     default:
         break;
     }
 }
 
+/*
+ * The reports are collected and emitted together with those of the other packets
+ * of the same batch, see dispatchPackets().
+ */
+void HciManager::handleAdvertisingReports(const quint8 *data, int size)
+{
+    // Spec v4.2, Vol 2, Part E, 7.7.65.2. Like BlueZ, we expect the parameters of
+    // each report to follow each other.
+    if (size < 1)
+        return;
+    const int reportCount = data[0];
+    ++data;
+    --size;
+    for (int i = 0; i < reportCount; ++i) {
+        // event type, address type, address, data length, data, RSSI
+        if (size < 9 || size < 10 + data[8]) {
+            qCWarning(QT_BT_BLUEZ) << "Unexpected LE advertising report size";
+            return;
+        }
+        AdvertisingReport report;
+        report.eventType = data[0];
+        report.addressType = data[1];
+        quint8 address[6];
+        memcpy(address, data + 2, sizeof address);
+        report.address = convertAddress(address);
+        report.dataLength = qMin<quint8>(data[8], sizeof report.data);
+        memcpy(report.data, data + 9, report.dataLength);
+        report.rssi = qint8(data[9 + data[8]]);
+        report.timestamp = batchTimestamp;
+        advertisingReports.append(report);
+
+        const int reportSize = 10 + data[8];
+        data += reportSize;
+        size -= reportSize;
+    }
+}
+
 QT_END_NAMESPACE
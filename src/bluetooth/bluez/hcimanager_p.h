@@ -54,6 +54,7 @@
 #include <QObject>
 #include <QtCore/QSet>
 #include <QtCore/QSocketNotifier>
+#include <QtCore/QVector>
 #include <QtBluetooth/QBluetoothAddress>
 #include "bluez/bluez_data_p.h"
 
@@ -68,9 +69,21 @@ public:
     enum HciEvent {
         EncryptChangeEvent = EVT_ENCRYPT_CHANGE,
         CommandCompleteEvent = EVT_CMD_COMPLETE,
+        CommandStatusEvent = EVT_CMD_STATUS,
         LeMetaEvent = 0x3e,
     };
 
+    // One report of an LE Advertising Report event, Spec v4.2, Vol 2, Part E, 7.7.65.2
+    struct AdvertisingReport {
+        quint64 address;
+        qint64 timestamp;   // monotonic, in ms
+        quint8 eventType;
+        quint8 addressType;
+        qint8 rssi;
+        quint8 dataLength;
+        quint8 data[31];
+    };
+
     explicit HciManager(const QBluetoothAddress &deviceAdapter, QObject *parent = 0);
     ~HciManager();
 
@@ -85,27 +98,50 @@ public:
     bool sendConnectionUpdateCommand(quint16 handle, const QLowEnergyConnectionParameters &params);
     bool sendConnectionParameterUpdateRequest(quint16 handle,
                                               const QLowEnergyConnectionParameters &params);
+    bool sendSetDataLengthCommand(quint16 handle, quint16 txOctets, quint16 txTime);
+    bool sendSetPhyCommand(quint16 handle, quint8 txPhys, quint8 rxPhys);
+    bool sendSetScanParametersCommand(bool active, quint16 interval, quint16 window);
+    bool sendSetScanEnableCommand(bool enable, bool filterDuplicates);
+
+#ifdef QT_BUILD_INTERNAL
+    void dispatchPackets(const QVector<QByteArray> &packets);
+#endif
 
 signals:
     void encryptionChangedEvent(const QBluetoothAddress &address, bool wasSuccess);
     void commandCompleted(quint16 opCode, quint8 status, const QByteArray &data);
-    void connectionComplete(quint16 handle);
+    void commandStatusReceived(quint16 opCode, quint8 status);
+    void connectionComplete(quint16 handle, bool isCentral, const QBluetoothAddress &peerAddress);
     void connectionUpdate(quint16 handle, const QLowEnergyConnectionParameters &parameters);
     void signatureResolvingKeyReceived(quint16 connHandle, bool remoteKey, const quint128 &csrk);
+    void dataLengthChanged(quint16 handle, quint16 maxTxOctets, quint16 maxRxOctets);
+    void phyUpdated(quint16 handle, quint8 txPhy, quint8 rxPhy);
+    // all reports of one batch of packets
+    void advertisingReportsReceived(const QVector<HciManager::AdvertisingReport> &reports);
 
 private slots:
     void _q_readNotify();
 
 private:
+    // packets read per system call
+    static const int ReadBatchSize = 16;
+
+    int readPackets(int *sizes);
+    void dispatchPackets(const int *sizes, int count);
     int hciForAddress(const QBluetoothAddress &deviceAdapter);
+    void attachAclFilter();
     void handleHciEventPacket(const quint8 *data, int size);
     void handleHciAclPacket(const quint8 *data, int size);
-    void handleLeMetaEvent(const quint8 *data);
+    void handleLeMetaEvent(const quint8 *data, int size);
+    void handleAdvertisingReports(const quint8 *data, int size);
 
     int hciSocket;
     int hciDev;
     quint8 sigPacketIdentifier = 0;
     QSocketNotifier *notifier;
+    QByteArray readBuffer;
+    QVector<AdvertisingReport> advertisingReports;
+    qint64 batchTimestamp = 0;
     QSet<HciManager::HciEvent> runningEvents;
 };
 
@@ -0,0 +1,210 @@
+/****************************************************************************
+**
+** Copyright (C) 2017 The Qt Company Ltd.
+** Contact: https://www.qt.io/licensing/
+**
+** This file is part of the QtBluetooth module of the Qt Toolkit.
+**
+** $QT_BEGIN_LICENSE:LGPL$
+** Commercial License Usage
+** Licensees holding valid commercial Qt licenses may use this file in
+** accordance with the commercial license agreement provided with the
+** Software or, alternatively, in accordance with the terms contained in
+** a written agreement between you and The Qt Company. For licensing terms
+** and conditions see https://www.qt.io/terms-conditions. For further
+** information use the contact form at https://www.qt.io/contact-us.
+**
+** GNU Lesser General Public License Usage
+** Alternatively, this file may be used under the terms of the GNU Lesser
+** General Public License version 3 as published by the Free Software
+** Foundation and appearing in the file LICENSE.LGPL3 included in the
+** packaging of this file. Please review the following information to
+** ensure the GNU Lesser General Public License version 3 requirements
+** will be met: https://www.gnu.org/licenses/lgpl-3.0.html.
+**
+** GNU General Public License Usage
+** Alternatively, this file may be used under the terms of the GNU
+** General Public License version 2.0 or (at your option) the GNU General
+** Public license version 3 or any later version approved by the KDE Free
+** Qt Foundation. The licenses are as published by the Free Software
+** Foundation and appearing in the file LICENSE.GPL2 and LICENSE.GPL3
+** included in the packaging of this file. Please review the following
+** information to ensure the GNU General Public License requirements will
+** be met: https://www.gnu.org/licenses/gpl-2.0.html and
+** https://www.gnu.org/licenses/gpl-3.0.html.
+**
+** $QT_END_LICENSE$
+**
+****************************************************************************/
+
+#include "btsnoopwriter_p.h"
+
+#include <QtCore/QDateTime>
+#include <QtCore/QFile>
+#include <QtCore/QLoggingCategory>
+#include <QtCore/QMutex>
+#include <QtCore/QtEndian>
+
+QT_BEGIN_NAMESPACE
+
+Q_DECLARE_LOGGING_CATEGORY(QT_BT)
+
+namespace {
+// RFC 1761 and the btsnoop extensions used by Android and Wireshark
+const char btsnoopMagic[8] = { 'b', 't', 's', 'n', 'o', 'o', 'p', '\0' };
+const quint32 btsnoopVersion = 1;
+const quint32 btsnoopDatalinkH4 = 1002;
+// microseconds from 0 AD to 1970-01-01
+const qint64 btsnoopEpochDelta = Q_INT64_C(0x00dcddb30f2f8000);
+
+const int recordHeaderSize = 24;
+const int aclHeaderSize = 1 + 4 + 4; // H4 packet type, ACL header, L2CAP header
+const quint8 h4AclPacket = 0x02;
+const quint16 aclStartOfPdu = 0x2000;
+
+// hand the records to the worker in chunks of at least this size
+const int flushThreshold = 16 * 1024;
+const int flushInterval = 500;
+}
+
+/*
+ * Owns the capture file. The records are handed over under a mutex, so that
+ * the writer can write the remaining ones itself once the thread has stopped.
+ */
+class BtSnoopFileWorker : public QObject
+{
+    Q_OBJECT
+public:
+    explicit BtSnoopFileWorker(QFile *file) : m_file(file) {}
+    ~BtSnoopFileWorker() { delete m_file; }
+
+    void append(const QByteArray &records)
+    {
+        QMutexLocker locker(&m_mutex);
+        m_records += records;
+    }
+
+public slots:
+    void write()
+    {
+        QByteArray records;
+        {
+            QMutexLocker locker(&m_mutex);
+            records.swap(m_records);
+        }
+        if (records.isEmpty())
+            return;
+
+        if (m_file->write(records) != records.size() && !m_failed) {
+            m_failed = true;
+            qCWarning(QT_BT) << "Cannot write packet capture:" << m_file->errorString();
+        }
+        m_file->flush();
+    }
+
+private:
+    QMutex m_mutex;
+    QByteArray m_records;
+    QFile *m_file;
+    bool m_failed = false;
+};
+
+BtSnoopWriter::BtSnoopWriter(QObject *parent)
+    : QObject(parent)
+{
+    m_thread.setObjectName(QStringLiteral("QtBluetooth btsnoop writer"));
+    m_flushTimer.setInterval(flushInterval);
+    connect(&m_flushTimer, &QTimer::timeout, this, &BtSnoopWriter::flush);
+}
+
+BtSnoopWriter::~BtSnoopWriter()
+{
+    if (!m_worker)
+        return;
+
+    m_flushTimer.stop();
+    m_thread.quit();
+    m_thread.wait();
+
+    // Writes still queued to the stopped thread are lost, but their records are
+    // not. Whatever the worker has not written yet is written from here.
+    m_worker->append(m_pending);
+    m_worker->write();
+    delete m_worker;
+}
+
+bool BtSnoopWriter::open(const QString &fileName)
+{
+    Q_ASSERT(!m_worker);
+
+    QFile *file = new QFile(fileName);
+    if (!file->open(QIODevice::WriteOnly | QIODevice::Truncate)) {
+        m_errorString = file->errorString();
+        delete file;
+        return false;
+    }
+
+    char header[16];
+    memcpy(header, btsnoopMagic, sizeof btsnoopMagic);
+    qToBigEndian<quint32>(btsnoopVersion, reinterpret_cast<uchar *>(header + 8));
+    qToBigEndian<quint32>(btsnoopDatalinkH4, reinterpret_cast<uchar *>(header + 12));
+    if (file->write(header, sizeof header) != qint64(sizeof header)) {
+        m_errorString = file->errorString();
+        delete file;
+        return false;
+    }
+
+    m_startTime = (QDateTime::currentMSecsSinceEpoch() * 1000) + btsnoopEpochDelta;
+    m_clock.start();
+
+    m_worker = new BtSnoopFileWorker(file);
+    m_worker->moveToThread(&m_thread);
+    m_thread.start();
+    m_flushTimer.start();
+    return true;
+}
+
+void BtSnoopWriter::writeL2capPacket(Direction direction, quint16 connectionHandle, quint16 cid,
+                                     const char *data, int size)
+{
+    if (!m_worker)
+        return;
+
+    const int packetSize = aclHeaderSize + size;
+    const int offset = m_pending.size();
+    m_pending.resize(offset + recordHeaderSize + packetSize);
+    uchar *record = reinterpret_cast<uchar *>(m_pending.data() + offset);
+
+    // record header, big endian
+    qToBigEndian<quint32>(packetSize, record);
+    qToBigEndian<quint32>(packetSize, record + 4);
+    qToBigEndian<quint32>(direction, record + 8);
+    qToBigEndian<quint32>(0, record + 12); // cumulative drops
+    qToBigEndian<qint64>(m_startTime + m_clock.nsecsElapsed() / 1000, record + 16);
+
+    // H4 ACL packet, little endian
+    uchar *packet = record + recordHeaderSize;
+    packet[0] = h4AclPacket;
+    qToLittleEndian<quint16>((connectionHandle & 0x0fff) | aclStartOfPdu, packet + 1);
+    qToLittleEndian<quint16>(size + 4, packet + 3);
+    qToLittleEndian<quint16>(size, packet + 5);
+    qToLittleEndian<quint16>(cid, packet + 7);
+    memcpy(packet + aclHeaderSize, data, size);
+
+    if (m_pending.size() >= flushThreshold)
+        flush();
+}
+
+void BtSnoopWriter::flush()
+{
+    if (!m_worker || m_pending.isEmpty())
+        return;
+
+    m_worker->append(m_pending);
+    m_pending.clear();
+    QMetaObject::invokeMethod(m_worker, "write", Qt::QueuedConnection);
+}
+
+QT_END_NAMESPACE
+
+#include "btsnoopwriter.moc"
@@ -0,0 +1,100 @@
+/****************************************************************************
+**
+** Copyright (C) 2017 The Qt Company Ltd.
+** Contact: https://www.qt.io/licensing/
+**
+** This file is part of the QtBluetooth module of the Qt Toolkit.
+**
+** $QT_BEGIN_LICENSE:LGPL$
+** Commercial License Usage
+** Licensees holding valid commercial Qt licenses may use this file in
+** accordance with the commercial license agreement provided with the
+** Software or, alternatively, in accordance with the terms contained in
+** a written agreement between you and The Qt Company. For licensing terms
+** and conditions see https://www.qt.io/terms-conditions. For further
+** information use the contact form at https://www.qt.io/contact-us.
+**
+** GNU Lesser General Public License Usage
+** Alternatively, this file may be used under the terms of the GNU Lesser
+** General Public License version 3 as published by the Free Software
+** Foundation and appearing in the file LICENSE.LGPL3 included in the
+** packaging of this file. Please review the following information to
+** ensure the GNU Lesser General Public License version 3 requirements
+** will be met: https://www.gnu.org/licenses/lgpl-3.0.html.
+**
+** GNU General Public License Usage
+** Alternatively, this file may be used under the terms of the GNU
+** General Public License version 2.0 or (at your option) the GNU General
+** Public license version 3 or any later version approved by the KDE Free
+** Qt Foundation. The licenses are as published by the Free Software
+** Foundation and appearing in the file LICENSE.GPL2 and LICENSE.GPL3
+** included in the packaging of this file. Please review the following
+** information to ensure the GNU General Public License requirements will
+** be met: https://www.gnu.org/licenses/gpl-2.0.html and
+** https://www.gnu.org/licenses/gpl-3.0.html.
+**
+** $QT_END_LICENSE$
+**
+****************************************************************************/
+
+#ifndef BTSNOOPWRITER_P_H
+#define BTSNOOPWRITER_P_H
+
+//
+//  W A R N I N G
+//  -------------
+//
+// This file is not part of the Qt API.  It exists purely as an
+// implementation detail.  This header file may change from version to
+// version without notice, or even be removed.
+//
+// We mean it.
+//
+
+#include <QtCore/QByteArray>
+#include <QtCore/QElapsedTimer>
+#include <QtCore/QObject>
+#include <QtCore/QThread>
+#include <QtCore/QTimer>
+
+QT_BEGIN_NAMESPACE
+
+class BtSnoopFileWorker;
+
+/*
+ * Writes packets to a file in the btsnoop format, as understood by Wireshark.
+ * Records are collected in memory and written to disk by a worker thread, so
+ * that capturing does not block the thread processing the packets.
+ */
+class Q_AUTOTEST_EXPORT BtSnoopWriter : public QObject
+{
+    Q_OBJECT
+public:
+    enum Direction { Sent = 0, Received = 1 };
+
+    explicit BtSnoopWriter(QObject *parent = nullptr);
+    ~BtSnoopWriter();
+
+    bool open(const QString &fileName);
+    QString errorString() const { return m_errorString; }
+
+    // Wraps an L2CAP payload for channel cid into an HCI ACL packet
+    void writeL2capPacket(Direction direction, quint16 connectionHandle, quint16 cid,
+                          const char *data, int size);
+
+public slots:
+    void flush();
+
+private:
+    QThread m_thread;
+    BtSnoopFileWorker *m_worker = nullptr;
+    QByteArray m_pending;
+    QTimer m_flushTimer;
+    QElapsedTimer m_clock;
+    qint64 m_startTime = 0; // btsnoop timestamp of m_clock's start
+    QString m_errorString;
+};
+
+QT_END_NAMESPACE
+
+#endif // BTSNOOPWRITER_P_H
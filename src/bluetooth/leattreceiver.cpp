@@ -0,0 +1,162 @@
+/****************************************************************************
+**
+** Copyright (C) 2017 The Qt Company Ltd.
+** Contact: https://www.qt.io/licensing/
+**
+** This file is part of the QtBluetooth module of the Qt Toolkit.
+**
+** $QT_BEGIN_LICENSE:LGPL$
+** Commercial License Usage
+** Licensees holding valid commercial Qt licenses may use this file in
+** accordance with the commercial license agreement provided with the
+** Software or, alternatively, in accordance with the terms contained in
+** a written agreement between you and The Qt Company. For licensing terms
+** and conditions see https://www.qt.io/terms-conditions. For further
+** information use the contact form at https://www.qt.io/contact-us.
+**
+** GNU Lesser General Public License Usage
+** Alternatively, this file may be used under the terms of the GNU Lesser
+** General Public License version 3 as published by the Free Software
+** Foundation and appearing in the file LICENSE.LGPL3 included in the
+** packaging of this file. Please review the following information to
+** ensure the GNU Lesser General Public License version 3 requirements
+** will be met: https://www.gnu.org/licenses/lgpl-3.0.html.
+**
+** GNU General Public License Usage
+** Alternatively, this file may be used under the terms of the GNU
+** General Public License version 2.0 or (at your option) the GNU General
+** Public license version 3 or any later version approved by the KDE Free
+** Qt Foundation. The licenses are as published by the Free Software
+** Foundation and appearing in the file LICENSE.GPL2 and LICENSE.GPL3
+** included in the packaging of this file. Please review the following
+** information to ensure the GNU General Public License requirements will
+** be met: https://www.gnu.org/licenses/gpl-2.0.html and
+** https://www.gnu.org/licenses/gpl-3.0.html.
+**
+** $QT_END_LICENSE$
+**
+****************************************************************************/
+
+#include "leattreceiver_p.h"
+
+#include <QtCore/QLoggingCategory>
+#include <QtCore/QSocketNotifier>
+#include <QtCore/private/qcore_unix_p.h>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+
+#define ATT_MAX_LE_MTU 0x200
+#define ATT_OP_HANDLE_VAL_INDICATION    0x1d
+#define ATT_OP_HANDLE_VAL_CONFIRMATION  0x1e
+
+QT_BEGIN_NAMESPACE
+
+Q_DECLARE_LOGGING_CATEGORY(QT_BT_BLUEZ)
+
+/*
+ * The receiver works on a duplicate of \a socketDescriptor. This keeps the
+ * descriptor valid until the receiver is gone, even if the socket it was
+ * taken from has been closed in the meantime.
+ */
+LeAttReceiver::LeAttReceiver(int socketDescriptor)
+    : m_socket(::fcntl(socketDescriptor, F_DUPFD_CLOEXEC, 0))
+{
+    if (m_socket == -1)
+        qCWarning(QT_BT_BLUEZ) << "Cannot duplicate L2CP socket:" << qt_error_string(errno);
+}
+
+LeAttReceiver::~LeAttReceiver()
+{
+    delete m_notifier;
+    if (m_socket != -1)
+        qt_safe_close(m_socket);
+}
+
+// Returns space for \a size more bytes behind the packets of the batch.
+char *LeAttReceiver::PacketBatch::reserve(int size)
+{
+    const int used = byteCount();
+    if (m_data.size() < used + size)
+        m_data.resize(used + size);
+    return m_data.data() + used;
+}
+
+void LeAttReceiver::PacketBatch::append(const PacketBatch &other)
+{
+    const int used = byteCount();
+    memcpy(reserve(other.byteCount()), other.m_data.constData(), size_t(other.byteCount()));
+    for (int end : other.m_ends)
+        m_ends.append(used + end);
+}
+
+const LeAttReceiver::PacketBatch &LeAttReceiver::takePackets()
+{
+    // the buffers of the batch taken before are reused by the receiver's thread
+    m_taken.clear();
+    QMutexLocker locker(&m_mutex);
+    qSwap(m_taken, m_packets);
+    return m_taken;
+}
+
+// Must be invoked in the receiver's thread.
+void LeAttReceiver::start()
+{
+    if (m_socket == -1 || m_notifier)
+        return;
+
+    m_notifier = new QSocketNotifier(m_socket, QSocketNotifier::Read, this);
+    connect(m_notifier, &QSocketNotifier::activated, this, &LeAttReceiver::_q_readNotify);
+}
+
+void LeAttReceiver::_q_readNotify()
+{
+    bool closed = false;
+
+    // Each read returns exactly one PDU. Drain the socket to batch them up.
+    forever {
+        char * const buffer = m_reading.reserve(ATT_MAX_LE_MTU);
+        const int size = int(qt_safe_read(m_socket, buffer, ATT_MAX_LE_MTU));
+        if (size > 0) {
+            if (quint8(buffer[0]) == ATT_OP_HANDLE_VAL_INDICATION) {
+                const char confirmation = char(ATT_OP_HANDLE_VAL_CONFIRMATION);
+                if (qt_safe_write(m_socket, &confirmation, 1) != 1) {
+                    qCDebug(QT_BT_BLUEZ) << "Cannot confirm indication:"
+                                         << qt_error_string(errno);
+                }
+            }
+            m_reading.m_ends.append(m_reading.byteCount() + size);
+            continue;
+        }
+        if (size == -1 && (errno == EAGAIN || errno == EWOULDBLOCK))
+            break;
+
+        // The owning QBluetoothSocket takes care of the error handling.
+        m_notifier->setEnabled(false);
+        closed = true;
+        break;
+    }
+
+    if (!m_reading.isEmpty()) {
+        bool firstOfBatch;
+        {
+            QMutexLocker locker(&m_mutex);
+            firstOfBatch = m_packets.isEmpty();
+            if (firstOfBatch)
+                qSwap(m_packets, m_reading);
+            else
+                m_packets.append(m_reading);
+        }
+        m_reading.clear();
+        // otherwise the previous batch has not been picked up yet
+        if (firstOfBatch)
+            emit packetsAvailable();
+    }
+
+    if (closed)
+        emit socketClosed();
+}
+
+QT_END_NAMESPACE
@@ -0,0 +1,129 @@
+/****************************************************************************
+**
+** Copyright (C) 2017 The Qt Company Ltd.
+** Contact: https://www.qt.io/licensing/
+**
+** This file is part of the QtBluetooth module of the Qt Toolkit.
+**
+** $QT_BEGIN_LICENSE:LGPL$
+** Commercial License Usage
+** Licensees holding valid commercial Qt licenses may use this file in
+** accordance with the commercial license agreement provided with the
+** Software or, alternatively, in accordance with the terms contained in
+** a written agreement between you and The Qt Company. For licensing terms
+** and conditions see https://www.qt.io/terms-conditions. For further
+** information use the contact form at https://www.qt.io/contact-us.
+**
+** GNU Lesser General Public License Usage
+** Alternatively, this file may be used under the terms of the GNU Lesser
+** General Public License version 3 as published by the Free Software
+** Foundation and appearing in the file LICENSE.LGPL3 included in the
+** packaging of this file. Please review the following information to
+** ensure the GNU Lesser General Public License version 3 requirements
+** will be met: https://www.gnu.org/licenses/lgpl-3.0.html.
+**
+** GNU General Public License Usage
+** Alternatively, this file may be used under the terms of the GNU
+** General Public License version 2.0 or (at your option) the GNU General
+** Public license version 3 or any later version approved by the KDE Free
+** Qt Foundation. The licenses are as published by the Free Software
+** Foundation and appearing in the file LICENSE.GPL2 and LICENSE.GPL3
+** included in the packaging of this file. Please review the following
+** information to ensure the GNU General Public License requirements will
+** be met: https://www.gnu.org/licenses/gpl-2.0.html and
+** https://www.gnu.org/licenses/gpl-3.0.html.
+**
+** $QT_END_LICENSE$
+**
+****************************************************************************/
+
+#ifndef LEATTRECEIVER_P_H
+#define LEATTRECEIVER_P_H
+
+//
+//  W A R N I N G
+//  -------------
+//
+// This file is not part of the Qt API.  It exists purely as an
+// implementation detail.  This header file may change from version to
+// version without notice, or even be removed.
+//
+// We mean it.
+//
+
+#include <QtCore/QByteArray>
+#include <QtCore/QMutex>
+#include <QtCore/QObject>
+#include <QtCore/QVector>
+
+QT_BEGIN_NAMESPACE
+
+class QSocketNotifier;
+
+/*
+ * Reads ATT PDUs from an L2CAP socket in a worker thread, so that the peer is not
+ * kept waiting while the thread owning the controller is busy. Handle value
+ * indications are confirmed right away. All PDUs are queued and handed to the
+ * owning thread in batches; packetsAvailable() is emitted once per batch.
+ */
+class Q_AUTOTEST_EXPORT LeAttReceiver : public QObject
+{
+    Q_OBJECT
+public:
+    /*
+     * The PDUs of a batch are stored back to back in a single buffer, which is
+     * reused for later batches. Only the buffer of the batch handed over is
+     * shared between the threads; the buffers are swapped under the mutex.
+     */
+    class PacketBatch
+    {
+    public:
+        int count() const { return m_ends.count(); }
+        bool isEmpty() const { return m_ends.isEmpty(); }
+        const char *packet(int i) const { return m_data.constData() + start(i); }
+        int packetSize(int i) const { return m_ends.at(i) - start(i); }
+
+    private:
+        friend class LeAttReceiver;
+
+        int start(int i) const { return i ? m_ends.at(i - 1) : 0; }
+        int byteCount() const { return m_ends.isEmpty() ? 0 : m_ends.last(); }
+        char *reserve(int size);
+        void append(const PacketBatch &other);
+        void clear() { m_ends.resize(0); } // keeps the capacity of both buffers
+
+        QByteArray m_data; // grows only, byteCount() bytes are in use
+        QVector<int> m_ends;
+    };
+
+    explicit LeAttReceiver(int socketDescriptor);
+    ~LeAttReceiver();
+
+    bool isValid() const { return m_socket != -1; }
+
+    // thread safe, the batch stays valid until the next call
+    const PacketBatch &takePackets();
+
+public slots:
+    void start();
+
+signals:
+    void packetsAvailable();
+    void socketClosed();
+
+private slots:
+    void _q_readNotify();
+
+private:
+    int m_socket;
+    QSocketNotifier *m_notifier = nullptr;
+    PacketBatch m_reading; // receiver's thread
+
+    QMutex m_mutex;
+    PacketBatch m_packets; // guarded by m_mutex
+    PacketBatch m_taken; // owning thread
+};
+
+QT_END_NAMESPACE
+
+#endif // LEATTRECEIVER_P_H
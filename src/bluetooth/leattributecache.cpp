@@ -0,0 +1,215 @@
+/****************************************************************************
+**
+** Copyright (C) 2017 The Qt Company Ltd.
+** Contact: https://www.qt.io/licensing/
+**
+** This file is part of the QtBluetooth module of the Qt Toolkit.
+**
+** $QT_BEGIN_LICENSE:LGPL$
+** Commercial License Usage
+** Licensees holding valid commercial Qt licenses may use this file in
+** accordance with the commercial license agreement provided with the
+** Software or, alternatively, in accordance with the terms contained in
+** a written agreement between you and The Qt Company. For licensing terms
+** and conditions see https://www.qt.io/terms-conditions. For further
+** information use the contact form at https://www.qt.io/contact-us.
+**
+** GNU Lesser General Public License Usage
+** Alternatively, this file may be used under the terms of the GNU Lesser
+** General Public License version 3 as published by the Free Software
+** Foundation and appearing in the file LICENSE.LGPL3 included in the
+** packaging of this file. Please review the following information to
+** ensure the GNU Lesser General Public License version 3 requirements
+** will be met: https://www.gnu.org/licenses/lgpl-3.0.html.
+**
+** GNU General Public License Usage
+** Alternatively, this file may be used under the terms of the GNU
+** General Public License version 2.0 or (at your option) the GNU General
+** Public license version 3 or any later version approved by the KDE Free
+** Qt Foundation. The licenses are as published by the Free Software
+** Foundation and appearing in the file LICENSE.GPL2 and LICENSE.GPL3
+** included in the packaging of this file. Please review the following
+** information to ensure the GNU General Public License requirements will
+** be met: https://www.gnu.org/licenses/gpl-2.0.html and
+** https://www.gnu.org/licenses/gpl-3.0.html.
+**
+** $QT_END_LICENSE$
+**
+****************************************************************************/
+
+#include "leattributecache_p.h"
+
+#include <QtCore/QDataStream>
+#include <QtCore/QDir>
+#include <QtCore/QFile>
+#include <QtCore/QFileInfo>
+#include <QtCore/QLoggingCategory>
+#include <QtCore/QSaveFile>
+
+QT_BEGIN_NAMESPACE
+
+Q_DECLARE_LOGGING_CATEGORY(QT_BT_BLUEZ)
+
+namespace {
+const quint32 cacheMagic = 0x51544743; // "QTGC"
+const quint16 cacheVersion = 1;
+}
+
+void LeAttributeCache::setFilePath(const QString &filePath)
+{
+    if (filePath == m_filePath)
+        return;
+    m_filePath = filePath;
+    m_contents.clear();
+}
+
+/*
+ * Reads the services stored for \a databaseHash into \a services. Returns \c false
+ * if there is no cache, if it was stored for a different hash or if it is corrupt.
+ * A device without Database Hash cannot tell us about changes made while we were
+ * not connected, so its cache is never valid.
+ */
+bool LeAttributeCache::load(const QByteArray &databaseHash, QVector<Service> *services)
+{
+    if (databaseHash.isEmpty())
+        return false;
+
+    QFile file(m_filePath);
+    if (!file.open(QIODevice::ReadOnly))
+        return false;
+    const QByteArray contents = file.readAll();
+
+    QDataStream stream(contents);
+    stream.setVersion(QDataStream::Qt_5_6);
+    quint32 magic;
+    quint16 version;
+    QByteArray cachedHash;
+    stream >> magic >> version;
+    if (magic != cacheMagic || version != cacheVersion) {
+        qCDebug(QT_BT_BLUEZ) << "Ignoring attribute cache" << m_filePath << "with unknown format";
+        return false;
+    }
+    stream >> cachedHash;
+    if (cachedHash != databaseHash) {
+        qCDebug(QT_BT_BLUEZ) << "Attribute cache is outdated";
+        return false;
+    }
+
+    quint32 serviceCount;
+    stream >> serviceCount;
+    QVector<Service> result;
+    for (quint32 i = 0; i < serviceCount && stream.status() == QDataStream::Ok; ++i) {
+        Service service;
+        QUuid uuid;
+        qint32 type;
+        stream >> uuid >> service.startHandle >> service.endHandle >> type >> service.detailed;
+        service.uuid = QBluetoothUuid(uuid);
+        service.type = type;
+        if (service.uuid.isNull() || !service.startHandle
+                || service.endHandle < service.startHandle) {
+            stream.setStatus(QDataStream::ReadCorruptData);
+            break;
+        }
+        if (service.detailed) {
+            quint32 includedCount;
+            stream >> includedCount;
+            for (quint32 j = 0; j < includedCount && stream.status() == QDataStream::Ok; ++j) {
+                stream >> uuid;
+                service.includedServices << QBluetoothUuid(uuid);
+            }
+            quint32 charCount;
+            stream >> charCount;
+            for (quint32 j = 0; j < charCount && stream.status() == QDataStream::Ok; ++j) {
+                Characteristic characteristic;
+                qint32 properties;
+                stream >> characteristic.handle >> characteristic.valueHandle >> uuid
+                       >> properties;
+                characteristic.uuid = QBluetoothUuid(uuid);
+                characteristic.properties = QLowEnergyCharacteristic::PropertyTypes(properties);
+                quint32 descCount;
+                stream >> descCount;
+                for (quint32 k = 0; k < descCount && stream.status() == QDataStream::Ok; ++k) {
+                    Descriptor descriptor;
+                    stream >> descriptor.handle >> uuid;
+                    descriptor.uuid = QBluetoothUuid(uuid);
+                    characteristic.descriptors << descriptor;
+                }
+                service.characteristics << characteristic;
+            }
+        }
+        result << service;
+    }
+
+    if (stream.status() != QDataStream::Ok || result.isEmpty()) {
+        qCWarning(QT_BT_BLUEZ) << "Ignoring invalid attribute cache" << m_filePath;
+        return false;
+    }
+    m_contents = contents;
+    *services = result;
+    return true;
+}
+
+/*
+ * Writes \a services to disk unless the file already holds them. Returns \c true
+ * if the file was written. Without \a databaseHash the cache could never be used,
+ * so it is removed instead.
+ */
+bool LeAttributeCache::store(const QByteArray &databaseHash, const QVector<Service> &services)
+{
+    if (databaseHash.isEmpty()) {
+        remove();
+        return false;
+    }
+
+    const QByteArray contents = serialize(databaseHash, services);
+    if (contents == m_contents)
+        return false;
+
+    QDir().mkpath(QFileInfo(m_filePath).absolutePath());
+    QSaveFile file(m_filePath);
+    if (!file.open(QIODevice::WriteOnly) || file.write(contents) != contents.size()
+            || !file.commit()) {
+        qCWarning(QT_BT_BLUEZ) << "Cannot write attribute cache" << m_filePath << ':'
+                               << file.errorString();
+        return false;
+    }
+    m_contents = contents;
+    return true;
+}
+
+void LeAttributeCache::remove()
+{
+    QFile::remove(m_filePath);
+    m_contents.clear();
+}
+
+QByteArray LeAttributeCache::serialize(const QByteArray &databaseHash,
+                                       const QVector<Service> &services)
+{
+    QByteArray data;
+    QDataStream stream(&data, QIODevice::WriteOnly);
+    stream.setVersion(QDataStream::Qt_5_6);
+
+    stream << cacheMagic << cacheVersion << databaseHash << quint32(services.count());
+    for (const Service &service : services) {
+        stream << static_cast<const QUuid &>(service.uuid) << service.startHandle
+               << service.endHandle << qint32(service.type) << service.detailed;
+        if (!service.detailed)
+            continue;
+        stream << quint32(service.includedServices.count());
+        for (const QBluetoothUuid &included : service.includedServices)
+            stream << static_cast<const QUuid &>(included);
+        stream << quint32(service.characteristics.count());
+        for (const Characteristic &characteristic : service.characteristics) {
+            stream << characteristic.handle << characteristic.valueHandle
+                   << static_cast<const QUuid &>(characteristic.uuid)
+                   << qint32(characteristic.properties)
+                   << quint32(characteristic.descriptors.count());
+            for (const Descriptor &descriptor : characteristic.descriptors)
+                stream << descriptor.handle << static_cast<const QUuid &>(descriptor.uuid);
+        }
+    }
+    return data;
+}
+
+QT_END_NAMESPACE
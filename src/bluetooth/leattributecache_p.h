@@ -0,0 +1,112 @@
+/****************************************************************************
+**
+** Copyright (C) 2017 The Qt Company Ltd.
+** Contact: https://www.qt.io/licensing/
+**
+** This file is part of the QtBluetooth module of the Qt Toolkit.
+**
+** $QT_BEGIN_LICENSE:LGPL$
+** Commercial License Usage
+** Licensees holding valid commercial Qt licenses may use this file in
+** accordance with the commercial license agreement provided with the
+** Software or, alternatively, in accordance with the terms contained in
+** a written agreement between you and The Qt Company. For licensing terms
+** and conditions see https://www.qt.io/terms-conditions. For further
+** information use the contact form at https://www.qt.io/contact-us.
+**
+** GNU Lesser General Public License Usage
+** Alternatively, this file may be used under the terms of the GNU Lesser
+** General Public License version 3 as published by the Free Software
+** Foundation and appearing in the file LICENSE.LGPL3 included in the
+** packaging of this file. Please review the following information to
+** ensure the GNU Lesser General Public License version 3 requirements
+** will be met: https://www.gnu.org/licenses/lgpl-3.0.html.
+**
+** GNU General Public License Usage
+** Alternatively, this file may be used under the terms of the GNU
+** General Public License version 2.0 or (at your option) the GNU General
+** Public license version 3 or any later version approved by the KDE Free
+** Qt Foundation. The licenses are as published by the Free Software
+** Foundation and appearing in the file LICENSE.GPL2 and LICENSE.GPL3
+** included in the packaging of this file. Please review the following
+** information to ensure the GNU General Public License requirements will
+** be met: https://www.gnu.org/licenses/gpl-2.0.html and
+** https://www.gnu.org/licenses/gpl-3.0.html.
+**
+** $QT_END_LICENSE$
+**
+****************************************************************************/
+
+#ifndef LEATTRIBUTECACHE_P_H
+#define LEATTRIBUTECACHE_P_H
+
+//
+//  W A R N I N G
+//  -------------
+//
+// This file is not part of the Qt API.  It exists purely as an
+// implementation detail.  This header file may change from version to
+// version without notice, or even be removed.
+//
+// We mean it.
+//
+
+#include <QtBluetooth/qbluetooth.h>
+#include <QtBluetooth/QBluetoothUuid>
+#include <QtBluetooth/QLowEnergyCharacteristic>
+#include <QtCore/QList>
+#include <QtCore/QMap>
+#include <QtCore/QString>
+#include <QtCore/QVector>
+
+QT_BEGIN_NAMESPACE
+
+/*
+ * The on-disk copy of the attribute database of one remote device. It is only
+ * valid as long as the Database Hash of the device matches the one it was stored
+ * with. The file is rewritten only if its contents change.
+ */
+class Q_AUTOTEST_EXPORT LeAttributeCache
+{
+public:
+    struct Descriptor {
+        QLowEnergyHandle handle = 0;
+        QBluetoothUuid uuid;
+    };
+
+    struct Characteristic {
+        QLowEnergyHandle handle = 0;
+        QLowEnergyHandle valueHandle = 0;
+        QBluetoothUuid uuid;
+        QLowEnergyCharacteristic::PropertyTypes properties;
+        QVector<Descriptor> descriptors;
+    };
+
+    struct Service {
+        QBluetoothUuid uuid;
+        QLowEnergyHandle startHandle = 0;
+        QLowEnergyHandle endHandle = 0;
+        int type = 0;
+        // the remaining members are only known for services whose details were discovered
+        bool detailed = false;
+        QList<QBluetoothUuid> includedServices;
+        QVector<Characteristic> characteristics;
+    };
+
+    void setFilePath(const QString &filePath);
+    QString filePath() const { return m_filePath; }
+
+    bool load(const QByteArray &databaseHash, QVector<Service> *services);
+    bool store(const QByteArray &databaseHash, const QVector<Service> &services);
+    void remove();
+
+private:
+    static QByteArray serialize(const QByteArray &databaseHash, const QVector<Service> &services);
+
+    QString m_filePath;
+    QByteArray m_contents; // of the file, as last read or written
+};
+
+QT_END_NAMESPACE
+
+#endif // LEATTRIBUTECACHE_P_H
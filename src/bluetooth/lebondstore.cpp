@@ -0,0 +1,512 @@
+/****************************************************************************
+**
+** Copyright (C) 2017 The Qt Company Ltd.
+** Contact: https://www.qt.io/licensing/
+**
+** This file is part of the QtBluetooth module of the Qt Toolkit.
+**
+** $QT_BEGIN_LICENSE:LGPL$
+** Commercial License Usage
+** Licensees holding valid commercial Qt licenses may use this file in
+** accordance with the commercial license agreement provided with the
+** Software or, alternatively, in accordance with the terms contained in
+** a written agreement between you and The Qt Company. For licensing terms
+** and conditions see https://www.qt.io/terms-conditions. For further
+** information use the contact form at https://www.qt.io/contact-us.
+**
+** GNU Lesser General Public License Usage
+** Alternatively, this file may be used under the terms of the GNU Lesser
+** General Public License version 3 as published by the Free Software
+** Foundation and appearing in the file LICENSE.LGPL3 included in the
+** packaging of this file. Please review the following information to
+** ensure the GNU Lesser General Public License version 3 requirements
+** will be met: https://www.gnu.org/licenses/lgpl-3.0.html.
+**
+** GNU General Public License Usage
+** Alternatively, this file may be used under the terms of the GNU
+** General Public License version 2.0 or (at your option) the GNU General
+** Public license version 3 or any later version approved by the KDE Free
+** Qt Foundation. The licenses are as published by the Free Software
+** Foundation and appearing in the file LICENSE.GPL2 and LICENSE.GPL3
+** included in the packaging of this file. Please review the following
+** information to ensure the GNU General Public License requirements will
+** be met: https://www.gnu.org/licenses/gpl-2.0.html and
+** https://www.gnu.org/licenses/gpl-3.0.html.
+**
+** $QT_END_LICENSE$
+**
+****************************************************************************/
+
+#include "lebondstore_p.h"
+
+#include <QtCore/QDataStream>
+#include <QtCore/QDir>
+#include <QtCore/QFile>
+#include <QtCore/QFileInfo>
+#include <QtCore/QLoggingCategory>
+#include <QtCore/QMutexLocker>
+#include <QtCore/QSaveFile>
+#include <QtCore/QSettings>
+#include <QtCore/QStandardPaths>
+
+#include <algorithm>
+#include <cstring>
+
+QT_BEGIN_NAMESPACE
+
+Q_DECLARE_LOGGING_CATEGORY(QT_BT_BLUEZ)
+
+namespace {
+const quint32 storeMagic = 0x51544253; // "QTBS"
+const quint16 storeVersion = 1;
+
+// changes made within this interval end up in the same write
+const int writeInterval = 1000;
+
+// The local sign counter on disk runs ahead of the one in use by this many values,
+// so that a crash can never make us reuse a counter value. The reserve is written
+// synchronously, so only every signCounterReserve-th signed write has to wait for it.
+// Remote counters are written in the background, at the latest once they have moved
+// half the reserve beyond the one on disk. After a crash, the reserve is added to them.
+const quint32 signCounterReserve = 64;
+
+// set in the store header if the store was written when it was closed
+const quint8 cleanShutdownFlag = 0x1;
+
+QString signingKeySettingsGroup(LeBondStore::SigningKeyType keyType)
+{
+    return QLatin1String(keyType == LeBondStore::LocalSigningKey
+                         ? "LocalSignatureKey" : "RemoteSignatureKey");
+}
+}
+
+/*
+ * Writes the snapshots of the store. Urgent snapshots are written by the store's
+ * thread while the worker thread may be busy with an older one. Snapshots are
+ * numbered, so that an older one never replaces a newer one on disk.
+ */
+class LeBondStoreWorker : public QObject
+{
+    Q_OBJECT
+public slots:
+    void write(const QString &fileName, const QByteArray &data, quint64 snapshot)
+    {
+        QMutexLocker locker(&m_mutex);
+        if (snapshot <= m_lastWrittenSnapshot)
+            return;
+        m_lastWrittenSnapshot = snapshot;
+
+        // The store holds signing keys, only the user may read it. BlueZ keeps them
+        // readable for root only.
+        const QString dirPath = QFileInfo(fileName).absolutePath();
+        if (!QFileInfo(dirPath).exists() && QDir().mkpath(dirPath)) {
+            QFile::setPermissions(dirPath, QFileDevice::ReadOwner | QFileDevice::WriteOwner
+                                  | QFileDevice::ExeOwner);
+        }
+        // QSaveFile syncs the data to disk before renaming it over the old file.
+        QSaveFile file(fileName);
+        if (!file.open(QIODevice::WriteOnly) || file.write(data) != data.size()
+                || !file.setPermissions(QFileDevice::ReadOwner | QFileDevice::WriteOwner)
+                || !file.commit()) {
+            qCWarning(QT_BT_BLUEZ) << "Cannot write bond store" << fileName << ':'
+                                   << file.errorString();
+        }
+    }
+
+    // Keeps BlueZ's own copy of the counter in sync, if we are allowed to touch it.
+    void writeBluezSignCounter(const QString &infoFilePath, const QString &group,
+                               quint32 nextCounter)
+    {
+        QMutexLocker locker(&m_mutex);
+        if (!QFileInfo(infoFilePath).exists())
+            return;
+        QSettings settings(infoFilePath, QSettings::IniFormat);
+        if (!settings.isWritable())
+            return;
+        settings.beginGroup(group);
+        const QString counterKey = QLatin1String("Counter");
+        if (!settings.allKeys().contains(counterKey))
+            return;
+        if (nextCounter == settings.value(counterKey).toUInt())
+            return;
+        settings.setValue(counterKey, nextCounter);
+    }
+
+private:
+    QMutex m_mutex;
+    quint64 m_lastWrittenSnapshot = 0;
+};
+
+LeBondStore::LeBondStore(const QBluetoothAddress &localAdapter, QObject *parent)
+    : QObject(parent), m_localAdapter(localAdapter),
+      m_fileName(QString::fromLatin1("%1/qtbluetooth/bonds/%2")
+                 .arg(QStandardPaths::writableLocation(QStandardPaths::GenericDataLocation),
+                      localAdapter.toString()))
+{
+    m_thread.setObjectName(QStringLiteral("QtBluetooth bond store writer"));
+    m_writeTimer.setSingleShot(true);
+    m_writeTimer.setInterval(writeInterval);
+    connect(&m_writeTimer, &QTimer::timeout, this, &LeBondStore::flush);
+    load();
+}
+
+LeBondStore::~LeBondStore()
+{
+    m_writeTimer.stop();
+    if (!m_worker)
+        return;
+
+    // Snapshots still queued when the thread stops are dropped. The last one is
+    // written here, marked as written on shutdown.
+    m_thread.quit();
+    m_thread.wait();
+    writeSnapshot(true, true);
+    delete m_worker;
+}
+
+QVector<LeBondStore::ClientConfiguration> LeBondStore::clientConfigurations(
+        const QBluetoothAddress &device) const
+{
+    return m_devices.value(device.toUInt64()).clientConfigs;
+}
+
+void LeBondStore::setClientConfigurations(const QBluetoothAddress &device,
+                                          const QVector<ClientConfiguration> &configs)
+{
+    m_devices[device.toUInt64()].clientConfigs = configs;
+    scheduleWrite();
+}
+
+void LeBondStore::removeClientConfigurations(const QBluetoothAddress &device)
+{
+    const auto it = m_devices.find(device.toUInt64());
+    if (it == m_devices.end() || it.value().clientConfigs.isEmpty())
+        return;
+    it.value().clientConfigs.clear();
+    scheduleWrite();
+}
+
+/*
+ * Remembers that the value of \a charValueHandle has changed for all devices which
+ * subscribed to it with one of the bits in \a configMask and which are not in
+ * \a skippedDevices. They are notified once they reconnect.
+ */
+void LeBondStore::markCharacteristicUpdated(QLowEnergyHandle charValueHandle,
+                                            quint16 configMask,
+                                            const QVector<quint64> &skippedDevices)
+{
+    if (!configMask)
+        return;
+
+    bool changed = false;
+    for (auto it = m_devices.begin(); it != m_devices.end(); ++it) {
+        if (skippedDevices.contains(it.key()))
+            continue;
+        for (ClientConfiguration &config : it.value().clientConfigs) {
+            if (config.charValueHandle != charValueHandle)
+                continue;
+            if ((config.configValue & configMask) && !config.charValueWasUpdated) {
+                config.charValueWasUpdated = true;
+                changed = true;
+            }
+            break;
+        }
+    }
+    if (changed)
+        scheduleWrite();
+}
+
+/*
+ * Makes sure that our idea of the signing key for \a device matches the one BlueZ
+ * has on file. This is done once per device and key, so that it can be called
+ * when the connection is set up rather than on the first signed write.
+ */
+void LeBondStore::loadSigningData(const QBluetoothAddress &device, SigningKeyType keyType)
+{
+    DeviceData &deviceData = m_devices[device.toUInt64()];
+    if (!deviceData.checkedBluez[keyType]) {
+        deviceData.checkedBluez[keyType] = true;
+        loadBluezSigningData(device.toUInt64(), keyType, deviceData);
+    }
+}
+
+bool LeBondStore::signingData(const QBluetoothAddress &device, SigningKeyType keyType,
+                              SigningData *data)
+{
+    loadSigningData(device, keyType);
+    const DeviceData &deviceData = m_devices[device.toUInt64()];
+    if (!deviceData.hasKey[keyType])
+        return false;
+    *data = deviceData.signingData[keyType];
+    return true;
+}
+
+void LeBondStore::setSigningKey(const QBluetoothAddress &device, SigningKeyType keyType,
+                                const quint128 &csrk)
+{
+    DeviceData &deviceData = m_devices[device.toUInt64()];
+    deviceData.signingData[keyType] = SigningData(csrk);
+    deviceData.hasKey[keyType] = true;
+    if (keyType == LocalSigningKey)
+        deviceData.reserveWritten = false;
+    deviceData.checkedBluez[keyType] = true; // the new key supersedes the one on file
+    scheduleWrite();
+}
+
+/*
+ * Must be called before a signed write with \a counter is sent or accepted. A local
+ * counter beyond the reserve on disk is written to disk before this function returns,
+ * so that a crash cannot make us reuse it. Remote counters are written in the
+ * background. Should we crash before, the reserve added on restart makes us reject
+ * replays of the signed writes accepted in the meantime. As the reserve is not added
+ * to a store written on shutdown, the first remote counter after a clean start is
+ * written right away.
+ */
+void LeBondStore::setSignCounter(const QBluetoothAddress &device, SigningKeyType keyType,
+                                 quint32 counter)
+{
+    const auto it = m_devices.find(device.toUInt64());
+    if (it == m_devices.end() || !it.value().hasKey[keyType])
+        return;
+    DeviceData &deviceData = it.value();
+    deviceData.signingData[keyType].counter = counter;
+    deviceData.dirtyCounters |= 1 << keyType;
+    scheduleWrite();
+    if (keyType == RemoteSigningKey) {
+        if (m_cleanOnDisk)
+            writeSnapshot(true);
+        else if (counter - deviceData.writtenRemoteCounter >= signCounterReserve / 2)
+            writeSnapshot(false);
+    } else if (!deviceData.reserveWritten || counter >= deviceData.reservedCounter) {
+        deviceData.reservedCounter = counter + signCounterReserve;
+        deviceData.reserveWritten = true;
+        writeSnapshot(true);
+    }
+}
+
+/*
+ * Hands a snapshot of the store to the worker thread. Snapshots are written in
+ * the order they are taken, so the last one always wins.
+ */
+void LeBondStore::flush()
+{
+    m_writeTimer.stop();
+    if (m_dirty)
+        writeSnapshot(false);
+}
+
+/*
+ * Writes a snapshot of the store in the worker thread or, if \a synchronous is set
+ * or the worker thread has stopped, right away in the calling thread. Only the
+ * snapshot written on shutdown is \a clean.
+ */
+void LeBondStore::writeSnapshot(bool synchronous, bool clean)
+{
+    m_writeTimer.stop();
+    m_dirty = false;
+    if (synchronous)
+        m_cleanOnDisk = clean; // otherwise the old store stays on disk for a while
+    const QByteArray data = serialize(clean);
+    const quint64 snapshot = ++m_snapshot;
+    if (synchronous) {
+        m_worker->write(m_fileName, data, snapshot);
+    } else {
+        QMetaObject::invokeMethod(m_worker, "write", Qt::QueuedConnection,
+                                  Q_ARG(QString, m_fileName), Q_ARG(QByteArray, data),
+                                  Q_ARG(quint64, snapshot));
+    }
+
+    for (auto it = m_devices.begin(); it != m_devices.end(); ++it) {
+        DeviceData &deviceData = it.value();
+        if (!deviceData.dirtyCounters)
+            continue;
+        deviceData.writtenRemoteCounter = deviceData.signingData[RemoteSigningKey].counter;
+        for (const SigningKeyType keyType : { LocalSigningKey, RemoteSigningKey }) {
+            if (!(deviceData.dirtyCounters & (1 << keyType)))
+                continue;
+            // BlueZ stores the next counter to use.
+            const QString infoFilePath = bluezInfoFilePath(it.key());
+            const QString group = signingKeySettingsGroup(keyType);
+            const quint32 nextCounter = deviceData.signingData[keyType].counter + 1;
+            if (synchronous) {
+                m_worker->writeBluezSignCounter(infoFilePath, group, nextCounter);
+            } else {
+                QMetaObject::invokeMethod(m_worker, "writeBluezSignCounter",
+                                          Qt::QueuedConnection, Q_ARG(QString, infoFilePath),
+                                          Q_ARG(QString, group), Q_ARG(quint32, nextCounter));
+            }
+        }
+        deviceData.dirtyCounters = 0;
+    }
+}
+
+void LeBondStore::scheduleWrite()
+{
+    m_dirty = true;
+    if (!m_worker) {
+        m_worker = new LeBondStoreWorker;
+        m_worker->moveToThread(&m_thread);
+        m_thread.start();
+    }
+    if (!m_writeTimer.isActive())
+        m_writeTimer.start();
+}
+
+void LeBondStore::load()
+{
+    QFile file(m_fileName);
+    if (!file.open(QIODevice::ReadOnly))
+        return;
+
+    QDataStream stream(&file);
+    stream.setVersion(QDataStream::Qt_5_6);
+    quint32 magic;
+    quint16 version;
+    quint8 flags;
+    stream >> magic >> version >> flags;
+    if (magic != storeMagic || version != storeVersion) {
+        qCWarning(QT_BT_BLUEZ) << "Ignoring bond store" << m_fileName
+                               << "with unknown format";
+        return;
+    }
+
+    quint32 deviceCount;
+    stream >> deviceCount;
+    QHash<quint64, DeviceData> devices;
+    for (quint32 i = 0; i < deviceCount && stream.status() == QDataStream::Ok; ++i) {
+        quint64 address;
+        quint8 keyFlags;
+        stream >> address >> keyFlags;
+        DeviceData &deviceData = devices[address];
+        for (const SigningKeyType keyType : { LocalSigningKey, RemoteSigningKey }) {
+            if (!(keyFlags & (1 << keyType)))
+                continue;
+            SigningData &signingData = deviceData.signingData[keyType];
+            if (stream.readRawData(reinterpret_cast<char *>(signingData.key.data),
+                                   sizeof signingData.key) != int(sizeof signingData.key)) {
+                stream.setStatus(QDataStream::ReadPastEnd);
+            }
+            stream >> signingData.counter;
+            deviceData.hasKey[keyType] = true;
+        }
+        // The local counter continues behind the values which may have been used
+        // before a crash. The reserve on disk is renewed with the first counter value
+        // handed out. Remote counters may have been accepted without reaching the disk.
+        if (deviceData.hasKey[RemoteSigningKey] && !(flags & cleanShutdownFlag)) {
+            deviceData.signingData[RemoteSigningKey].counter += signCounterReserve;
+            deviceData.dirtyCounters |= 1 << RemoteSigningKey;
+        }
+        deviceData.writtenRemoteCounter = deviceData.signingData[RemoteSigningKey].counter;
+        quint32 configCount;
+        stream >> configCount;
+        for (quint32 j = 0; j < configCount && stream.status() == QDataStream::Ok; ++j) {
+            QUuid charUuid;
+            ClientConfiguration config;
+            stream >> charUuid >> config.charValueHandle >> config.configHandle
+                   >> config.configValue >> config.charValueWasUpdated;
+            config.charUuid = QBluetoothUuid(charUuid);
+            deviceData.clientConfigs << config;
+        }
+    }
+
+    if (stream.status() != QDataStream::Ok) {
+        qCWarning(QT_BT_BLUEZ) << "Ignoring corrupt bond store" << m_fileName;
+        return;
+    }
+    m_devices = devices;
+    m_cleanOnDisk = flags & cleanShutdownFlag;
+    if (!m_cleanOnDisk)
+        scheduleWrite();
+}
+
+QByteArray LeBondStore::serialize(bool clean) const
+{
+    QByteArray data;
+    QDataStream stream(&data, QIODevice::WriteOnly);
+    stream.setVersion(QDataStream::Qt_5_6);
+
+    const quint32 deviceCount = quint32(std::count_if(m_devices.cbegin(), m_devices.cend(),
+            [](const DeviceData &deviceData) { return !deviceData.isEmpty(); }));
+    stream << storeMagic << storeVersion << quint8(clean ? cleanShutdownFlag : 0) << deviceCount;
+    for (auto it = m_devices.cbegin(); it != m_devices.cend(); ++it) {
+        const DeviceData &deviceData = it.value();
+        if (deviceData.isEmpty())
+            continue;
+        const quint8 keyFlags = (deviceData.hasKey[LocalSigningKey] ? 1 << LocalSigningKey : 0)
+                | (deviceData.hasKey[RemoteSigningKey] ? 1 << RemoteSigningKey : 0);
+        stream << it.key() << keyFlags;
+        for (const SigningKeyType keyType : { LocalSigningKey, RemoteSigningKey }) {
+            if (!deviceData.hasKey[keyType])
+                continue;
+            const SigningData &signingData = deviceData.signingData[keyType];
+            stream.writeRawData(reinterpret_cast<const char *>(signingData.key.data),
+                                sizeof signingData.key);
+            stream << (keyType == LocalSigningKey && deviceData.reserveWritten
+                       ? deviceData.reservedCounter : signingData.counter);
+        }
+        stream << quint32(deviceData.clientConfigs.count());
+        for (const ClientConfiguration &config : deviceData.clientConfigs) {
+            stream << static_cast<const QUuid &>(config.charUuid) << config.charValueHandle
+                   << config.configHandle << config.configValue << config.charValueWasUpdated;
+        }
+    }
+    return data;
+}
+
+/*
+ * BlueZ keeps the keys exchanged during pairing in its info file for the device. If
+ * the device was paired again while we were not running, the key on file is newer
+ * than ours and its counter starts over.
+ */
+void LeBondStore::loadBluezSigningData(quint64 device, SigningKeyType keyType,
+                                       DeviceData &deviceData)
+{
+    const QString settingsFilePath = bluezInfoFilePath(device);
+    if (!QFileInfo(settingsFilePath).exists()) {
+        qCDebug(QT_BT_BLUEZ) << "No settings found for peer device.";
+        return;
+    }
+    QSettings settings(settingsFilePath, QSettings::IniFormat);
+    const QString group = signingKeySettingsGroup(keyType);
+    settings.beginGroup(group);
+    const QByteArray keyString = settings.value(QLatin1String("Key")).toByteArray();
+    if (keyString.isEmpty()) {
+        qCDebug(QT_BT_BLUEZ) << "Group" << group << "not found in settings file";
+        return;
+    }
+    const QByteArray keyData = QByteArray::fromHex(keyString);
+    if (keyData.count() != int(sizeof(quint128))) {
+        qCWarning(QT_BT_BLUEZ) << "Signing key in settings file has invalid size"
+                               << keyString.count();
+        return;
+    }
+    qCDebug(QT_BT_BLUEZ) << "CSRK of peer device is" << keyString;
+    const quint32 nextCounter = settings.value(QLatin1String("Counter"), 0).toUInt();
+    quint128 csrk;
+    std::memcpy(csrk.data, keyData.constData(), keyData.count());
+
+    SigningData &signingData = deviceData.signingData[keyType];
+    if (deviceData.hasKey[keyType]
+            && std::memcmp(signingData.key.data, csrk.data, sizeof csrk) == 0) {
+        // BlueZ's counter may lag behind if its file was not writable.
+        if (quint32(signingData.counter + 1) >= nextCounter)
+            return;
+        signingData.counter = nextCounter - 1;
+    } else {
+        signingData = SigningData(csrk, nextCounter - 1);
+        deviceData.hasKey[keyType] = true;
+    }
+    if (keyType == LocalSigningKey)
+        deviceData.reserveWritten = false;
+    scheduleWrite();
+}
+
+QString LeBondStore::bluezInfoFilePath(quint64 device) const
+{
+    return QString::fromLatin1("/var/lib/bluetooth/%1/%2/info")
+            .arg(m_localAdapter.toString(), QBluetoothAddress(device).toString());
+}
+
+QT_END_NAMESPACE
+
+#include "lebondstore.moc"
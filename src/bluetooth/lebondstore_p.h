@@ -0,0 +1,160 @@
+/****************************************************************************
+**
+** Copyright (C) 2017 The Qt Company Ltd.
+** Contact: https://www.qt.io/licensing/
+**
+** This file is part of the QtBluetooth module of the Qt Toolkit.
+**
+** $QT_BEGIN_LICENSE:LGPL$
+** Commercial License Usage
+** Licensees holding valid commercial Qt licenses may use this file in
+** accordance with the commercial license agreement provided with the
+** Software or, alternatively, in accordance with the terms contained in
+** a written agreement between you and The Qt Company. For licensing terms
+** and conditions see https://www.qt.io/terms-conditions. For further
+** information use the contact form at https://www.qt.io/contact-us.
+**
+** GNU Lesser General Public License Usage
+** Alternatively, this file may be used under the terms of the GNU Lesser
+** General Public License version 3 as published by the Free Software
+** Foundation and appearing in the file LICENSE.LGPL3 included in the
+** packaging of this file. Please review the following information to
+** ensure the GNU Lesser General Public License version 3 requirements
+** will be met: https://www.gnu.org/licenses/lgpl-3.0.html.
+**
+** GNU General Public License Usage
+** Alternatively, this file may be used under the terms of the GNU
+** General Public License version 2.0 or (at your option) the GNU General
+** Public license version 3 or any later version approved by the KDE Free
+** Qt Foundation. The licenses are as published by the Free Software
+** Foundation and appearing in the file LICENSE.GPL2 and LICENSE.GPL3
+** included in the packaging of this file. Please review the following
+** information to ensure the GNU General Public License requirements will
+** be met: https://www.gnu.org/licenses/gpl-2.0.html and
+** https://www.gnu.org/licenses/gpl-3.0.html.
+**
+** $QT_END_LICENSE$
+**
+****************************************************************************/
+
+#ifndef LEBONDSTORE_P_H
+#define LEBONDSTORE_P_H
+
+//
+//  W A R N I N G
+//  -------------
+//
+// This file is not part of the Qt API.  It exists purely as an
+// implementation detail.  This header file may change from version to
+// version without notice, or even be removed.
+//
+// We mean it.
+//
+
+#include <QtBluetooth/qbluetooth.h>
+#include <QtBluetooth/QBluetoothAddress>
+#include <QtBluetooth/QBluetoothUuid>
+#include <QtCore/QHash>
+#include <QtCore/QObject>
+#include <QtCore/QThread>
+#include <QtCore/QTimer>
+#include <QtCore/QVector>
+
+QT_BEGIN_NAMESPACE
+
+class LeBondStoreWorker;
+
+/*
+ * Keeps the GATT state that has to survive the connection to a bonded device:
+ * the client characteristic configurations written to the local GATT server and
+ * the signature resolving keys with their sign counters. The state of all devices
+ * of one adapter is read from disk once. Afterwards all lookups and changes happen
+ * in memory. Changes are collected and written back in batches by a worker thread.
+ * The store file is replaced atomically, so that a crash leaves either the old or
+ * the new state behind, but never a partial one. Only the user may read it.
+ */
+class Q_AUTOTEST_EXPORT LeBondStore : public QObject
+{
+    Q_OBJECT
+public:
+    enum SigningKeyType { LocalSigningKey, RemoteSigningKey };
+
+    struct ClientConfiguration {
+        ClientConfiguration(QLowEnergyHandle chHndl = 0, QLowEnergyHandle coHndl = 0,
+                            quint16 val = 0, const QBluetoothUuid &uuid = QBluetoothUuid())
+            : charUuid(uuid), charValueHandle(chHndl), configHandle(coHndl), configValue(val) {}
+
+        // checked on restore, the local database may have changed in the meantime
+        QBluetoothUuid charUuid;
+        QLowEnergyHandle charValueHandle;
+        QLowEnergyHandle configHandle;
+        quint16 configValue;
+        bool charValueWasUpdated = false;
+    };
+
+    struct SigningData {
+        SigningData() = default;
+        SigningData(const quint128 &csrk, quint32 signCounter = quint32(-1))
+            : key(csrk), counter(signCounter) {}
+
+        quint128 key;
+        quint32 counter = quint32(-1); // the last counter value used
+    };
+
+    explicit LeBondStore(const QBluetoothAddress &localAdapter, QObject *parent = nullptr);
+    ~LeBondStore();
+
+    QVector<ClientConfiguration> clientConfigurations(const QBluetoothAddress &device) const;
+    void setClientConfigurations(const QBluetoothAddress &device,
+                                 const QVector<ClientConfiguration> &configs);
+    void removeClientConfigurations(const QBluetoothAddress &device);
+    void markCharacteristicUpdated(QLowEnergyHandle charValueHandle, quint16 configMask,
+                                   const QVector<quint64> &skippedDevices);
+
+    void loadSigningData(const QBluetoothAddress &device, SigningKeyType keyType);
+    bool signingData(const QBluetoothAddress &device, SigningKeyType keyType,
+                     SigningData *data);
+    void setSigningKey(const QBluetoothAddress &device, SigningKeyType keyType,
+                       const quint128 &csrk);
+    void setSignCounter(const QBluetoothAddress &device, SigningKeyType keyType,
+                        quint32 counter);
+
+public slots:
+    void flush();
+
+private:
+    struct DeviceData {
+        bool isEmpty() const { return clientConfigs.isEmpty() && !hasKey[0] && !hasKey[1]; }
+
+        QVector<ClientConfiguration> clientConfigs;
+        SigningData signingData[2];
+        bool hasKey[2] = { false, false };
+        bool checkedBluez[2] = { false, false }; // not persistent
+        quint8 dirtyCounters = 0; // bit per SigningKeyType
+        // local sign counter as written to disk, valid if reserveWritten is set
+        quint32 reservedCounter = 0;
+        bool reserveWritten = false; // not persistent
+        quint32 writtenRemoteCounter = quint32(-1); // remote sign counter on disk
+    };
+
+    void load();
+    QByteArray serialize(bool clean) const;
+    void loadBluezSigningData(quint64 device, SigningKeyType keyType, DeviceData &deviceData);
+    QString bluezInfoFilePath(quint64 device) const;
+    void scheduleWrite();
+    void writeSnapshot(bool synchronous, bool clean = false);
+
+    const QBluetoothAddress m_localAdapter;
+    const QString m_fileName;
+    QHash<quint64, DeviceData> m_devices;
+    QThread m_thread;
+    LeBondStoreWorker *m_worker = nullptr;
+    QTimer m_writeTimer;
+    bool m_dirty = false;
+    bool m_cleanOnDisk = false; // the store on disk was written on shutdown
+    quint64 m_snapshot = 0; // number of the last snapshot taken
+};
+
+QT_END_NAMESPACE
+
+#endif // LEBONDSTORE_P_H
@@ -44,6 +44,7 @@
 #include <QtCore/qloggingcategory.h>
 #include <QtCore/private/qcore_unix_p.h>
 
+#include <algorithm>
 #include <cstring>
 #include <sys/socket.h>
 #include <sys/types.h>
@@ -53,36 +54,140 @@
 #include <linux/if_alg.h>
 #endif
 
+// GCC before 4.9 does not allow AES-NI intrinsics in functions with a target attribute
+#if defined(Q_PROCESSOR_X86) && (Q_CC_GNU >= 409 || Q_CC_CLANG >= 308)
+#define QT_BT_HAVE_AESNI
+#include <cpuid.h>
+#include <wmmintrin.h>
+#endif
+
 QT_BEGIN_NAMESPACE
 
 Q_DECLARE_LOGGING_CATEGORY(QT_BT_BLUEZ)
 
-LeCmacCalculator::LeCmacCalculator()
+namespace {
+const int blockSize = 16;
+
+#ifdef QT_BT_HAVE_AESNI
+bool cpuHasAesNi()
+{
+    unsigned int eax, ebx, ecx, edx;
+    return __get_cpuid(1, &eax, &ebx, &ecx, &edx) && (ecx & bit_AES);
+}
+
+// FIPS-197, 5.2, the round key following \a key. The round constant must be known
+// at compile time.
+template <int RoundConstant>
+__attribute__((target("aes,sse2")))
+__m128i aesNiNextRoundKey(__m128i key)
 {
+    const __m128i temp = _mm_shuffle_epi32(_mm_aeskeygenassist_si128(key, RoundConstant),
+                                           _MM_SHUFFLE(3, 3, 3, 3));
+    key = _mm_xor_si128(key, _mm_slli_si128(key, 4));
+    key = _mm_xor_si128(key, _mm_slli_si128(key, 4));
+    key = _mm_xor_si128(key, _mm_slli_si128(key, 4));
+    return _mm_xor_si128(key, temp);
+}
+
+// for a 128 bit key given MSB first
+__attribute__((target("aes,sse2")))
+void aesNiExpandKey(const quint8 *key, quint8 *roundKeys)
+{
+    __m128i * const keys = reinterpret_cast<__m128i *>(roundKeys);
+    __m128i roundKey = _mm_loadu_si128(reinterpret_cast<const __m128i *>(key));
+    _mm_storeu_si128(keys, roundKey);
+    roundKey = aesNiNextRoundKey<0x01>(roundKey);
+    _mm_storeu_si128(keys + 1, roundKey);
+    roundKey = aesNiNextRoundKey<0x02>(roundKey);
+    _mm_storeu_si128(keys + 2, roundKey);
+    roundKey = aesNiNextRoundKey<0x04>(roundKey);
+    _mm_storeu_si128(keys + 3, roundKey);
+    roundKey = aesNiNextRoundKey<0x08>(roundKey);
+    _mm_storeu_si128(keys + 4, roundKey);
+    roundKey = aesNiNextRoundKey<0x10>(roundKey);
+    _mm_storeu_si128(keys + 5, roundKey);
+    roundKey = aesNiNextRoundKey<0x20>(roundKey);
+    _mm_storeu_si128(keys + 6, roundKey);
+    roundKey = aesNiNextRoundKey<0x40>(roundKey);
+    _mm_storeu_si128(keys + 7, roundKey);
+    roundKey = aesNiNextRoundKey<0x80>(roundKey);
+    _mm_storeu_si128(keys + 8, roundKey);
+    roundKey = aesNiNextRoundKey<0x1b>(roundKey);
+    _mm_storeu_si128(keys + 9, roundKey);
+    roundKey = aesNiNextRoundKey<0x36>(roundKey);
+    _mm_storeu_si128(keys + 10, roundKey);
+}
+
+__attribute__((target("aes,sse2")))
+void aesNiEncryptBlock(const quint8 *roundKeys, quint8 *block)
+{
+    const __m128i *keys = reinterpret_cast<const __m128i *>(roundKeys);
+    __m128i state = _mm_loadu_si128(reinterpret_cast<const __m128i *>(block));
+    state = _mm_xor_si128(state, _mm_loadu_si128(keys));
+    for (int round = 1; round < 10; ++round)
+        state = _mm_aesenc_si128(state, _mm_loadu_si128(keys + round));
+    state = _mm_aesenclast_si128(state, _mm_loadu_si128(keys + 10));
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(block), state);
+}
+
+// RFC 4493, 2.3, without branching on the key dependent input
+void deriveSubkey(const quint8 *in, quint8 *out)
+{
+    for (int i = 0; i < blockSize - 1; ++i)
+        out[i] = quint8((in[i] << 1) | (in[i + 1] >> 7));
+    out[blockSize - 1] = quint8((in[blockSize - 1] << 1) ^ (0x87 & -(in[0] >> 7)));
+}
+#endif
+}
+
+LeCmacCalculator::LeCmacCalculator(Backend backend)
+    : m_backend(backend == AutomaticBackend ? KernelBackend : backend)
+{
+#ifdef QT_BT_HAVE_AESNI
+    m_useAesNi = cpuHasAesNi();
+#endif
+    if (m_backend == SoftwareBackend)
+        return;
+
 #ifdef CONFIG_LINUX_CRYPTO_API
-    m_baseSocket = socket(AF_ALG, SOCK_SEQPACKET, 0);
+    m_baseSocket = socket(AF_ALG, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
     if (m_baseSocket == -1) {
         qCWarning(QT_BT_BLUEZ) << "failed to create first level crypto socket:"
                                << strerror(errno);
-        return;
-    }
-    sockaddr_alg sa;
-    using namespace std;
-    memset(&sa, 0, sizeof sa);
-    sa.salg_family = AF_ALG;
-    strcpy(reinterpret_cast<char *>(sa.salg_type), "hash");
-    strcpy(reinterpret_cast<char *>(sa.salg_name), "cmac(aes)");
-    if (::bind(m_baseSocket, reinterpret_cast<sockaddr *>(&sa), sizeof sa) == -1) {
-        qCWarning(QT_BT_BLUEZ) << "bind() failed for crypto socket:" << strerror(errno);
-        return;
+    } else {
+        sockaddr_alg sa;
+        using namespace std;
+        memset(&sa, 0, sizeof sa);
+        sa.salg_family = AF_ALG;
+        strcpy(reinterpret_cast<char *>(sa.salg_type), "hash");
+        strcpy(reinterpret_cast<char *>(sa.salg_name), "cmac(aes)");
+        if (::bind(m_baseSocket, reinterpret_cast<sockaddr *>(&sa), sizeof sa) == -1) {
+            qCWarning(QT_BT_BLUEZ) << "bind() failed for crypto socket:" << strerror(errno);
+            close(m_baseSocket);
+            m_baseSocket = -1;
+        }
     }
 #else // CONFIG_LINUX_CRYPTO_API
-    qCWarning(QT_BT_BLUEZ) << "Linux crypto API not present, CMAC verification will fail.";
+    qCDebug(QT_BT_BLUEZ) << "Linux crypto API not present.";
 #endif
+
+    // A table based AES implementation would leak the key through cache timing, so
+    // the built-in one is only used with the AES instructions of the CPU.
+    if (m_baseSocket == -1 && backend == AutomaticBackend) {
+        if (m_useAesNi) {
+            qCDebug(QT_BT_BLUEZ) << "Using built-in AES-CMAC implementation.";
+            m_backend = SoftwareBackend;
+        } else {
+            qCWarning(QT_BT_BLUEZ) << "Neither the Linux crypto API nor AES-NI is available,"
+                                      " cannot calculate AES-CMAC signatures.";
+        }
+    }
 }
 
 LeCmacCalculator::~LeCmacCalculator()
 {
+    if (m_opSocket != -1)
+        close(m_opSocket);
     if (m_baseSocket != -1)
         close(m_baseSocket);
 }
@@ -96,57 +201,136 @@ QByteArray LeCmacCalculator::createFullMessage(const QByteArray &message, quint3
     return fullMessage;
 }
 
-quint64 LeCmacCalculator::calculateMac(const QByteArray &message, const quint128 &csrk) const
+quint64 LeCmacCalculator::calculateMac(const QByteArray &message, const quint128 &csrk)
 {
+    if (!setKey(csrk))
+        return 0;
+
+    // Bluetooth transmits LSB first, AES-CMAC works on MSB first data.
+    m_messageMsb.resize(message.count());
+    std::reverse_copy(message.begin(), message.end(), m_messageMsb.begin());
+    return calculateMacMsb(m_messageMsb);
+}
+
+quint64 LeCmacCalculator::calculateMac(const char *message, int size, quint32 signCounter,
+                                       const quint128 &csrk)
+{
+    if (!setKey(csrk))
+        return 0;
+
+    // The counter is the last part of the message, so it comes first in MSB order.
+    m_messageMsb.resize(int(sizeof signCounter) + size);
+    char * const data = m_messageMsb.data();
+    putBtData(signCounter, data);
+    std::reverse(data, data + sizeof signCounter);
+    std::reverse_copy(message, message + size, data + sizeof signCounter);
+    return calculateMacMsb(m_messageMsb);
+}
+
+/*
+ * Prepares the calculator for \a csrk. This only does work if the key differs
+ * from the one used before.
+ */
+bool LeCmacCalculator::setKey(const quint128 &csrk)
+{
+    if (m_hasKey && std::memcmp(m_key, csrk.data, sizeof m_key) == 0)
+        return m_backend == SoftwareBackend ? m_useAesNi : m_opSocket != -1;
+
+    std::memcpy(m_key, csrk.data, sizeof m_key);
+    m_hasKey = true;
+    quint8 csrkMsb[blockSize];
+    std::reverse_copy(std::begin(csrk.data), std::end(csrk.data), csrkMsb);
+    qCDebug(QT_BT_BLUEZ) << "CSRK (MSB):" << QByteArray(reinterpret_cast<char *>(csrkMsb),
+                                                        sizeof csrkMsb).toHex();
+
+    if (m_backend == SoftwareBackend) {
+#ifdef QT_BT_HAVE_AESNI
+        if (m_useAesNi) {
+            aesNiExpandKey(csrkMsb, m_roundKeys);
+            quint8 l[blockSize] = { };
+            aesNiEncryptBlock(m_roundKeys, l);
+            deriveSubkey(l, m_subkey1);
+            deriveSubkey(m_subkey1, m_subkey2);
+            return true;
+        }
+#endif
+        qCWarning(QT_BT_BLUEZ) << "CMAC calculation failed due to missing AES-NI.";
+        return false;
+    }
+
 #ifdef CONFIG_LINUX_CRYPTO_API
+    if (m_opSocket != -1) {
+        close(m_opSocket);
+        m_opSocket = -1;
+    }
     if (m_baseSocket == -1)
         return false;
-    quint128 csrkMsb;
-    std::reverse_copy(std::begin(csrk.data), std::end(csrk.data), std::begin(csrkMsb.data));
-    qCDebug(QT_BT_BLUEZ) << "CSRK (MSB):" << QByteArray(reinterpret_cast<char *>(csrkMsb.data),
-                                                        sizeof csrkMsb).toHex();
-    if (setsockopt(m_baseSocket, 279 /* SOL_ALG */, ALG_SET_KEY, csrkMsb.data, sizeof csrkMsb) == -1) {
+    if (setsockopt(m_baseSocket, 279 /* SOL_ALG */, ALG_SET_KEY, csrkMsb, sizeof csrkMsb) == -1) {
         qCWarning(QT_BT_BLUEZ) << "setsockopt() failed for crypto socket:" << strerror(errno);
-        return 0;
+        return false;
     }
+    // The operation socket is kept for all messages signed with this key.
+    m_opSocket = accept4(m_baseSocket, nullptr, 0, SOCK_CLOEXEC);
+    if (m_opSocket == -1) {
+        qCWarning(QT_BT_BLUEZ) << "accept() failed for crypto socket:" << strerror(errno);
+        return false;
+    }
+    return true;
+#else // CONFIG_LINUX_CRYPTO_API
+    qCWarning(QT_BT_BLUEZ) << "CMAC calculation failed due to missing Linux crypto API.";
+    return false;
+#endif
+}
 
-    class SocketWrapper
-    {
-    public:
-        SocketWrapper(int socket) : m_socket(socket) {}
-        ~SocketWrapper() {
-            if (m_socket != -1)
-                close(m_socket);
+quint64 LeCmacCalculator::calculateMacMsb(const QByteArray &messageMsb)
+{
+    quint64 mac;
+#ifdef QT_BT_HAVE_AESNI
+    if (m_backend == SoftwareBackend) {
+        // RFC 4493, 2.4
+        const quint8 *data = reinterpret_cast<const quint8 *>(messageMsb.constData());
+        int remaining = messageMsb.count();
+        quint8 x[blockSize] = { };
+        while (remaining > blockSize) {
+            for (int i = 0; i < blockSize; ++i)
+                x[i] ^= data[i];
+            aesNiEncryptBlock(m_roundKeys, x);
+            data += blockSize;
+            remaining -= blockSize;
         }
-
-        int value() const { return m_socket; }
-    private:
-        int m_socket;
-    };
-    SocketWrapper cryptoSocket(accept(m_baseSocket, nullptr, 0));
-    if (cryptoSocket.value() == -1) {
-        qCWarning(QT_BT_BLUEZ) << "accept() failed for crypto socket:" << strerror(errno);
-        return 0;
+        if (remaining == blockSize) {
+            for (int i = 0; i < blockSize; ++i)
+                x[i] ^= data[i] ^ m_subkey1[i];
+        } else {
+            for (int i = 0; i < blockSize; ++i) {
+                const quint8 padded = i < remaining ? data[i] : (i == remaining ? 0x80 : 0x00);
+                x[i] ^= padded ^ m_subkey2[i];
+            }
+        }
+        aesNiEncryptBlock(m_roundKeys, x);
+        // Only the most significant 64 bits are used.
+        std::memcpy(&mac, x, sizeof mac);
+        return qFromBigEndian(mac);
     }
+#endif
 
-    QByteArray messageSwapped(message.count(), Qt::Uninitialized);
-    std::reverse_copy(message.begin(), message.end(), messageSwapped.begin());
+#ifdef CONFIG_LINUX_CRYPTO_API
+    // A single write finalizes the hash, the next one starts over.
     qint64 totalBytesWritten = 0;
     do {
-        const qint64 bytesWritten = qt_safe_write(cryptoSocket.value(),
-                                                  messageSwapped.constData() + totalBytesWritten,
-                                                  messageSwapped.count() - totalBytesWritten);
+        const qint64 bytesWritten = qt_safe_write(m_opSocket,
+                                                  messageMsb.constData() + totalBytesWritten,
+                                                  messageMsb.count() - totalBytesWritten);
         if (bytesWritten == -1) {
             qCWarning(QT_BT_BLUEZ) << "writing to crypto socket failed:" << strerror(errno);
             return 0;
         }
         totalBytesWritten += bytesWritten;
-    } while (totalBytesWritten < messageSwapped.count());
-    quint64 mac;
+    } while (totalBytesWritten < messageMsb.count());
     quint8 * const macPtr = reinterpret_cast<quint8 *>(&mac);
     qint64 totalBytesRead = 0;
     do {
-        const qint64 bytesRead = qt_safe_read(cryptoSocket.value(), macPtr + totalBytesRead,
+        const qint64 bytesRead = qt_safe_read(m_opSocket, macPtr + totalBytesRead,
                                               sizeof mac - totalBytesRead);
         if (bytesRead == -1) {
             qCWarning(QT_BT_BLUEZ) << "reading from crypto socket failed:" << strerror(errno);
@@ -156,17 +340,13 @@ quint64 LeCmacCalculator::calculateMac(const QByteArray &message, const quint128
     } while (totalBytesRead < qint64(sizeof mac));
     return qFromBigEndian(mac);
 #else // CONFIG_LINUX_CRYPTO_API
-    Q_UNUSED(message);
-    Q_UNUSED(csrk);
-    qCWarning(QT_BT_BLUEZ) << "CMAC calculation failed due to missing Linux crypto API.";
     return 0;
 #endif
 }
 
 bool LeCmacCalculator::verify(const QByteArray &message, const quint128 &csrk,
-                           quint64 expectedMac) const
+                              quint64 expectedMac)
 {
-#ifdef CONFIG_LINUX_CRYPTO_API
     const quint64 actualMac = calculateMac(message, csrk);
     if (actualMac != expectedMac) {
         qCWarning(QT_BT_BLUEZ) << hex << "signature verification failed: calculated mac:"
@@ -174,13 +354,18 @@ bool LeCmacCalculator::verify(const QByteArray &message, const quint128 &csrk,
         return false;
     }
     return true;
-#else // CONFIG_LINUX_CRYPTO_API
-    Q_UNUSED(message);
-    Q_UNUSED(csrk);
-    Q_UNUSED(expectedMac);
-    qCWarning(QT_BT_BLUEZ) << "CMAC verification failed due to missing Linux crypto API.";
-    return false;
-#endif
+}
+
+bool LeCmacCalculator::verify(const char *message, int size, quint32 signCounter,
+                              const quint128 &csrk, quint64 expectedMac)
+{
+    const quint64 actualMac = calculateMac(message, size, signCounter, csrk);
+    if (actualMac != expectedMac) {
+        qCWarning(QT_BT_BLUEZ) << hex << "signature verification failed: calculated mac:"
+                               << actualMac << "expected mac:" << expectedMac;
+        return false;
+    }
+    return true;
 }
 
 QT_END_NAMESPACE
@@ -50,27 +50,63 @@
 // We mean it.
 //
 
-#include <QtCore/qglobal.h>
+#include <QtCore/qbytearray.h>
 
 QT_BEGIN_NAMESPACE
 
 struct quint128;
 
+/*
+ * Calculates AES-CMAC signatures as used for signed writes. The calculator keeps
+ * its state for the most recently used key, so that signing a series of messages
+ * with the same key costs no more than the signing itself. Keep one calculator
+ * per key to benefit from this.
+ */
 class Q_AUTOTEST_EXPORT LeCmacCalculator
 {
 public:
-    LeCmacCalculator();
+    enum Backend {
+        AutomaticBackend,   // the kernel if available, the software implementation otherwise
+        KernelBackend,      // the Linux crypto API
+        SoftwareBackend     // in-process, requires a CPU with AES-NI
+    };
+
+    explicit LeCmacCalculator(Backend backend = AutomaticBackend);
     ~LeCmacCalculator();
 
+    Backend backend() const { return m_backend; }
+    // false if the backend is not available on this system
+    bool isValid() const { return m_backend == SoftwareBackend ? m_useAesNi : m_baseSocket != -1; }
+
     static QByteArray createFullMessage(const QByteArray &message, quint32 signCounter);
 
-    quint64 calculateMac(const QByteArray &message, const quint128 &csrk) const;
+    quint64 calculateMac(const QByteArray &message, const quint128 &csrk);
+
+    // Signs message || signCounter without building the full message first.
+    quint64 calculateMac(const char *message, int size, quint32 signCounter,
+                         const quint128 &csrk);
 
-    // Convenience function.
-    bool verify(const QByteArray &message, const quint128 &csrk, quint64 expectedMac) const;
+    // Convenience functions.
+    bool verify(const QByteArray &message, const quint128 &csrk, quint64 expectedMac);
+    bool verify(const char *message, int size, quint32 signCounter, const quint128 &csrk,
+                quint64 expectedMac);
 
 private:
+    Q_DISABLE_COPY(LeCmacCalculator)
+
+    bool setKey(const quint128 &csrk);
+    quint64 calculateMacMsb(const QByteArray &messageMsb);
+
+    Backend m_backend;
     int m_baseSocket = -1;
+    int m_opSocket = -1;
+    bool m_hasKey = false;
+    bool m_useAesNi = false;
+    quint8 m_key[16];           // as passed in, LSB first
+    quint8 m_roundKeys[11 * 16];
+    quint8 m_subkey1[16];
+    quint8 m_subkey2[16];
+    QByteArray m_messageMsb;    // reused for every message
 };
 
 
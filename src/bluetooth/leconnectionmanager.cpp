@@ -0,0 +1,213 @@
+/****************************************************************************
+**
+** Copyright (C) 2017 The Qt Company Ltd.
+** Contact: https://www.qt.io/licensing/
+**
+** This file is part of the QtBluetooth module of the Qt Toolkit.
+**
+** $QT_BEGIN_LICENSE:LGPL$
+** Commercial License Usage
+** Licensees holding valid commercial Qt licenses may use this file in
+** accordance with the commercial license agreement provided with the
+** Software or, alternatively, in accordance with the terms contained in
+** a written agreement between you and The Qt Company. For licensing terms
+** and conditions see https://www.qt.io/terms-conditions. For further
+** information use the contact form at https://www.qt.io/contact-us.
+**
+** GNU Lesser General Public License Usage
+** Alternatively, this file may be used under the terms of the GNU Lesser
+** General Public License version 3 as published by the Free Software
+** Foundation and appearing in the file LICENSE.LGPL3 included in the
+** packaging of this file. Please review the following information to
+** ensure the GNU Lesser General Public License version 3 requirements
+** will be met: https://www.gnu.org/licenses/lgpl-3.0.html.
+**
+** GNU General Public License Usage
+** Alternatively, this file may be used under the terms of the GNU
+** General Public License version 2.0 or (at your option) the GNU General
+** Public license version 3 or any later version approved by the KDE Free
+** Qt Foundation. The licenses are as published by the Free Software
+** Foundation and appearing in the file LICENSE.GPL2 and LICENSE.GPL3
+** included in the packaging of this file. Please review the following
+** information to ensure the GNU General Public License requirements will
+** be met: https://www.gnu.org/licenses/gpl-2.0.html and
+** https://www.gnu.org/licenses/gpl-3.0.html.
+**
+** $QT_END_LICENSE$
+**
+****************************************************************************/
+
+#include "leconnectionmanager_p.h"
+#include "lebondstore_p.h"
+#include "qlowenergycontroller_p.h"
+#include "bluez/hcimanager_p.h"
+
+#include <QtCore/QHash>
+#include <QtCore/QMutex>
+#include <QtCore/QThread>
+#include <QtCore/QWeakPointer>
+
+QT_BEGIN_NAMESPACE
+
+const int LeConnectionManager::WriteCommandBurst;
+
+namespace {
+typedef QPair<QThread *, quint64> ManagerKey;
+
+struct ManagerRegistry
+{
+    QMutex mutex;
+    QHash<ManagerKey, QWeakPointer<LeConnectionManager>> managers;
+};
+}
+
+Q_GLOBAL_STATIC(ManagerRegistry, managerRegistry)
+
+/*
+ * Returns the manager for \a localAdapter in the current thread. The manager
+ * is created on first use and destroyed together with its last controller.
+ */
+QSharedPointer<LeConnectionManager> LeConnectionManager::instance(
+        const QBluetoothAddress &localAdapter)
+{
+    QThread * const thread = QThread::currentThread();
+    const ManagerKey key(thread, localAdapter.toUInt64());
+    ManagerRegistry * const registry = managerRegistry();
+
+    QMutexLocker locker(&registry->mutex);
+    QSharedPointer<LeConnectionManager> manager = registry->managers.value(key).toStrongRef();
+    if (!manager) {
+        manager.reset(new LeConnectionManager(localAdapter, thread));
+        registry->managers.insert(key, manager);
+    }
+    return manager;
+}
+
+LeConnectionManager::LeConnectionManager(const QBluetoothAddress &localAdapter, QThread *thread)
+    : m_localAdapter(localAdapter), m_thread(thread),
+      m_hciManager(new HciManager(localAdapter, this))
+{
+    if (!m_hciManager->isValid())
+        return;
+
+    // Union of the events required by all controllers. The connection handle
+    // in each event tells the controllers apart.
+    m_hciManager->monitorEvent(HciManager::EncryptChangeEvent);
+    m_hciManager->monitorEvent(HciManager::LeMetaEvent);
+    m_hciManager->monitorAclPackets();
+}
+
+LeConnectionManager::~LeConnectionManager()
+{
+    if (m_ioThread) {
+        m_ioThread->quit();
+        m_ioThread->wait();
+    }
+
+    if (managerRegistry.isDestroyed())
+        return;
+
+    ManagerRegistry * const registry = managerRegistry();
+    QMutexLocker locker(&registry->mutex);
+    const auto it = registry->managers.find(ManagerKey(m_thread, m_localAdapter.toUInt64()));
+    // the entry might already belong to a new manager for the same adapter
+    if (it != registry->managers.end() && it.value().isNull())
+        registry->managers.erase(it);
+}
+
+/*
+ * Returns the worker thread in which the controllers of the adapter read
+ * their sockets if they have been asked to. It is started on first use.
+ */
+QThread *LeConnectionManager::ioThread()
+{
+    if (!m_ioThread) {
+        m_ioThread = new QThread(this);
+        m_ioThread->setObjectName(QStringLiteral("QtBluetooth LE I/O"));
+        m_ioThread->start();
+    }
+    return m_ioThread;
+}
+
+/*
+ * Returns the store for the GATT state of the devices bonded with the adapter.
+ * It is loaded on first use.
+ */
+LeBondStore *LeConnectionManager::bondStore()
+{
+    if (!m_bondStore)
+        m_bondStore = new LeBondStore(m_localAdapter, this);
+    return m_bondStore;
+}
+
+/*
+ * Returns an advertising set handle that no other advertiser of the adapter uses,
+ * or -1 if all of them are taken. The handles are handed out from the top of the
+ * range, as the kernel numbers its own advertising instances from 1 upwards.
+ */
+int LeConnectionManager::allocateAdvertisingHandle()
+{
+    // Spec v5.0, Vol 2, Part E, 7.8.53
+    for (int handle = 0xef; handle >= 0; --handle) {
+        if (!m_advertisingHandles.contains(handle)) {
+            m_advertisingHandles << handle;
+            return handle;
+        }
+    }
+    return -1;
+}
+
+void LeConnectionManager::releaseAdvertisingHandle(int handle)
+{
+    m_advertisingHandles.removeOne(handle);
+}
+
+/*
+ * Gives \a controller a turn at writing its queued write commands. A connection
+ * without competition is served right away. Otherwise the connections take turns
+ * of at most WriteCommandBurst packets each, returning to the event loop after
+ * every round so that incoming packets on all connections are processed in between.
+ */
+void LeConnectionManager::scheduleWriteCommands(QLowEnergyControllerPrivate *controller)
+{
+    if (m_writeSchedule.contains(controller))
+        return;
+
+    if (m_writeSchedule.isEmpty() && !m_sending
+            && !controller->writeQueuedCommands(WriteCommandBurst)) {
+        return;
+    }
+
+    m_writeSchedule.append(controller);
+    if (!m_sendPosted) {
+        m_sendPosted = true;
+        QMetaObject::invokeMethod(this, "_q_sendScheduledWriteCommands", Qt::QueuedConnection);
+    }
+}
+
+void LeConnectionManager::unscheduleWriteCommands(QLowEnergyControllerPrivate *controller)
+{
+    m_writeSchedule.removeAll(controller);
+}
+
+void LeConnectionManager::_q_sendScheduledWriteCommands()
+{
+    m_sendPosted = false;
+    m_sending = true;
+
+    // Connections scheduled during this round get their turn in the next one.
+    int turns = m_writeSchedule.size();
+    while (turns-- > 0 && !m_writeSchedule.isEmpty()) {
+        QLowEnergyControllerPrivate * const controller = m_writeSchedule.takeFirst();
+        if (controller->writeQueuedCommands(WriteCommandBurst))
+            m_writeSchedule.append(controller);
+    }
+
+    m_sending = false;
+    if (!m_writeSchedule.isEmpty() && !m_sendPosted) {
+        m_sendPosted = true;
+        QMetaObject::invokeMethod(this, "_q_sendScheduledWriteCommands", Qt::QueuedConnection);
+    }
+}
+
+QT_END_NAMESPACE
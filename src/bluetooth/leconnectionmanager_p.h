@@ -0,0 +1,123 @@
+/****************************************************************************
+**
+** Copyright (C) 2017 The Qt Company Ltd.
+** Contact: https://www.qt.io/licensing/
+**
+** This file is part of the QtBluetooth module of the Qt Toolkit.
+**
+** $QT_BEGIN_LICENSE:LGPL$
+** Commercial License Usage
+** Licensees holding valid commercial Qt licenses may use this file in
+** accordance with the commercial license agreement provided with the
+** Software or, alternatively, in accordance with the terms contained in
+** a written agreement between you and The Qt Company. For licensing terms
+** and conditions see https://www.qt.io/terms-conditions. For further
+** information use the contact form at https://www.qt.io/contact-us.
+**
+** GNU Lesser General Public License Usage
+** Alternatively, this file may be used under the terms of the GNU Lesser
+** General Public License version 3 as published by the Free Software
+** Foundation and appearing in the file LICENSE.LGPL3 included in the
+** packaging of this file. Please review the following information to
+** ensure the GNU Lesser General Public License version 3 requirements
+** will be met: https://www.gnu.org/licenses/lgpl-3.0.html.
+**
+** GNU General Public License Usage
+** Alternatively, this file may be used under the terms of the GNU
+** General Public License version 2.0 or (at your option) the GNU General
+** Public license version 3 or any later version approved by the KDE Free
+** Qt Foundation. The licenses are as published by the Free Software
+** Foundation and appearing in the file LICENSE.GPL2 and LICENSE.GPL3
+** included in the packaging of this file. Please review the following
+** information to ensure the GNU General Public License requirements will
+** be met: https://www.gnu.org/licenses/gpl-2.0.html and
+** https://www.gnu.org/licenses/gpl-3.0.html.
+**
+** $QT_END_LICENSE$
+**
+****************************************************************************/
+
+#ifndef LECONNECTIONMANAGER_P_H
+#define LECONNECTIONMANAGER_P_H
+
+//
+//  W A R N I N G
+//  -------------
+//
+// This file is not part of the Qt API.  It exists purely as an
+// implementation detail.  This header file may change from version to
+// version without notice, or even be removed.
+//
+// We mean it.
+//
+
+#include <QtCore/QObject>
+#include <QtCore/QSharedPointer>
+#include <QtCore/QVector>
+#include <QtBluetooth/QBluetoothAddress>
+
+QT_BEGIN_NAMESPACE
+
+class HciManager;
+class LeBondStore;
+class QLowEnergyControllerPrivate;
+class QThread;
+
+/*
+ * Shared by all BlueZ LE controllers of one local adapter living in the same thread.
+ * It owns the single HCI socket for the adapter, round-robins the write commands
+ * of all connections and keeps adapter wide connection statistics as well as the
+ * stored state of bonded devices.
+ */
+class LeConnectionManager : public QObject
+{
+    Q_OBJECT
+public:
+    static QSharedPointer<LeConnectionManager> instance(const QBluetoothAddress &localAdapter);
+    ~LeConnectionManager();
+
+    HciManager *hciManager() const { return m_hciManager; }
+    QThread *ioThread();
+    LeBondStore *bondStore();
+
+    void connectionOpened() { ++m_connectionCount; }
+    void connectionClosed() { --m_connectionCount; }
+    int connectionCount() const { return m_connectionCount; }
+
+    void addBytesSent(qint64 bytes) { m_bytesSent += bytes; }
+    void addBytesReceived(qint64 bytes) { m_bytesReceived += bytes; }
+    qint64 bytesSent() const { return m_bytesSent; }
+    qint64 bytesReceived() const { return m_bytesReceived; }
+
+    int allocateAdvertisingHandle();
+    void releaseAdvertisingHandle(int handle);
+
+    void scheduleWriteCommands(QLowEnergyControllerPrivate *controller);
+    void unscheduleWriteCommands(QLowEnergyControllerPrivate *controller);
+
+    // write commands sent per connection before the next connection gets its turn
+    static const int WriteCommandBurst = 8;
+
+private slots:
+    void _q_sendScheduledWriteCommands();
+
+private:
+    LeConnectionManager(const QBluetoothAddress &localAdapter, QThread *thread);
+
+    const QBluetoothAddress m_localAdapter;
+    QThread * const m_thread;
+    HciManager *m_hciManager;
+    QThread *m_ioThread = nullptr;
+    LeBondStore *m_bondStore = nullptr;
+    QVector<QLowEnergyControllerPrivate *> m_writeSchedule;
+    QVector<int> m_advertisingHandles;
+    bool m_sendPosted = false;
+    bool m_sending = false;
+    int m_connectionCount = 0;
+    qint64 m_bytesSent = 0;
+    qint64 m_bytesReceived = 0;
+};
+
+QT_END_NAMESPACE
+
+#endif // LECONNECTIONMANAGER_P_H
@@ -0,0 +1,256 @@
+/****************************************************************************
+**
+** Copyright (C) 2017 The Qt Company Ltd.
+** Contact: https://www.qt.io/licensing/
+**
+** This file is part of the QtBluetooth module of the Qt Toolkit.
+**
+** $QT_BEGIN_LICENSE:LGPL$
+** Commercial License Usage
+** Licensees holding valid commercial Qt licenses may use this file in
+** accordance with the commercial license agreement provided with the
+** Software or, alternatively, in accordance with the terms contained in
+** a written agreement between you and The Qt Company. For licensing terms
+** and conditions see https://www.qt.io/terms-conditions. For further
+** information use the contact form at https://www.qt.io/contact-us.
+**
+** GNU Lesser General Public License Usage
+** Alternatively, this file may be used under the terms of the GNU Lesser
+** General Public License version 3 as published by the Free Software
+** Foundation and appearing in the file LICENSE.LGPL3 included in the
+** packaging of this file. Please review the following information to
+** ensure the GNU Lesser General Public License version 3 requirements
+** will be met: https://www.gnu.org/licenses/lgpl-3.0.html.
+**
+** GNU General Public License Usage
+** Alternatively, this file may be used under the terms of the GNU
+** General Public License version 2.0 or (at your option) the GNU General
+** Public license version 3 or any later version approved by the KDE Free
+** Qt Foundation. The licenses are as published by the Free Software
+** Foundation and appearing in the file LICENSE.GPL2 and LICENSE.GPL3
+** included in the packaging of this file. Please review the following
+** information to ensure the GNU General Public License requirements will
+** be met: https://www.gnu.org/licenses/gpl-2.0.html and
+** https://www.gnu.org/licenses/gpl-3.0.html.
+**
+** $QT_END_LICENSE$
+**
+****************************************************************************/
+
+#include "lerawscanner_p.h"
+#include "leconnectionmanager_p.h"
+
+#include <QtCore/QLoggingCategory>
+#include <QtCore/QVariant>
+
+QT_BEGIN_NAMESPACE
+
+Q_DECLARE_LOGGING_CATEGORY(QT_BT_BLUEZ)
+
+namespace {
+// Forget devices not heard of for this long once the table grows beyond
+// lastReportsLimit. Rotating random addresses would let it grow forever otherwise.
+const qint64 lastReportsExpiry = 60000;
+const int lastReportsLimit = 4096;
+
+quint16 scanTimeToUnits(int msecs)
+{
+    // Spec v4.2, Vol 2, Part E, 7.8.10: units of 0.625 ms from 2.5 ms to 10.24 s
+    return quint16(qBound(0x4, int(msecs / 0.625), 0x4000));
+}
+}
+
+LeRawScanner::LeRawScanner(const QBluetoothAddress &localAdapter, QObject *parent)
+    : QObject(parent),
+      m_connectionManager(LeConnectionManager::instance(localAdapter)),
+      m_hciManager(m_connectionManager->hciManager())
+{
+    connect(m_hciManager, &HciManager::advertisingReportsReceived,
+            this, &LeRawScanner::handleReports);
+    connect(m_hciManager, &HciManager::commandCompleted,
+            this, &LeRawScanner::handleCommandCompleted);
+}
+
+LeRawScanner::~LeRawScanner()
+{
+    stop();
+}
+
+bool LeRawScanner::isValid() const
+{
+    return m_hciManager->isValid();
+}
+
+void LeRawScanner::setDuplicateFilterInterval(int msecs)
+{
+    m_duplicateFilterInterval = qMax(-1, msecs);
+    m_lastReports.clear();
+}
+
+/*
+ * Configures the controller and enables scanning. The controller's own duplicate
+ * filter stays off, so that the reports reach us with current RSSI values.
+ */
+bool LeRawScanner::start()
+{
+    if (m_active)
+        return true;
+    if (!isValid() || !m_hciManager->monitorEvent(HciManager::CommandCompleteEvent))
+        return false;
+
+    const quint16 interval = scanTimeToUnits(m_interval);
+    const quint16 window = qMin(scanTimeToUnits(m_window), interval);
+    // The parameters cannot be changed while scanning.
+    if (m_hciManager->sendSetScanEnableCommand(false, false))
+        m_pendingCommands.append(DisableScanCommand);
+    if (!m_hciManager->sendSetScanParametersCommand(m_scanType == ActiveScan, interval, window))
+        return false;
+    m_pendingCommands.append(SetParametersCommand);
+    if (!m_hciManager->sendSetScanEnableCommand(true, false))
+        return false;
+    m_pendingCommands.append(EnableScanCommand);
+
+    m_lastReports.clear();
+    m_active = true;
+    return true;
+}
+
+void LeRawScanner::stop()
+{
+    if (!m_active)
+        return;
+    m_active = false;
+    if (m_hciManager->sendSetScanEnableCommand(false, false))
+        m_pendingCommands.append(DisableScanCommand);
+}
+
+#ifdef QT_BUILD_INTERNAL
+/*
+ * Marks the scanner as started as if start() had sent its commands. Lets autotests
+ * run a scanner without an adapter.
+ */
+void LeRawScanner::simulateStart()
+{
+    m_pendingCommands << DisableScanCommand << SetParametersCommand << EnableScanCommand;
+    m_lastReports.clear();
+    m_active = true;
+}
+#endif
+
+void LeRawScanner::handleCommandCompleted(quint16 opCode, quint8 status, const QByteArray &data)
+{
+    Q_UNUSED(data);
+    if (ogfFromOpCode(opCode) != OgfLinkControl)
+        return;
+    const quint16 ocf = ocfFromOpCode(opCode);
+    if (ocf != OcfLeSetScanParameters && ocf != OcfLeSetScanEnable)
+        return;
+    // Other processes can run scans on the adapter as well. Their commands complete
+    // after ours or, if they were sent before, while none of ours is pending.
+    if (m_pendingCommands.isEmpty())
+        return;
+    const ScanCommand command = m_pendingCommands.takeFirst();
+    if (status == 0 || !m_active)
+        return;
+
+    // "Command Disallowed" is harmless for disabling a scan that does not run.
+    // In all other cases, among them a controller that only accepts the extended
+    // scan commands, no reports will arrive.
+    if (status == 0xc && command == DisableScanCommand) {
+        qCDebug(QT_BT_BLUEZ) << "no scan to disable";
+        return;
+    }
+    qCWarning(QT_BT_BLUEZ) << "scan command" << ocf << "failed with status" << status;
+    m_active = false;
+    emit errorOccurred();
+}
+
+void LeRawScanner::handleReports(const QVector<HciManager::AdvertisingReport> &reports)
+{
+    if (!m_active)
+        return;
+    if (m_duplicateFilterInterval == 0) {
+        emit reportsReceived(reports);
+        return;
+    }
+
+    m_filteredReports.resize(0);
+    for (const HciManager::AdvertisingReport &report : reports) {
+        if (!isDuplicate(report))
+            m_filteredReports.append(report);
+    }
+    if (!m_filteredReports.isEmpty())
+        emit reportsReceived(m_filteredReports);
+}
+
+bool LeRawScanner::isDuplicate(const HciManager::AdvertisingReport &report)
+{
+    // Advertisements and scan responses of a device differ in type and payload.
+    const uint payloadHash = qHash(QByteArray::fromRawData(
+            reinterpret_cast<const char *>(report.data), report.dataLength), report.eventType);
+
+    if (m_lastReports.size() > lastReportsLimit
+            && report.timestamp - m_lastPruneTimestamp > lastReportsExpiry / 60) {
+        m_lastPruneTimestamp = report.timestamp;
+        for (auto it = m_lastReports.begin(); it != m_lastReports.end(); ) {
+            if (report.timestamp - it.value().timestamp > lastReportsExpiry)
+                it = m_lastReports.erase(it);
+            else
+                ++it;
+        }
+    }
+
+    const auto it = m_lastReports.find(report.address);
+    if (it == m_lastReports.end()) {
+        m_lastReports.insert(report.address, { payloadHash, report.timestamp });
+        return false;
+    }
+    LastReport &lastReport = it.value();
+    if (lastReport.payloadHash == payloadHash && (m_duplicateFilterInterval == -1
+            || report.timestamp - lastReport.timestamp < m_duplicateFilterInterval)) {
+        return true;
+    }
+    lastReport.payloadHash = payloadHash;
+    lastReport.timestamp = report.timestamp;
+    return false;
+}
+
+#ifdef QT_BUILD_INTERNAL
+// The scanners created here have no adapter. Autotests feed them canned HCI packets
+// and get the reports back as maps of plain values.
+Q_AUTOTEST_EXPORT QObject *qt_createLowEnergyRawScanner(int duplicateFilterInterval)
+{
+    LeRawScanner * const scanner = new LeRawScanner(QBluetoothAddress());
+    scanner->setDuplicateFilterInterval(duplicateFilterInterval);
+    scanner->simulateStart();
+    return scanner;
+}
+
+Q_AUTOTEST_EXPORT QVariantList qt_dispatchLowEnergyRawScannerPackets(
+        QObject *scanner, const QVector<QByteArray> &packets)
+{
+    LeRawScanner * const rawScanner = static_cast<LeRawScanner *>(scanner);
+    QVariantList result;
+    const QMetaObject::Connection connection = QObject::connect(rawScanner,
+            &LeRawScanner::reportsReceived,
+            [&result](const QVector<HciManager::AdvertisingReport> &reports) {
+        for (const HciManager::AdvertisingReport &report : reports) {
+            QVariantMap reportMap;
+            reportMap.insert(QStringLiteral("address"),
+                             QBluetoothAddress(report.address).toString());
+            reportMap.insert(QStringLiteral("addressType"), int(report.addressType));
+            reportMap.insert(QStringLiteral("eventType"), int(report.eventType));
+            reportMap.insert(QStringLiteral("rssi"), int(report.rssi));
+            reportMap.insert(QStringLiteral("data"), QByteArray(
+                    reinterpret_cast<const char *>(report.data), report.dataLength));
+            reportMap.insert(QStringLiteral("timestamp"), report.timestamp);
+            result.append(reportMap);
+        }
+    });
+    rawScanner->hciManager()->dispatchPackets(packets);
+    QObject::disconnect(connection);
+    return result;
+}
+#endif
+
+QT_END_NAMESPACE
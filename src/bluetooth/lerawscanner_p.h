@@ -0,0 +1,135 @@
+/****************************************************************************
+**
+** Copyright (C) 2017 The Qt Company Ltd.
+** Contact: https://www.qt.io/licensing/
+**
+** This file is part of the QtBluetooth module of the Qt Toolkit.
+**
+** $QT_BEGIN_LICENSE:LGPL$
+** Commercial License Usage
+** Licensees holding valid commercial Qt licenses may use this file in
+** accordance with the commercial license agreement provided with the
+** Software or, alternatively, in accordance with the terms contained in
+** a written agreement between you and The Qt Company. For licensing terms
+** and conditions see https://www.qt.io/terms-conditions. For further
+** information use the contact form at https://www.qt.io/contact-us.
+**
+** GNU Lesser General Public License Usage
+** Alternatively, this file may be used under the terms of the GNU Lesser
+** General Public License version 3 as published by the Free Software
+** Foundation and appearing in the file LICENSE.LGPL3 included in the
+** packaging of this file. Please review the following information to
+** ensure the GNU Lesser General Public License version 3 requirements
+** will be met: https://www.gnu.org/licenses/lgpl-3.0.html.
+**
+** GNU General Public License Usage
+** Alternatively, this file may be used under the terms of the GNU
+** General Public License version 2.0 or (at your option) the GNU General
+** Public license version 3 or any later version approved by the KDE Free
+** Qt Foundation. The licenses are as published by the Free Software
+** Foundation and appearing in the file LICENSE.GPL2 and LICENSE.GPL3
+** included in the packaging of this file. Please review the following
+** information to ensure the GNU General Public License requirements will
+** be met: https://www.gnu.org/licenses/gpl-2.0.html and
+** https://www.gnu.org/licenses/gpl-3.0.html.
+**
+** $QT_END_LICENSE$
+**
+****************************************************************************/
+
+#ifndef LERAWSCANNER_P_H
+#define LERAWSCANNER_P_H
+
+//
+//  W A R N I N G
+//  -------------
+//
+// This file is not part of the Qt API.  It exists purely as an
+// implementation detail.  This header file may change from version to
+// version without notice, or even be removed.
+//
+// We mean it.
+//
+
+#include "bluez/hcimanager_p.h"
+
+#include <QtBluetooth/QBluetoothAddress>
+#include <QtCore/QHash>
+#include <QtCore/QObject>
+#include <QtCore/QSharedPointer>
+#include <QtCore/QVector>
+
+QT_BEGIN_NAMESPACE
+
+class LeConnectionManager;
+
+/*
+ * Scans for LE advertisements directly on the HCI socket of an adapter, bypassing
+ * the BlueZ D-Bus API. Every advertising report is delivered with its raw AD
+ * payload, in batches of all reports read from the socket in one go. Duplicates
+ * are not filtered by the controller, but by the scanner, as configured with
+ * setDuplicateFilterInterval(). Requires the CAP_NET_RAW capability.
+ */
+class Q_AUTOTEST_EXPORT LeRawScanner : public QObject
+{
+    Q_OBJECT
+public:
+    enum ScanType { PassiveScan, ActiveScan };
+
+    explicit LeRawScanner(const QBluetoothAddress &localAdapter, QObject *parent = nullptr);
+    ~LeRawScanner();
+
+    bool isValid() const;
+    bool isActive() const { return m_active; }
+
+    // Take effect on the next start().
+    void setScanType(ScanType type) { m_scanType = type; }
+    void setScanInterval(int msecs) { m_interval = msecs; }
+    void setScanWindow(int msecs) { m_window = msecs; }
+
+    // 0 reports every advertisement, -1 reports each payload of a device once,
+    // otherwise identical reports of a device are suppressed for msecs.
+    void setDuplicateFilterInterval(int msecs);
+    int duplicateFilterInterval() const { return m_duplicateFilterInterval; }
+
+    bool start();
+    void stop();
+
+#ifdef QT_BUILD_INTERNAL
+    void simulateStart();
+    HciManager *hciManager() const { return m_hciManager; }
+#endif
+
+signals:
+    void reportsReceived(const QVector<HciManager::AdvertisingReport> &reports);
+    void errorOccurred();
+
+private:
+    void handleReports(const QVector<HciManager::AdvertisingReport> &reports);
+    void handleCommandCompleted(quint16 opCode, quint8 status, const QByteArray &data);
+    bool isDuplicate(const HciManager::AdvertisingReport &report);
+
+    // The scan commands sent and not completed yet, in the order they were sent.
+    enum ScanCommand { DisableScanCommand, SetParametersCommand, EnableScanCommand };
+
+    struct LastReport {
+        uint payloadHash;
+        qint64 timestamp;
+    };
+
+    QSharedPointer<LeConnectionManager> m_connectionManager;
+    HciManager *m_hciManager;
+    ScanType m_scanType = PassiveScan;
+    int m_interval = 100;
+    int m_window = 100;
+    int m_duplicateFilterInterval = 0;
+    bool m_active = false;
+    QVector<ScanCommand> m_pendingCommands;
+    QHash<quint64, LastReport> m_lastReports;
+    qint64 m_lastPruneTimestamp = 0;
+    QVector<HciManager::AdvertisingReport> m_filteredReports;
+};
+
+QT_END_NAMESPACE
+
+#endif // LERAWSCANNER_P_H
@@ -62,9 +62,36 @@ struct AdvParams {
     quint8 filterPolicy;
 } __attribute__ ((packed));
 
+struct ExtAdvParams {
+    quint8 handle;
+    quint16 eventProperties;
+    quint8 minInterval[3];
+    quint8 maxInterval[3];
+    quint8 channelMap;
+    quint8 ownAddrType;
+    quint8 peerAddrType;
+    bdaddr_t peerAddr;
+    quint8 filterPolicy;
+    qint8 txPower;
+    quint8 primaryPhy;
+    quint8 secondaryMaxSkip;
+    quint8 secondaryPhy;
+    quint8 sid;
+    quint8 scanRequestNotification;
+} __attribute__ ((packed));
+
+static const int LegacyAdvDataLength = 31;
+static const int MaxExtAdvDataLength = 1650;
+// The most advertising data a single extended advertising data command can carry.
+static const int MaxAdvDataFragmentLength = 251;
+
 struct AdvData {
-    quint8 length;
-    quint8 data[31];
+    int length;
+    int capacity; // LegacyAdvDataLength or the maximum reported by the controller
+    int powerLevelOffset; // -1 if the TX power level is not included
+    int manufacturerDataOffset; // -1 if there is no manufacturer specific data
+    bool isComplete; // false if some of the data did not fit
+    quint8 data[MaxExtAdvDataLength];
 };
 
 struct WhiteListParams {
@@ -81,40 +108,93 @@ template<typename T> QByteArray byteArrayFromStruct(const T &data, int maxSize =
 QLeAdvertiserBluez::QLeAdvertiserBluez(const QLowEnergyAdvertisingParameters &params,
                                        const QLowEnergyAdvertisingData &advertisingData,
                                        const QLowEnergyAdvertisingData &scanResponseData,
-                                       HciManager &hciManager, QObject *parent)
-    : QLeAdvertiser(params, advertisingData, scanResponseData, parent), m_hciManager(hciManager)
+                                       HciManager &hciManager, int advertisingHandle,
+                                       QObject *parent)
+    : QLeAdvertiser(params, advertisingData, scanResponseData, parent), m_hciManager(hciManager),
+      m_advertisingHandle(advertisingHandle),
+      m_compiledAdvData(new AdvData), m_compiledResponseData(new AdvData)
 {
     connect(&m_hciManager, &HciManager::commandCompleted, this,
             &QLeAdvertiserBluez::handleCommandCompleted);
+    connect(&m_hciManager, &HciManager::commandStatusReceived, this,
+            &QLeAdvertiserBluez::handleCommandStatus);
 }
 
 QLeAdvertiserBluez::~QLeAdvertiserBluez()
 {
     disconnect(&m_hciManager, &HciManager::commandCompleted, this,
                &QLeAdvertiserBluez::handleCommandCompleted);
-    doStopAdvertising();
+    disconnect(&m_hciManager, &HciManager::commandStatusReceived, this,
+               &QLeAdvertiserBluez::handleCommandStatus);
+
+    // Nobody is left to wait for the results, so the commands are sent right away.
+    // Advertising cannot have been enabled before the probe finished.
+    m_pendingCommands.clear();
+    if (m_commandSet == UndecidedCommandSet || m_commandSet == ProbingCommandSet)
+        return;
+    toggleAdvertising(false);
+    if (m_commandSet == ExtendedCommandSet)
+        removeAdvertisingSet();
+    foreach (const Command &c, m_pendingCommands)
+        m_hciManager.sendCommand(OgfLinkControl, c.ocf, c.data);
+}
+
+// ADV_DIRECT_IND with high and low duty cycle, Spec v4.2, Vol 2, Part E, 7.8.5
+static bool isDirectedMode(QLowEnergyAdvertisingParameters::Mode mode)
+{
+    return mode == 0x1 || mode == 0x4;
 }
 
 void QLeAdvertiserBluez::doStartAdvertising()
 {
-    if (!m_hciManager.monitorEvent(HciManager::CommandCompleteEvent)) {
+    if (!m_hciManager.monitorEvent(HciManager::CommandCompleteEvent)
+            || !m_hciManager.monitorEvent(HciManager::CommandStatusEvent)) {
+        handleError();
+        return;
+    }
+    if (isDirectedMode(parameters().mode())) {
+        // the parameters cannot hold the address of the peer these modes require
+        qCWarning(QT_BT_BLUEZ) << "directed advertising is not supported";
         handleError();
         return;
     }
 
+    m_advertisingRequested = true;
     m_disableCommandFinished = false;
-    m_sendPowerLevel = advertisingData().includePowerLevel()
+    const bool sendPowerLevel = advertisingData().includePowerLevel()
             || scanResponseData().includePowerLevel();
-    if (m_sendPowerLevel)
-        queueReadTxPowerLevelCommand();
-    else
-        queueAdvertisingCommands();
-    sendNextCommand();
+    if (sendPowerLevel != m_sendPowerLevel)
+        m_dataCompiled = false; // The TX power level field comes and goes with it.
+    m_sendPowerLevel = sendPowerLevel;
+    const bool idle = m_pendingCommands.isEmpty();
+    if (m_commandSet == UndecidedCommandSet) {
+        if (needsExtendedAdvertising()) {
+            // Spec v5.0, Vol 2, Part E, 7.8.57. Only controllers supporting extended
+            // advertising know this command, which makes it the probe for that feature.
+            m_commandSet = ProbingCommandSet;
+            queueCommand(OcfLeReadMaxAdvDataLength, QByteArray());
+        } else {
+            m_commandSet = LegacyCommandSet;
+            queueStartCommands();
+        }
+    } else if (m_commandSet != ProbingCommandSet) {
+        queueStartCommands(); // Otherwise started once the probe has finished.
+    }
+    if (idle)
+        sendNextCommand();
 }
 
 void QLeAdvertiserBluez::doStopAdvertising()
 {
+    m_advertisingRequested = false;
+    if (m_commandSet == UndecidedCommandSet || m_commandSet == ProbingCommandSet)
+        return; // Nothing has been enabled yet.
+    const bool idle = m_pendingCommands.isEmpty();
     toggleAdvertising(false);
+    if (m_commandSet == ExtendedCommandSet)
+        removeAdvertisingSet();
+    if (idle)
+        sendNextCommand();
 }
 
 void QLeAdvertiserBluez::queueCommand(OpCodeCommandField ocf, const QByteArray &data)
@@ -135,8 +215,184 @@ void QLeAdvertiserBluez::sendNextCommand()
     }
 }
 
+bool QLeAdvertiserBluez::doUpdateData(const QLowEnergyAdvertisingData &advData,
+                                      const QLowEnergyAdvertisingData &responseData)
+{
+    const bool advDataChanged = advData != advertisingData();
+    const bool responseDataChanged = responseData != scanResponseData();
+    if (!advDataChanged && !responseDataChanged)
+        return true;
+    if (!m_dataCompiled) {
+        // The data gets compiled once the capabilities of the adapter are known.
+        replaceData(advData, responseData);
+        return true;
+    }
+    if ((advData.includePowerLevel() || responseData.includePowerLevel())
+            != (advertisingData().includePowerLevel() || scanResponseData().includePowerLevel())) {
+        // The TX power level has to be read first, so advertising starts over.
+        replaceData(advData, responseData);
+        m_dataCompiled = false;
+        if (m_advertisingRequested)
+            doStartAdvertising();
+        return true;
+    }
+
+    // Typically, only the manufacturer data of a beacon changes. In that case,
+    // the new bytes simply overwrite the old ones in the compiled data.
+    const auto canUpdateInPlace = [](const QLowEnergyAdvertisingData &oldData,
+            const QLowEnergyAdvertisingData &newData, const AdvData &compiledData) {
+        if (compiledData.manufacturerDataOffset == -1
+                || newData.manufacturerId() != oldData.manufacturerId()
+                || newData.manufacturerData().count() != oldData.manufacturerData().count()) {
+            return false;
+        }
+        QLowEnergyAdvertisingData otherData = newData;
+        otherData.setManufacturerData(oldData.manufacturerId(), oldData.manufacturerData());
+        return otherData == oldData;
+    };
+    const auto updateInPlace = [](const QLowEnergyAdvertisingData &newData,
+            AdvData &compiledData) {
+        std::memcpy(compiledData.data + compiledData.manufacturerDataOffset,
+                    newData.manufacturerData().constData(), newData.manufacturerData().count());
+    };
+
+    if ((!advDataChanged || canUpdateInPlace(advertisingData(), advData, *m_compiledAdvData))
+            && (!responseDataChanged
+                || canUpdateInPlace(scanResponseData(), responseData, *m_compiledResponseData))) {
+        if (advDataChanged)
+            updateInPlace(advData, *m_compiledAdvData);
+        if (responseDataChanged)
+            updateInPlace(responseData, *m_compiledResponseData);
+        replaceData(advData, responseData);
+    } else {
+        // The data currently being advertised stays untouched unless the new data fits.
+        const QLowEnergyAdvertisingData oldAdvData = advertisingData();
+        const QLowEnergyAdvertisingData oldResponseData = scanResponseData();
+        replaceData(advData, responseData);
+        AdvData newAdvData;
+        AdvData newResponseData;
+        newAdvData.capacity = newResponseData.capacity = m_compiledAdvData->capacity;
+        buildData(false, newAdvData);
+        buildData(true, newResponseData);
+        if (!newAdvData.isComplete || !newResponseData.isComplete) {
+            qCWarning(QT_BT_BLUEZ) << "new advertising data does not fit into the advertising "
+                                      "packets, keeping the old data";
+            replaceData(oldAdvData, oldResponseData);
+            return false;
+        }
+        *m_compiledAdvData = newAdvData;
+        *m_compiledResponseData = newResponseData;
+    }
+
+    if (!m_advertisingRequested)
+        return true; // Sent when advertising is started again.
+    const bool idle = m_pendingCommands.isEmpty();
+    queueDataUpdateCommands(advDataChanged, responseDataChanged);
+    if (idle)
+        sendNextCommand();
+    return true;
+}
+
+/*
+ * Queues the commands that replace the data of the running advertisement. Unless the
+ * kind of advertising packets has to change, advertising is not restarted.
+ */
+void QLeAdvertiserBluez::queueDataUpdateCommands(bool advDataChanged, bool responseDataChanged)
+{
+    if (m_commandSet != ExtendedCommandSet) {
+        // Spec v4.2, Vol 2, Part E, 7.8.7-8. Both are permitted while advertising.
+        if (advDataChanged)
+            setAdvertisingData();
+        if (responseDataChanged)
+            setScanResponseData();
+        return;
+    }
+
+    if (fitsIntoLegacyPdus() != m_useLegacyPdus) {
+        queueExtendedAdvertisingCommands(); // The event properties have to change.
+        return;
+    }
+
+    // Spec v5.0, Vol 2, Part E, 7.8.54. While advertising, the data can only be
+    // replaced in one piece.
+    const bool needsFragments = m_compiledAdvData->length > MaxAdvDataFragmentLength
+            || m_compiledResponseData->length > MaxAdvDataFragmentLength;
+    if (needsFragments)
+        toggleAdvertising(false);
+    queueExtendedDataCommands();
+    if (needsFragments)
+        toggleAdvertising(true);
+}
+
+/*
+ * Serializes the advertising and the scan response data into the AD structures
+ * sent to the controller. Starting again reuses the result, and so does updating
+ * the manufacturer data.
+ */
+void QLeAdvertiserBluez::compileData()
+{
+    const int capacity = m_commandSet == ExtendedCommandSet
+            ? m_maxDataLength : LegacyAdvDataLength;
+    m_compiledAdvData->capacity = m_compiledResponseData->capacity = capacity;
+    buildData(false, *m_compiledAdvData);
+    buildData(true, *m_compiledResponseData);
+    m_dataCompiled = true;
+}
+
+void QLeAdvertiserBluez::updatePowerLevel()
+{
+    if (m_compiledAdvData->powerLevelOffset != -1)
+        m_compiledAdvData->data[m_compiledAdvData->powerLevelOffset] = m_powerLevel;
+    if (m_compiledResponseData->powerLevelOffset != -1)
+        m_compiledResponseData->data[m_compiledResponseData->powerLevelOffset] = m_powerLevel;
+}
+
+/*
+ * Returns whether the parameters or the data call for Bluetooth 5 extended advertising.
+ * Everything else is left to the legacy commands, which all adapters understand.
+ */
+bool QLeAdvertiserBluez::needsExtendedAdvertising()
+{
+    if (parameters().primaryPhy() != QLowEnergyAdvertisingParameters::Phy1M
+            || parameters().secondaryPhy() != QLowEnergyAdvertisingParameters::Phy1M) {
+        return true;
+    }
+    AdvData legacyData;
+    legacyData.capacity = LegacyAdvDataLength;
+    buildData(false, legacyData);
+    if (!legacyData.isComplete)
+        return true;
+    buildData(true, legacyData);
+    return !legacyData.isComplete;
+}
+
+bool QLeAdvertiserBluez::fitsIntoLegacyPdus() const
+{
+    return parameters().primaryPhy() == QLowEnergyAdvertisingParameters::Phy1M
+            && parameters().secondaryPhy() == QLowEnergyAdvertisingParameters::Phy1M
+            && m_compiledAdvData->length <= LegacyAdvDataLength
+            && m_compiledResponseData->length <= LegacyAdvDataLength;
+}
+
+void QLeAdvertiserBluez::queueStartCommands()
+{
+    if (!m_dataCompiled)
+        compileData();
+    if (m_commandSet == ExtendedCommandSet)
+        queueExtendedAdvertisingCommands();
+    else if (m_sendPowerLevel)
+        queueReadTxPowerLevelCommand();
+    else
+        queueAdvertisingCommands();
+}
+
 void QLeAdvertiserBluez::queueAdvertisingCommands()
 {
+    if (parameters().primaryPhy() != QLowEnergyAdvertisingParameters::Phy1M
+            || parameters().secondaryPhy() != QLowEnergyAdvertisingParameters::Phy1M) {
+        qCWarning(QT_BT_BLUEZ) << "the adapter does not support extended advertising, "
+                                  "advertising on the LE 1M PHY";
+    }
     toggleAdvertising(false); // Stop advertising first, in case it's currently active.
     setWhiteList();
     setAdvertisingParams();
@@ -153,6 +409,16 @@ void QLeAdvertiserBluez::queueReadTxPowerLevelCommand()
 
 void QLeAdvertiserBluez::toggleAdvertising(bool enable)
 {
+    if (m_commandSet == ExtendedCommandSet) {
+        // Spec v5.0, Vol 2, Part E, 7.8.56. One set, no duration and no event limit.
+        QByteArray commandData(6, 0);
+        commandData[0] = enable;
+        commandData[1] = 1;
+        commandData[2] = m_advertisingHandle;
+        queueCommand(OcfLeSetExtAdvEnable, commandData);
+        return;
+    }
+
     // Spec v4.2, Vol 2, Part E, 7.8.9
     queueCommand(OcfLeSetAdvEnable, QByteArray(1, enable));
 }
@@ -166,19 +432,8 @@ void QLeAdvertiserBluez::setAdvertisingParams()
     memset(&params, 0, sizeof params);
     setAdvertisingInterval(params);
     params.type = parameters().mode();
-    params.filterPolicy = parameters().filterPolicy();
-    if (params.filterPolicy != QLowEnergyAdvertisingParameters::IgnoreWhiteList
-            && advertisingData().discoverability() == QLowEnergyAdvertisingData::DiscoverabilityLimited) {
-        qCWarning(QT_BT_BLUEZ) << "limited discoverability is incompatible with "
-                                  "using a white list; disabling filtering";
-        params.filterPolicy = QLowEnergyAdvertisingParameters::IgnoreWhiteList;
-    }
-    params.ownAddrType = QLowEnergyController::PublicAddress; // TODO: Make configurable.
-
-    // TODO: For ADV_DIRECT_IND.
-    // params.directAddrType = xxx;
-    // params.direct_bdaddr = xxx;
-
+    params.filterPolicy = filterPolicy();
+    advertisingAddresses(&params.ownAddrType, &params.directAddrType, &params.directAddr);
     params.channelMap = 0x7; // All channels.
 
     const QByteArray paramsData = byteArrayFromStruct(params);
@@ -186,12 +441,36 @@ void QLeAdvertiserBluez::setAdvertisingParams()
     queueCommand(OcfLeSetAdvParams, paramsData);
 }
 
+quint8 QLeAdvertiserBluez::filterPolicy() const
+{
+    if (parameters().filterPolicy() != QLowEnergyAdvertisingParameters::IgnoreWhiteList
+            && advertisingData().discoverability() == QLowEnergyAdvertisingData::DiscoverabilityLimited) {
+        qCWarning(QT_BT_BLUEZ) << "limited discoverability is incompatible with "
+                                  "using a white list; disabling filtering";
+        return QLowEnergyAdvertisingParameters::IgnoreWhiteList;
+    }
+    return parameters().filterPolicy();
+}
+
+/*
+ * The same for legacy and extended advertising. Directed advertising is rejected by
+ * doStartAdvertising(), so there is no peer address to fill in.
+ */
+void QLeAdvertiserBluez::advertisingAddresses(quint8 *ownAddrType, quint8 *peerAddrType,
+                                              bdaddr_t *peerAddr) const
+{
+    *ownAddrType = QLowEnergyController::PublicAddress; // TODO: Make configurable.
+    *peerAddrType = QLowEnergyController::PublicAddress;
+    using namespace std;
+    memset(peerAddr, 0, sizeof *peerAddr);
+}
+
 static quint16 forceIntoRange(quint16 val, quint16 min, quint16 max)
 {
     return qMin(qMax(val, min), max);
 }
 
-void QLeAdvertiserBluez::setAdvertisingInterval(AdvParams &params)
+void QLeAdvertiserBluez::advertisingInterval(quint16 *minimum, quint16 *maximum) const
 {
     const double multiplier = 0.625;
     const quint16 minVal = parameters().minimumInterval() / multiplier;
@@ -201,9 +480,18 @@ void QLeAdvertiserBluez::setAdvertisingInterval(AdvParams &params)
             parameters().mode() == QLowEnergyAdvertisingParameters::AdvScanInd
             || parameters().mode() == QLowEnergyAdvertisingParameters::AdvNonConnInd ? 0xa0 : 0x20;
     const quint16 specMaximum = 0x4000;
-    params.minInterval = qToLittleEndian(forceIntoRange(minVal, specMinimum, specMaximum));
-    params.maxInterval = qToLittleEndian(forceIntoRange(maxVal, specMinimum, specMaximum));
-    Q_ASSERT(params.minInterval <= params.maxInterval);
+    *minimum = forceIntoRange(minVal, specMinimum, specMaximum);
+    *maximum = forceIntoRange(maxVal, specMinimum, specMaximum);
+    Q_ASSERT(*minimum <= *maximum);
+}
+
+void QLeAdvertiserBluez::setAdvertisingInterval(AdvParams &params)
+{
+    quint16 minimum;
+    quint16 maximum;
+    advertisingInterval(&minimum, &maximum);
+    params.minInterval = qToLittleEndian(minimum);
+    params.maxInterval = qToLittleEndian(maximum);
 }
 
 void QLeAdvertiserBluez::setPowerLevel(AdvData &advData)
@@ -211,6 +499,7 @@ void QLeAdvertiserBluez::setPowerLevel(AdvData &advData)
     if (m_sendPowerLevel) {
         advData.data[advData.length++] = 2;
         advData.data[advData.length++]= 0xa;
+        advData.powerLevelOffset = advData.length;
         advData.data[advData.length++] = m_powerLevel;
     }
 }
@@ -249,14 +538,16 @@ template<typename T> static void addServicesData(AdvData &data, const QVector<T>
 {
     if (services.isEmpty())
         return;
-    const int spaceAvailable = sizeof data.data - data.length;
+    const int spaceAvailable = data.capacity - data.length;
     const int maxServices = qMin<int>((spaceAvailable - 2) / sizeof(T), services.count());
     if (maxServices <= 0) {
         qCWarning(QT_BT_BLUEZ) << "services data does not fit into advertising data packet";
+        data.isComplete = false;
         return;
     }
     const bool dataComplete = maxServices == services.count();
     if (!dataComplete) {
+        data.isComplete = false;
         qCWarning(QT_BT_BLUEZ) << "only" << maxServices << "out of" << services.count()
                                << "services fit into the advertising data";
     }
@@ -302,8 +593,9 @@ void QLeAdvertiserBluez::setManufacturerData(const QLowEnergyAdvertisingData &sr
 {
     if (src.manufacturerId() == QLowEnergyAdvertisingData::invalidManufacturerId())
         return;
-    if (dest.length >= sizeof dest.data - 1 - 1 - 2 - src.manufacturerData().count()) {
+    if (dest.length + 1 + 1 + 2 + src.manufacturerData().count() > dest.capacity) {
         qCWarning(QT_BT_BLUEZ) << "manufacturer data does not fit into advertising data packet";
+        dest.isComplete = false;
         return;
     }
 
@@ -311,6 +603,7 @@ void QLeAdvertiserBluez::setManufacturerData(const QLowEnergyAdvertisingData &sr
     dest.data[dest.length++] = 0xff;
     putBtData(src.manufacturerId(), dest.data + dest.length);
     dest.length += sizeof(quint16);
+    dest.manufacturerDataOffset = dest.length;
     std::memcpy(dest.data + dest.length, src.manufacturerData(), src.manufacturerData().count());
     dest.length += src.manufacturerData().count();
 }
@@ -319,15 +612,18 @@ void QLeAdvertiserBluez::setLocalNameData(const QLowEnergyAdvertisingData &src,
 {
     if (src.localName().isEmpty())
         return;
-    if (dest.length >= sizeof dest.data - 3) {
+    if (dest.length >= dest.capacity - 3) {
         qCWarning(QT_BT_BLUEZ) << "local name does not fit into advertising data";
+        dest.isComplete = false;
         return;
     }
 
     const QByteArray localNameUtf8 = src.localName().toUtf8();
     const int fullSize = localNameUtf8.count() + 1 + 1;
-    const int size = qMin<int>(fullSize, sizeof dest.data - dest.length);
+    const int size = qMin(fullSize, dest.capacity - dest.length);
     const bool isComplete = size == fullSize;
+    if (!isComplete)
+        dest.isComplete = false;
     dest.data[dest.length++] = size - 1;
     const int dataType = isComplete ? 0x9 : 0x8;
     dest.data[dest.length++] = dataType;
@@ -335,34 +631,47 @@ void QLeAdvertiserBluez::setLocalNameData(const QLowEnergyAdvertisingData &src,
     dest.length += size - 2;
 }
 
-void QLeAdvertiserBluez::setData(bool isScanResponseData)
+/*
+ * Fills \a dest with as much of the advertising or scan response data as fits
+ * into its capacity.
+ */
+void QLeAdvertiserBluez::buildData(bool isScanResponseData, AdvData &dest)
 {
     // Spec v4.2, Vol 3, Part C, 11 and Supplement, Part 1
-    AdvData theData;
-    static_assert(sizeof theData == 32, "unexpected struct size");
-    theData.length = 0;
+    dest.length = 0;
+    dest.powerLevelOffset = -1;
+    dest.manufacturerDataOffset = -1;
+    dest.isComplete = true;
 
     const QLowEnergyAdvertisingData &sourceData = isScanResponseData
             ? scanResponseData() : advertisingData();
 
     if (!sourceData.rawData().isEmpty()) {
-        theData.length = qMin<int>(sizeof theData.data, sourceData.rawData().count());
-        std::memcpy(theData.data, sourceData.rawData().constData(), theData.length);
+        dest.isComplete = sourceData.rawData().count() <= dest.capacity;
+        dest.length = qMin(dest.capacity, sourceData.rawData().count());
+        std::memcpy(dest.data, sourceData.rawData().constData(), dest.length);
     } else {
         if (sourceData.includePowerLevel())
-            setPowerLevel(theData);
+            setPowerLevel(dest);
         if (!isScanResponseData)
-            setFlags(theData);
+            setFlags(dest);
 
         // Insert new constant-length data here.
 
-        setLocalNameData(sourceData, theData);
-        setServicesData(sourceData, theData);
-        setManufacturerData(sourceData, theData);
+        setLocalNameData(sourceData, dest);
+        setServicesData(sourceData, dest);
+        setManufacturerData(sourceData, dest);
     }
+}
 
-    std::memset(theData.data + theData.length, 0, sizeof theData.data - theData.length);
-    const QByteArray dataToSend = byteArrayFromStruct(theData);
+void QLeAdvertiserBluez::setData(bool isScanResponseData)
+{
+    const AdvData &theData = isScanResponseData ? *m_compiledResponseData : *m_compiledAdvData;
+
+    // The data is always sent in full length, padded with zeros.
+    QByteArray dataToSend(1 + LegacyAdvDataLength, 0);
+    dataToSend[0] = theData.length;
+    std::memcpy(dataToSend.data() + 1, theData.data, theData.length);
 
     if (!isScanResponseData) {
         qCDebug(QT_BT_BLUEZ) << "advertising data:" << dataToSend.toHex();
@@ -402,6 +711,130 @@ void QLeAdvertiserBluez::setWhiteList()
     }
 }
 
+static void putLe24(quint32 value, quint8 *dest)
+{
+    dest[0] = value & 0xff;
+    dest[1] = (value >> 8) & 0xff;
+    dest[2] = (value >> 16) & 0xff;
+}
+
+void QLeAdvertiserBluez::queueExtendedAdvertisingCommands()
+{
+    // Legacy packets are understood by all scanners, so they are used whenever possible.
+    // The data is sent once the controller has reported the TX power it selected.
+    m_useLegacyPdus = fitsIntoLegacyPdus();
+
+    toggleAdvertising(false); // Stop advertising first, in case it's currently active.
+    setWhiteList();
+    setExtendedAdvertisingParams();
+}
+
+void QLeAdvertiserBluez::setExtendedAdvertisingParams()
+{
+    // Spec v5.0, Vol 2, Part E, 7.8.53
+    ExtAdvParams params;
+    static_assert(sizeof params == 25, "unexpected struct size");
+    using namespace std;
+    memset(&params, 0, sizeof params);
+    params.handle = m_advertisingHandle;
+
+    quint16 properties = 0;
+    switch (parameters().mode()) {
+    case QLowEnergyAdvertisingParameters::AdvInd:
+        properties = 0x1; // Connectable. Extended advertising cannot be scannable at the same time.
+        if (m_useLegacyPdus)
+            properties |= 0x2;
+        break;
+    case QLowEnergyAdvertisingParameters::AdvScanInd:
+        properties = 0x2; // Scannable.
+        break;
+    case QLowEnergyAdvertisingParameters::AdvNonConnInd:
+        break;
+    }
+    if (m_useLegacyPdus)
+        properties |= 0x10;
+    params.eventProperties = qToLittleEndian(properties);
+
+    quint16 minInterval;
+    quint16 maxInterval;
+    advertisingInterval(&minInterval, &maxInterval);
+    putLe24(minInterval, params.minInterval);
+    putLe24(maxInterval, params.maxInterval);
+    params.channelMap = 0x7; // All channels.
+    advertisingAddresses(&params.ownAddrType, &params.peerAddrType, &params.peerAddr);
+    params.filterPolicy = filterPolicy();
+    params.txPower = 0x7f; // No preference.
+    params.primaryPhy = parameters().primaryPhy();
+    params.secondaryPhy = parameters().secondaryPhy();
+    params.sid = m_advertisingHandle & 0xf;
+
+    const QByteArray paramsData = byteArrayFromStruct(params);
+    qCDebug(QT_BT_BLUEZ) << "extended advertising parameters:" << paramsData.toHex();
+    queueCommand(OcfLeSetExtAdvParams, paramsData);
+}
+
+void QLeAdvertiserBluez::queueExtendedDataCommands()
+{
+    const QLowEnergyAdvertisingParameters::Mode mode = parameters().mode();
+
+    if (!m_useLegacyPdus && mode == QLowEnergyAdvertisingParameters::AdvScanInd) {
+        // Scannable extended advertising has no advertising data, only a scan response,
+        // so the advertising data takes its place if there is no scan response data.
+        const AdvData &theData = m_compiledResponseData->length > 0
+                ? *m_compiledResponseData : *m_compiledAdvData;
+        if (m_compiledResponseData->length > 0)
+            qCDebug(QT_BT_BLUEZ) << "advertising data is left out of scannable extended advertising";
+        qCDebug(QT_BT_BLUEZ) << "extended scan response data length:" << theData.length;
+        setExtendedData(OcfLeSetExtScanResponseData, theData);
+        return;
+    }
+
+    qCDebug(QT_BT_BLUEZ) << "extended advertising data length:" << m_compiledAdvData->length;
+    setExtendedData(OcfLeSetExtAdvData, *m_compiledAdvData);
+
+    if (mode == QLowEnergyAdvertisingParameters::AdvNonConnInd
+            || m_compiledResponseData->length == 0) {
+        return;
+    }
+    if (m_useLegacyPdus) {
+        qCDebug(QT_BT_BLUEZ) << "extended scan response data length:"
+                             << m_compiledResponseData->length;
+        setExtendedData(OcfLeSetExtScanResponseData, *m_compiledResponseData);
+    } else {
+        qCWarning(QT_BT_BLUEZ) << "connectable extended advertising cannot be scanned; "
+                                  "leaving out the scan response data";
+    }
+}
+
+/*
+ * Queues the commands that hand \a data to the controller in fragments that
+ * fit into one command each.
+ */
+void QLeAdvertiserBluez::setExtendedData(OpCodeCommandField ocf, const AdvData &data)
+{
+    // Spec v5.0, Vol 2, Part E, 7.8.54-55
+    int offset = 0;
+    do {
+        const int fragmentLength = qMin(data.length - offset, MaxAdvDataFragmentLength);
+        const bool isFirst = offset == 0;
+        const bool isLast = offset + fragmentLength == data.length;
+        QByteArray commandData(4 + fragmentLength, Qt::Uninitialized);
+        commandData[0] = m_advertisingHandle;
+        commandData[1] = isFirst && isLast ? 0x3 : isFirst ? 0x1 : isLast ? 0x2 : 0x0;
+        commandData[2] = 0x1; // The controller should not fragment the data any further.
+        commandData[3] = fragmentLength;
+        std::memcpy(commandData.data() + 4, data.data + offset, fragmentLength);
+        queueCommand(ocf, commandData);
+        offset += fragmentLength;
+    } while (offset < data.length);
+}
+
+void QLeAdvertiserBluez::removeAdvertisingSet()
+{
+    // Spec v5.0, Vol 2, Part E, 7.8.59
+    queueCommand(OcfLeRemoveAdvSet, QByteArray(1, char(m_advertisingHandle)));
+}
+
 void QLeAdvertiserBluez::handleCommandCompleted(quint16 opCode, quint8 status,
                                                 const QByteArray &data)
 {
@@ -413,13 +846,21 @@ void QLeAdvertiserBluez::handleCommandCompleted(quint16 opCode, quint8 status,
     m_pendingCommands.takeFirst();
     if (status != 0) {
         qCDebug(QT_BT_BLUEZ) << "command" << ocf << "failed with status" << status;
-        if (ocf == OcfLeSetAdvEnable && !m_disableCommandFinished && status == 0xc) {
+        // 0x42 means that the advertising set does not exist yet.
+        if ((ocf == OcfLeSetAdvEnable || ocf == OcfLeSetExtAdvEnable)
+                && !m_disableCommandFinished && (status == 0xc || status == 0x42)) {
             qCDebug(QT_BT_BLUEZ) << "initial advertising disable failed, ignoring";
             m_disableCommandFinished = true;
             sendNextCommand();
             return;
         }
-        if (ocf == OcfLeReadTxPowerLevel) {
+        if (ocf == OcfLeReadMaxAdvDataLength) {
+            qCDebug(QT_BT_BLUEZ) << "extended advertising is not supported, "
+                                    "using legacy advertising";
+            m_commandSet = LegacyCommandSet;
+        } else if (ocf == OcfLeRemoveAdvSet) {
+            qCDebug(QT_BT_BLUEZ) << "removing the advertising set failed, ignoring";
+        } else if (ocf == OcfLeReadTxPowerLevel) {
             qCDebug(QT_BT_BLUEZ) << "reading power level failed, leaving it out of the "
                                     "advertising data";
             m_sendPowerLevel = false;
@@ -432,14 +873,43 @@ void QLeAdvertiserBluez::handleCommandCompleted(quint16 opCode, quint8 status,
     }
 
     switch (ocf) {
+    case OcfLeReadMaxAdvDataLength:
+        if (status == 0 && data.count() >= 2) {
+            m_commandSet = ExtendedCommandSet;
+            m_maxDataLength = qBound<int>(LegacyAdvDataLength, bt_get_le16(data.constData()),
+                                          MaxExtAdvDataLength);
+            qCDebug(QT_BT_BLUEZ) << "using extended advertising, maximum data length is"
+                                 << m_maxDataLength;
+        } else {
+            m_commandSet = LegacyCommandSet;
+        }
+        if (m_advertisingRequested)
+            queueStartCommands();
+        break;
+    case OcfLeSetExtAdvParams:
+        if (m_sendPowerLevel && !data.isEmpty()) {
+            m_powerLevel = data.at(0); // The TX power the controller selected.
+            qCDebug(QT_BT_BLUEZ) << "TX power level is" << m_powerLevel;
+            updatePowerLevel();
+        }
+        if (m_advertisingRequested) {
+            queueExtendedDataCommands();
+            toggleAdvertising(true);
+        }
+        break;
     case OcfLeReadTxPowerLevel:
         if (m_sendPowerLevel) {
             m_powerLevel = data.at(0);
             qCDebug(QT_BT_BLUEZ) << "TX power level is" << m_powerLevel;
+            updatePowerLevel();
+        } else {
+            compileData(); // Leaves out the TX power level.
         }
-        queueAdvertisingCommands();
+        if (m_advertisingRequested)
+            queueAdvertisingCommands();
         break;
     case OcfLeSetAdvEnable:
+    case OcfLeSetExtAdvEnable:
         if (!m_disableCommandFinished)
             m_disableCommandFinished = true;
         break;
@@ -450,6 +920,17 @@ void QLeAdvertiserBluez::handleCommandCompleted(quint16 opCode, quint8 status,
     sendNextCommand();
 }
 
+/*
+ * Controllers may reject a command with a Command Status event instead of a
+ * Command Complete event, in particular a command they do not know, like the
+ * probe for extended advertising.
+ */
+void QLeAdvertiserBluez::handleCommandStatus(quint16 opCode, quint8 status)
+{
+    if (status != 0)
+        handleCommandCompleted(opCode, status, QByteArray());
+}
+
 void QLeAdvertiserBluez::handleError()
 {
     m_pendingCommands.clear();
@@ -457,4 +938,49 @@ void QLeAdvertiserBluez::handleError()
     emit errorOccurred();
 }
 
+#ifdef QT_BUILD_INTERNAL
+QByteArray QLeAdvertiserBluez::compiledData(bool isScanResponseData, int *powerLevelOffset,
+                                            int *manufacturerDataOffset)
+{
+    if (!m_dataCompiled) {
+        m_sendPowerLevel = advertisingData().includePowerLevel()
+                || scanResponseData().includePowerLevel();
+        compileData();
+    }
+    const AdvData &theData = isScanResponseData ? *m_compiledResponseData : *m_compiledAdvData;
+    *powerLevelOffset = theData.powerLevelOffset;
+    *manufacturerDataOffset = theData.manufacturerDataOffset;
+    return QByteArray(reinterpret_cast<const char *>(theData.data), theData.length);
+}
+
+// The advertisers created here have no adapter and are never started, they let
+// autotests check how the data is compiled and updated.
+Q_AUTOTEST_EXPORT QObject *qt_createLowEnergyAdvertiser(
+        const QLowEnergyAdvertisingParameters &params,
+        const QLowEnergyAdvertisingData &advertisingData,
+        const QLowEnergyAdvertisingData &scanResponseData)
+{
+    HciManager * const hciManager = new HciManager(QBluetoothAddress());
+    QLeAdvertiserBluez * const advertiser = new QLeAdvertiserBluez(params, advertisingData,
+            scanResponseData, *hciManager, 0);
+    hciManager->setParent(advertiser); // outlives the advertiser's destructor
+    return advertiser;
+}
+
+Q_AUTOTEST_EXPORT QByteArray qt_lowEnergyAdvertiserData(QObject *advertiser,
+        bool isScanResponseData, int *powerLevelOffset, int *manufacturerDataOffset)
+{
+    return static_cast<QLeAdvertiserBluez *>(advertiser)->compiledData(isScanResponseData,
+            powerLevelOffset, manufacturerDataOffset);
+}
+
+Q_AUTOTEST_EXPORT bool qt_updateLowEnergyAdvertiserData(QObject *advertiser,
+        const QLowEnergyAdvertisingData &advertisingData,
+        const QLowEnergyAdvertisingData &scanResponseData)
+{
+    return static_cast<QLeAdvertiser *>(advertiser)->updateData(advertisingData,
+                                                                scanResponseData);
+}
+#endif
+
 QT_END_NAMESPACE
@@ -59,6 +59,7 @@
 #endif
 
 #include <QtCore/qobject.h>
+#include <QtCore/qscopedpointer.h>
 #include <QtCore/qvector.h>
 
 QT_BEGIN_NAMESPACE
@@ -69,6 +70,13 @@ class QLeAdvertiser : public QObject
 public:
     void startAdvertising() { doStartAdvertising(); }
     void stopAdvertising() { doStopAdvertising(); }
+    bool updateData(const QLowEnergyAdvertisingData &advData,
+                    const QLowEnergyAdvertisingData &responseData)
+    {
+        return doUpdateData(advData, responseData);
+    }
+
+    const QLowEnergyAdvertisingParameters &parameters() const { return m_params; }
 
 signals:
     void errorOccurred();
@@ -80,17 +88,24 @@ protected:
         : QObject(parent), m_params(params), m_advData(advData), m_responseData(responseData) {}
     virtual ~QLeAdvertiser() { }
 
-    const QLowEnergyAdvertisingParameters &parameters() const { return m_params; }
     const QLowEnergyAdvertisingData &advertisingData() const { return m_advData; }
     const QLowEnergyAdvertisingData &scanResponseData() const { return m_responseData; }
+    void replaceData(const QLowEnergyAdvertisingData &advData,
+                     const QLowEnergyAdvertisingData &responseData)
+    {
+        m_advData = advData;
+        m_responseData = responseData;
+    }
 
 private:
     virtual void doStartAdvertising() = 0;
     virtual void doStopAdvertising() = 0;
+    virtual bool doUpdateData(const QLowEnergyAdvertisingData &advData,
+                              const QLowEnergyAdvertisingData &responseData) = 0;
 
     const QLowEnergyAdvertisingParameters m_params;
-    const QLowEnergyAdvertisingData m_advData;
-    const QLowEnergyAdvertisingData m_responseData;
+    QLowEnergyAdvertisingData m_advData;
+    QLowEnergyAdvertisingData m_responseData;
 };
 
 
@@ -105,12 +120,26 @@ public:
     QLeAdvertiserBluez(const QLowEnergyAdvertisingParameters &params,
                        const QLowEnergyAdvertisingData &advertisingData,
                        const QLowEnergyAdvertisingData &scanResponseData, HciManager &hciManager,
-                       QObject *parent = nullptr);
+                       int advertisingHandle, QObject *parent = nullptr);
     ~QLeAdvertiserBluez();
 
+#ifdef QT_BUILD_INTERNAL
+    // the data as it would be sent by legacy advertising, for autotests
+    QByteArray compiledData(bool isScanResponseData, int *powerLevelOffset,
+                            int *manufacturerDataOffset);
+#endif
+
 private:
     void doStartAdvertising() override;
     void doStopAdvertising() override;
+    bool doUpdateData(const QLowEnergyAdvertisingData &advData,
+                      const QLowEnergyAdvertisingData &responseData) override;
+
+    void compileData();
+    void updatePowerLevel();
+    bool needsExtendedAdvertising();
+    bool fitsIntoLegacyPdus() const;
+    void queueDataUpdateCommands(bool advDataChanged, bool responseDataChanged);
 
     void setPowerLevel(AdvData &advData);
     void setFlags(AdvData &advData);
@@ -118,19 +147,33 @@ private:
     void setManufacturerData(const QLowEnergyAdvertisingData &src, AdvData &dest);
     void setLocalNameData(const QLowEnergyAdvertisingData &src, AdvData &dest);
 
+    void buildData(bool isScanResponseData, AdvData &dest);
+
     void queueCommand(OpCodeCommandField ocf, const QByteArray &advertisingData);
     void sendNextCommand();
+    void queueStartCommands();
     void queueAdvertisingCommands();
     void queueReadTxPowerLevelCommand();
     void toggleAdvertising(bool enable);
     void setAdvertisingParams();
+    quint8 filterPolicy() const;
+    void advertisingAddresses(quint8 *ownAddrType, quint8 *peerAddrType,
+                              bdaddr_t *peerAddr) const;
+    void advertisingInterval(quint16 *minimum, quint16 *maximum) const;
     void setAdvertisingInterval(AdvParams &params);
     void setData(bool isScanResponseData);
     void setAdvertisingData();
     void setScanResponseData();
     void setWhiteList();
 
+    void queueExtendedAdvertisingCommands();
+    void setExtendedAdvertisingParams();
+    void queueExtendedDataCommands();
+    void setExtendedData(OpCodeCommandField ocf, const AdvData &data);
+    void removeAdvertisingSet();
+
     void handleCommandCompleted(quint16 opCode, quint8 status, const QByteArray &advertisingData);
+    void handleCommandStatus(quint16 opCode, quint8 status);
     void handleError();
 
     HciManager &m_hciManager;
@@ -143,8 +186,28 @@ private:
     };
     QVector<Command> m_pendingCommands;
 
-    quint8 m_powerLevel;
-    bool m_sendPowerLevel;
+    // Legacy and extended advertising commands must not be mixed. The extended ones are
+    // only used if the first start asks for more than legacy advertising can do and the
+    // adapter supports them. Once the choice has been made, it sticks.
+    enum CommandSet {
+        UndecidedCommandSet,
+        ProbingCommandSet,
+        LegacyCommandSet,
+        ExtendedCommandSet
+    };
+    CommandSet m_commandSet = UndecidedCommandSet;
+    const int m_advertisingHandle;
+    int m_maxDataLength = 0;
+    bool m_useLegacyPdus = true;
+    bool m_advertisingRequested = false;
+
+    // The AD structures as sent to the controller, built once per data set.
+    QScopedPointer<AdvData> m_compiledAdvData;
+    QScopedPointer<AdvData> m_compiledResponseData;
+    bool m_dataCompiled = false;
+
+    quint8 m_powerLevel = 0;
+    bool m_sendPowerLevel = false;
     bool m_disableCommandFinished;
 };
 #endif // QT_BLUEZ_BLUETOOTH
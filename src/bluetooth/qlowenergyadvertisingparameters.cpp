@@ -49,6 +49,8 @@ public:
         , mode(QLowEnergyAdvertisingParameters::AdvInd)
         , minInterval(1280)
         , maxInterval(1280)
+        , primaryPhy(QLowEnergyAdvertisingParameters::Phy1M)
+        , secondaryPhy(QLowEnergyAdvertisingParameters::Phy1M)
     {
     }
 
@@ -57,6 +59,8 @@ public:
     QLowEnergyAdvertisingParameters::Mode mode;
     int minInterval;
     int maxInterval;
+    QLowEnergyAdvertisingParameters::Phy primaryPhy;
+    QLowEnergyAdvertisingParameters::Phy secondaryPhy;
 };
 
 /*!
@@ -114,6 +118,22 @@ public:
     \sa QLowEnergyAdvertisingParameters::whiteList()
 */
 
+/*!
+    \enum QLowEnergyAdvertisingParameters::Phy
+    \since 5.10
+
+    Specifies the physical layer (PHY) used for advertising.
+    \value Phy1M
+        The LE 1M PHY, which is supported by all Bluetooth Low Energy devices.
+    \value Phy2M
+        The LE 2M PHY, introduced with Bluetooth 5.0. It can only be used on the
+        secondary advertising channels.
+    \value PhyCoded
+        The LE Coded PHY, introduced with Bluetooth 5.0. It trades data rate for range.
+
+    \sa setPrimaryPhy(), setSecondaryPhy()
+*/
+
 /*!
     \class QLowEnergyAdvertisingParameters::AddressInfo
     \inmodule QtBluetooth
@@ -263,6 +283,59 @@ int QLowEnergyAdvertisingParameters::maximumInterval() const
     return d->maxInterval;
 }
 
+/*!
+   Sets the PHY used on the primary advertising channels to \a phy.
+   Since \l QLowEnergyAdvertisingParameters::Phy2M is not permitted on these
+   channels, it is replaced with \l QLowEnergyAdvertisingParameters::Phy1M.
+
+   Any value other than \l QLowEnergyAdvertisingParameters::Phy1M requires
+   Bluetooth 5.0 extended advertising, which is used automatically if the local
+   adapter supports it.
+
+   \note This parameter is currently only taken into account on Linux.
+   \since 5.10
+   \sa setSecondaryPhy()
+ */
+void QLowEnergyAdvertisingParameters::setPrimaryPhy(Phy phy)
+{
+    d->primaryPhy = phy == Phy2M ? Phy1M : phy;
+}
+
+/*!
+   Returns the PHY used on the primary advertising channels. The default is
+   \l QLowEnergyAdvertisingParameters::Phy1M.
+   \since 5.10
+ */
+QLowEnergyAdvertisingParameters::Phy QLowEnergyAdvertisingParameters::primaryPhy() const
+{
+    return d->primaryPhy;
+}
+
+/*!
+   Sets the PHY used on the secondary advertising channels to \a phy. These channels
+   carry the advertising data that does not fit into the legacy advertising packets,
+   which is why a value other than \l QLowEnergyAdvertisingParameters::Phy1M makes
+   the advertiser use Bluetooth 5.0 extended advertising packets.
+
+   \note This parameter is currently only taken into account on Linux.
+   \since 5.10
+   \sa setPrimaryPhy()
+ */
+void QLowEnergyAdvertisingParameters::setSecondaryPhy(Phy phy)
+{
+    d->secondaryPhy = phy;
+}
+
+/*!
+   Returns the PHY used on the secondary advertising channels. The default is
+   \l QLowEnergyAdvertisingParameters::Phy1M.
+   \since 5.10
+ */
+QLowEnergyAdvertisingParameters::Phy QLowEnergyAdvertisingParameters::secondaryPhy() const
+{
+    return d->secondaryPhy;
+}
+
 /*!
    \fn void QLowEnergyAdvertisingParameters::swap(QLowEnergyAdvertisingParameters &other)
    Swaps this object with \a other.
@@ -281,6 +354,8 @@ bool operator==(const QLowEnergyAdvertisingParameters &p1,
             && p1.minimumInterval() == p2.minimumInterval()
             && p1.maximumInterval() == p2.maximumInterval()
             && p1.mode() == p2.mode()
+            && p1.primaryPhy() == p2.primaryPhy()
+            && p1.secondaryPhy() == p2.secondaryPhy()
             && p1.whiteList() == p2.whiteList();
 }
 
@@ -79,6 +79,7 @@ public:
         UseWhiteListForConnecting = 0x02,
         UseWhiteListForScanningAndConnecting = 0x03,
     };
+    enum Phy { Phy1M = 0x1, Phy2M = 0x2, PhyCoded = 0x3 };
     void setWhiteList(const QList<AddressInfo> &whiteList, FilterPolicy policy);
     QList<AddressInfo> whiteList() const;
     FilterPolicy filterPolicy() const;
@@ -87,6 +88,11 @@ public:
     int minimumInterval() const;
     int maximumInterval() const;
 
+    void setPrimaryPhy(Phy phy);
+    Phy primaryPhy() const;
+    void setSecondaryPhy(Phy phy);
+    Phy secondaryPhy() const;
+
     // TODO: own address type
     // TODO: For ADV_DIRECT_IND: peer address + peer address type
 
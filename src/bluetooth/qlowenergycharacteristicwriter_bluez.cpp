@@ -0,0 +1,113 @@
+/***************************************************************************
+**
+** Copyright (C) 2017 The Qt Company Ltd.
+** Contact: https://www.qt.io/licensing/
+**
+** This file is part of the QtBluetooth module of the Qt Toolkit.
+**
+** $QT_BEGIN_LICENSE:LGPL$
+** Commercial License Usage
+** Licensees holding valid commercial Qt licenses may use this file in
+** accordance with the commercial license agreement provided with the
+** Software or, alternatively, in accordance with the terms contained in
+** a written agreement between you and The Qt Company. For licensing terms
+** and conditions see https://www.qt.io/terms-conditions. For further
+** information use the contact form at https://www.qt.io/contact-us.
+**
+** GNU Lesser General Public License Usage
+** Alternatively, this file may be used under the terms of the GNU Lesser
+** General Public License version 3 as published by the Free Software
+** Foundation and appearing in the file LICENSE.LGPL3 included in the
+** packaging of this file. Please review the following information to
+** ensure the GNU Lesser General Public License version 3 requirements
+** will be met: https://www.gnu.org/licenses/lgpl-3.0.html.
+**
+** GNU General Public License Usage
+** Alternatively, this file may be used under the terms of the GNU
+** General Public License version 2.0 or (at your option) the GNU General
+** Public license version 3 or any later version approved by the KDE Free
+** Qt Foundation. The licenses are as published by the Free Software
+** Foundation and appearing in the file LICENSE.GPL2 and LICENSE.GPL3
+** included in the packaging of this file. Please review the following
+** information to ensure the GNU General Public License requirements will
+** be met: https://www.gnu.org/licenses/gpl-2.0.html and
+** https://www.gnu.org/licenses/gpl-3.0.html.
+**
+** $QT_END_LICENSE$
+**
+****************************************************************************/
+
+#include "qlowenergycharacteristicwriter_p.h"
+#include "qlowenergycontroller_p.h"
+#include "qlowenergyserviceprivate_p.h"
+
+QT_BEGIN_NAMESPACE
+
+const qint64 QLowEnergyCharacteristicWriter::MaxPendingBytes;
+
+QLowEnergyCharacteristicWriter::QLowEnergyCharacteristicWriter(
+        const QSharedPointer<QLowEnergyServicePrivate> &service, QLowEnergyHandle valueHandle,
+        QObject *parent)
+    : QIODevice(parent), service(service), valueHandle(valueHandle)
+{
+    open(QIODevice::WriteOnly | QIODevice::Unbuffered);
+}
+
+QLowEnergyCharacteristicWriter::~QLowEnergyCharacteristicWriter()
+{
+}
+
+bool QLowEnergyCharacteristicWriter::isSequential() const
+{
+    return true;
+}
+
+qint64 QLowEnergyCharacteristicWriter::bytesToWrite() const
+{
+    return pendingBytes;
+}
+
+void QLowEnergyCharacteristicWriter::chunkWritten(int size)
+{
+    pendingBytes -= size;
+    emit bytesWritten(size);
+}
+
+void QLowEnergyCharacteristicWriter::writeFailed()
+{
+    pendingBytes = 0;
+    setErrorString(tr("Cannot write to the characteristic"));
+    close();
+}
+
+qint64 QLowEnergyCharacteristicWriter::readData(char *data, qint64 maxSize)
+{
+    Q_UNUSED(data);
+    Q_UNUSED(maxSize);
+    return -1;
+}
+
+qint64 QLowEnergyCharacteristicWriter::writeData(const char *data, qint64 maxSize)
+{
+    QLowEnergyControllerPrivate *controller = service->controller;
+    if (!controller || service->state != QLowEnergyService::ServiceDiscovered) {
+        setErrorString(tr("The service is not connected"));
+        return -1;
+    }
+
+    const qint64 accepted = qMin(maxSize, MaxPendingBytes - pendingBytes);
+    if (accepted <= 0)
+        return 0;
+
+    const int chunkSize = controller->mtu() - 3;
+    for (qint64 offset = 0; offset < accepted; offset += chunkSize) {
+        const int size = int(qMin<qint64>(chunkSize, accepted - offset));
+        controller->enqueueWriteCommand(this, valueHandle, data + offset, size);
+    }
+    pendingBytes += accepted;
+    controller->sendQueuedWriteCommands();
+
+    return accepted;
+}
+
+QT_END_NAMESPACE
@@ -0,0 +1,97 @@
+/***************************************************************************
+**
+** Copyright (C) 2017 The Qt Company Ltd.
+** Contact: https://www.qt.io/licensing/
+**
+** This file is part of the QtBluetooth module of the Qt Toolkit.
+**
+** $QT_BEGIN_LICENSE:LGPL$
+** Commercial License Usage
+** Licensees holding valid commercial Qt licenses may use this file in
+** accordance with the commercial license agreement provided with the
+** Software or, alternatively, in accordance with the terms contained in
+** a written agreement between you and The Qt Company. For licensing terms
+** and conditions see https://www.qt.io/terms-conditions. For further
+** information use the contact form at https://www.qt.io/contact-us.
+**
+** GNU Lesser General Public License Usage
+** Alternatively, this file may be used under the terms of the GNU Lesser
+** General Public License version 3 as published by the Free Software
+** Foundation and appearing in the file LICENSE.LGPL3 included in the
+** packaging of this file. Please review the following information to
+** ensure the GNU Lesser General Public License version 3 requirements
+** will be met: https://www.gnu.org/licenses/lgpl-3.0.html.
+**
+** GNU General Public License Usage
+** Alternatively, this file may be used under the terms of the GNU
+** General Public License version 2.0 or (at your option) the GNU General
+** Public license version 3 or any later version approved by the KDE Free
+** Qt Foundation. The licenses are as published by the Free Software
+** Foundation and appearing in the file LICENSE.GPL2 and LICENSE.GPL3
+** included in the packaging of this file. Please review the following
+** information to ensure the GNU General Public License requirements will
+** be met: https://www.gnu.org/licenses/gpl-2.0.html and
+** https://www.gnu.org/licenses/gpl-3.0.html.
+**
+** $QT_END_LICENSE$
+**
+****************************************************************************/
+
+#ifndef QLOWENERGYCHARACTERISTICWRITER_P_H
+#define QLOWENERGYCHARACTERISTICWRITER_P_H
+
+//
+//  W A R N I N G
+//  -------------
+//
+// This file is not part of the Qt API.  It exists purely as an
+// implementation detail.  This header file may change from version to
+// version without notice, or even be removed.
+//
+// We mean it.
+//
+
+#include <QtBluetooth/qbluetooth.h>
+#include <QtCore/QIODevice>
+#include <QtCore/QSharedPointer>
+
+QT_BEGIN_NAMESPACE
+
+class QLowEnergyServicePrivate;
+
+/*
+ * Write-only sequential device which streams the written data to a characteristic
+ * using write commands. The data is split into chunks of at most ATT MTU - 3 bytes.
+ * bytesWritten() is emitted once a chunk was accepted by the kernel, and write()
+ * accepts fewer bytes than requested while too much data is still pending.
+ */
+class QLowEnergyCharacteristicWriter : public QIODevice
+{
+    Q_OBJECT
+public:
+    QLowEnergyCharacteristicWriter(const QSharedPointer<QLowEnergyServicePrivate> &service,
+                                   QLowEnergyHandle valueHandle, QObject *parent = nullptr);
+    ~QLowEnergyCharacteristicWriter();
+
+    bool isSequential() const override;
+    qint64 bytesToWrite() const override;
+
+    void chunkWritten(int size);
+    void writeFailed();
+
+    // Maximum amount of data queued per writer
+    static const qint64 MaxPendingBytes = 64 * 1024;
+
+protected:
+    qint64 readData(char *data, qint64 maxSize) override;
+    qint64 writeData(const char *data, qint64 maxSize) override;
+
+private:
+    QSharedPointer<QLowEnergyServicePrivate> service;
+    QLowEnergyHandle valueHandle;
+    qint64 pendingBytes = 0;
+};
+
+QT_END_NAMESPACE
+
+#endif // QLOWENERGYCHARACTERISTICWRITER_P_H
@@ -45,8 +45,13 @@
 #include "qlowenergydescriptordata.h"
 #include "qlowenergyservicedata.h"
 
+#if defined(QT_BLUEZ_BLUETOOTH) && !defined(QT_BLUEZ_NO_BTLE)
+#include "leconnectionmanager_p.h"
+#endif
+
 #include <QtBluetooth/QBluetoothLocalDevice>
 #include <QtCore/QLoggingCategory>
+#include <QtCore/QTimer>
 
 #include <algorithm>
 
@@ -264,6 +269,53 @@ Q_DECLARE_LOGGING_CATEGORY(QT_BT)
     \sa requestConnectionUpdate()
 */
 
+/*!
+    \fn void QLowEnergyController::mtuChanged(int mtu)
+
+    This signal is emitted once the ATT MTU of the connection has been negotiated
+    with the remote device. This happens right after the connection has been
+    established, before any other request is answered by the remote device.
+    The new value is passed as \a mtu.
+
+    \since 5.10
+    \sa mtu(), setPreferredMtu()
+*/
+
+/*!
+    \fn void QLowEnergyController::statisticsUpdated(const QLowEnergyControllerStatistics &statistics)
+
+    This signal is emitted periodically if a statistics interval has been set.
+    \a statistics is a snapshot of the statistics collected so far.
+
+    \since 5.10
+    \sa setStatisticsInterval(), statistics()
+*/
+
+/*!
+    \fn void QLowEnergyController::clientConnected(const QBluetoothAddress &address)
+
+    This signal is emitted in the \l PeripheralRole when the client with the
+    given \a address has connected to the local GATT server.
+
+    \note Currently, this signal is only emitted on Linux.
+
+    \since 5.10
+    \sa clientDisconnected(), setMaximumClientCount()
+*/
+
+/*!
+    \fn void QLowEnergyController::clientDisconnected(const QBluetoothAddress &address)
+
+    This signal is emitted in the \l PeripheralRole when the client with the
+    given \a address has disconnected from the local GATT server. If it was the
+    last connected client, the \l disconnected() signal follows.
+
+    \note Currently, this signal is only emitted on Linux.
+
+    \since 5.10
+    \sa clientConnected(), setMaximumClientCount()
+*/
+
 
 void registerQLowEnergyControllerMetaType()
 {
@@ -272,6 +324,7 @@ void registerQLowEnergyControllerMetaType()
         qRegisterMetaType<QLowEnergyController::ControllerState>();
         qRegisterMetaType<QLowEnergyController::Error>();
         qRegisterMetaType<QLowEnergyConnectionParameters>();
+        qRegisterMetaType<QLowEnergyControllerStatistics>();
         initDone = true;
     }
 }
@@ -310,6 +363,22 @@ void QLowEnergyControllerPrivate::setError(
     emit q->error(newError);
 }
 
+QLowEnergyControllerStatistics QLowEnergyControllerPrivate::statisticsSnapshot() const
+{
+    QLowEnergyControllerStatistics snapshot(statistics);
+    QLowEnergyControllerStatisticsPrivate * const data = snapshot.d.data();
+    data->duration = data->clock.elapsed();
+    data->mtu = mtu();
+#if defined(QT_BLUEZ_BLUETOOTH) && !defined(QT_BLUEZ_NO_BTLE)
+    if (connectionManager) {
+        data->adapterConnections = connectionManager->connectionCount();
+        data->adapterBytesSent = connectionManager->bytesSent();
+        data->adapterBytesReceived = connectionManager->bytesReceived();
+    }
+#endif
+    return snapshot;
+}
+
 bool QLowEnergyControllerPrivate::isValidLocalAdapter()
 {
 #ifdef QT_WINRT_BLUETOOTH
@@ -343,9 +412,25 @@ void QLowEnergyControllerPrivate::setState(
             && role == QLowEnergyController::PeripheralRole) {
         remoteDevice.clear();
     }
+    if (state == QLowEnergyController::DiscoveredState)
+        updateServiceHandleIndex();
     emit q->stateChanged(state);
 }
 
+void QLowEnergyControllerPrivate::updateServiceHandleIndex()
+{
+    serviceHandleIndex.clear();
+    serviceHandleIndex.reserve(serviceList.size());
+    for (auto it = serviceList.constBegin(); it != serviceList.constEnd(); ++it)
+        serviceHandleIndex.append(it.value());
+    std::sort(serviceHandleIndex.begin(), serviceHandleIndex.end(),
+              [](const QSharedPointer<QLowEnergyServicePrivate> &a,
+                 const QSharedPointer<QLowEnergyServicePrivate> &b) {
+        return a->startHandle < b->startHandle;
+    });
+    serviceHandleIndexDirty = false;
+}
+
 void QLowEnergyControllerPrivate::invalidateServices()
 {
     foreach (const QSharedPointer<QLowEnergyServicePrivate> service, serviceList.values()) {
@@ -354,14 +439,31 @@ void QLowEnergyControllerPrivate::invalidateServices()
     }
 
     serviceList.clear();
+    serviceHandleIndex.clear();
+    serviceHandleIndexDirty = true;
 }
 
 QSharedPointer<QLowEnergyServicePrivate> QLowEnergyControllerPrivate::serviceForHandle(
         QLowEnergyHandle handle)
 {
-    foreach (QSharedPointer<QLowEnergyServicePrivate> service, serviceList.values())
+    // services do not overlap -> the candidate is the last one starting before handle
+    if (!serviceHandleIndexDirty) {
+        auto it = std::upper_bound(serviceHandleIndex.constBegin(), serviceHandleIndex.constEnd(),
+                                   handle,
+                                   [](QLowEnergyHandle h,
+                                      const QSharedPointer<QLowEnergyServicePrivate> &service) {
+            return h < service->startHandle;
+        });
+        if (it != serviceHandleIndex.constBegin() && handle <= (*(it - 1))->endHandle)
+            return *(it - 1);
+        return QSharedPointer<QLowEnergyServicePrivate>();
+    }
+
+    for (auto it = serviceList.constBegin(); it != serviceList.constEnd(); ++it) {
+        const QSharedPointer<QLowEnergyServicePrivate> &service = it.value();
         if (service->startHandle <= handle && handle <= service->endHandle)
             return service;
+    }
 
     return QSharedPointer<QLowEnergyServicePrivate>();
 }
@@ -385,6 +487,14 @@ QLowEnergyCharacteristic QLowEnergyControllerPrivate::characteristicForHandle(
         return QLowEnergyCharacteristic(service, handle);
 
     // check whether it is the handle of the characteristic value or its descriptors
+    const QVector<QLowEnergyHandle> &sortedHandles = service->characteristicHandles;
+    if (!sortedHandles.isEmpty()) {
+        auto it = std::upper_bound(sortedHandles.constBegin(), sortedHandles.constEnd(), handle);
+        if (it == sortedHandles.constBegin())
+            return QLowEnergyCharacteristic();
+        return QLowEnergyCharacteristic(service, *(it - 1));
+    }
+
     QList<QLowEnergyHandle> charHandles = service->characteristicList.keys();
     std::sort(charHandles.begin(), charHandles.end());
     for (int i = charHandles.size() - 1; i >= 0; i--) {
@@ -408,10 +518,12 @@ QLowEnergyDescriptor QLowEnergyControllerPrivate::descriptorForHandle(
     if (!matchingChar.isValid())
         return QLowEnergyDescriptor();
 
-    const QLowEnergyServicePrivate::CharData charData = matchingChar.
-            d_ptr->characteristicList[matchingChar.attributeHandle()];
+    const CharacteristicDataMap &charList = matchingChar.d_ptr->characteristicList;
+    const auto charIt = charList.constFind(matchingChar.attributeHandle());
+    if (charIt == charList.constEnd())
+        return QLowEnergyDescriptor();
 
-    if (charData.descriptorList.contains(handle))
+    if (charIt.value().descriptorList.contains(handle))
         return QLowEnergyDescriptor(matchingChar.d_ptr, matchingChar.attributeHandle(),
                                     handle);
 
@@ -748,6 +860,14 @@ void QLowEnergyController::disconnectFromDevice()
     problem, the best workaround is to temporarily turn Bluetooth off. This
     causes a reset of the cache data. Currently Android exhibits such a
     cache behavior.
+
+    On Linux with BlueZ, the discovered services and their details are cached
+    too. The cache is only used if the remote device confirms via its GATT
+    Database Hash that its attributes did not change. Devices without such a hash
+    must be bonded, as they can only announce changes via Service Changed
+    indications. If the cache is used, the details of each service are restored
+    when calling \l QLowEnergyService::discoverDetails() and only their values
+    are read from the device.
  */
 void QLowEnergyController::discoverServices()
 {
@@ -764,6 +884,48 @@ void QLowEnergyController::discoverServices()
     d->discoverServices();
 }
 
+/*!
+    Initiates the discovery of the details of all services returned by \l services()
+    which are still in the \l QLowEnergyService::DiscoveryRequired state.
+
+    This is equivalent to calling \l QLowEnergyService::discoverDetails() on each
+    of those services. However, on Linux with BlueZ, the included services,
+    characteristics and descriptors of all services are discovered together rather
+    than one service after another. This significantly reduces the time required to
+    discover devices with many services.
+
+    The discovery progress of each service is indicated via the
+    \l QLowEnergyService::stateChanged() signal of the related service objects.
+
+    If the controller has not finished the discovery of services yet, this function
+    does nothing.
+
+    \sa discoverServices(), createServiceObject()
+    \since 5.10
+ */
+void QLowEnergyController::discoverAllServiceDetails()
+{
+    Q_D(QLowEnergyController);
+
+    if (d->role != CentralRole) {
+        qCWarning(QT_BT) << "Cannot discover service details in peripheral role";
+        return;
+    }
+    if (d->state != QLowEnergyController::DiscoveredState)
+        return;
+
+    QList<QBluetoothUuid> pendingServices;
+    for (auto it = d->serviceList.constBegin(); it != d->serviceList.constEnd(); ++it) {
+        if (it.value()->state != QLowEnergyService::DiscoveryRequired)
+            continue;
+        it.value()->setState(QLowEnergyService::DiscoveringServices);
+        pendingServices.append(it.key());
+    }
+
+    if (!pendingServices.isEmpty())
+        d->discoverAllServiceDetails(pendingServices);
+}
+
 /*!
     Returns the list of services offered by the remote device, if the controller is in
     the \l CentralRole. Otherwise, the result is unspecified.
@@ -828,7 +990,8 @@ QLowEnergyService *QLowEnergyController::createServiceObject(
    configurations of \c parameters.
 
    If this object is currently not in the \l UnconnectedState, nothing happens.
-   \note Advertising will stop automatically once a client connects to the local device.
+   \note Advertising will stop automatically once a client connects to the local device,
+   unless further clients may connect according to \l maximumClientCount().
 
    \since 5.7
    \sa stopAdvertising()
@@ -849,8 +1012,40 @@ void QLowEnergyController::startAdvertising(const QLowEnergyAdvertisingParameter
     d->startAdvertising(parameters, advertisingData, scanResponseData);
 }
 
+/*!
+   Replaces the data being advertised with \a advertisingData and \a scanResponseData,
+   without stopping and restarting advertising. The parameters passed to
+   \l startAdvertising() remain in effect. If advertising has been stopped in the
+   meantime, the new data is used once it is started again.
+
+   The data is validated before it is handed to the local adapter. If it does not fit
+   into the advertising packets, the previous data continues to be advertised and this
+   function returns \c false. It also returns \c false if advertising has never been
+   started. Otherwise it returns \c true.
+
+   Updates that only change the value of the manufacturer specific data, such as a
+   counter or a sensor reading, while keeping its length are the cheapest ones.
+
+   \note Currently, this functionality is only implemented on Linux.
+
+   \since 5.10
+   \sa startAdvertising()
+ */
+bool QLowEnergyController::updateAdvertisingData(const QLowEnergyAdvertisingData &advertisingData,
+                                                 const QLowEnergyAdvertisingData &scanResponseData)
+{
+    Q_D(QLowEnergyController);
+    if (role() != PeripheralRole) {
+        qCWarning(QT_BT) << "Cannot update advertising data in central role";
+        return false;
+    }
+    return d->updateAdvertisingData(advertisingData, scanResponseData);
+}
+
 /*!
    Stops advertising, if this object is currently in the advertising state.
+   If more than one client may connect, this function also stops accepting
+   further clients while others are connected.
 
    \since 5.7
    \sa startAdvertising()
@@ -858,6 +1053,13 @@ void QLowEnergyController::startAdvertising(const QLowEnergyAdvertisingParameter
 void QLowEnergyController::stopAdvertising()
 {
     Q_D(QLowEnergyController);
+#if defined(QT_BLUEZ_BLUETOOTH) && !defined(QT_BLUEZ_NO_BTLE)
+    // Advertising continues while further clients may connect.
+    if (state() == ConnectedState && d->acceptingClients && d->maximumClientCount > 1) {
+        d->stopAdvertising();
+        return;
+    }
+#endif
     if (state() != AdvertisingState) {
         qCDebug(QT_BT) << "stopAdvertising called in state" << state();
         return;
@@ -954,6 +1156,340 @@ void QLowEnergyController::requestConnectionUpdate(const QLowEnergyConnectionPar
     d_ptr->requestConnectionUpdate(parameters);
 }
 
+/*!
+    Sets the ATT MTU which the controller offers to the remote device to \a mtu.
+    The value must be set before \l connectToDevice() is called or, in the
+    \l PeripheralRole, before a client connects. It is bound to the range
+    supported by the platform. The default value \c 0 selects the largest MTU
+    supported by the platform.
+
+    Larger MTUs reduce the protocol overhead of long reads, writes and notifications.
+    On Linux, a preferred MTU larger than the default of 23 bytes also causes the
+    controller to request link layer packets of maximum length and the LE 2M PHY,
+    provided the local adapter and the remote device support them. This requires
+    root privileges or the \c CAP_NET_ADMIN capability.
+
+    \note Currently, this functionality is only implemented on Linux.
+
+    \since 5.10
+    \sa preferredMtu(), mtu(), mtuChanged()
+ */
+void QLowEnergyController::setPreferredMtu(int mtu)
+{
+    Q_D(QLowEnergyController);
+    d->preferredMtu = qMax(0, mtu);
+}
+
+/*!
+    Returns the ATT MTU which the controller offers to the remote device.
+
+    \since 5.10
+    \sa setPreferredMtu()
+ */
+int QLowEnergyController::preferredMtu() const
+{
+    Q_D(const QLowEnergyController);
+    return d->preferredMtu;
+}
+
+/*!
+    Returns the ATT MTU of the current connection or \c -1 if the controller
+    is not connected or the MTU is unknown on the current platform.
+
+    \since 5.10
+    \sa mtuChanged(), setPreferredMtu()
+ */
+int QLowEnergyController::mtu() const
+{
+    Q_D(const QLowEnergyController);
+    return d->mtu();
+}
+
+/*!
+    Sets whether the controller receives the packets of the remote device in a
+    separate I/O thread to \a enabled. The value must be set before
+    \l connectToDevice() is called or, in the \l PeripheralRole, before a client
+    connects. The default is \c false.
+
+    Packets are still processed and all signals are still emitted in the thread
+    owning the controller. However, the controller acknowledges indications while
+    that thread is busy, and the packets arriving in the meantime are processed in
+    one batch. This prevents the remote device from disconnecting due to an ATT
+    timeout while the owning thread is blocked, for example by rendering.
+
+    The I/O thread is shared by all controllers of the same local adapter.
+
+    \note Currently, this functionality is only implemented on Linux. The other
+    platforms perform the I/O outside of the application's threads anyway.
+
+    \since 5.10
+    \sa isIoThreadEnabled()
+ */
+void QLowEnergyController::setIoThreadEnabled(bool enabled)
+{
+    Q_D(QLowEnergyController);
+    d->ioThreadEnabled = enabled;
+}
+
+/*!
+    Returns whether the controller receives packets in a separate I/O thread.
+
+    \since 5.10
+    \sa setIoThreadEnabled()
+ */
+bool QLowEnergyController::isIoThreadEnabled() const
+{
+    Q_D(const QLowEnergyController);
+    return d->ioThreadEnabled;
+}
+
+/*!
+    Sets the time in milliseconds after which a request to the remote device
+    without response is considered failed to \a msecs. The default is 30000,
+    the ATT transaction timeout defined by the Bluetooth specification. A value
+    of \c 0 disables the timeout.
+
+    Once a request has timed out, no further requests may be sent to the remote
+    device. The controller therefore sets the \l NetworkError and disconnects.
+
+    \note Currently, this functionality is only implemented on Linux.
+
+    \since 5.10
+    \sa requestTimeout(), setReadRetryCount()
+ */
+void QLowEnergyController::setRequestTimeout(int msecs)
+{
+    Q_D(QLowEnergyController);
+    d->requestTimeout = qMax(0, msecs);
+}
+
+/*!
+    Returns the time in milliseconds after which a request without response
+    is considered failed.
+
+    \since 5.10
+    \sa setRequestTimeout()
+ */
+int QLowEnergyController::requestTimeout() const
+{
+    Q_D(const QLowEnergyController);
+    return d->requestTimeout;
+}
+
+/*!
+    Sets the number of times a read of a characteristic or descriptor is
+    repeated to \a count if the remote device reports a temporary failure, such
+    as insufficient resources. Reads do not change the state of the remote
+    device and can therefore be repeated safely. The default is \c 0.
+
+    The first repetition is delayed by 100 milliseconds. Each further repetition
+    waits twice as long as the previous one, up to two seconds. A repeated read is
+    queued behind the requests which were issued in the meantime.
+
+    \note Currently, this functionality is only implemented on Linux.
+
+    \since 5.10
+    \sa readRetryCount()
+ */
+void QLowEnergyController::setReadRetryCount(int count)
+{
+    Q_D(QLowEnergyController);
+    d->readRetryCount = qMax(0, count);
+}
+
+/*!
+    Returns the number of times a read is repeated after a temporary failure.
+
+    \since 5.10
+    \sa setReadRetryCount()
+ */
+int QLowEnergyController::readRetryCount() const
+{
+    Q_D(const QLowEnergyController);
+    return d->readRetryCount;
+}
+
+/*!
+    Sets the number of clients that may be connected at the same time in the
+    \l PeripheralRole to \a count. The value must be set before
+    \l startAdvertising() is called. The default is \c 1.
+
+    While fewer than \a count clients are connected, the controller keeps
+    advertising and accepts further connections. All clients share the services
+    added via \l addService(), but each one has its own MTU, its own client
+    characteristic configurations and its own queue of pending indications.
+    Writing a characteristic value notifies or indicates every client that has
+    subscribed to it.
+
+    The controller stays in the \l ConnectedState until the last client has
+    disconnected. \l remoteAddress() and \l mtu() refer to the client that
+    connected first. The \l clientConnected() and \l clientDisconnected()
+    signals report the individual clients.
+
+    \note Currently, this functionality is only implemented on Linux.
+
+    \since 5.10
+    \sa maximumClientCount()
+ */
+void QLowEnergyController::setMaximumClientCount(int count)
+{
+    Q_D(QLowEnergyController);
+    d->maximumClientCount = qMax(1, count);
+}
+
+/*!
+    Returns the number of clients that may be connected at the same time in the
+    \l PeripheralRole.
+
+    \since 5.10
+    \sa setMaximumClientCount()
+ */
+int QLowEnergyController::maximumClientCount() const
+{
+    Q_D(const QLowEnergyController);
+    return d->maximumClientCount;
+}
+
+/*!
+    Starts a batch of characteristic updates in the \l PeripheralRole.
+
+    Until the matching \l endNotificationBatch() call, writing characteristic
+    values via \l QLowEnergyService::writeCharacteristic() does not send
+    notifications right away. If a characteristic is written more than once,
+    only its latest value is notified. The notifications of the whole batch are
+    then handed to the operating system at once, using a single system call per
+    client where possible. Indications are not affected.
+
+    Batches may be nested; the notifications are sent when the outermost batch
+    ends.
+
+    \note Currently, this functionality is only implemented on Linux.
+
+    \since 5.10
+    \sa endNotificationBatch()
+ */
+void QLowEnergyController::beginNotificationBatch()
+{
+    Q_D(QLowEnergyController);
+    ++d->notificationBatchDepth;
+}
+
+/*!
+    Ends a batch of characteristic updates started by \l beginNotificationBatch()
+    and sends the notifications held back by it.
+
+    \since 5.10
+    \sa beginNotificationBatch()
+ */
+void QLowEnergyController::endNotificationBatch()
+{
+    Q_D(QLowEnergyController);
+    if (d->notificationBatchDepth == 0) {
+        qCWarning(QT_BT) << "endNotificationBatch() called without beginNotificationBatch()";
+        return;
+    }
+    if (--d->notificationBatchDepth == 0)
+        d->flushNotifications();
+}
+
+/*!
+    Returns a snapshot of the statistics collected by the controller since its
+    creation or the last call to \l resetStatistics().
+
+    The statistics are always collected. Taking a snapshot is cheap.
+
+    \since 5.10
+    \sa statisticsUpdated(), setStatisticsInterval()
+ */
+QLowEnergyControllerStatistics QLowEnergyController::statistics() const
+{
+    Q_D(const QLowEnergyController);
+    return d->statisticsSnapshot();
+}
+
+/*!
+    Discards the statistics collected so far.
+
+    \since 5.10
+    \sa statistics()
+ */
+void QLowEnergyController::resetStatistics()
+{
+    Q_D(QLowEnergyController);
+    d->statistics = new QLowEnergyControllerStatisticsPrivate;
+}
+
+/*!
+    Sets the interval in milliseconds at which the \l statisticsUpdated() signal
+    is emitted to \a msecs. The default value \c 0 disables the signal.
+
+    \since 5.10
+    \sa statisticsInterval(), statistics()
+ */
+void QLowEnergyController::setStatisticsInterval(int msecs)
+{
+    Q_D(QLowEnergyController);
+    if (msecs <= 0) {
+        delete d->statisticsTimer;
+        d->statisticsTimer = nullptr;
+        return;
+    }
+
+    if (!d->statisticsTimer) {
+        d->statisticsTimer = new QTimer(this);
+        connect(d->statisticsTimer, &QTimer::timeout, this, [this]() {
+            emit statisticsUpdated(statistics());
+        });
+    }
+    d->statisticsTimer->start(msecs);
+}
+
+/*!
+    Returns the interval in milliseconds at which the \l statisticsUpdated() signal
+    is emitted, or \c 0 if the signal is disabled.
+
+    \since 5.10
+    \sa setStatisticsInterval()
+ */
+int QLowEnergyController::statisticsInterval() const
+{
+    Q_D(const QLowEnergyController);
+    return d->statisticsTimer ? d->statisticsTimer->interval() : 0;
+}
+
+/*!
+    Starts writing the packets exchanged with the remote device to the file
+    \a fileName in the btsnoop format, which can be analyzed with tools such as
+    Wireshark. An existing file is overwritten. A capture which is already running
+    is stopped first. Returns \c true if the file could be opened.
+
+    The packets are written by a background thread. The capture continues across
+    reconnects until \l stopPacketCapture() is called or the controller is destroyed.
+    No overhead is incurred while no capture is running.
+
+    \note Currently, this functionality is only implemented on Linux.
+
+    \since 5.10
+    \sa stopPacketCapture()
+ */
+bool QLowEnergyController::startPacketCapture(const QString &fileName)
+{
+    Q_D(QLowEnergyController);
+    return d->startPacketCapture(fileName);
+}
+
+/*!
+    Stops the packet capture and writes the remaining packets to the file.
+
+    \since 5.10
+    \sa startPacketCapture()
+ */
+void QLowEnergyController::stopPacketCapture()
+{
+    Q_D(QLowEnergyController);
+    d->stopPacketCapture();
+}
+
 /*!
     Returns the last occurred error or \l NoError.
 */
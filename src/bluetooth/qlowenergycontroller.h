@@ -45,6 +45,7 @@
 #include <QtBluetooth/QBluetoothDeviceInfo>
 #include <QtBluetooth/QBluetoothUuid>
 #include <QtBluetooth/QLowEnergyAdvertisingData>
+#include <QtBluetooth/QLowEnergyControllerStatistics>
 #include <QtBluetooth/QLowEnergyService>
 
 QT_BEGIN_NAMESPACE
@@ -119,6 +120,7 @@ public:
     void disconnectFromDevice();
 
     void discoverServices();
+    void discoverAllServiceDetails();
     QList<QBluetoothUuid> services() const;
     QLowEnergyService *createServiceObject(const QBluetoothUuid &service, QObject *parent = Q_NULLPTR);
 
@@ -126,11 +128,38 @@ public:
                           const QLowEnergyAdvertisingData &advertisingData,
                           const QLowEnergyAdvertisingData &scanResponseData = QLowEnergyAdvertisingData());
     void stopAdvertising();
+    bool updateAdvertisingData(const QLowEnergyAdvertisingData &advertisingData,
+                               const QLowEnergyAdvertisingData &scanResponseData = QLowEnergyAdvertisingData());
 
     QLowEnergyService *addService(const QLowEnergyServiceData &service, QObject *parent = nullptr);
 
     void requestConnectionUpdate(const QLowEnergyConnectionParameters &parameters);
 
+    void setPreferredMtu(int mtu);
+    int preferredMtu() const;
+    int mtu() const;
+
+    void setIoThreadEnabled(bool enabled);
+    bool isIoThreadEnabled() const;
+
+    void setRequestTimeout(int msecs);
+    int requestTimeout() const;
+    void setReadRetryCount(int count);
+    int readRetryCount() const;
+
+    void setMaximumClientCount(int count);
+    int maximumClientCount() const;
+    void beginNotificationBatch();
+    void endNotificationBatch();
+
+    QLowEnergyControllerStatistics statistics() const;
+    void resetStatistics();
+    void setStatisticsInterval(int msecs);
+    int statisticsInterval() const;
+
+    bool startPacketCapture(const QString &fileName);
+    void stopPacketCapture();
+
     Error error() const;
     QString errorString() const;
 
@@ -145,6 +174,10 @@ Q_SIGNALS:
     void serviceDiscovered(const QBluetoothUuid &newService);
     void discoveryFinished();
     void connectionUpdated(const QLowEnergyConnectionParameters &parameters);
+    void mtuChanged(int mtu);
+    void statisticsUpdated(const QLowEnergyControllerStatistics &statistics);
+    void clientConnected(const QBluetoothAddress &address);
+    void clientDisconnected(const QBluetoothAddress &address);
 
 private:
     explicit QLowEnergyController(QObject *parent = nullptr); // For the peripheral role.
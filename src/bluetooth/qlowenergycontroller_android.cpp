@@ -174,6 +174,12 @@ void QLowEnergyControllerPrivate::discoverServiceDetails(const QBluetoothUuid &s
     qCDebug(QT_BT_ANDROID) << "Discovery of" << service << "started";
 }
 
+void QLowEnergyControllerPrivate::discoverAllServiceDetails(const QList<QBluetoothUuid> &services)
+{
+    for (const QBluetoothUuid &service : services)
+        discoverServiceDetails(service);
+}
+
 void QLowEnergyControllerPrivate::writeCharacteristic(
         const QSharedPointer<QLowEnergyServicePrivate> service,
         const QLowEnergyHandle charHandle,
@@ -370,6 +376,7 @@ void QLowEnergyControllerPrivate::servicesDiscovered(
 
             QSharedPointer<QLowEnergyServicePrivate> pointer(priv);
             serviceList.insert(service, pointer);
+            serviceHandleIndexDirty = true;
 
             emit q->serviceDiscovered(QBluetoothUuid(entry));
         }
@@ -561,6 +568,7 @@ void QLowEnergyControllerPrivate::descriptorWritten(
 void QLowEnergyControllerPrivate::characteristicChanged(
         int charHandle, const QByteArray &data)
 {
+    ++statistics->notifications;
     QSharedPointer<QLowEnergyServicePrivate> service =
             serviceForHandle(charHandle);
     if (service.isNull())
@@ -575,12 +583,8 @@ void QLowEnergyControllerPrivate::characteristicChanged(
         return;
     }
 
-    // only update cache when property is readable. Otherwise it remains
-    // empty.
-    if (characteristic.properties() & QLowEnergyCharacteristic::Read)
-        updateValueOfCharacteristic(characteristic.attributeHandle(),
-                                data, false);
-    emit service->characteristicChanged(characteristic, data);
+    if (service->deliverNotification(characteristic, data.constData(), data.size()))
+        emit service->characteristicChanged(characteristic, data);
 }
 
 void QLowEnergyControllerPrivate::serviceError(
@@ -614,12 +618,70 @@ void QLowEnergyControllerPrivate::stopAdvertising()
     qCWarning(QT_BT_ANDROID) << "LE advertising not implemented for Android";
 }
 
+bool QLowEnergyControllerPrivate::updateAdvertisingData(
+        const QLowEnergyAdvertisingData &advertisingData,
+        const QLowEnergyAdvertisingData &scanResponseData)
+{
+    Q_UNUSED(advertisingData);
+    Q_UNUSED(scanResponseData);
+    qCWarning(QT_BT_ANDROID) << "LE advertising not implemented for Android";
+    return false;
+}
+
 void QLowEnergyControllerPrivate::requestConnectionUpdate(const QLowEnergyConnectionParameters &params)
 {
     Q_UNUSED(params);
     qCWarning(QT_BT_ANDROID) << "Connection update not implemented for Android";
 }
 
+int QLowEnergyControllerPrivate::mtu() const
+{
+    return -1;
+}
+
+bool QLowEnergyControllerPrivate::beginReliableWrite(
+        const QSharedPointer<QLowEnergyServicePrivate> &service)
+{
+    Q_UNUSED(service);
+    qCWarning(QT_BT_ANDROID) << "Reliable writes not implemented for Android";
+    return false;
+}
+
+void QLowEnergyControllerPrivate::executeReliableWrite(
+        const QSharedPointer<QLowEnergyServicePrivate> &service)
+{
+    Q_UNUSED(service);
+}
+
+void QLowEnergyControllerPrivate::abortReliableWrite(
+        const QSharedPointer<QLowEnergyServicePrivate> &service)
+{
+    Q_UNUSED(service);
+}
+
+void QLowEnergyControllerPrivate::cancelRequests(
+        const QSharedPointer<QLowEnergyServicePrivate> &service)
+{
+    // requests are queued by the Java part
+    Q_UNUSED(service);
+}
+
+bool QLowEnergyControllerPrivate::startPacketCapture(const QString &fileName)
+{
+    Q_UNUSED(fileName);
+    qCWarning(QT_BT_ANDROID) << "Packet capture not implemented for Android";
+    return false;
+}
+
+void QLowEnergyControllerPrivate::stopPacketCapture()
+{
+}
+
+void QLowEnergyControllerPrivate::flushNotifications()
+{
+    // notifications are sent by the Java part
+}
+
 void QLowEnergyControllerPrivate::addToGenericAttributeList(const QLowEnergyServiceData &service,
                                                             QLowEnergyHandle startHandle)
 {
@@ -38,8 +38,13 @@
 **
 ****************************************************************************/
 
+#include "btsnoopwriter_p.h"
+#include "leattreceiver_p.h"
+#include "lebondstore_p.h"
 #include "lecmaccalculator_p.h"
+#include "leconnectionmanager_p.h"
 #include "qlowenergycontroller_p.h"
+#include "qlowenergycharacteristicwriter_p.h"
 #include "qbluetoothsocket_p.h"
 #include "qleadvertiser_p.h"
 #include "bluez/bluez_data_p.h"
@@ -48,6 +53,8 @@
 #include <QtCore/QFileInfo>
 #include <QtCore/QLoggingCategory>
 #include <QtCore/QSettings>
+#include <QtCore/QStandardPaths>
+#include <QtCore/QTimer>
 #include <QtBluetooth/QBluetoothLocalDevice>
 #include <QtBluetooth/QBluetoothSocket>
 #include <QtBluetooth/QLowEnergyCharacteristicData>
@@ -57,19 +64,35 @@
 
 #include <algorithm>
 #include <climits>
+#include <iterator>
 #include <cstring>
 #include <errno.h>
 #include <sys/types.h>
 #include <sys/socket.h>
 #include <unistd.h>
 
+// sendmmsg() is available since glibc 2.14 and Linux 3.0
+#if defined(__GLIBC__) && defined(__GLIBC_PREREQ)
+#  if __GLIBC_PREREQ(2, 14)
+#    define QT_BT_HAVE_SENDMMSG
+#  endif
+#endif
+
 #define ATT_DEFAULT_LE_MTU 23
 #define ATT_MAX_LE_MTU 0x200
 
+// Spec v4.2, Vol 6, Part B, 4.5.10
+#define LL_MAX_TX_OCTETS 251
+#define LL_MAX_TX_TIME 2120
+// Spec v5.0, Vol 2, Part E, 7.8.49
+#define LE_PHY_1M 0x01
+#define LE_PHY_2M 0x02
+
 #define GATT_PRIMARY_SERVICE    quint16(0x2800)
 #define GATT_SECONDARY_SERVICE  quint16(0x2801)
 #define GATT_INCLUDED_SERVICE   quint16(0x2802)
 #define GATT_CHARACTERISTIC     quint16(0x2803)
+#define GATT_DATABASE_HASH      quint16(0x2B2A)
 
 // GATT commands
 #define ATT_OP_ERROR_RESPONSE           0x1
@@ -98,6 +121,8 @@
 #define ATT_OP_HANDLE_VAL_NOTIFICATION  0x1b //informs about value change
 #define ATT_OP_HANDLE_VAL_INDICATION    0x1d //informs about value change -> requires reply
 #define ATT_OP_HANDLE_VAL_CONFIRMATION  0x1e //answer for ATT_OP_HANDLE_VAL_INDICATION
+#define ATT_OP_READ_MULTIPLE_VARIABLE_REQUEST  0x20 //read multiple values of variable size
+#define ATT_OP_READ_MULTIPLE_VARIABLE_RESPONSE 0x21
 #define ATT_OP_WRITE_COMMAND            0x52 //write characteristic without response
 #define ATT_OP_SIGNED_WRITE_COMMAND     0xD2
 
@@ -144,6 +169,10 @@ Q_DECLARE_LOGGING_CATEGORY(QT_BT_BLUEZ)
 using namespace QBluetooth;
 
 const int maxPrepareQueueSize = 1024;
+const int maxNotificationBatchSize = 32;
+// backoff before the first and the longest backoff before any further retry of a read
+const int retryBackoffInitial = 100;
+const int retryBackoffMaximum = 2000;
 
 static inline QBluetoothUuid convert_uuid128(const quint128 *p)
 {
@@ -257,9 +286,7 @@ QLowEnergyControllerPrivate::QLowEnergyControllerPrivate()
       state(QLowEnergyController::UnconnectedState),
       error(QLowEnergyController::NoError),
       lastLocalHandle(0),
-      l2cpSocket(0), requestPending(false),
-      mtuSize(ATT_DEFAULT_LE_MTU),
-      securityLevelValue(-1),
+      requestPending(false),
       encryptionChangePending(false),
       hciManager(0),
       advertiser(0),
@@ -267,32 +294,65 @@ QLowEnergyControllerPrivate::QLowEnergyControllerPrivate()
 {
     registerQLowEnergyControllerMetaType();
     qRegisterMetaType<QList<QLowEnergyHandle> >();
+    receiveBuffer.resize(ATT_MAX_LE_MTU);
+    requestClock.start();
 }
 
 void QLowEnergyControllerPrivate::init()
 {
-    hciManager = new HciManager(localAdapter, this);
+    // All controllers of an adapter share one HCI socket. Events are matched
+    // against connectionHandle, which is assigned from the connection complete event.
+    connectionManager = LeConnectionManager::instance(localAdapter);
+    hciManager = connectionManager->hciManager();
     if (!hciManager->isValid())
         return;
 
-    hciManager->monitorEvent(HciManager::EncryptChangeEvent);
     connect(hciManager, SIGNAL(encryptionChangedEvent(QBluetoothAddress,bool)),
             this, SLOT(encryptionChangedEvent(QBluetoothAddress,bool)));
-    hciManager->monitorEvent(HciManager::LeMetaEvent);
-    hciManager->monitorAclPackets();
-    connect(hciManager, &HciManager::connectionComplete, [this](quint16 handle) {
-        connectionHandle = handle;
-        qCDebug(QT_BT_BLUEZ) << "received connection complete event, handle:" << handle;
-    });
-    connect(hciManager, &HciManager::connectionUpdate,
+    connect(hciManager, &HciManager::connectionComplete, this,
+            [this](quint16 handle, bool isCentral, const QBluetoothAddress &peerAddress) {
+                if (role == QLowEnergyController::PeripheralRole) {
+                    if (!isCentral)
+                        assignServerConnectionHandle(handle, peerAddress);
+                    return;
+                }
+                if (activeLink->connectionHandle != 0 || !isCentral || peerAddress != remoteDevice
+                        || state == QLowEnergyController::UnconnectedState) {
+                    return;
+                }
+                activeLink->connectionHandle = handle;
+                qCDebug(QT_BT_BLUEZ) << "received connection complete event, handle:" << handle;
+                requestLinkLayerThroughput();
+            }
+    );
+    connect(hciManager, &HciManager::dataLengthChanged, this,
+            [this](quint16 handle, quint16 maxTxOctets, quint16 maxRxOctets) {
+                if (handle == activeLink->connectionHandle) {
+                    qCDebug(QT_BT_BLUEZ) << "link layer data length changed; tx:" << maxTxOctets
+                                         << "rx:" << maxRxOctets;
+                }
+            }
+    );
+    connect(hciManager, &HciManager::phyUpdated, this,
+            [this](quint16 handle, quint8 txPhy, quint8 rxPhy) {
+                if (handle == activeLink->connectionHandle)
+                    qCDebug(QT_BT_BLUEZ) << "PHY updated; tx:" << txPhy << "rx:" << rxPhy;
+            }
+    );
+    connect(hciManager, &HciManager::connectionUpdate, this,
             [this](quint16 handle, const QLowEnergyConnectionParameters &params) {
-                if (handle == connectionHandle)
+                if (handle == activeLink->connectionHandle)
                     emit q_ptr->connectionUpdated(params);
             }
     );
-    connect(hciManager, &HciManager::signatureResolvingKeyReceived,
+    connect(hciManager, &HciManager::signatureResolvingKeyReceived, this,
             [this](quint16 handle, bool remoteKey, const quint128 &csrk) {
-                if (handle != connectionHandle)
+                QBluetoothAddress peerAddress;
+                if (handle == activeLink->connectionHandle)
+                    peerAddress = remoteDevice;
+                else if (const Link * const connection = serverConnectionForHandle(handle))
+                    peerAddress = connection->remoteDevice;
+                else
                     return;
                 if ((remoteKey && role == QLowEnergyController::CentralRole)
                         || (!remoteKey && role == QLowEnergyController::PeripheralRole)) {
@@ -301,7 +361,9 @@ void QLowEnergyControllerPrivate::init()
                 qCDebug(QT_BT_BLUEZ) << "received new signature resolving key"
                                      << QByteArray(reinterpret_cast<const char *>(csrk.data),
                                                    sizeof csrk).toHex();
-                signingData.insert(remoteDevice.toUInt64(), SigningData(csrk));
+                connectionManager->bondStore()->setSigningKey(peerAddress,
+                        remoteKey ? LeBondStore::RemoteSigningKey : LeBondStore::LocalSigningKey,
+                        csrk);
         }
     );
 }
@@ -309,7 +371,30 @@ void QLowEnergyControllerPrivate::init()
 QLowEnergyControllerPrivate::~QLowEnergyControllerPrivate()
 {
     closeServerSocket();
-    delete cmacCalculator;
+    qDeleteAll(cmacCalculators);
+    for (Link * const connection : qAsConst(serverConnections)) {
+        activateServerConnection(connection);
+        stopAttReceiver();
+        if (activeLink->connectionCounted && connectionManager)
+            connectionManager->connectionClosed();
+        activeLink->connectionCounted = false;
+    }
+    activateServerConnection(nullptr);
+    stopAttReceiver();
+    // refers to the shared HciManager, which may go away with connectionManager
+    delete advertiser;
+    if (connectionManager) {
+        connectionManager->releaseAdvertisingHandle(advertisingHandle);
+        connectionManager->unscheduleWriteCommands(this);
+        if (activeLink->connectionCounted)
+            connectionManager->connectionClosed();
+    }
+    qDeleteAll(serverConnections);
+}
+
+QLowEnergyControllerPrivate::Link::Link()
+    : mtuSize(ATT_DEFAULT_LE_MTU)
+{
 }
 
 class ServerSocket
@@ -367,9 +452,23 @@ void QLowEnergyControllerPrivate::startAdvertising(const QLowEnergyAdvertisingPa
         const QLowEnergyAdvertisingData &scanResponseData)
 {
     qCDebug(QT_BT_BLUEZ) << "Starting to advertise";
+    // An advertiser with the same parameters keeps the data compiled before, unless the
+    // data has changed. Data that does not fit is truncated by a new advertiser instead.
+    if (advertiser && (advertiser->parameters() != params
+                       || !advertiser->updateData(advertisingData, scanResponseData))) {
+        delete advertiser;
+        advertiser = nullptr;
+        connectionManager->releaseAdvertisingHandle(advertisingHandle);
+    }
     if (!advertiser) {
+        advertisingHandle = connectionManager->allocateAdvertisingHandle();
+        if (advertisingHandle == -1) {
+            qCWarning(QT_BT_BLUEZ) << "all advertising sets of the adapter are in use";
+            setError(QLowEnergyController::AdvertisingError);
+            return;
+        }
         advertiser = new QLeAdvertiserBluez(params, advertisingData, scanResponseData, *hciManager,
-                                            this);
+                                            advertisingHandle, this);
         connect(advertiser, &QLeAdvertiser::errorOccurred, this,
                 &QLowEnergyControllerPrivate::handleAdvertisingError);
     }
@@ -382,25 +481,50 @@ void QLowEnergyControllerPrivate::startAdvertising(const QLowEnergyAdvertisingPa
         return;
     }
 
-    ServerSocket serverSocket;
-    if (!serverSocket.listen(localAdapter)) {
+    if (!listenForConnections()) {
         setError(QLowEnergyController::AdvertisingError);
         setState(QLowEnergyController::UnconnectedState);
         return;
     }
-
-    const int socketFd = serverSocket.takeSocket();
-    serverSocketNotifier = new QSocketNotifier(socketFd, QSocketNotifier::Read, this);
-    connect(serverSocketNotifier, &QSocketNotifier::activated, this,
-            &QLowEnergyControllerPrivate::handleConnectionRequest);
+    acceptingClients = true;
 }
 
 void QLowEnergyControllerPrivate::stopAdvertising()
 {
-    setState(QLowEnergyController::UnconnectedState);
+    acceptingClients = false;
+    closeServerSocket();
+    // Connected clients stay connected.
+    if (serverConnections.isEmpty()) {
+        pendingConnectionHandles.clear();
+        setState(QLowEnergyController::UnconnectedState);
+    }
     advertiser->stopAdvertising();
 }
 
+bool QLowEnergyControllerPrivate::updateAdvertisingData(
+        const QLowEnergyAdvertisingData &advertisingData,
+        const QLowEnergyAdvertisingData &scanResponseData)
+{
+    if (!advertiser) {
+        qCWarning(QT_BT_BLUEZ) << "Cannot update advertising data before advertising has started";
+        return false;
+    }
+    return advertiser->updateData(advertisingData, scanResponseData);
+}
+
+bool QLowEnergyControllerPrivate::listenForConnections()
+{
+    ServerSocket serverSocket;
+    if (!serverSocket.listen(localAdapter))
+        return false;
+
+    const int socketFd = serverSocket.takeSocket();
+    serverSocketNotifier = new QSocketNotifier(socketFd, QSocketNotifier::Read, this);
+    connect(serverSocketNotifier, &QSocketNotifier::activated, this,
+            &QLowEnergyControllerPrivate::handleConnectionRequest);
+    return true;
+}
+
 void QLowEnergyControllerPrivate::requestConnectionUpdate(const QLowEnergyConnectionParameters &params)
 {
     // The spec says that the connection update command can be used by both slave and master
@@ -408,9 +532,9 @@ void QLowEnergyControllerPrivate::requestConnectionUpdate(const QLowEnergyConnec
     // connection parameter update request, which we need to wrap in an ACL command, as BlueZ
     // does not allow user-space sockets for the signaling channel.
     if (role == QLowEnergyController::CentralRole)
-        hciManager->sendConnectionUpdateCommand(connectionHandle, params);
+        hciManager->sendConnectionUpdateCommand(activeLink->connectionHandle, params);
     else
-        hciManager->sendConnectionParameterUpdateRequest(connectionHandle, params);
+        hciManager->sendConnectionParameterUpdateRequest(activeLink->connectionHandle, params);
 }
 
 void QLowEnergyControllerPrivate::connectToDevice()
@@ -422,22 +546,22 @@ void QLowEnergyControllerPrivate::connectToDevice()
     }
 
     setState(QLowEnergyController::ConnectingState);
-    if (l2cpSocket)
-        delete l2cpSocket;
+    if (activeLink->l2cpSocket)
+        delete activeLink->l2cpSocket;
 
-    l2cpSocket = new QBluetoothSocket(QBluetoothServiceInfo::L2capProtocol, this);
-    connect(l2cpSocket, SIGNAL(connected()), this, SLOT(l2cpConnected()));
-    connect(l2cpSocket, SIGNAL(disconnected()), this, SLOT(l2cpDisconnected()));
-    connect(l2cpSocket, SIGNAL(error(QBluetoothSocket::SocketError)),
+    activeLink->l2cpSocket = new QBluetoothSocket(QBluetoothServiceInfo::L2capProtocol, this);
+    connect(activeLink->l2cpSocket, SIGNAL(connected()), this, SLOT(l2cpConnected()));
+    connect(activeLink->l2cpSocket, SIGNAL(disconnected()), this, SLOT(l2cpDisconnected()));
+    connect(activeLink->l2cpSocket, SIGNAL(error(QBluetoothSocket::SocketError)),
             this, SLOT(l2cpErrorChanged(QBluetoothSocket::SocketError)));
-    connect(l2cpSocket, SIGNAL(readyRead()), this, SLOT(l2cpReadyRead()));
+    connect(activeLink->l2cpSocket, SIGNAL(readyRead()), this, SLOT(l2cpReadyRead()));
 
     if (addressType == QLowEnergyController::PublicAddress)
-        l2cpSocket->d_ptr->lowEnergySocketType = BDADDR_LE_PUBLIC;
+        activeLink->l2cpSocket->d_ptr->lowEnergySocketType = BDADDR_LE_PUBLIC;
     else if (addressType == QLowEnergyController::RandomAddress)
-        l2cpSocket->d_ptr->lowEnergySocketType = BDADDR_LE_RANDOM;
+        activeLink->l2cpSocket->d_ptr->lowEnergySocketType = BDADDR_LE_RANDOM;
 
-    int sockfd = l2cpSocket->socketDescriptor();
+    int sockfd = activeLink->l2cpSocket->socketDescriptor();
     if (sockfd < 0) {
         qCWarning(QT_BT_BLUEZ) << "l2cp socket not initialised";
         setError(QLowEnergyController::ConnectionError);
@@ -462,16 +586,45 @@ void QLowEnergyControllerPrivate::connectToDevice()
 
     // connect
     // Unbuffered mode required to separate each GATT packet
-    l2cpSocket->connectToService(remoteDevice, ATTRIBUTE_CHANNEL_ID,
+    activeLink->l2cpSocket->connectToService(remoteDevice, ATTRIBUTE_CHANNEL_ID,
                                  QIODevice::ReadWrite | QIODevice::Unbuffered);
-    loadSigningDataIfNecessary(LocalSigningKey);
+    connectionManager->bondStore()->loadSigningData(remoteDevice, LeBondStore::LocalSigningKey);
+}
+
+#ifdef QT_BUILD_INTERNAL
+void QLowEnergyControllerPrivate::connectToAttSocket(int socketDescriptor)
+{
+    setState(QLowEnergyController::ConnectingState);
+    delete activeLink->l2cpSocket;
+
+    // the socket takes ownership of socketDescriptor
+    activeLink->l2cpSocket = new QBluetoothSocket(this);
+    connect(activeLink->l2cpSocket, SIGNAL(disconnected()), this, SLOT(l2cpDisconnected()));
+    connect(activeLink->l2cpSocket, SIGNAL(error(QBluetoothSocket::SocketError)),
+            this, SLOT(l2cpErrorChanged(QBluetoothSocket::SocketError)));
+    connect(activeLink->l2cpSocket, SIGNAL(readyRead()), this, SLOT(l2cpReadyRead()));
+    activeLink->l2cpSocket->setSocketDescriptor(socketDescriptor, QBluetoothServiceInfo::L2capProtocol,
+                                    QBluetoothSocket::ConnectedState,
+                                    QIODevice::ReadWrite | QIODevice::Unbuffered);
+    l2cpConnected();
+}
+
+Q_AUTOTEST_EXPORT void qt_connectLowEnergyControllerToAttSocket(QLowEnergyController *controller,
+                                                                int socketDescriptor)
+{
+    QLowEnergyControllerPrivate::get(controller)->connectToAttSocket(socketDescriptor);
 }
+#endif
 
 void QLowEnergyControllerPrivate::l2cpConnected()
 {
     Q_Q(QLowEnergyController);
 
-    securityLevelValue = securityLevel();
+    activeLink->securityLevelValue = securityLevel();
+    activeLink->connectionCounted = true;
+    connectionManager->connectionOpened();
+    startAttReceiver();
+    requestLinkLayerThroughput();
     exchangeMTU();
 
     setState(QLowEnergyController::ConnectedState);
@@ -480,8 +633,13 @@ void QLowEnergyControllerPrivate::l2cpConnected()
 
 void QLowEnergyControllerPrivate::disconnectFromDevice()
 {
+    // All GATT clients but the first one are dropped right away.
+    stopAcceptingClients();
+    while (serverConnections.count() > 1)
+        removeServerConnection(serverConnections.last());
+
     setState(QLowEnergyController::ClosingState);
-    l2cpSocket->close();
+    activeLink->l2cpSocket->close();
     resetController();
 }
 
@@ -515,7 +673,7 @@ void QLowEnergyControllerPrivate::l2cpErrorChanged(QBluetoothSocket::SocketError
     default:
         // these errors shouldn't happen -> as it means
         // the code in this file has bugs
-        qCDebug(QT_BT_BLUEZ) << "Unknown l2cp socket error: " << e << l2cpSocket->errorString();
+        qCDebug(QT_BT_BLUEZ) << "Unknown l2cp socket error: " << e << activeLink->l2cpSocket->errorString();
         setError(QLowEnergyController::UnknownError);
         break;
     }
@@ -529,42 +687,99 @@ void QLowEnergyControllerPrivate::l2cpErrorChanged(QBluetoothSocket::SocketError
 void QLowEnergyControllerPrivate::resetController()
 {
     openRequests.clear();
-    openPrepareWriteRequests.clear();
-    scheduledIndications.clear();
-    indicationInFlight = false;
+    if (requestTimer)
+        requestTimer->stop();
+    delayedRetries.clear();
+    if (retryTimer)
+        retryTimer->stop();
+    activeLink->openPrepareWriteRequests.clear();
+    readMultipleVariableSupported = true;
+    sweepServices.clear();
+    sweptServices.clear();
+    cachedServices.clear();
+    databaseHash.clear();
+    activeLink->scheduledIndications.clear();
+    activeLink->indicationInFlight = false;
+    activeLink->pendingNotifications.clear();
     requestPending = false;
     encryptionChangePending = false;
-    receivedMtuExchangeRequest = false;
-    securityLevelValue = -1;
-    connectionHandle = 0;
+    activeLink->receivedMtuExchangeRequest = false;
+    reliableWriteService.clear();
+    reliableWrites.clear();
+    failQueuedWriteCommands();
+    stopAttReceiver();
+    if (connectionManager)
+        connectionManager->unscheduleWriteCommands(this);
+    if (activeLink->connectionCounted) {
+        connectionManager->connectionClosed();
+        activeLink->connectionCounted = false;
+    }
+    disconnect(activeLink->socketWritableConnection);
+    activeLink->waitingForWritableSocket = false;
+    activeLink->mtuSize = ATT_DEFAULT_LE_MTU;
+    activeLink->linkLayerThroughputRequested = false;
+    activeLink->securityLevelValue = -1;
+    activeLink->connectionHandle = 0;
+    // Each calculator holds two sockets, they are not kept for peers which are gone.
+    qDeleteAll(cmacCalculators);
+    cmacCalculators.clear();
 }
 
 void QLowEnergyControllerPrivate::l2cpReadyRead()
 {
-    const QByteArray incomingPacket = l2cpSocket->readAll();
-    qCDebug(QT_BT_BLUEZ) << "Received size:" << incomingPacket.size() << "data:"
-                         << incomingPacket.toHex();
-    if (incomingPacket.isEmpty())
+    // Like the former readAll(), this treats everything buffered by the socket as one
+    // ATT PDU: QBluetoothSocket reads one L2CAP SDU before each readyRead(). The data is
+    // copied from the socket's buffer into the reused receiveBuffer, which saves the
+    // allocation per PDU. Notifications are processed from there, other PDUs are
+    // copied into a QByteArray once more.
+    const qint64 available = activeLink->l2cpSocket->bytesAvailable();
+    if (receiveBuffer.size() < available)
+        receiveBuffer.resize(int(available));
+    const int size = int(activeLink->l2cpSocket->read(receiveBuffer.data(), receiveBuffer.size()));
+    if (size <= 0)
         return;
 
-    const quint8 command = incomingPacket.constData()[0];
+    processIncomingPacket(receiveBuffer.constData(), size);
+}
+
+void QLowEnergyControllerPrivate::processIncomingPacket(const char *data, int size)
+{
+    connectionManager->addBytesReceived(size);
+    statistics->bytesReceived += size;
+    if (Q_UNLIKELY(packetCapture)) {
+        packetCapture->writeL2capPacket(BtSnoopWriter::Received, activeLink->connectionHandle,
+                                        ATTRIBUTE_CHANNEL_ID, data, size);
+    }
+    if (QT_BT_BLUEZ().isDebugEnabled()) {
+        qCDebug(QT_BT_BLUEZ) << "Received size:" << size << "data:"
+                             << QByteArray::fromRawData(data, size).toHex();
+    }
+
+    const quint8 command = data[0];
     switch (command) {
     case ATT_OP_HANDLE_VAL_NOTIFICATION:
     {
-        processUnsolicitedReply(incomingPacket);
+        processUnsolicitedReply(data, size);
         return;
     }
     case ATT_OP_HANDLE_VAL_INDICATION:
     {
-        //send confirmation
-        QByteArray packet;
-        packet.append(static_cast<char>(ATT_OP_HANDLE_VAL_CONFIRMATION));
-        sendPacket(packet);
+        //send confirmation, unless the I/O thread has done so already
+        if (!activeLink->attReceiver) {
+            QByteArray packet;
+            packet.append(static_cast<char>(ATT_OP_HANDLE_VAL_CONFIRMATION));
+            sendPacket(packet);
+        }
 
-        processUnsolicitedReply(incomingPacket);
+        processUnsolicitedReply(data, size);
         return;
     }
+    default:
+        break;
+    }
 
+    const QByteArray incomingPacket(data, size);
+    switch (command) {
     case ATT_OP_EXCHANGE_MTU_REQUEST:
         handleExchangeMtuRequest(incomingPacket);
         return;
@@ -584,6 +799,7 @@ void QLowEnergyControllerPrivate::l2cpReadyRead()
         handleReadBlobRequest(incomingPacket);
         return;
     case ATT_OP_READ_MULTIPLE_REQUEST:
+    case ATT_OP_READ_MULTIPLE_VARIABLE_REQUEST:
         handleReadMultipleRequest(incomingPacket);
         return;
     case ATT_OP_READ_BY_GROUP_REQUEST:
@@ -601,8 +817,8 @@ void QLowEnergyControllerPrivate::l2cpReadyRead()
         handleExecuteWriteRequest(incomingPacket);
         return;
     case ATT_OP_HANDLE_VAL_CONFIRMATION:
-        if (indicationInFlight) {
-            indicationInFlight = false;
+        if (activeLink->indicationInFlight) {
+            activeLink->indicationInFlight = false;
             sendNextIndication();
         } else {
             qCWarning(QT_BT_BLUEZ) << "received unexpected handle value confirmation";
@@ -616,16 +832,100 @@ void QLowEnergyControllerPrivate::l2cpReadyRead()
 
     if (openRequests.isEmpty()) {
         qCWarning(QT_BT_BLUEZ) << "Received unexpected packet from peer, disconnecting.";
-        disconnectFromDevice();
+        disconnectPeer();
+        return;
+    }
+
+    if (retryRequest(incomingPacket)) {
+        sendNextPendingRequest();
         return;
     }
 
     const Request request = openRequests.dequeue();
+    recordRequestCompleted(request);
     processReply(request, incomingPacket);
 
     sendNextPendingRequest();
 }
 
+/*!
+    \internal
+
+    Moves reading from the L2CP socket to the I/O thread of the connection
+    manager if ioThreadEnabled is set. QBluetoothSocket keeps handling writes
+    and is woken up again to process the disconnection.
+ */
+void QLowEnergyControllerPrivate::startAttReceiver()
+{
+    if (!ioThreadEnabled || activeLink->attReceiver)
+        return;
+
+    QSocketNotifier * const socketNotifier = activeLink->l2cpSocket->d_ptr->readNotifier;
+    if (!socketNotifier)
+        return;
+
+    activeLink->attReceiver = new LeAttReceiver(activeLink->l2cpSocket->socketDescriptor());
+    if (!activeLink->attReceiver->isValid()) {
+        delete activeLink->attReceiver;
+        activeLink->attReceiver = nullptr;
+        return;
+    }
+
+    socketNotifier->setEnabled(false);
+    if (activeLink->l2cpSocket->bytesAvailable() > 0)
+        l2cpReadyRead();
+
+    connect(activeLink->attReceiver, &LeAttReceiver::packetsAvailable,
+            this, &QLowEnergyControllerPrivate::attPacketsAvailable);
+    connect(activeLink->attReceiver, &LeAttReceiver::socketClosed,
+            this, &QLowEnergyControllerPrivate::attSocketClosed);
+    activeLink->attReceiver->moveToThread(connectionManager->ioThread());
+    QMetaObject::invokeMethod(activeLink->attReceiver, "start", Qt::QueuedConnection);
+}
+
+void QLowEnergyControllerPrivate::stopAttReceiver()
+{
+    if (!activeLink->attReceiver)
+        return;
+
+    activeLink->attReceiver->disconnect(this);
+    activeLink->attReceiver->deleteLater();
+    activeLink->attReceiver = nullptr;
+}
+
+void QLowEnergyControllerPrivate::attPacketsAvailable()
+{
+    Link * const previous = activeLink;
+    if (Link * const connection = serverConnectionForAttReceiver(sender()))
+        activateServerConnection(connection);
+    LeAttReceiver * const receiver = activeLink->attReceiver;
+    if (receiver && sender() == receiver) {
+        // processed in place, only PDUs other than notifications are copied
+        const LeAttReceiver::PacketBatch &packets = receiver->takePackets();
+        for (int i = 0; i < packets.count(); ++i) {
+            // a packet may cause the connection to be closed
+            if (activeLink->attReceiver != receiver)
+                break;
+            processIncomingPacket(packets.packet(i), packets.packetSize(i));
+        }
+    }
+    restoreActiveLink(previous);
+}
+
+void QLowEnergyControllerPrivate::attSocketClosed()
+{
+    Link * const previous = activeLink;
+    if (Link * const connection = serverConnectionForAttReceiver(sender()))
+        activateServerConnection(connection);
+    if (activeLink->attReceiver && sender() == activeLink->attReceiver) {
+        stopAttReceiver();
+        // let QBluetoothSocket find out about the error or disconnection
+        if (activeLink->l2cpSocket && activeLink->l2cpSocket->d_ptr->readNotifier)
+            activeLink->l2cpSocket->d_ptr->readNotifier->setEnabled(true);
+    }
+    restoreActiveLink(previous);
+}
+
 /*!
  * Called when the request for socket encryption has been
  * processed by the kernel. Such requests take time as the kernel
@@ -644,7 +944,7 @@ void QLowEnergyControllerPrivate::encryptionChangedEvent(
     if (remoteDevice != address)
         return;
 
-    securityLevelValue = securityLevel();
+    activeLink->securityLevelValue = securityLevel();
 
     // On success continue to process ATT command queue
     if (!wasSuccess) {
@@ -669,14 +969,10 @@ void QLowEnergyControllerPrivate::encryptionChangedEvent(
                     service->setError(QLowEnergyService::DescriptorWriteError);
             }
         } else if (failedRequest.command == ATT_OP_PREPARE_WRITE_REQUEST) {
-            uint handleData = failedRequest.reference.toUInt();
-            const QLowEnergyHandle attrHandle = (handleData & 0xffff);
-            const QByteArray newValue = failedRequest.reference2.toByteArray();
-
             // Prepare command failed, cancel pending prepare queue on
             // the device. The appropriate (Descriptor|Characteristic)WriteError
             // is emitted too once the execute write request comes through
-            sendExecuteWriteRequest(attrHandle, newValue, true);
+            cancelLongWrite();
         }
     }
 
@@ -686,141 +982,611 @@ void QLowEnergyControllerPrivate::encryptionChangedEvent(
 
 void QLowEnergyControllerPrivate::sendPacket(const QByteArray &packet)
 {
-    qint64 result = l2cpSocket->write(packet.constData(),
-                                      packet.size());
+    sendPacket(packet.constData(), packet.size());
+}
+
+qint64 QLowEnergyControllerPrivate::sendPacket(const char *data, int size)
+{
+    qint64 result = activeLink->l2cpSocket->write(data, size);
     // We ignore result == 0 which is likely to be caused by EAGAIN.
     // This packet is effectively discarded but the controller can still recover
 
     if (result == -1) {
         qCDebug(QT_BT_BLUEZ) << "Cannot write L2CP packet:" << hex
-                             << packet.toHex()
-                             << l2cpSocket->errorString();
+                             << QByteArray::fromRawData(data, size).toHex()
+                             << activeLink->l2cpSocket->errorString();
         setError(QLowEnergyController::NetworkError);
-    } else if (result < packet.size()) {
-        qCWarning(QT_BT_BLUEZ) << "L2CP write request incomplete:"
-                               << result << "of" << packet.size();
+    } else {
+        recordPacketSent(data, int(result));
+        if (result < size) {
+            qCWarning(QT_BT_BLUEZ) << "L2CP write request incomplete:"
+                                   << result << "of" << size;
+        }
     }
-
+    return result;
 }
 
-void QLowEnergyControllerPrivate::sendNextPendingRequest()
+void QLowEnergyControllerPrivate::recordPacketSent(const char *data, int size)
 {
-    if (openRequests.isEmpty() || requestPending || encryptionChangePending)
+    if (size <= 0)
         return;
+    connectionManager->addBytesSent(size);
+    statistics->bytesSent += size;
+    if (Q_UNLIKELY(packetCapture)) {
+        packetCapture->writeL2capPacket(BtSnoopWriter::Sent, activeLink->connectionHandle,
+                                        ATTRIBUTE_CHANNEL_ID, data, size);
+    }
+}
 
-    const Request &request = openRequests.head();
-//    qCDebug(QT_BT_BLUEZ) << "Sending request, type:" << hex << request.command
-//             << request.payload.toHex();
+/*!
+    \internal
 
-    requestPending = true;
-    sendPacket(request.payload);
+    Queues a write command carrying \a size bytes of \a data for the
+    characteristic value at \a valueHandle on behalf of \a writer.
+    The caller must ensure that the data fits into a single packet.
+ */
+void QLowEnergyControllerPrivate::enqueueWriteCommand(QLowEnergyCharacteristicWriter *writer,
+                                                      QLowEnergyHandle valueHandle,
+                                                      const char *data, int size)
+{
+    Q_ASSERT(size <= activeLink->mtuSize - WRITE_REQUEST_HEADER_SIZE);
+
+    WriteCommand command;
+    command.writer = writer;
+    command.packet.resize(WRITE_REQUEST_HEADER_SIZE + size);
+    command.packet[0] = ATT_OP_WRITE_COMMAND;
+    putBtData(valueHandle, command.packet.data() + 1);
+    memcpy(command.packet.data() + WRITE_REQUEST_HEADER_SIZE, data, size);
+    writeCommandQueue.enqueue(command);
 }
 
-QLowEnergyHandle parseReadByTypeCharDiscovery(
-        QLowEnergyServicePrivate::CharData *charData,
-        const char *data, quint16 elementLength)
+/*!
+    \internal
+
+    Hands the queued write commands to the connection manager, which lets the
+    connections of the adapter take turns at writing them. If the socket buffer is
+    full the remaining commands are sent once the socket becomes writable again.
+    Write commands do not have responses and therefore bypass openRequests.
+ */
+void QLowEnergyControllerPrivate::sendQueuedWriteCommands()
 {
-    Q_ASSERT(charData);
-    Q_ASSERT(data);
+    // writers may queue more data from their bytesWritten() handlers
+    if (sendingWriteCommands)
+        return;
+    if (activeLink->waitingForWritableSocket)
+        return;
+    if (!activeLink->l2cpSocket || activeLink->l2cpSocket->state() != QBluetoothSocket::ConnectedState) {
+        failQueuedWriteCommands();
+        return;
+    }
+    if (writeCommandQueue.isEmpty())
+        return;
 
-    QLowEnergyHandle attributeHandle = bt_get_le16(&data[0]);
-    charData->properties =
-            (QLowEnergyCharacteristic::PropertyTypes)(data[2] & 0xff);
-    charData->valueHandle = bt_get_le16(&data[3]);
+    connectionManager->scheduleWriteCommands(this);
+}
 
-    if (elementLength == 7) // 16 bit uuid
-        charData->uuid = QBluetoothUuid(bt_get_le16(&data[5]));
-    else
-        charData->uuid = convert_uuid128((quint128 *)&data[5]);
+/*!
+    \internal
 
-    qCDebug(QT_BT_BLUEZ) << "Found handle:" << hex << attributeHandle
-             << "properties:" << charData->properties
-             << "value handle:" << charData->valueHandle
-             << "uuid:" << charData->uuid.toString();
+    Writes up to \a maxCommands queued write commands. Returns \c true if more
+    commands are waiting and the socket is still able to take them.
+ */
+bool QLowEnergyControllerPrivate::writeQueuedCommands(int maxCommands)
+{
+    // the socket might have been closed while waiting for our turn
+    if (!activeLink->l2cpSocket || activeLink->l2cpSocket->state() != QBluetoothSocket::ConnectedState) {
+        failQueuedWriteCommands();
+        return false;
+    }
 
-    return attributeHandle;
+    sendingWriteCommands = true;
+    for (int sent = 0; sent < maxCommands && !writeCommandQueue.isEmpty(); ++sent) {
+        const QByteArray &packet = writeCommandQueue.head().packet;
+        const qint64 result = activeLink->l2cpSocket->write(packet.constData(), packet.size());
+        if (result == 0) {
+            // EAGAIN
+            waitForWritableSocket();
+            sendingWriteCommands = false;
+            return false;
+        }
+
+        if (result == -1) {
+            qCDebug(QT_BT_BLUEZ) << "Cannot write L2CP packet:" << activeLink->l2cpSocket->errorString();
+            sendingWriteCommands = false;
+            failQueuedWriteCommands();
+            setError(QLowEnergyController::NetworkError);
+            return false;
+        }
+
+        recordPacketSent(packet.constData(), int(result));
+        const WriteCommand command = writeCommandQueue.dequeue();
+        if (command.writer)
+            command.writer->chunkWritten(command.packet.size() - WRITE_REQUEST_HEADER_SIZE);
+    }
+    sendingWriteCommands = false;
+    if (!writeCommandQueue.isEmpty())
+        return true;
+
+    // requests queued after the commands were held back by sendNextPendingRequest()
+    sendNextPendingRequest();
+    return false;
 }
 
-QLowEnergyHandle parseReadByTypeIncludeDiscovery(
-        QList<QBluetoothUuid> *foundServices,
-        const char *data, quint16 elementLength)
-{
-    Q_ASSERT(foundServices);
-    Q_ASSERT(data);
+/*!
+    \internal
 
-    QLowEnergyHandle attributeHandle = bt_get_le16(&data[0]);
+    Resumes the queued write commands and pending notifications once the socket
+    buffer has room again.
 
-    // the next 2 elements are not required as we have discovered
-    // all (primary/secondary) services already. Now we are only
-    // interested in their relationship to each other
-    // data[2] -> included service start handle
-    // data[4] -> included service end handle
+    A descriptor may only have one enabled notifier per type, so the write notifier
+    of the L2CP socket itself is borrowed. The socket is unbuffered and therefore
+    merely disables its notifier again when it is activated.
+ */
+void QLowEnergyControllerPrivate::waitForWritableSocket()
+{
+    if (activeLink->waitingForWritableSocket)
+        return;
 
-    if (elementLength == 8) //16 bit uuid
-        foundServices->append(QBluetoothUuid(bt_get_le16(&data[6])));
-    else
-        foundServices->append(convert_uuid128((quint128 *) &data[6]));
+    QSocketNotifier * const notifier = activeLink->l2cpSocket->d_ptr->connectWriteNotifier;
+    if (!notifier) {
+        failQueuedWriteCommands();
+        activeLink->pendingNotifications.clear();
+        return;
+    }
 
-    qCDebug(QT_BT_BLUEZ) << "Found included service: " << hex
-                         << attributeHandle << "uuid:" << *foundServices;
+    activeLink->waitingForWritableSocket = true;
+    Link * const link = activeLink;
+    link->socketWritableConnection = connect(notifier, &QSocketNotifier::activated,
+                                             this, [this, link]() {
+        if (link != &defaultLink && !serverConnections.contains(link))
+            return;
+        Link * const previous = activeLink;
+        activateServerConnection(link);
+        disconnect(link->socketWritableConnection);
+        link->waitingForWritableSocket = false;
+        sendQueuedWriteCommands();
+        sendPendingNotifications();
+        restoreActiveLink(previous);
+    });
+    notifier->setEnabled(true);
+}
 
-    return attributeHandle;
+void QLowEnergyControllerPrivate::failQueuedWriteCommands()
+{
+    const QQueue<WriteCommand> commands = writeCommandQueue;
+    writeCommandQueue.clear();
+    for (const WriteCommand &command : commands) {
+        if (command.writer && command.writer->isOpen())
+            command.writer->writeFailed();
+    }
 }
 
-void QLowEnergyControllerPrivate::processReply(
-        const Request &request, const QByteArray &response)
+/*
+    Returns whether a later write to the same attribute may replace \a request.
+    This is restricted to descriptors and readable characteristics whose value
+    reflects a state. Other characteristics such as control points may
+    interpret each write as a separate command.
+ */
+bool QLowEnergyControllerPrivate::isSupersedableWrite(const Request &request)
 {
-    Q_Q(QLowEnergyController);
+    const uint ref = request.reference.toUInt();
+    const QLowEnergyHandle charHandle = (ref & 0xffff);
+    const QLowEnergyHandle descriptorHandle = ((ref >> 16) & 0xffff);
+    if (descriptorHandle)
+        return true;
 
-    quint8 command = response.constData()[0];
+    return characteristicForHandle(charHandle).properties() & QLowEnergyCharacteristic::Read;
+}
 
-    bool isErrorResponse = false;
-    // if error occurred 2. byte is previous request type
-    if (command == ATT_OP_ERROR_RESPONSE) {
-        dumpErrorInformation(response);
-        command = response.constData()[1];
-        isErrorResponse = true;
-    }
+/*!
+    \internal
 
-    switch (command) {
-    case ATT_OP_EXCHANGE_MTU_REQUEST: // in case of error
-    case ATT_OP_EXCHANGE_MTU_RESPONSE:
-    {
-        Q_ASSERT(request.command == ATT_OP_EXCHANGE_MTU_REQUEST);
-        if (isErrorResponse) {
-            mtuSize = ATT_DEFAULT_LE_MTU;
-            break;
-        }
+    Adds \a request to the queue of requests which require a response from the
+    remote device. Only one of them can be in flight at any given time.
 
-        const char *data = response.constData();
-        quint16 mtu = bt_get_le16(&data[1]);
-        mtuSize = mtu;
-        if (mtuSize < ATT_DEFAULT_LE_MTU)
-            mtuSize = ATT_DEFAULT_LE_MTU;
+    Requests are ordered by their priority. Requests with equal priority are
+    processed in the order of their arrival. This ensures that reads and writes
+    triggered by the user are not stuck behind long running service discovery.
+    The head of the queue is never displaced while it is waiting for its response
+    or for an encryption change.
 
-        qCDebug(QT_BT_BLUEZ) << "Server MTU:" << mtu << "resulting mtu:" << mtuSize;
-    }
-        break;
-    case ATT_OP_READ_BY_GROUP_REQUEST: // in case of error
-    case ATT_OP_READ_BY_GROUP_RESPONSE:
-    {
-        // Discovering services
-        Q_ASSERT(request.command == ATT_OP_READ_BY_GROUP_REQUEST);
+    A write request that has not been sent yet is superseded by a subsequent write
+    request to the same attribute if isSupersedableWrite() permits it. Only the
+    last value is written to the device.
 
-        const quint16 type = request.reference.toUInt();
+    ATT commands such as write without response, signed write and handle value
+    confirmations do not need a response. They bypass this queue and are written
+    straight to the socket via sendPacket().
+ */
+void QLowEnergyControllerPrivate::enqueueRequest(const Request &request)
+{
+    const int firstMovable = (requestPending || encryptionChangePending) ? 1 : 0;
 
-        if (isErrorResponse) {
-            if (type == GATT_SECONDARY_SERVICE) {
-                setState(QLowEnergyController::DiscoveredState);
-                q->discoveryFinished();
-            } else { // search for secondary services
-                sendReadByGroupRequest(0x0001, 0xFFFF, GATT_SECONDARY_SERVICE);
+    if (request.command == ATT_OP_WRITE_REQUEST && isSupersedableWrite(request)) {
+        for (int i = firstMovable; i < openRequests.size(); i++) {
+            Request &queued = openRequests[i];
+            if (queued.command != ATT_OP_WRITE_REQUEST
+                    || queued.reference != request.reference) {
+                continue;
             }
-            break;
+
+            qCDebug(QT_BT_BLUEZ) << "Superseding pending write request for" << hex
+                                 << request.reference.toUInt();
+            queued.payload = request.payload;
+            queued.reference2 = request.reference2;
+            queued.priority = qMax(queued.priority, request.priority);
+            return;
         }
+    }
 
-        QLowEnergyHandle start = 0, end = 0;
-        const quint16 elementLength = response.constData()[1];
+    int position = openRequests.size();
+    while (position > firstMovable && openRequests.at(position - 1).priority < request.priority)
+        --position;
+    openRequests.insert(position, request);
+    if (openRequests.at(position).enqueueTime < 0)
+        openRequests[position].enqueueTime = requestClock.elapsed();
+    if (openRequests.size() > statistics.constData()->maxQueueDepth)
+        statistics->maxQueueDepth = openRequests.size();
+}
+
+void QLowEnergyControllerPrivate::sendNextPendingRequest()
+{
+    if (openRequests.isEmpty() || requestPending || encryptionChangePending)
+        return;
+    // the request must not overtake write commands queued before it
+    if (!writeCommandQueue.isEmpty())
+        return;
+
+    Request &request = openRequests.head();
+//    qCDebug(QT_BT_BLUEZ) << "Sending request, type:" << hex << request.command
+//             << request.payload.toHex();
+
+    // requests prepended by the reply handlers skip enqueueRequest()
+    requestSentTime = requestClock.elapsed();
+    if (request.enqueueTime < 0)
+        request.enqueueTime = requestSentTime;
+
+    if (requestTimeout > 0) {
+        if (!requestTimer) {
+            requestTimer = new QTimer(this);
+            connect(requestTimer, &QTimer::timeout,
+                    this, &QLowEnergyControllerPrivate::checkRequestTimeout);
+        }
+        const int interval = qMin(requestTimeout, 1000);
+        if (!requestTimer->isActive() || requestTimer->interval() != interval)
+            requestTimer->start(interval);
+    }
+
+    requestPending = true;
+    sendPacket(request.payload);
+}
+
+/*!
+    \internal
+
+    Called periodically while requests are outstanding. The deadline of the
+    request in flight is therefore checked with a granularity of up to one second.
+
+    A request without response within requestTimeout terminates the ATT bearer.
+    No further requests may be sent on it, so the connection is closed and the
+    application can reconnect instead of waiting forever.
+ */
+void QLowEnergyControllerPrivate::checkRequestTimeout()
+{
+    if (!requestPending || openRequests.isEmpty()) {
+        requestTimer->stop();
+        return;
+    }
+    if (requestTimeout <= 0 || requestClock.elapsed() - requestSentTime < requestTimeout)
+        return;
+
+    ++statistics->timedOutRequests;
+    qCWarning(QT_BT_BLUEZ) << "ATT request" << hex << openRequests.head().command << dec
+                           << "timed out after" << requestTimeout << "ms, disconnecting";
+    requestTimer->stop();
+    setError(QLowEnergyController::NetworkError);
+    disconnectFromDevice();
+}
+
+/*!
+    \internal
+
+    Requeues the request in flight if \a response reports a temporary failure of
+    an idempotent read and readRetryCount permits another attempt. Returns \c true
+    if the request was requeued.
+
+    The peer reported that it is short of resources. Each further attempt therefore
+    waits twice as long as the previous one, starting at retryBackoffInitial.
+ */
+bool QLowEnergyControllerPrivate::retryRequest(const QByteArray &response)
+{
+    if (readRetryCount <= 0 || response.size() < ERROR_RESPONSE_HEADER_SIZE
+            || response.at(0) != ATT_OP_ERROR_RESPONSE) {
+        return false;
+    }
+
+    const Request &request = openRequests.head();
+    switch (request.command) {
+    case ATT_OP_READ_REQUEST:
+    case ATT_OP_READ_BLOB_REQUEST:
+    case ATT_OP_READ_MULTIPLE_REQUEST:
+    case ATT_OP_READ_MULTIPLE_VARIABLE_REQUEST:
+        break;
+    default:
+        return false;
+    }
+
+    const quint8 errorCode = response.at(4);
+    if (errorCode != ATT_ERROR_UNLIKELY && errorCode != ATT_ERROR_INSUF_RESOURCES)
+        return false;
+    if (request.retries >= readRetryCount)
+        return false;
+
+    Request retry = openRequests.dequeue();
+    ++retry.retries;
+    ++statistics->retriedRequests;
+    const int delay = qMin(retryBackoffInitial << qMin(retry.retries - 1, 8),
+                           retryBackoffMaximum);
+    qCDebug(QT_BT_BLUEZ) << "Retrying read request" << hex << retry.command << dec
+                         << "attempt" << retry.retries << "in" << delay << "ms";
+    delayedRetries.append({ requestClock.elapsed() + delay, retry });
+
+    if (!retryTimer) {
+        retryTimer = new QTimer(this);
+        retryTimer->setSingleShot(true);
+        connect(retryTimer, &QTimer::timeout,
+                this, &QLowEnergyControllerPrivate::requeueDelayedRetries);
+    }
+    if (!retryTimer->isActive() || retryTimer->remainingTime() > delay)
+        retryTimer->start(delay);
+    return true;
+}
+
+/*!
+    \internal
+
+    Moves the delayed reads whose backoff has expired back into the request queue.
+ */
+void QLowEnergyControllerPrivate::requeueDelayedRetries()
+{
+    const qint64 now = requestClock.elapsed();
+    qint64 nextDueTime = -1;
+    for (int i = 0; i < delayedRetries.size(); ) {
+        const qint64 dueTime = delayedRetries.at(i).dueTime;
+        if (dueTime <= now) {
+            enqueueRequest(delayedRetries.takeAt(i).request);
+            continue;
+        }
+        if (nextDueTime < 0 || dueTime < nextDueTime)
+            nextDueTime = dueTime;
+        ++i;
+    }
+
+    if (nextDueTime >= 0)
+        retryTimer->start(int(nextDueTime - now));
+    sendNextPendingRequest();
+}
+
+/*!
+    \internal
+
+    Passes the mark of the last value read during the discovery of \a service on
+    to a retry of another read of the service which is still pending. Returns
+    \c true if there is such a retry; the discovery then continues once it is done.
+ */
+bool QLowEnergyControllerPrivate::passLastValueToRetry(
+        const QSharedPointer<QLowEnergyServicePrivate> &service)
+{
+    const auto isRetriedRead = [&service](const Request &request) {
+        if (request.retries == 0 || request.priority != BackgroundPriority)
+            return false;
+
+        quint32 handleData = 0;
+        switch (request.command) {
+        case ATT_OP_READ_REQUEST:
+        case ATT_OP_READ_BLOB_REQUEST:
+            handleData = request.reference.toUInt();
+            break;
+        case ATT_OP_READ_MULTIPLE_REQUEST:
+        case ATT_OP_READ_MULTIPLE_VARIABLE_REQUEST:
+            handleData = request.reference.value<ReadTargetList>().first().second;
+            break;
+        default:
+            return false;
+        }
+        const QLowEnergyHandle charHandle = (handleData & 0xffff);
+        return charHandle >= service->startHandle && charHandle <= service->endHandle;
+    };
+
+    // Delayed retries are requeued in the order of their due time,
+    // behind any retry which is queued already.
+    Request *lastRetry = nullptr;
+    qint64 lastDueTime = -1;
+    for (DelayedRetry &retry : delayedRetries) {
+        if (retry.dueTime >= lastDueTime && isRetriedRead(retry.request)) {
+            lastRetry = &retry.request;
+            lastDueTime = retry.dueTime;
+        }
+    }
+    for (int i = openRequests.size() - 1; !lastRetry && i >= 0; --i) {
+        if (isRetriedRead(openRequests.at(i)))
+            lastRetry = &openRequests[i];
+    }
+
+    if (!lastRetry)
+        return false;
+    lastRetry->reference2 = true;
+    return true;
+}
+
+void QLowEnergyControllerPrivate::recordRequestCompleted(const Request &request)
+{
+    statistics->recordRequest(request.command, requestClock.elapsed() - request.enqueueTime);
+}
+
+/*!
+    \internal
+
+    Starts writing all ATT packets of the connection to \a fileName.
+    Replaces a capture which is already running.
+ */
+bool QLowEnergyControllerPrivate::startPacketCapture(const QString &fileName)
+{
+    stopPacketCapture();
+
+    BtSnoopWriter *writer = new BtSnoopWriter(this);
+    if (!writer->open(fileName)) {
+        qCWarning(QT_BT_BLUEZ) << "Cannot start packet capture:" << writer->errorString();
+        delete writer;
+        return false;
+    }
+    packetCapture = writer;
+    return true;
+}
+
+void QLowEnergyControllerPrivate::stopPacketCapture()
+{
+    delete packetCapture;
+    packetCapture = nullptr;
+}
+
+void QLowEnergyControllerPrivate::cancelRequests(
+        const QSharedPointer<QLowEnergyServicePrivate> &service)
+{
+    // The request in flight runs to completion, and so do the blob reads continuing
+    // it. Service discovery, prepared writes and requests spanning several attributes
+    // are not cancelled either.
+    const auto isCancellable = [&service](const Request &request) {
+        if (request.priority != UserPriority)
+            return false;
+        if (request.command != ATT_OP_READ_REQUEST && request.command != ATT_OP_WRITE_REQUEST)
+            return false;
+        const QLowEnergyHandle handle = bt_get_le16(request.payload.constData() + 1);
+        return handle >= service->startHandle && handle <= service->endHandle;
+    };
+
+    QVector<Request> cancelled;
+    const int firstMovable = (requestPending || encryptionChangePending) ? 1 : 0;
+    for (int i = openRequests.size() - 1; i >= firstMovable; --i) {
+        if (isCancellable(openRequests.at(i)))
+            cancelled.prepend(openRequests.takeAt(i));
+    }
+    for (int i = delayedRetries.size() - 1; i >= 0; --i) {
+        if (isCancellable(delayedRetries.at(i).request))
+            cancelled.prepend(delayedRetries.takeAt(i).request);
+    }
+
+    // Nobody is left to receive an error either. Reporting one would merely leave
+    // the next service object created for the service in an error state.
+    statistics->cancelledRequests += cancelled.count();
+}
+
+QLowEnergyHandle parseReadByTypeCharDiscovery(
+        QLowEnergyServicePrivate::CharData *charData,
+        const char *data, quint16 elementLength)
+{
+    Q_ASSERT(charData);
+    Q_ASSERT(data);
+
+    QLowEnergyHandle attributeHandle = bt_get_le16(&data[0]);
+    charData->properties =
+            (QLowEnergyCharacteristic::PropertyTypes)(data[2] & 0xff);
+    charData->valueHandle = bt_get_le16(&data[3]);
+
+    if (elementLength == 7) // 16 bit uuid
+        charData->uuid = QBluetoothUuid(bt_get_le16(&data[5]));
+    else
+        charData->uuid = convert_uuid128((quint128 *)&data[5]);
+
+    qCDebug(QT_BT_BLUEZ) << "Found handle:" << hex << attributeHandle
+             << "properties:" << charData->properties
+             << "value handle:" << charData->valueHandle
+             << "uuid:" << charData->uuid.toString();
+
+    return attributeHandle;
+}
+
+QLowEnergyHandle parseReadByTypeIncludeDiscovery(
+        QList<QBluetoothUuid> *foundServices,
+        const char *data, quint16 elementLength)
+{
+    Q_ASSERT(foundServices);
+    Q_ASSERT(data);
+
+    QLowEnergyHandle attributeHandle = bt_get_le16(&data[0]);
+
+    // the next 2 elements are not required as we have discovered
+    // all (primary/secondary) services already. Now we are only
+    // interested in their relationship to each other
+    // data[2] -> included service start handle
+    // data[4] -> included service end handle
+
+    if (elementLength == 8) //16 bit uuid
+        foundServices->append(QBluetoothUuid(bt_get_le16(&data[6])));
+    else
+        foundServices->append(convert_uuid128((quint128 *) &data[6]));
+
+    qCDebug(QT_BT_BLUEZ) << "Found included service: " << hex
+                         << attributeHandle << "uuid:" << *foundServices;
+
+    return attributeHandle;
+}
+
+void QLowEnergyControllerPrivate::processReply(
+        const Request &request, const QByteArray &response)
+{
+    Q_Q(QLowEnergyController);
+
+    quint8 command = response.constData()[0];
+
+    bool isErrorResponse = false;
+    // if error occurred 2. byte is previous request type
+    if (command == ATT_OP_ERROR_RESPONSE) {
+        dumpErrorInformation(response);
+        command = response.constData()[1];
+        isErrorResponse = true;
+    }
+
+    switch (command) {
+    case ATT_OP_EXCHANGE_MTU_REQUEST: // in case of error
+    case ATT_OP_EXCHANGE_MTU_RESPONSE:
+    {
+        Q_ASSERT(request.command == ATT_OP_EXCHANGE_MTU_REQUEST);
+        if (isErrorResponse) {
+            activeLink->mtuSize = ATT_DEFAULT_LE_MTU;
+            emit q->mtuChanged(activeLink->mtuSize);
+            break;
+        }
+
+        const char *data = response.constData();
+        quint16 mtu = bt_get_le16(&data[1]);
+        activeLink->mtuSize = qMax<quint16>(ATT_DEFAULT_LE_MTU, qMin(mtu, localRxMtu()));
+
+        qCDebug(QT_BT_BLUEZ) << "Server MTU:" << mtu << "resulting mtu:" << activeLink->mtuSize;
+        emit q->mtuChanged(activeLink->mtuSize);
+    }
+        break;
+    case ATT_OP_READ_BY_GROUP_REQUEST: // in case of error
+    case ATT_OP_READ_BY_GROUP_RESPONSE:
+    {
+        // Discovering services
+        Q_ASSERT(request.command == ATT_OP_READ_BY_GROUP_REQUEST);
+
+        const quint16 type = request.reference.toUInt();
+
+        if (isErrorResponse) {
+            if (type == GATT_SECONDARY_SERVICE) {
+                storeAttributeCache();
+                setState(QLowEnergyController::DiscoveredState);
+                q->discoveryFinished();
+            } else { // search for secondary services
+                sendReadByGroupRequest(0x0001, 0xFFFF, GATT_SECONDARY_SERVICE);
+            }
+            break;
+        }
+
+        QLowEnergyHandle start = 0, end = 0;
+        const quint16 elementLength = response.constData()[1];
         const quint16 numElements = (response.size() - 2) / elementLength;
         quint16 offset = 2;
         const char *data = response.constData();
@@ -841,6 +1607,10 @@ void QLowEnergyControllerPrivate::processReply(
             qCDebug(QT_BT_BLUEZ) << "Found uuid:" << uuid << "start handle:" << hex
                      << start << "end handle:" << end;
 
+            const QSharedPointer<QLowEnergyServicePrivate> known = serviceList.value(uuid);
+            if (known && known->startHandle == start && known->endHandle == end)
+                continue; // unaffected by a Service Changed indication
+
             QLowEnergyServicePrivate *priv = new QLowEnergyServicePrivate();
             priv->uuid = uuid;
             priv->startHandle = start;
@@ -848,10 +1618,12 @@ void QLowEnergyControllerPrivate::processReply(
             if (type != GATT_PRIMARY_SERVICE) //unset PrimaryService bit
                 priv->type &= ~QLowEnergyService::PrimaryService;
             priv->setController(this);
+            trackServiceForAttributeCache(priv);
 
             QSharedPointer<QLowEnergyServicePrivate> pointer(priv);
 
             serviceList.insert(uuid, pointer);
+            serviceHandleIndexDirty = true;
             emit q->serviceDiscovered(uuid);
         }
 
@@ -859,6 +1631,7 @@ void QLowEnergyControllerPrivate::processReply(
             sendReadByGroupRequest(end+1, 0xFFFF, type);
         } else {
             if (type == GATT_SECONDARY_SERVICE) {
+                storeAttributeCache();
                 setState(QLowEnergyController::DiscoveredState);
                 emit q->discoveryFinished();
             } else { // search for secondary services
@@ -873,6 +1646,16 @@ void QLowEnergyControllerPrivate::processReply(
         // Discovering characteristics
         Q_ASSERT(request.command == ATT_OP_READ_BY_TYPE_REQUEST);
 
+        if (request.reference2.toUInt() == GATT_DATABASE_HASH) {
+            processDatabaseHashReply(response, isErrorResponse);
+            break;
+        }
+
+        if (!request.reference.isValid()) {
+            processServiceSweepReply(request, response, isErrorResponse);
+            break;
+        }
+
         QSharedPointer<QLowEnergyServicePrivate> p =
                 request.reference.value<QSharedPointer<QLowEnergyServicePrivate> >();
         const quint16 attributeType = request.reference2.toUInt();
@@ -979,12 +1762,12 @@ void QLowEnergyControllerPrivate::processReply(
                 updateValueOfDescriptor(charHandle, descriptorHandle,
                                         response.mid(1), NEW_VALUE);
 
-            if (response.size() == mtuSize) {
+            if (response.size() == activeLink->mtuSize) {
                 qCDebug(QT_BT_BLUEZ) << "Switching to blob reads for"
                          << charHandle << descriptorHandle
                          << service->characteristicList[charHandle].uuid.toString();
                 // Potentially more data -> switch to blob reads
-                readServiceValuesByOffset(handleData, mtuSize-1,
+                readServiceValuesByOffset(handleData, activeLink->mtuSize-1,
                                           request.reference2.toBool());
                 break;
             } else if (!isServiceDiscoveryRun) {
@@ -1000,7 +1783,8 @@ void QLowEnergyControllerPrivate::processReply(
             }
         }
 
-        if (request.reference2.toBool() && isServiceDiscoveryRun) {
+        if (request.reference2.toBool() && isServiceDiscoveryRun
+                && !passLastValueToRetry(service)) {
             // we only run into this code path during the initial service discovery
             // and not when processing readCharacteristics() after service discovery
 
@@ -1013,6 +1797,12 @@ void QLowEnergyControllerPrivate::processReply(
         }
     }
         break;
+    case ATT_OP_READ_MULTIPLE_REQUEST: //error case
+    case ATT_OP_READ_MULTIPLE_RESPONSE:
+    case ATT_OP_READ_MULTIPLE_VARIABLE_REQUEST: //error case
+    case ATT_OP_READ_MULTIPLE_VARIABLE_RESPONSE:
+        processReadMultipleReply(request, response, isErrorResponse);
+        break;
     case ATT_OP_READ_BLOB_REQUEST: //error case
     case ATT_OP_READ_BLOB_RESPONSE:
     {
@@ -1040,7 +1830,7 @@ void QLowEnergyControllerPrivate::processReply(
                 length = updateValueOfDescriptor(charHandle, descriptorHandle,
                                         response.mid(1), APPEND_VALUE);
 
-            if (response.size() == mtuSize) {
+            if (response.size() == activeLink->mtuSize) {
                 readServiceValuesByOffset(handleData, length,
                                           request.reference2.toBool());
                 break;
@@ -1062,7 +1852,7 @@ void QLowEnergyControllerPrivate::processReply(
                        << (service->state == QLowEnergyService::ServiceDiscovered) << ")";
         }
 
-        if (request.reference2.toBool()) {
+        if (request.reference2.toBool() && !passLastValueToRetry(service)) {
             //last overlong characteristic -> progress to descriptor discovery
             //last overlong descriptor -> service discovery is done
 
@@ -1080,6 +1870,11 @@ void QLowEnergyControllerPrivate::processReply(
         //Discovering descriptors
         Q_ASSERT(request.command == ATT_OP_FIND_INFORMATION_REQUEST);
 
+        if (!request.reference.isValid()) {
+            processServiceSweepReply(request, response, isErrorResponse);
+            break;
+        }
+
         /* packet format:
          *  <opcode><format>[<handle><descriptor_uuid>]+
          *
@@ -1239,11 +2034,6 @@ void QLowEnergyControllerPrivate::processReply(
         //Prepare write command response
         Q_ASSERT(request.command == ATT_OP_PREPARE_WRITE_REQUEST);
 
-        uint handleData = request.reference.toUInt();
-        const QLowEnergyHandle attrHandle = (handleData & 0xffff);
-        const QByteArray newValue = request.reference2.toByteArray();
-        const int writtenPayload = ((handleData >> 16) & 0xffff);
-
         if (isErrorResponse) {
             Q_ASSERT(!encryptionChangePending);
             encryptionChangePending = increaseEncryptLevelfRequired(response.constData()[4]);
@@ -1251,50 +2041,60 @@ void QLowEnergyControllerPrivate::processReply(
                 openRequests.prepend(request);
                 break;
             }
-            //emits error on cancellation and aborts existing prepare reuqests
-            sendExecuteWriteRequest(attrHandle, newValue, true);
-        } else {
-            if (writtenPayload < newValue.size()) {
-                sendNextPrepareWriteRequest(attrHandle, newValue, writtenPayload);
-            } else {
-                sendExecuteWriteRequest(attrHandle, newValue, false);
-            }
+            //emits error on cancellation and aborts existing prepare requests
+            cancelLongWrite();
+        } else if (response.size() != request.payload.size()
+                   || memcmp(response.constData() + 1, request.payload.constData() + 1,
+                             response.size() - 1) != 0) {
+            // the server must echo handle, offset and value
+            qCWarning(QT_BT_BLUEZ) << "Prepare write response does not match request for handle"
+                                   << hex << request.reference.toUInt();
+            cancelLongWrite();
         }
+        // otherwise the next segment or the execute request is already queued
     }
         break;
     case ATT_OP_EXECUTE_WRITE_REQUEST: //error case
     case ATT_OP_EXECUTE_WRITE_RESPONSE:
     {
-        // right now used in connection with long characteristic/descriptor value writes
-        // not catering for reliable writes
+        // used for long characteristic/descriptor value writes and reliable writes
         Q_ASSERT(request.command == ATT_OP_EXECUTE_WRITE_REQUEST);
 
-        uint handleData = request.reference.toUInt();
-        const QLowEnergyHandle attrHandle = handleData & 0xffff;
-        bool wasCancellation = !((handleData >> 16) & 0xffff);
-        const QByteArray newValue = request.reference2.toByteArray();
+        const bool wasCancellation = !request.reference.toBool();
+        const QVariantList writes = request.reference2.toList();
 
-        // is it a descriptor or characteristic?
-        const QLowEnergyDescriptor descriptor = descriptorForHandle(attrHandle);
-        QSharedPointer<QLowEnergyServicePrivate> service = serviceForHandle(attrHandle);
-        Q_ASSERT(!service.isNull());
+        // the error is reported once per service
+        QSet<QLowEnergyServicePrivate *> failedServices;
+        for (const QVariant &write : writes) {
+            const QVariantList writeData = write.toList();
+            const QLowEnergyHandle attrHandle = writeData.at(0).toUInt();
+            const QByteArray newValue = writeData.at(1).toByteArray();
 
-        if (isErrorResponse || wasCancellation) {
-            // charHandle == 0 -> cancellation
-            if (descriptor.isValid())
-                service->setError(QLowEnergyService::DescriptorWriteError);
-            else
-                service->setError(QLowEnergyService::CharacteristicWriteError);
-        } else {
-            if (descriptor.isValid()) {
-                updateValueOfDescriptor(descriptor.characteristicHandle(),
-                                        attrHandle, newValue, NEW_VALUE);
-                emit service->descriptorWritten(descriptor, newValue);
+            // is it a descriptor or characteristic?
+            const QLowEnergyDescriptor descriptor = descriptorForHandle(attrHandle);
+            QSharedPointer<QLowEnergyServicePrivate> service = serviceForHandle(attrHandle);
+            if (service.isNull())
+                continue;
+
+            if (isErrorResponse || wasCancellation) {
+                if (failedServices.contains(service.data()))
+                    continue;
+                failedServices.insert(service.data());
+                if (descriptor.isValid())
+                    service->setError(QLowEnergyService::DescriptorWriteError);
+                else
+                    service->setError(QLowEnergyService::CharacteristicWriteError);
             } else {
-                QLowEnergyCharacteristic ch(service, attrHandle);
-                if (ch.properties() & QLowEnergyCharacteristic::Read)
-                    updateValueOfCharacteristic(attrHandle, newValue, NEW_VALUE);
-                emit service->characteristicWritten(ch, newValue);
+                if (descriptor.isValid()) {
+                    updateValueOfDescriptor(descriptor.characteristicHandle(),
+                                            attrHandle, newValue, NEW_VALUE);
+                    emit service->descriptorWritten(descriptor, newValue);
+                } else {
+                    QLowEnergyCharacteristic ch(service, attrHandle);
+                    if (ch.properties() & QLowEnergyCharacteristic::Read)
+                        updateValueOfCharacteristic(attrHandle, newValue, NEW_VALUE);
+                    emit service->characteristicWritten(ch, newValue);
+                }
             }
         }
     }
@@ -1305,10 +2105,35 @@ void QLowEnergyControllerPrivate::processReply(
     }
 }
 
+/*!
+    \internal
+
+    The service discovery starts by reading the Database Hash characteristic of
+    the remote device. If the hash matches the one of the attribute cache, the
+    cached services are restored and no further discovery is required.
+    Otherwise the services are discovered from scratch.
+ */
 void QLowEnergyControllerPrivate::discoverServices()
 {
-    sendReadByGroupRequest(0x0001, 0xFFFF, GATT_PRIMARY_SERVICE);
-}
+    quint8 packet[READ_BY_TYPE_REQ_HEADER_SIZE];
+
+    packet[0] = ATT_OP_READ_BY_TYPE_REQUEST;
+    putBtData(quint16(0x0001), &packet[1]);
+    putBtData(quint16(0xFFFF), &packet[3]);
+    putBtData(GATT_DATABASE_HASH, &packet[5]);
+
+    QByteArray data(READ_BY_TYPE_REQ_HEADER_SIZE, Qt::Uninitialized);
+    memcpy(data.data(), packet,  READ_BY_TYPE_REQ_HEADER_SIZE);
+    qCDebug(QT_BT_BLUEZ) << "Reading database hash";
+
+    Request request;
+    request.payload = data;
+    request.command = ATT_OP_READ_BY_TYPE_REQUEST;
+    request.reference2 = GATT_DATABASE_HASH;
+    enqueueRequest(request);
+
+    sendNextPendingRequest();
+}
 
 void QLowEnergyControllerPrivate::sendReadByGroupRequest(
         QLowEnergyHandle start, QLowEnergyHandle end, quint16 type)
@@ -1330,7 +2155,7 @@ void QLowEnergyControllerPrivate::sendReadByGroupRequest(
     request.payload = data;
     request.command = ATT_OP_READ_BY_GROUP_REQUEST;
     request.reference = type;
-    openRequests.enqueue(request);
+    enqueueRequest(request);
 
     sendNextPendingRequest();
 }
@@ -1344,6 +2169,13 @@ void QLowEnergyControllerPrivate::discoverServiceDetails(const QBluetoothUuid &s
     }
 
     QSharedPointer<QLowEnergyServicePrivate> serviceData = serviceList.value(service);
+    if (cachedServices.remove(service)) {
+        // attributes are known from the attribute cache, only read their values
+        sweptServices.insert(service);
+        readServiceValues(service, true);
+        return;
+    }
+
     serviceData->characteristicList.clear();
     sendReadByTypeRequest(serviceData, serviceData->startHandle, GATT_INCLUDED_SERVICE);
 }
@@ -1370,11 +2202,247 @@ void QLowEnergyControllerPrivate::sendReadByTypeRequest(
     request.command = ATT_OP_READ_BY_TYPE_REQUEST;
     request.reference = QVariant::fromValue(serviceData);
     request.reference2 = attributeType;
-    openRequests.enqueue(request);
+    enqueueRequest(request);
+
+    sendNextPendingRequest();
+}
+
+/*!
+    \internal
+
+    Discovers the details of all \a services in breadth-first order.
+
+    Instead of discovering one service after another, the included services and
+    characteristic declarations of all services are obtained by sweeping across the
+    combined handle range using Read By Type requests. Their descriptors are found
+    by a single Find Information sweep across the same range. The results are split
+    into the individual services afterwards. This significantly reduces the number of
+    round trips for devices with many services.
+
+    The values of the characteristics and descriptors are read per service,
+    as part of the regular service discovery.
+ */
+void QLowEnergyControllerPrivate::discoverAllServiceDetails(const QList<QBluetoothUuid> &services)
+{
+    if (!sweepServices.isEmpty()) {
+        // another sweep is still running
+        for (const QBluetoothUuid &uuid : services)
+            discoverServiceDetails(uuid);
+        return;
+    }
+
+    for (const QBluetoothUuid &uuid : services) {
+        QSharedPointer<QLowEnergyServicePrivate> serviceData = serviceList.value(uuid);
+        if (serviceData.isNull()) {
+            qCWarning(QT_BT_BLUEZ) << "Discovery of unknown service" << uuid.toString()
+                                   << "not possible";
+            continue;
+        }
+
+        if (cachedServices.contains(uuid)) {
+            discoverServiceDetails(uuid);
+            continue;
+        }
+
+        serviceData->characteristicList.clear();
+        serviceData->includedServices.clear();
+        sweepServices.append(serviceData);
+    }
+
+    if (sweepServices.isEmpty())
+        return;
+
+    std::sort(sweepServices.begin(), sweepServices.end(),
+              [](const QSharedPointer<QLowEnergyServicePrivate> &a,
+                 const QSharedPointer<QLowEnergyServicePrivate> &b) {
+        return a->startHandle < b->startHandle;
+    });
+
+    qCDebug(QT_BT_BLUEZ) << "Discovering details of" << sweepServices.count()
+                         << "services in one sweep";
+
+    sendServiceSweepRequest(ATT_OP_READ_BY_TYPE_REQUEST,
+                            sweepServices.first()->startHandle, GATT_INCLUDED_SERVICE);
+}
+
+void QLowEnergyControllerPrivate::sendServiceSweepRequest(
+        quint8 command, QLowEnergyHandle start, quint16 attributeType)
+{
+    Q_ASSERT(!sweepServices.isEmpty());
+    const QLowEnergyHandle end = sweepServices.last()->endHandle;
+
+    QByteArray data;
+    if (command == ATT_OP_READ_BY_TYPE_REQUEST) {
+        data.resize(READ_BY_TYPE_REQ_HEADER_SIZE);
+        putBtData(attributeType, data.data() + 5);
+    } else {
+        Q_ASSERT(command == ATT_OP_FIND_INFORMATION_REQUEST);
+        data.resize(FIND_INFO_REQUEST_HEADER_SIZE);
+    }
+    data[0] = command;
+    putBtData(start, data.data() + 1);
+    putBtData(end, data.data() + 3);
+
+    qCDebug(QT_BT_BLUEZ) << "Sending service sweep request, startHandle:" << hex
+                         << start << "endHandle:" << end << "packet:" << data.toHex();
+
+    // The missing reference marks the request as part of a sweep
+    Request request;
+    request.payload = data;
+    request.command = command;
+    request.reference2 = attributeType;
+    enqueueRequest(request);
 
     sendNextPendingRequest();
 }
 
+/*!
+    \internal
+
+    Returns the service being swept which contains \a handle; otherwise
+    a null pointer.
+ */
+QSharedPointer<QLowEnergyServicePrivate> QLowEnergyControllerPrivate::sweepServiceForHandle(
+        QLowEnergyHandle handle) const
+{
+    auto it = std::upper_bound(sweepServices.constBegin(), sweepServices.constEnd(), handle,
+                               [](QLowEnergyHandle h,
+                                  const QSharedPointer<QLowEnergyServicePrivate> &service) {
+        return h < service->startHandle;
+    });
+    if (it == sweepServices.constBegin())
+        return QSharedPointer<QLowEnergyServicePrivate>();
+
+    --it;
+    if (handle > (*it)->endHandle)
+        return QSharedPointer<QLowEnergyServicePrivate>();
+    return *it;
+}
+
+void QLowEnergyControllerPrivate::processServiceSweepReply(
+        const Request &request, const QByteArray &response, bool isErrorResponse)
+{
+    if (sweepServices.isEmpty()) // the sweep was aborted
+        return;
+
+    const QLowEnergyHandle endHandle = sweepServices.last()->endHandle;
+    const quint16 attributeType = request.reference2.toUInt();
+    const char *data = response.constData();
+    QLowEnergyHandle lastHandle = endHandle;
+
+    if (!isErrorResponse && request.command == ATT_OP_READ_BY_TYPE_REQUEST) {
+        const quint16 elementLength = response.constData()[1];
+        const quint16 numElements = (response.size() - 2) / elementLength;
+        quint16 offset = 2;
+        for (int i = 0; i < numElements; i++, offset += elementLength) {
+            lastHandle = bt_get_le16(&data[offset]);
+            QSharedPointer<QLowEnergyServicePrivate> p = sweepServiceForHandle(lastHandle);
+            if (p.isNull())
+                continue;
+
+            if (attributeType == GATT_CHARACTERISTIC) {
+                QLowEnergyServicePrivate::CharData characteristic;
+                parseReadByTypeCharDiscovery(&characteristic, &data[offset], elementLength);
+                p->characteristicList[lastHandle] = characteristic;
+            } else {
+                parseReadByTypeIncludeDiscovery(&p->includedServices,
+                                                &data[offset], elementLength);
+                const QBluetoothUuid &uuid = p->includedServices.last();
+                if (serviceList.contains(uuid))
+                    serviceList[uuid]->type |= QLowEnergyService::IncludedService;
+            }
+        }
+    } else if (!isErrorResponse) {
+        // Find Information response, see ATT_OP_FIND_INFORMATION_RESPONSE in processReply()
+        const quint8 format = response[1];
+        quint16 elementLength;
+        switch (format) {
+        case 0x01:
+            elementLength = 2 + 2; //sizeof(QLowEnergyHandle) + 16bit uuid
+            break;
+        case 0x02:
+            elementLength = 2 + 16; //sizeof(QLowEnergyHandle) + 128bit uuid
+            break;
+        default:
+            qCWarning(QT_BT_BLUEZ) << "Unknown format in FIND_INFORMATION_RESPONSE";
+            finishServiceSweep();
+            return;
+        }
+
+        const quint16 numElements = (response.size() - 2) / elementLength;
+        quint16 offset = 2;
+        for (int i = 0; i < numElements; i++, offset += elementLength) {
+            lastHandle = bt_get_le16(&data[offset]);
+            QBluetoothUuid uuid;
+            if (format == 0x01)
+                uuid = QBluetoothUuid(bt_get_le16(&data[offset+2]));
+            else
+                uuid = convert_uuid128((quint128 *)&data[offset+2]);
+
+            // ignore service, include and characteristic declarations
+            bool ok = false;
+            quint16 shortUuid = uuid.toUInt16(&ok);
+            if (ok && shortUuid >= QLowEnergyServicePrivate::PrimaryService
+                   && shortUuid <= QLowEnergyServicePrivate::Characteristic) {
+                continue;
+            }
+
+            QSharedPointer<QLowEnergyServicePrivate> p = sweepServiceForHandle(lastHandle);
+            if (p.isNull())
+                continue;
+
+            // the descriptor belongs to the closest preceding characteristic
+            QLowEnergyHandle charHandle = 0;
+            CharacteristicDataMap::const_iterator charIt = p->characteristicList.constBegin();
+            for ( ; charIt != p->characteristicList.constEnd(); ++charIt) {
+                if (charIt.key() < lastHandle && charIt.key() > charHandle)
+                    charHandle = charIt.key();
+            }
+            if (!charHandle)
+                continue;
+
+            // ignore value handle
+            QLowEnergyServicePrivate::CharData &charData = p->characteristicList[charHandle];
+            if (lastHandle == charData.valueHandle)
+                continue;
+
+            QLowEnergyServicePrivate::DescData descData;
+            descData.uuid = uuid;
+            charData.descriptorList.insert(lastHandle, descData);
+
+            qCDebug(QT_BT_BLUEZ) << "Descriptor found, uuid:" << uuid.toString()
+                                 << "descriptor handle:" << hex << lastHandle;
+        }
+    }
+
+    if (lastHandle < endHandle) {
+        sendServiceSweepRequest(request.command, lastHandle + 1, attributeType);
+        return;
+    }
+
+    // continue with the next phase of the sweep
+    if (request.command == ATT_OP_FIND_INFORMATION_REQUEST) {
+        finishServiceSweep();
+    } else if (attributeType == GATT_INCLUDED_SERVICE) {
+        sendServiceSweepRequest(ATT_OP_READ_BY_TYPE_REQUEST,
+                                sweepServices.first()->startHandle, GATT_CHARACTERISTIC);
+    } else {
+        sendServiceSweepRequest(ATT_OP_FIND_INFORMATION_REQUEST,
+                                sweepServices.first()->startHandle);
+    }
+}
+
+void QLowEnergyControllerPrivate::finishServiceSweep()
+{
+    const QVector<QSharedPointer<QLowEnergyServicePrivate>> services = sweepServices;
+    sweepServices.clear();
+
+    for (const QSharedPointer<QLowEnergyServicePrivate> &service : services) {
+        sweptServices.insert(service->uuid);
+        readServiceValues(service->uuid, true);
+    }
+}
+
 /*!
     \internal
 
@@ -1387,7 +2455,6 @@ void QLowEnergyControllerPrivate::sendReadByTypeRequest(
 void QLowEnergyControllerPrivate::readServiceValues(
         const QBluetoothUuid &serviceUuid, bool readCharacteristics)
 {
-    quint8 packet[READ_REQUEST_HEADER_SIZE];
     if (QT_BT_BLUEZ().isDebugEnabled()) {
         if (readCharacteristics)
             qCDebug(QT_BT_BLUEZ) << "Reading all characteristic values for"
@@ -1448,31 +2515,233 @@ void QLowEnergyControllerPrivate::readServiceValues(
         return;
     }
 
-    for (int i = 0; i < targetHandles.count(); i++) {
-        pair = targetHandles.at(i);
-        packet[0] = ATT_OP_READ_REQUEST;
-        putBtData(pair.first, &packet[1]);
+    QList<Request> requests;
+    appendReadRequests(&requests, service, targetHandles, true);
+    // last entry
+    requests.last().reference2 = true;
+    for (const Request &request : qAsConst(requests))
+        enqueueRequest(request);
+
+    sendNextPendingRequest();
+}
 
-        QByteArray data(READ_REQUEST_HEADER_SIZE, Qt::Uninitialized);
-        memcpy(data.data(), packet,  READ_REQUEST_HEADER_SIZE);
+/*!
+    \internal
+
+    Returns the size of the value of descriptors with the given \a uuid if the size
+    is fixed; otherwise -1.
+ */
+static int fixedDescriptorValueSize(const QBluetoothUuid &uuid)
+{
+    bool ok = false;
+    const quint16 shortUuid = uuid.toUInt16(&ok);
+    if (!ok)
+        return -1;
+
+    switch (shortUuid) {
+    case QBluetoothUuid::CharacteristicExtendedProperties:
+    case QBluetoothUuid::ClientCharacteristicConfiguration:
+    case QBluetoothUuid::ServerCharacteristicConfiguration:
+    case QBluetoothUuid::ReportReference:
+        return 2;
+    case QBluetoothUuid::CharacteristicPresentationFormat:
+        return 7;
+    default:
+        return -1;
+    }
+}
+
+/*!
+    \internal
+
+    Appends the requests for reading the values of \a targets to \a requests.
+    None of the appended requests is marked as last request of the service.
+
+    If \a allowBatching is \c true, the values are read via Read Multiple Variable
+    requests. If the remote device does not support them, descriptors with a fixed
+    value size are read via Read Multiple requests. All other values are read
+    individually.
+ */
+void QLowEnergyControllerPrivate::appendReadRequests(
+        QList<Request> *requests, const QSharedPointer<QLowEnergyServicePrivate> &service,
+        const ReadTargetList &targets, bool allowBatching) const
+{
+    const int maxHandles = (activeLink->mtuSize - 1) / int(sizeof(QLowEnergyHandle));
+
+    const auto appendRequest = [requests](quint8 command, const ReadTargetList &batch) {
+        Q_ASSERT(!batch.isEmpty());
+        if (batch.count() == 1) // Read Multiple requires at least two handles
+            command = ATT_OP_READ_REQUEST;
+
+        QByteArray data(1 + batch.count() * int(sizeof(QLowEnergyHandle)), Qt::Uninitialized);
+        data[0] = command;
+        for (int i = 0; i < batch.count(); i++)
+            putBtData(batch.at(i).first, data.data() + 1 + i * sizeof(QLowEnergyHandle));
 
         Request request;
         request.payload = data;
-        request.command = ATT_OP_READ_REQUEST;
-        request.reference = pair.second;
-        // last entry?
-        request.reference2 = QVariant((bool)(i + 1 == targetHandles.count()));
-        openRequests.enqueue(request);
+        request.command = command;
+        if (command == ATT_OP_READ_REQUEST)
+            request.reference = batch.first().second;
+        else
+            request.reference = QVariant::fromValue(batch);
+        request.reference2 = false;
+        requests->append(request);
+    };
+
+    ReadTargetList batch;
+    int batchValueSize = 0;
+    for (const auto &target : targets) {
+        if (!allowBatching) {
+            appendRequest(ATT_OP_READ_REQUEST, ReadTargetList() << target);
+            continue;
+        }
+
+        if (readMultipleVariableSupported) {
+            batch.append(target);
+            if (batch.count() == maxHandles) {
+                appendRequest(ATT_OP_READ_MULTIPLE_VARIABLE_REQUEST, batch);
+                batch.clear();
+            }
+            continue;
+        }
+
+        // Read Multiple responses do not contain the size of the individual values
+        const QLowEnergyHandle charHandle = (target.second & 0xffff);
+        const QLowEnergyHandle descriptorHandle = ((target.second >> 16) & 0xffff);
+        int valueSize = -1;
+        if (descriptorHandle) {
+            valueSize = fixedDescriptorValueSize(service->characteristicList.value(charHandle)
+                                                 .descriptorList.value(descriptorHandle).uuid);
+        }
+        if (valueSize < 0) {
+            appendRequest(ATT_OP_READ_REQUEST, ReadTargetList() << target);
+            continue;
+        }
+
+        if (batch.count() == maxHandles || batchValueSize + valueSize > activeLink->mtuSize - 1) {
+            appendRequest(ATT_OP_READ_MULTIPLE_REQUEST, batch);
+            batch.clear();
+            batchValueSize = 0;
+        }
+        batch.append(target);
+        batchValueSize += valueSize;
     }
 
-    sendNextPendingRequest();
+    if (!batch.isEmpty()) {
+        appendRequest(readMultipleVariableSupported ? ATT_OP_READ_MULTIPLE_VARIABLE_REQUEST
+                                                    : ATT_OP_READ_MULTIPLE_REQUEST, batch);
+    }
+}
+
+void QLowEnergyControllerPrivate::processReadMultipleReply(
+        const Request &request, const QByteArray &response, bool isErrorResponse)
+{
+    const ReadTargetList targets = request.reference.value<ReadTargetList>();
+    const bool isLastValue = request.reference2.toBool();
+    Q_ASSERT(targets.count() > 1);
+
+    QSharedPointer<QLowEnergyServicePrivate> service =
+            serviceForHandle(targets.first().second & 0xffff);
+    if (service.isNull())
+        return;
+
+    const auto updateValue = [this](quint32 handleData, const QByteArray &value) {
+        const QLowEnergyHandle charHandle = (handleData & 0xffff);
+        const QLowEnergyHandle descriptorHandle = ((handleData >> 16) & 0xffff);
+        if (!descriptorHandle)
+            updateValueOfCharacteristic(charHandle, value, NEW_VALUE);
+        else
+            updateValueOfDescriptor(charHandle, descriptorHandle, value, NEW_VALUE);
+    };
+
+    ReadTargetList pendingTargets; // to be read individually
+    ReadTargetList remainingTargets; // not contained in the response
+    if (isErrorResponse) {
+        if (request.command == ATT_OP_READ_MULTIPLE_VARIABLE_REQUEST
+                && response.size() >= ERROR_RESPONSE_HEADER_SIZE
+                && response.at(4) == ATT_ERROR_REQUEST_NOT_SUPPORTED) {
+            qCDebug(QT_BT_BLUEZ) << "Remote device does not support Read Multiple Variable";
+            readMultipleVariableSupported = false;
+            remainingTargets = targets;
+        } else {
+            // individual reads determine the failing attribute
+            // and deal with the required security level
+            pendingTargets = targets;
+        }
+    } else if (request.command == ATT_OP_READ_MULTIPLE_VARIABLE_REQUEST) {
+        /* packet format:
+         *      <opcode>[<length><value>]+
+         *
+         * The response is cut off at the MTU. The last value may be incomplete.
+         */
+        int offset = 1;
+        for (int i = 0; i < targets.count(); i++) {
+            if (offset + 2 > response.size()) {
+                remainingTargets = targets.mid(i);
+                break;
+            }
+            const quint16 length = bt_get_le16(response.constData() + offset);
+            offset += 2;
+            if (offset + length > response.size()) {
+                pendingTargets.append(targets.at(i));
+                remainingTargets = targets.mid(i + 1);
+                break;
+            }
+            updateValue(targets.at(i).second, response.mid(offset, length));
+            offset += length;
+        }
+    } else {
+        /* packet format:
+         *      <opcode>[<value>]+
+         *
+         * Only descriptors with fixed value size are read this way.
+         */
+        int offset = 1;
+        for (int i = 0; i < targets.count(); i++) {
+            const quint32 handleData = targets.at(i).second;
+            const QLowEnergyHandle charHandle = (handleData & 0xffff);
+            const QLowEnergyHandle descriptorHandle = ((handleData >> 16) & 0xffff);
+            const int valueSize = fixedDescriptorValueSize(service->characteristicList
+                    .value(charHandle).descriptorList.value(descriptorHandle).uuid);
+            if (valueSize < 0 || offset + valueSize > response.size()) {
+                pendingTargets = targets.mid(i);
+                break;
+            }
+            updateValue(handleData, response.mid(offset, valueSize));
+            offset += valueSize;
+        }
+    }
+
+    QList<Request> requests;
+    appendReadRequests(&requests, service, pendingTargets, false);
+    appendReadRequests(&requests, service, remainingTargets, true);
+    if (!requests.isEmpty()) {
+        // finish this batch before continuing with the next request
+        requests.last().reference2 = isLastValue;
+        for (int i = requests.count() - 1; i >= 0; i--)
+            openRequests.prepend(requests.at(i));
+        return;
+    }
+
+    if (!isLastValue || service->state == QLowEnergyService::ServiceDiscovered
+            || passLastValueToRetry(service)) {
+        return;
+    }
+
+    //last characteristic -> progress to descriptor discovery
+    //last descriptor -> service discovery is done
+    if (!((targets.last().second >> 16) & 0xffff))
+        discoverServiceDescriptors(service->uuid);
+    else
+        service->setState(QLowEnergyService::ServiceDiscovered);
 }
 
 /*!
     \internal
 
     This function is used when reading a handle value that is
-    longer than the mtuSize.
+    longer than the activeLink->mtuSize.
 
     The BLOB read request is prepended to the list of
     open requests to finish the current value read up before
@@ -1526,6 +2795,7 @@ void QLowEnergyControllerPrivate::discoverServiceDescriptors(
     qCDebug(QT_BT_BLUEZ) << "Discovering descriptor values for"
                          << serviceUuid.toString();
     QSharedPointer<QLowEnergyServicePrivate> service = serviceList.value(serviceUuid);
+    const bool descriptorsKnown = sweptServices.remove(serviceUuid);
 
     if (service->characteristicList.isEmpty()) { // service has no characteristics
         // implies that characteristic & descriptor discovery can be skipped
@@ -1533,6 +2803,11 @@ void QLowEnergyControllerPrivate::discoverServiceDescriptors(
         return;
     }
 
+    if (descriptorsKnown) { // found by discoverAllServiceDetails()
+        readServiceValues(serviceUuid, false);
+        return;
+    }
+
     // start handle of all known characteristics
     QList<QLowEnergyHandle> keys = service->characteristicList.keys();
     std::sort(keys.begin(), keys.end());
@@ -1540,9 +2815,13 @@ void QLowEnergyControllerPrivate::discoverServiceDescriptors(
     discoverNextDescriptor(service, keys, keys[0]);
 }
 
-void QLowEnergyControllerPrivate::processUnsolicitedReply(const QByteArray &payload)
+void QLowEnergyControllerPrivate::processUnsolicitedReply(const char *data, int size)
 {
-    const char *data = payload.constData();
+    if (size < 3) {
+        qCWarning(QT_BT_BLUEZ) << "Received truncated notification/indication";
+        return;
+    }
+
     bool isNotification = (data[0] == ATT_OP_HANDLE_VAL_NOTIFICATION);
     const QLowEnergyHandle changedHandle = bt_get_le16(&data[1]);
 
@@ -1553,11 +2832,21 @@ void QLowEnergyControllerPrivate::processUnsolicitedReply(const QByteArray &payl
             qCDebug(QT_BT_BLUEZ) << "Change indication for handle" << hex << changedHandle;
     }
 
+    ++statistics->notifications;
     const QLowEnergyCharacteristic ch = characteristicForHandle(changedHandle);
     if (ch.isValid() && ch.handle() == changedHandle) {
-        if (ch.properties() & QLowEnergyCharacteristic::Read)
-            updateValueOfCharacteristic(ch.attributeHandle(), payload.mid(3), NEW_VALUE);
-        emit ch.d_ptr->characteristicChanged(ch, payload.mid(3));
+        if (ch.d_ptr->deliverNotification(ch, data + 3, size - 3))
+            emit ch.d_ptr->characteristicChanged(ch, QByteArray(data + 3, size - 3));
+
+        if (ch.uuid() == QBluetoothUuid::ServiceChanged) {
+            // the value is the affected handle range, if missing assume all of them
+            QLowEnergyHandle affectedStart = 0x0001, affectedEnd = 0xFFFF;
+            if (size >= 3 + 4) {
+                affectedStart = bt_get_le16(&data[3]);
+                affectedEnd = bt_get_le16(&data[5]);
+            }
+            processServiceChanged(affectedStart, affectedEnd);
+        }
     } else {
         qCWarning(QT_BT_BLUEZ) << "Cannot find matching characteristic for "
                                   "notification/indication";
@@ -1570,7 +2859,7 @@ void QLowEnergyControllerPrivate::exchangeMTU()
 
     quint8 packet[MTU_EXCHANGE_HEADER_SIZE];
     packet[0] = ATT_OP_EXCHANGE_MTU_REQUEST;
-    putBtData(quint16(ATT_MAX_LE_MTU), &packet[1]);
+    putBtData(localRxMtu(), &packet[1]);
 
     QByteArray data(MTU_EXCHANGE_HEADER_SIZE, Qt::Uninitialized);
     memcpy(data.data(), packet, MTU_EXCHANGE_HEADER_SIZE);
@@ -1578,14 +2867,55 @@ void QLowEnergyControllerPrivate::exchangeMTU()
     Request request;
     request.payload = data;
     request.command = ATT_OP_EXCHANGE_MTU_REQUEST;
-    openRequests.enqueue(request);
+    request.priority = UserPriority;
+    enqueueRequest(request);
 
     sendNextPendingRequest();
 }
 
+quint16 QLowEnergyControllerPrivate::localRxMtu() const
+{
+    if (preferredMtu <= 0)
+        return ATT_MAX_LE_MTU;
+    return quint16(qBound(ATT_DEFAULT_LE_MTU, preferredMtu, ATT_MAX_LE_MTU));
+}
+
+int QLowEnergyControllerPrivate::mtu() const
+{
+    if (state == QLowEnergyController::UnconnectedState
+            || state == QLowEnergyController::ConnectingState
+            || state == QLowEnergyController::AdvertisingState) {
+        return -1;
+    }
+    return activeLink->mtuSize;
+}
+
+/*
+ * Asks the local adapter to use link layer packets of maximum size and the LE 2M PHY
+ * if a larger MTU was requested. Without them a long ATT PDU is split across several
+ * link layer packets which severely limits the throughput of bulk transfers.
+ */
+void QLowEnergyControllerPrivate::requestLinkLayerThroughput()
+{
+    if (activeLink->linkLayerThroughputRequested || !activeLink->connectionHandle || localRxMtu() <= ATT_DEFAULT_LE_MTU)
+        return;
+    if (!activeLink->l2cpSocket || activeLink->l2cpSocket->state() != QBluetoothSocket::ConnectedState)
+        return;
+    if (!hciManager || !hciManager->isValid())
+        return;
+
+    activeLink->linkLayerThroughputRequested = true;
+    if (!hciManager->sendSetDataLengthCommand(activeLink->connectionHandle, LL_MAX_TX_OCTETS, LL_MAX_TX_TIME))
+        qCDebug(QT_BT_BLUEZ) << "cannot request maximum link layer data length";
+    if (!hciManager->sendSetPhyCommand(activeLink->connectionHandle, LE_PHY_1M | LE_PHY_2M,
+                                       LE_PHY_1M | LE_PHY_2M)) {
+        qCDebug(QT_BT_BLUEZ) << "cannot request LE 2M PHY";
+    }
+}
+
 int QLowEnergyControllerPrivate::securityLevel() const
 {
-    int socket = l2cpSocket->socketDescriptor();
+    int socket = activeLink->l2cpSocket->socketDescriptor();
     if (socket < 0) {
         qCWarning(QT_BT_BLUEZ) << "Invalid l2cp socket, aborting getting of sec level";
         return -1;
@@ -1627,7 +2957,7 @@ bool QLowEnergyControllerPrivate::setSecurityLevel(int level)
     if (level > BT_SECURITY_HIGH || level < BT_SECURITY_LOW)
         return false;
 
-    int socket = l2cpSocket->socketDescriptor();
+    int socket = activeLink->l2cpSocket->socketDescriptor();
     if (socket < 0) {
         qCWarning(QT_BT_BLUEZ) << "Invalid l2cp socket, aborting setting of sec level";
         return false;
@@ -1699,97 +3029,178 @@ void QLowEnergyControllerPrivate::discoverNextDescriptor(
     request.command = ATT_OP_FIND_INFORMATION_REQUEST;
     request.reference = QVariant::fromValue<QList<QLowEnergyHandle> >(pendingCharHandles);
     request.reference2 = startingHandle;
-    openRequests.enqueue(request);
+    enqueueRequest(request);
 
     sendNextPendingRequest();
 }
 
-void QLowEnergyControllerPrivate::sendNextPrepareWriteRequest(
-        const QLowEnergyHandle handle, const QByteArray &newValue,
-        quint16 offset)
+/*!
+    \internal
+
+    Queues the prepare write requests for all \a writes followed by a single
+    execute write request. Each write consists of the characteristic or
+    descriptor handle and the new value.
+
+    ATT permits only one outstanding request. Nevertheless, the complete
+    series is queued at once, so the next segment is sent as soon as the
+    previous one is echoed. The series stays contiguous because all of its
+    requests share the same priority. Each echo is compared with the segment
+    that was sent. A mismatch or an error drops the remaining segments and
+    turns the execute request into a cancellation (see cancelLongWrite()).
+ */
+void QLowEnergyControllerPrivate::enqueueLongWrite(const PreparedWriteList &writes)
 {
-    // is it a descriptor or characteristic?
-    QLowEnergyHandle targetHandle = 0;
-    const QLowEnergyDescriptor descriptor = descriptorForHandle(handle);
-    if (descriptor.isValid())
-        targetHandle = descriptor.handle();
-    else
-        targetHandle = characteristicForHandle(handle).handle();
+    const int maxAvailablePayload = activeLink->mtuSize - PREPARE_WRITE_HEADER_SIZE;
 
-    if (!targetHandle) {
-        qCWarning(QT_BT_BLUEZ) << "sendNextPrepareWriteRequest cancelled due to invalid handle"
-                               << handle;
-        return;
-    }
+    QList<Request> requests;
+    QVariantList executedWrites;
+    for (const auto &write : writes) {
+        const QLowEnergyHandle handle = write.first;
+        const QByteArray &newValue = write.second;
 
-    quint8 packet[PREPARE_WRITE_HEADER_SIZE];
-    packet[0] = ATT_OP_PREPARE_WRITE_REQUEST;
-    putBtData(targetHandle, &packet[1]); // attribute handle
-    putBtData(offset, &packet[3]); // offset into newValue
+        // is it a descriptor or characteristic?
+        QLowEnergyHandle targetHandle = 0;
+        const QLowEnergyDescriptor descriptor = descriptorForHandle(handle);
+        if (descriptor.isValid())
+            targetHandle = descriptor.handle();
+        else
+            targetHandle = characteristicForHandle(handle).handle();
+
+        if (!targetHandle) {
+            qCWarning(QT_BT_BLUEZ) << "Long write cancelled due to invalid handle" << handle;
+            continue;
+        }
 
-    qCDebug(QT_BT_BLUEZ) << "Writing long characteristic (prepare):"
-                         << hex << handle;
+        qCDebug(QT_BT_BLUEZ) << "Writing long attribute value (prepare):" << hex << handle
+                             << "size:" << dec << newValue.size();
 
+        int offset = 0;
+        do {
+            const int requiredPayload = qMin(newValue.size() - offset, maxAvailablePayload);
 
-    const int maxAvailablePayload = mtuSize - PREPARE_WRITE_HEADER_SIZE;
-    const int requiredPayload = qMin(newValue.size() - offset, maxAvailablePayload);
-    const int dataSize = PREPARE_WRITE_HEADER_SIZE + requiredPayload;
+            QByteArray data(PREPARE_WRITE_HEADER_SIZE + requiredPayload, Qt::Uninitialized);
+            data[0] = ATT_OP_PREPARE_WRITE_REQUEST;
+            putBtData(targetHandle, data.data() + 1); // attribute handle
+            putBtData(quint16(offset), data.data() + 3); // offset into newValue
+            memcpy(data.data() + PREPARE_WRITE_HEADER_SIZE, newValue.constData() + offset,
+                   requiredPayload);
 
-    Q_ASSERT((offset + requiredPayload) <= newValue.size());
-    Q_ASSERT(dataSize <= mtuSize);
+            Request request;
+            request.payload = data;
+            request.command = ATT_OP_PREPARE_WRITE_REQUEST;
+            request.reference = handle;
+            request.priority = UserPriority;
+            requests.append(request);
 
-    QByteArray data(dataSize, Qt::Uninitialized);
-    memcpy(data.data(), packet, PREPARE_WRITE_HEADER_SIZE);
-    memcpy(&(data.data()[PREPARE_WRITE_HEADER_SIZE]), &(newValue.constData()[offset]),
-                                               requiredPayload);
+            offset += requiredPayload;
+        } while (offset < newValue.size());
+
+        executedWrites.append(QVariant(QVariantList() << uint(handle) << newValue));
+    }
+
+    if (requests.isEmpty())
+        return;
+
+    QByteArray data(EXECUTE_WRITE_HEADER_SIZE, Qt::Uninitialized);
+    data[0] = ATT_OP_EXECUTE_WRITE_REQUEST;
+    data[1] = 0x01; // execute pending write prepare requests
 
     Request request;
     request.payload = data;
-    request.command = ATT_OP_PREPARE_WRITE_REQUEST;
-    request.reference = (handle | ((offset + requiredPayload) << 16));
-    request.reference2 = newValue;
-    openRequests.enqueue(request);
+    request.command = ATT_OP_EXECUTE_WRITE_REQUEST;
+    request.reference = true;
+    request.reference2 = executedWrites;
+    request.priority = UserPriority;
+    requests.append(request);
+
+    for (const Request &request : qAsConst(requests))
+        enqueueRequest(request);
+}
+
+/*!
+    \internal
+
+    Aborts the long write whose prepare write request failed. The remaining
+    segments at the head of the queue are dropped, and the execute request
+    that follows them is turned into a cancellation. A cancellation removes
+    all pending prepare write requests on the GATT server. Its response
+    reports the write errors.
+ */
+void QLowEnergyControllerPrivate::cancelLongWrite()
+{
+    while (!openRequests.isEmpty()
+           && openRequests.head().command == ATT_OP_PREPARE_WRITE_REQUEST) {
+        openRequests.dequeue();
+    }
+
+    if (openRequests.isEmpty() || openRequests.head().command != ATT_OP_EXECUTE_WRITE_REQUEST) {
+        qCWarning(QT_BT_BLUEZ) << "Cannot find execute write request of cancelled long write";
+        return;
+    }
+
+    qCDebug(QT_BT_BLUEZ) << "Cancelling long write";
+    Request &request = openRequests.head();
+    request.payload[1] = 0x00; // cancel pending write prepare requests
+    request.reference = false;
 }
 
 /*!
-    Sends an "Execute Write Request" for a long characteristic or descriptor write.
-    This cannot be used for executes in relation to reliable write requests.
+    \internal
+
+    Starts a reliable write transaction on \a service. Until the transaction is
+    executed or aborted, all writes with response to the characteristics and
+    descriptors of \a service are collected. They are then sent using prepare
+    write requests which are committed by a single execute write request.
+ */
+bool QLowEnergyControllerPrivate::beginReliableWrite(
+        const QSharedPointer<QLowEnergyServicePrivate> &service)
+{
+    if (!reliableWriteService.isNull()) {
+        if (reliableWriteService == service.data())
+            return true;
+        qCWarning(QT_BT_BLUEZ) << "Another reliable write transaction is in progress";
+        return false;
+    }
+
+    reliableWriteService = service.data();
+    reliableWrites.clear();
+    return true;
+}
 
-    A cancellation removes all pending prepare write request on the GATT server.
-    Otherwise this function sends an execute request for all pending prepare
-    write requests.
- */
-void QLowEnergyControllerPrivate::sendExecuteWriteRequest(
-        const QLowEnergyHandle attrHandle, const QByteArray &newValue,
-        bool isCancelation)
-{
-    quint8 packet[EXECUTE_WRITE_HEADER_SIZE];
-    packet[0] = ATT_OP_EXECUTE_WRITE_REQUEST;
-    if (isCancelation)
-        packet[1] = 0x00; // cancel pending write prepare requests
-    else
-        packet[1] = 0x01; // execute pending write prepare requests
+void QLowEnergyControllerPrivate::executeReliableWrite(
+        const QSharedPointer<QLowEnergyServicePrivate> &service)
+{
+    if (reliableWriteService != service.data())
+        return;
 
-    QByteArray data(EXECUTE_WRITE_HEADER_SIZE, Qt::Uninitialized);
-    memcpy(data.data(), packet, EXECUTE_WRITE_HEADER_SIZE);
+    const PreparedWriteList writes = reliableWrites;
+    reliableWrites.clear();
+    reliableWriteService.clear();
 
-    qCDebug(QT_BT_BLUEZ) << "Sending Execute Write Request for long characteristic value"
-                         << hex << attrHandle;
+    if (writes.isEmpty())
+        return;
 
-    Request request;
-    request.payload = data;
-    request.command = ATT_OP_EXECUTE_WRITE_REQUEST;
-    request.reference  = (attrHandle | ((isCancelation ? 0x00 : 0x01) << 16));
-    request.reference2 = newValue;
-    openRequests.prepend(request);
+    enqueueLongWrite(writes);
+    sendNextPendingRequest();
 }
 
+void QLowEnergyControllerPrivate::abortReliableWrite(
+        const QSharedPointer<QLowEnergyServicePrivate> &service)
+{
+    if (reliableWriteService != service.data())
+        return;
+
+    // nothing has been sent to the remote device yet
+    reliableWrites.clear();
+    reliableWriteService.clear();
+}
 
 /*!
     Writes long (prepare write request), short (write request)
     and writeWithoutResponse characteristic values.
 
-    TODO Reliable/prepare write across multiple characteristics is not supported
+    Writes with response are collected instead while a reliable write
+    transaction is active on \a service.
  */
 void QLowEnergyControllerPrivate::writeCharacteristic(
         const QSharedPointer<QLowEnergyServicePrivate> service,
@@ -1861,7 +3272,8 @@ void QLowEnergyControllerPrivate::readCharacteristic(
     // reference2 not really required but false prevents service discovery
     // code from running in ATT_OP_READ_RESPONSE handler
     request.reference2 = false;
-    openRequests.enqueue(request);
+    request.priority = UserPriority;
+    enqueueRequest(request);
 
     sendNextPendingRequest();
 }
@@ -1896,7 +3308,8 @@ void QLowEnergyControllerPrivate::readDescriptor(
     // reference2 not really required but false prevents service discovery
     // code from running in ATT_OP_READ_RESPONSE handler
     request.reference2 = false;
-    openRequests.enqueue(request);
+    request.priority = UserPriority;
+    enqueueRequest(request);
 
     sendNextPendingRequest();
 }
@@ -1907,7 +3320,7 @@ void QLowEnergyControllerPrivate::readDescriptor(
  */
 bool QLowEnergyControllerPrivate::increaseEncryptLevelfRequired(quint8 errorCode)
 {
-    if (securityLevelValue == BT_SECURITY_HIGH)
+    if (activeLink->securityLevelValue == BT_SECURITY_HIGH)
         return false;
 
     switch (errorCode) {
@@ -1918,7 +3331,7 @@ bool QLowEnergyControllerPrivate::increaseEncryptLevelfRequired(quint8 errorCode
             return false;
         if (!hciManager->monitorEvent(HciManager::EncryptChangeEvent))
             return false;
-        if (securityLevelValue != BT_SECURITY_HIGH) {
+        if (activeLink->securityLevelValue != BT_SECURITY_HIGH) {
             qCDebug(QT_BT_BLUEZ) << "Requesting encrypted link";
             if (setSecurityLevel(BT_SECURITY_HIGH))
                 return true;
@@ -1976,25 +3389,28 @@ void QLowEnergyControllerPrivate::handleExchangeMtuRequest(const QByteArray &pac
 
     if (!checkPacketSize(packet, 3))
         return;
-    if (receivedMtuExchangeRequest) { // Client must only send this once per connection.
+    if (activeLink->receivedMtuExchangeRequest) { // Client must only send this once per connection.
         qCDebug(QT_BT_BLUEZ) << "Client sent extraneous MTU exchange packet";
         sendErrorResponse(packet.at(0), 0, ATT_ERROR_REQUEST_NOT_SUPPORTED);
         return;
     }
-    receivedMtuExchangeRequest = true;
+    activeLink->receivedMtuExchangeRequest = true;
 
     // Send reply.
     QByteArray reply(MTU_EXCHANGE_HEADER_SIZE, Qt::Uninitialized);
     reply[0] = ATT_OP_EXCHANGE_MTU_RESPONSE;
-    putBtData(static_cast<quint16>(ATT_MAX_LE_MTU), reply.data() + 1);
+    putBtData(localRxMtu(), reply.data() + 1);
     sendPacket(reply);
 
     // Apply requested MTU.
     const quint16 clientRxMtu = bt_get_le16(packet.constData() + 1);
-    mtuSize = qMax<quint16>(ATT_DEFAULT_LE_MTU, qMin<quint16>(clientRxMtu, ATT_MAX_LE_MTU));
+    activeLink->mtuSize = qMax<quint16>(ATT_DEFAULT_LE_MTU, qMin<quint16>(clientRxMtu, localRxMtu()));
     qCDebug(QT_BT_BLUEZ) << "MTU request from client:" << clientRxMtu
-                         << "effective client RX MTU:" << mtuSize;
-    qCDebug(QT_BT_BLUEZ) << "Sending server RX MTU" << ATT_MAX_LE_MTU;
+                         << "effective client RX MTU:" << activeLink->mtuSize;
+    qCDebug(QT_BT_BLUEZ) << "Sending server RX MTU" << localRxMtu();
+    // QLowEnergyController::mtu() refers to the first client.
+    if (activeLink == serverConnections.value(0))
+        emit q_ptr->mtuChanged(activeLink->mtuSize);
 }
 
 void QLowEnergyControllerPrivate::handleFindInformationRequest(const QByteArray &packet)
@@ -2010,7 +3426,9 @@ void QLowEnergyControllerPrivate::handleFindInformationRequest(const QByteArray
     if (!checkHandlePair(packet.at(0), startingHandle, endingHandle))
         return;
 
-    QVector<Attribute> results = getAttributes(startingHandle, endingHandle);
+    const int maxCount = maxListResponseCount(2, sizeof(QLowEnergyHandle) + 2);
+    QVector<QLowEnergyHandle> results = getAttributeHandles(startingHandle, endingHandle,
+                                                            maxCount);
     if (results.isEmpty()) {
         sendErrorResponse(packet.at(0), startingHandle, ATT_ERROR_ATTRIBUTE_NOT_FOUND);
         return;
@@ -2018,7 +3436,7 @@ void QLowEnergyControllerPrivate::handleFindInformationRequest(const QByteArray
     ensureUniformUuidSizes(results);
 
     QByteArray responsePrefix(2, Qt::Uninitialized);
-    const int uuidSize = getUuidSize(results.first().type);
+    const int uuidSize = getUuidSize(localAttributes.at(results.first()).type);
     responsePrefix[0] = ATT_OP_FIND_INFORMATION_RESPONSE;
     responsePrefix[1] = uuidSize == 2 ? 0x1 : 0x2;
     const int elementSize = sizeof(QLowEnergyHandle) + uuidSize;
@@ -2034,7 +3452,7 @@ void QLowEnergyControllerPrivate::handleFindByTypeValueRequest(const QByteArray
 {
     // Spec v4.2, Vol 3, Part F, 3.4.3.3-4
 
-    if (!checkPacketSize(packet, 7, mtuSize))
+    if (!checkPacketSize(packet, 7, activeLink->mtuSize))
         return;
     const QLowEnergyHandle startingHandle = bt_get_le16(packet.constData() + 1);
     const QLowEnergyHandle endingHandle = bt_get_le16(packet.constData() + 3);
@@ -2046,18 +3464,21 @@ void QLowEnergyControllerPrivate::handleFindByTypeValueRequest(const QByteArray
     if (!checkHandlePair(packet.at(0), startingHandle, endingHandle))
         return;
 
-    const auto predicate = [value, this, type](const Attribute &attr) {
-        return attr.type == QBluetoothUuid(type) && attr.value == value
-                && checkReadPermissions(attr) == 0;
-    };
-    const QVector<Attribute> results = getAttributes(startingHandle, endingHandle, predicate);
+    const int elemSize = 2 * sizeof(QLowEnergyHandle);
+    const int maxCount = maxListResponseCount(1, elemSize);
+    QVector<QLowEnergyHandle> results;
+    const auto range = attributeTypeRange(QBluetoothUuid(type), startingHandle, endingHandle);
+    for (auto it = range.first; it != range.second && results.count() < maxCount; ++it) {
+        const Attribute &attr = localAttributes.at(*it);
+        if (localAttributeValue(attr) == value && checkReadPermissions(attr) == 0)
+            results << attr.handle;
+    }
     if (results.isEmpty()) {
         sendErrorResponse(packet.at(0), startingHandle, ATT_ERROR_ATTRIBUTE_NOT_FOUND);
         return;
     }
 
     QByteArray responsePrefix(1, ATT_OP_FIND_BY_TYPE_VALUE_RESPONSE);
-    const int elemSize = 2 * sizeof(QLowEnergyHandle);
     const auto elemWriter = [](const Attribute &attr, char *&data) {
         putDataAndIncrement(attr.handle, data);
         putDataAndIncrement(attr.groupEndHandle, data);
@@ -2091,9 +3512,9 @@ void QLowEnergyControllerPrivate::handleReadByTypeRequest(const QByteArray &pack
     if (!checkHandlePair(packet.at(0), startingHandle, endingHandle))
         return;
 
-    // Get all attributes with matching type.
-    QVector<Attribute> results = getAttributes(startingHandle, endingHandle,
-        [type](const Attribute &attr) { return attr.type == type; });
+    // Get the attributes with matching type, but no more than could possibly fit into the response.
+    QVector<QLowEnergyHandle> results = getAttributeHandles(type, startingHandle, endingHandle,
+            maxListResponseCount(2, sizeof(QLowEnergyHandle)));
     ensureUniformValueSizes(results);
 
     if (results.isEmpty()) {
@@ -2103,17 +3524,22 @@ void QLowEnergyControllerPrivate::handleReadByTypeRequest(const QByteArray &pack
 
     const int error = checkReadPermissions(results);
     if (error) {
-        sendErrorResponse(packet.at(0), results.first().handle, error);
+        sendErrorResponse(packet.at(0), results.first(), error);
         return;
     }
 
-    const int elementSize = sizeof(QLowEnergyHandle) + results.first().value.count();
+    // Long values are cut off, see Vol 3, Part F, 3.4.4.2.
+    const int valueLength = qMin(localAttributeValue(localAttributes.at(results.first())).count(),
+                                 qMin(activeLink->mtuSize - 4, 253));
+    const int elementSize = sizeof(QLowEnergyHandle) + valueLength;
     QByteArray responsePrefix(2, Qt::Uninitialized);
     responsePrefix[0] = ATT_OP_READ_BY_TYPE_RESPONSE;
     responsePrefix[1] = elementSize;
-    const auto elemWriter = [](const Attribute &attr, char *&data) {
+    const auto elemWriter = [this, valueLength](const Attribute &attr, char *&data) {
         putDataAndIncrement(attr.handle, data);
-        putDataAndIncrement(attr.value, data);
+        using namespace std;
+        memcpy(data, localAttributeValue(attr).constData(), valueLength);
+        data += valueLength;
     };
     sendListResponse(responsePrefix, elementSize, results, elemWriter);
 }
@@ -2136,11 +3562,12 @@ void QLowEnergyControllerPrivate::handleReadRequest(const QByteArray &packet)
         return;
     }
 
-    const int sentValueLength = qMin(attribute.value.count(), mtuSize - 1);
+    const QByteArray value = localAttributeValue(attribute);
+    const int sentValueLength = qMin(value.count(), activeLink->mtuSize - 1);
     QByteArray response(1 + sentValueLength, Qt::Uninitialized);
     response[0] = ATT_OP_READ_RESPONSE;
     using namespace std;
-    memcpy(response.data() + 1, attribute.value.constData(), sentValueLength);
+    memcpy(response.data() + 1, value.constData(), sentValueLength);
     qCDebug(QT_BT_BLUEZ) << "sending response:" << response.toHex();
     sendPacket(response);
 }
@@ -2164,22 +3591,23 @@ void QLowEnergyControllerPrivate::handleReadBlobRequest(const QByteArray &packet
         sendErrorResponse(packet.at(0), handle, permissionsError);
         return;
     }
-    if (valueOffset > attribute.value.count()) {
+    const QByteArray value = localAttributeValue(attribute);
+    if (valueOffset > value.count()) {
         sendErrorResponse(packet.at(0), handle, ATT_ERROR_INVALID_OFFSET);
         return;
     }
-    if (attribute.value.count() <= mtuSize - 3) {
+    if (value.count() <= activeLink->mtuSize - 3) {
         sendErrorResponse(packet.at(0), handle, ATT_ERROR_ATTRIBUTE_NOT_LONG);
         return;
     }
 
     // Yes, this value can be zero.
-    const int sentValueLength = qMin(attribute.value.count() - valueOffset, mtuSize - 1);
+    const int sentValueLength = qMin(value.count() - valueOffset, activeLink->mtuSize - 1);
 
     QByteArray response(1 + sentValueLength, Qt::Uninitialized);
     response[0] = ATT_OP_READ_BLOB_RESPONSE;
     using namespace std;
-    memcpy(response.data() + 1, attribute.value.constData() + valueOffset, sentValueLength);
+    memcpy(response.data() + 1, value.constData() + valueOffset, sentValueLength);
     qCDebug(QT_BT_BLUEZ) << "sending response:" << response.toHex();
     sendPacket(response);
 }
@@ -2187,24 +3615,28 @@ void QLowEnergyControllerPrivate::handleReadBlobRequest(const QByteArray &packet
 void QLowEnergyControllerPrivate::handleReadMultipleRequest(const QByteArray &packet)
 {
     // Spec v4.2, Vol 3, Part F, 3.4.4.7-8
+    // Spec v5.2, Vol 3, Part F, 3.4.4.11-12 (Read Multiple Variable)
 
-    if (!checkPacketSize(packet, 5, mtuSize))
+    if (!checkPacketSize(packet, 5, activeLink->mtuSize))
         return;
+    const bool isVariable = quint8(packet.at(0)) == ATT_OP_READ_MULTIPLE_VARIABLE_REQUEST;
     QVector<QLowEnergyHandle> handles((packet.count() - 1) / sizeof(QLowEnergyHandle));
     auto *packetPtr = reinterpret_cast<const QLowEnergyHandle *>(packet.constData() + 1);
     for (int i = 0; i < handles.count(); ++i, ++packetPtr)
         handles[i] = bt_get_le16(packetPtr);
-    qCDebug(QT_BT_BLUEZ) << "client sends read multiple request for handles" << handles;
+    qCDebug(QT_BT_BLUEZ) << "client sends read multiple request for handles" << handles
+                         << "variable:" << isVariable;
 
     const auto it = std::find_if(handles.constBegin(), handles.constEnd(),
-            [this](QLowEnergyHandle handle) { return handle >= lastLocalHandle; });
+            [this](QLowEnergyHandle handle) { return handle == 0 || handle > lastLocalHandle; });
     if (it != handles.constEnd()) {
         sendErrorResponse(packet.at(0), *it, ATT_ERROR_INVALID_HANDLE);
         return;
     }
-    const QVector<Attribute> results = getAttributes(handles.first(), handles.last());
-    QByteArray response(1, ATT_OP_READ_MULTIPLE_RESPONSE);
-    foreach (const Attribute &attr, results) {
+    QByteArray response(1, isVariable ? ATT_OP_READ_MULTIPLE_VARIABLE_RESPONSE
+                                      : ATT_OP_READ_MULTIPLE_RESPONSE);
+    foreach (const QLowEnergyHandle handle, handles) {
+        const Attribute &attr = localAttributes.at(handle);
         const int error = checkReadPermissions(attr);
         if (error) {
             sendErrorResponse(packet.at(0), attr.handle, error);
@@ -2213,7 +3645,13 @@ void QLowEnergyControllerPrivate::handleReadMultipleRequest(const QByteArray &pa
 
         // Note: We do not abort if no more values fit into the packet, because we still have to
         //       report possible permission errors for the other handles.
-        response += attr.value.left(mtuSize - response.count());
+        const QByteArray value = localAttributeValue(attr);
+        if (isVariable) {
+            QByteArray length(sizeof(quint16), Qt::Uninitialized);
+            putBtData(quint16(value.count()), length.data());
+            response += length.left(activeLink->mtuSize - response.count());
+        }
+        response += value.left(activeLink->mtuSize - response.count());
     }
 
     qCDebug(QT_BT_BLUEZ) << "sending response:" << response.toHex();
@@ -2253,21 +3691,22 @@ void QLowEnergyControllerPrivate::handleReadByGroupTypeRequest(const QByteArray
         return;
     }
 
-    QVector<Attribute> results = getAttributes(startingHandle, endingHandle,
-            [type](const Attribute &attr) { return attr.type == type; });
+    QVector<QLowEnergyHandle> results = getAttributeHandles(type, startingHandle, endingHandle,
+            maxListResponseCount(2, 2 * sizeof(QLowEnergyHandle) + 2));
     if (results.isEmpty()) {
         sendErrorResponse(packet.at(0), startingHandle, ATT_ERROR_ATTRIBUTE_NOT_FOUND);
         return;
     }
     const int error = checkReadPermissions(results);
     if (error) {
-        sendErrorResponse(packet.at(0), results.first().handle, error);
+        sendErrorResponse(packet.at(0), results.first(), error);
         return;
     }
 
     ensureUniformValueSizes(results);
 
-    const int elementSize = 2 * sizeof(QLowEnergyHandle) + results.first().value.count();
+    const int elementSize = 2 * sizeof(QLowEnergyHandle)
+            + localAttributes.at(results.first()).value.count();
     QByteArray responsePrefix(2, Qt::Uninitialized);
     responsePrefix[0] = ATT_OP_READ_BY_GROUP_RESPONSE;
     responsePrefix[1] = elementSize;
@@ -2279,6 +3718,16 @@ void QLowEnergyControllerPrivate::handleReadByGroupTypeRequest(const QByteArray
     sendListResponse(responsePrefix, elementSize, results, elemWriter);
 }
 
+/*
+ * Returns the value of attr as seen by the active client. Each client has its own
+ * client characteristic configurations.
+ */
+QByteArray QLowEnergyControllerPrivate::localAttributeValue(const Attribute &attr) const
+{
+    const auto configIt = activeLink->clientConfigValues.constFind(attr.handle);
+    return configIt != activeLink->clientConfigValues.constEnd() ? configIt.value() : attr.value;
+}
+
 void QLowEnergyControllerPrivate::updateLocalAttributeValue(
         QLowEnergyHandle handle,
         const QByteArray &value,
@@ -2286,6 +3735,9 @@ void QLowEnergyControllerPrivate::updateLocalAttributeValue(
         QLowEnergyDescriptor &descriptor)
 {
     localAttributes[handle].value = value;
+    const auto configIt = activeLink->clientConfigValues.find(handle);
+    if (configIt != activeLink->clientConfigValues.end())
+        configIt.value() = value;
     foreach (const auto &service, localServices) {
         if (handle < service->startHandle || handle > service->endHandle)
             continue;
@@ -2332,44 +3784,65 @@ void QLowEnergyControllerPrivate::writeCharacteristicForPeripheral(
             = attribute.properties & QLowEnergyCharacteristic::Indicate;
     if (!hasNotifyProperty && !hasIndicateProperty)
         return;
-    foreach (const QLowEnergyServicePrivate::DescData &desc, charData.descriptorList) {
-        if (desc.uuid != QBluetoothUuid::ClientCharacteristicConfiguration)
+    for (auto descIt = charData.descriptorList.constBegin();
+         descIt != charData.descriptorList.constEnd(); ++descIt) {
+        if (descIt.value().uuid != QBluetoothUuid::ClientCharacteristicConfiguration)
             continue;
 
-        // Notify/indicate currently connected client.
-        const bool isConnected = state == QLowEnergyController::ConnectedState;
-        if (isConnected) {
-            Q_ASSERT(desc.value.count() == 2);
-            quint16 configValue = bt_get_le16(desc.value.constData());
+        // Notify/indicate the currently connected clients.
+        Link * const previous = activeLink;
+        const QVector<Link *> connections = serverConnections;
+        for (Link * const connection : connections) {
+            if (!serverConnections.contains(connection))
+                continue;
+            activateServerConnection(connection);
+            const QByteArray configValueData = connection->clientConfigValues.value(descIt.key());
+            if (configValueData.count() != 2)
+                continue;
+            const quint16 configValue = bt_get_le16(configValueData.constData());
             if (isNotificationEnabled(configValue) && hasNotifyProperty) {
                 sendNotification(valueHandle);
             } else if (isIndicationEnabled(configValue) && hasIndicateProperty) {
-                if (indicationInFlight)
-                    scheduledIndications << valueHandle;
+                if (activeLink->indicationInFlight)
+                    activeLink->scheduledIndications.enqueue(valueHandle);
                 else
                     sendIndication(valueHandle);
             }
         }
+        restoreActiveLink(previous);
 
         // Prepare notification/indication of unconnected, bonded clients.
-        for (auto it = clientConfigData.begin(); it != clientConfigData.end(); ++it) {
-            if (isConnected && it.key() == remoteDevice.toUInt64())
-                continue;
-            QVector<ClientConfigurationData> &configDataList = it.value();
-            for (ClientConfigurationData &configData : configDataList) {
-                if (configData.charValueHandle != valueHandle)
-                    continue;
-                if ((isNotificationEnabled(configData.configValue) && hasNotifyProperty)
-                        || (isIndicationEnabled(configData.configValue) && hasIndicateProperty)) {
-                    configData.charValueWasUpdated = true;
-                    break;
-                }
-            }
-        }
+        QVector<quint64> connectedClients;
+        for (const Link * const connection : qAsConst(serverConnections))
+            connectedClients << connection->remoteDevice.toUInt64();
+        quint16 configMask = 0;
+        if (hasNotifyProperty)
+            configMask |= 1;
+        if (hasIndicateProperty)
+            configMask |= 2;
+        connectionManager->bondStore()->markCharacteristicUpdated(valueHandle, configMask,
+                                                                  connectedClients);
         break;
     }
 }
 
+/*!
+    \internal
+
+    Returns whether the Reliable Write bit is set in the Characteristic Extended
+    Properties descriptor of \a charData.
+ */
+static bool supportsReliableWrite(const QLowEnergyServicePrivate::CharData &charData)
+{
+    if (!(charData.properties & QLowEnergyCharacteristic::ExtendedProperty))
+        return false;
+    for (const QLowEnergyServicePrivate::DescData &descData : charData.descriptorList) {
+        if (descData.uuid == QBluetoothUuid::CharacteristicExtendedProperties)
+            return descData.value.size() >= 2 && (descData.value.at(0) & 0x01);
+    }
+    return false;
+}
+
 void QLowEnergyControllerPrivate::writeCharacteristicForCentral(const QSharedPointer<QLowEnergyServicePrivate> &service,
         QLowEnergyHandle charHandle,
         QLowEnergyHandle valueHandle,
@@ -2382,8 +3855,18 @@ void QLowEnergyControllerPrivate::writeCharacteristicForCentral(const QSharedPoi
     bool writeWithResponse = false;
     switch (mode) {
     case QLowEnergyService::WriteWithResponse:
-        if (newValue.size() > (mtuSize - WRITE_REQUEST_HEADER_SIZE)) {
-            sendNextPrepareWriteRequest(charHandle, newValue, 0);
+        if (!reliableWriteService.isNull() && reliableWriteService == service.data()) {
+            if (!supportsReliableWrite(service->characteristicList.value(charHandle))) {
+                qCWarning(QT_BT_BLUEZ) << "Characteristic" << hex << charHandle
+                                       << "does not support reliable writes";
+                service->setError(QLowEnergyService::CharacteristicWriteError);
+                return;
+            }
+            reliableWrites.append(qMakePair(charHandle, newValue));
+            return;
+        }
+        if (newValue.size() > (activeLink->mtuSize - WRITE_REQUEST_HEADER_SIZE)) {
+            enqueueLongWrite(PreparedWriteList() << qMakePair(charHandle, newValue));
             sendNextPendingRequest();
             return;
         }
@@ -2406,18 +3889,21 @@ void QLowEnergyControllerPrivate::writeCharacteristicForCentral(const QSharedPoi
             service->setError(QLowEnergyService::CharacteristicWriteError);
             return;
         }
-        const auto signingDataIt = signingData.find(remoteDevice.toUInt64());
-        if (signingDataIt == signingData.end()) {
+        LeBondStore * const bondStore = connectionManager->bondStore();
+        LeBondStore::SigningData signingData;
+        if (!bondStore->signingData(remoteDevice, LeBondStore::LocalSigningKey, &signingData)) {
             qCWarning(QT_BT_BLUEZ) << "signed write not possible: no signature key found";
             service->setError(QLowEnergyService::CharacteristicWriteError);
             return;
         }
-        ++signingDataIt.value().counter;
-        packet = LeCmacCalculator::createFullMessage(packet, signingDataIt.value().counter);
-        const quint64 mac = LeCmacCalculator().calculateMac(packet, signingDataIt.value().key);
-        packet.resize(packet.count() + sizeof mac);
+        ++signingData.counter;
+        const quint64 mac = cmacCalculator(remoteDevice)->calculateMac(packet.constData(),
+                packet.count(), signingData.counter, signingData.key);
+        const int messageSize = packet.count();
+        packet.resize(messageSize + int(sizeof signingData.counter) + int(sizeof mac));
+        putBtData(signingData.counter, packet.data() + messageSize);
         putBtData(mac, packet.data() + packet.count() - sizeof mac);
-        storeSignCounter(LocalSigningKey);
+        bondStore->setSignCounter(remoteDevice, LeBondStore::LocalSigningKey, signingData.counter);
         break;
     }
 
@@ -2430,7 +3916,10 @@ void QLowEnergyControllerPrivate::writeCharacteristicForCentral(const QSharedPoi
     // It can be sent at any time and does not produce responses.
     // Therefore we will not put them into the openRequest queue at all.
     if (!writeWithResponse) {
-        sendPacket(packet);
+        WriteCommand command;
+        command.packet = packet;
+        writeCommandQueue.enqueue(command);
+        sendQueuedWriteCommands();
         return;
     }
 
@@ -2439,7 +3928,8 @@ void QLowEnergyControllerPrivate::writeCharacteristicForCentral(const QSharedPoi
     request.command = ATT_OP_WRITE_REQUEST;
     request.reference = charHandle;
     request.reference2 = newValue;
-    openRequests.enqueue(request);
+    request.priority = UserPriority;
+    enqueueRequest(request);
 
     sendNextPendingRequest();
 }
@@ -2466,8 +3956,14 @@ void QLowEnergyControllerPrivate::writeDescriptorForCentral(
         const QLowEnergyHandle descriptorHandle,
         const QByteArray &newValue)
 {
-    if (newValue.size() > (mtuSize - WRITE_REQUEST_HEADER_SIZE)) {
-        sendNextPrepareWriteRequest(descriptorHandle, newValue, 0);
+    if (!reliableWriteService.isNull()
+            && reliableWriteService == serviceForHandle(descriptorHandle).data()) {
+        reliableWrites.append(qMakePair(descriptorHandle, newValue));
+        return;
+    }
+
+    if (newValue.size() > (activeLink->mtuSize - WRITE_REQUEST_HEADER_SIZE)) {
+        enqueueLongWrite(PreparedWriteList() << qMakePair(descriptorHandle, newValue));
         sendNextPendingRequest();
         return;
     }
@@ -2489,7 +3985,8 @@ void QLowEnergyControllerPrivate::writeDescriptorForCentral(
     request.command = ATT_OP_WRITE_REQUEST;
     request.reference = (charHandle | (descriptorHandle << 16));
     request.reference2 = newValue;
-    openRequests.enqueue(request);
+    request.priority = UserPriority;
+    enqueueRequest(request);
 
     sendNextPendingRequest();
 }
@@ -2500,7 +3997,7 @@ void QLowEnergyControllerPrivate::handleWriteRequestOrCommand(const QByteArray &
 
     const bool isRequest = packet.at(0) == ATT_OP_WRITE_REQUEST;
     const bool isSigned = quint8(packet.at(0)) == quint8(ATT_OP_SIGNED_WRITE_COMMAND);
-    if (!checkPacketSize(packet, isSigned ? 15 : 3, mtuSize))
+    if (!checkPacketSize(packet, isSigned ? 15 : 3, activeLink->mtuSize))
         return;
     const QLowEnergyHandle handle = bt_get_le16(packet.constData() + 1);
     qCDebug(QT_BT_BLUEZ) << "client sends" << (isSigned ? "signed" : "") << "write"
@@ -2529,32 +4026,32 @@ void QLowEnergyControllerPrivate::handleWriteRequestOrCommand(const QByteArray &
             qCWarning(QT_BT_BLUEZ) << "Ignoring signed write on encrypted link.";
             return;
         }
-        const auto signingDataIt = signingData.find(remoteDevice.toUInt64());
-        if (signingDataIt == signingData.constEnd()) {
+        LeBondStore * const bondStore = connectionManager->bondStore();
+        LeBondStore::SigningData signingData;
+        if (!bondStore->signingData(remoteDevice, LeBondStore::RemoteSigningKey, &signingData)) {
             qCWarning(QT_BT_BLUEZ) << "No CSRK found for peer device, ignoring signed write";
             return;
         }
 
         const quint32 signCounter = getBtData<quint32>(packet.data() + packet.count() - 12);
-        if (signCounter < signingDataIt.value().counter + 1) {
+        if (signCounter < signingData.counter + 1) {
             qCWarning(QT_BT_BLUEZ) << "Client's' sign counter" << signCounter
                                    << "not greater than local sign counter"
-                                   << signingDataIt.value().counter
+                                   << signingData.counter
                                    << "; ignoring signed write command.";
             return;
         }
 
         const quint64 macFromClient = getBtData<quint64>(packet.data() + packet.count() - 8);
-        const bool signatureCorrect = verifyMac(packet.left(packet.count() - 12),
-                signingDataIt.value().key, signCounter, macFromClient);
+        const bool signatureCorrect = verifyMac(packet.constData(), packet.count() - 12,
+                signingData.key, signCounter, macFromClient);
         if (!signatureCorrect) {
             qCWarning(QT_BT_BLUEZ) << "Signed Write packet has wrong signature, disconnecting";
-            disconnectFromDevice(); // Recommended by spec v4.2, Vol 3, part C, 10.4.2
+            disconnectPeer(); // Recommended by spec v4.2, Vol 3, part C, 10.4.2
             return;
         }
 
-        signingDataIt.value().counter = signCounter;
-        storeSignCounter(RemoteSigningKey);
+        bondStore->setSignCounter(remoteDevice, LeBondStore::RemoteSigningKey, signCounter);
         valueLength = packet.count() - 15;
     } else {
         valueLength = packet.count() - 3;
@@ -2569,7 +4066,7 @@ void QLowEnergyControllerPrivate::handleWriteRequestOrCommand(const QByteArray &
     // then we overwrite only the start of the attribute value and keep the rest.
     QByteArray value = packet.mid(3, valueLength);
     if (attribute.minLength == attribute.maxLength && valueLength < attribute.minLength)
-        value += attribute.value.mid(valueLength, attribute.maxLength - valueLength);
+        value += localAttributeValue(attribute).mid(valueLength, attribute.maxLength - valueLength);
 
     QLowEnergyCharacteristic characteristic;
     QLowEnergyDescriptor descriptor;
@@ -2592,7 +4089,7 @@ void QLowEnergyControllerPrivate::handlePrepareWriteRequest(const QByteArray &pa
 {
     // Spec v4.2, Vol 3, Part F, 3.4.6.1
 
-    if (!checkPacketSize(packet, 5, mtuSize))
+    if (!checkPacketSize(packet, 5, activeLink->mtuSize))
         return;
     const quint16 handle = bt_get_le16(packet.constData() + 1);
     qCDebug(QT_BT_BLUEZ) << "client sends prepare write request for handle" << handle;
@@ -2605,13 +4102,13 @@ void QLowEnergyControllerPrivate::handlePrepareWriteRequest(const QByteArray &pa
         sendErrorResponse(packet.at(0), handle, permissionsError);
         return;
     }
-    if (openPrepareWriteRequests.count() >= maxPrepareQueueSize) {
+    if (activeLink->openPrepareWriteRequests.count() >= maxPrepareQueueSize) {
         sendErrorResponse(packet.at(0), handle, ATT_ERROR_PREPARE_QUEUE_FULL);
         return;
     }
 
     // The value is not checked here, but on the Execute request.
-    openPrepareWriteRequests << WriteRequest(handle, bt_get_le16(packet.constData() + 3),
+    activeLink->openPrepareWriteRequests << WriteRequest(handle, bt_get_le16(packet.constData() + 3),
                                                     packet.mid(5));
 
     QByteArray response = packet;
@@ -2629,18 +4126,19 @@ void QLowEnergyControllerPrivate::handleExecuteWriteRequest(const QByteArray &pa
     qCDebug(QT_BT_BLUEZ) << "client sends execute write request; flag is"
                          << (cancel ? "cancel" : "flush");
 
-    QVector<WriteRequest> requests = openPrepareWriteRequests;
-    openPrepareWriteRequests.clear();
+    QVector<WriteRequest> requests = activeLink->openPrepareWriteRequests;
+    activeLink->openPrepareWriteRequests.clear();
     QVector<QLowEnergyCharacteristic> characteristics;
     QVector<QLowEnergyDescriptor> descriptors;
     if (!cancel) {
         foreach (const WriteRequest &request, requests) {
-            Attribute &attribute = localAttributes[request.handle];
-            if (request.valueOffset > attribute.value.count()) {
+            const Attribute &attribute = localAttributes.at(request.handle);
+            const QByteArray value = localAttributeValue(attribute);
+            if (request.valueOffset > value.count()) {
                 sendErrorResponse(packet.at(0), request.handle, ATT_ERROR_INVALID_OFFSET);
                 return;
             }
-            const QByteArray newValue = attribute.value.left(request.valueOffset) + request.value;
+            const QByteArray newValue = value.left(request.valueOffset) + request.value;
             if (newValue.count() > attribute.maxLength) {
                 sendErrorResponse(packet.at(0), request.handle, ATT_ERROR_INVAL_ATTR_VALUE_LEN);
                 return;
@@ -2684,58 +4182,185 @@ void QLowEnergyControllerPrivate::sendErrorResponse(quint8 request, quint16 hand
 }
 
 void QLowEnergyControllerPrivate::sendListResponse(const QByteArray &packetStart, int elemSize,
-        const QVector<Attribute> &attributes, const ElemWriter &elemWriter)
+        const QVector<QLowEnergyHandle> &handles, const ElemWriter &elemWriter)
 {
     const int offset = packetStart.count();
-    const int elemCount = qMin(attributes.count(), (mtuSize - offset) / elemSize);
+    const int elemCount = qMin(handles.count(), (activeLink->mtuSize - offset) / elemSize);
     const int totalPacketSize = offset + elemCount * elemSize;
     QByteArray response(totalPacketSize, Qt::Uninitialized);
     using namespace std;
     memcpy(response.data(), packetStart.constData(), offset);
     char *data = response.data() + offset;
-    for_each(attributes.constBegin(), attributes.constBegin() + elemCount,
-             [&data, elemWriter](const Attribute &attr) { elemWriter(attr, data); });
+    for_each(handles.constBegin(), handles.constBegin() + elemCount,
+             [this, &data, elemWriter](QLowEnergyHandle handle) {
+        elemWriter(localAttributes.at(handle), data);
+    });
     qCDebug(QT_BT_BLUEZ) << "sending response:" << response.toHex();
     sendPacket(response);
 }
 
 void QLowEnergyControllerPrivate::sendNotification(QLowEnergyHandle handle)
 {
-    sendNotificationOrIndication(ATT_OP_HANDLE_VAL_NOTIFICATION, handle);
+    // Behind a batch or a backlog, only the latest value of each characteristic is sent.
+    if (notificationBatchDepth > 0 || !activeLink->pendingNotifications.isEmpty()) {
+        if (!activeLink->pendingNotifications.contains(handle))
+            activeLink->pendingNotifications << handle;
+        return;
+    }
+
+    if (notificationBuffer.size() < ATT_MAX_LE_MTU)
+        notificationBuffer.resize(ATT_MAX_LE_MTU);
+    const int size = buildValuePacket(ATT_OP_HANDLE_VAL_NOTIFICATION, handle,
+                                      notificationBuffer.data());
+    if (sendPacket(notificationBuffer.constData(), size) == 0) {
+        activeLink->pendingNotifications << handle;
+        waitForWritableSocket();
+    }
 }
 
 void QLowEnergyControllerPrivate::sendIndication(QLowEnergyHandle handle)
 {
-    Q_ASSERT(!indicationInFlight);
-    indicationInFlight = true;
-    sendNotificationOrIndication(ATT_OP_HANDLE_VAL_INDICATION, handle);
+    Q_ASSERT(!activeLink->indicationInFlight);
+    activeLink->indicationInFlight = true;
+    if (notificationBuffer.size() < ATT_MAX_LE_MTU)
+        notificationBuffer.resize(ATT_MAX_LE_MTU);
+    const int size = buildValuePacket(ATT_OP_HANDLE_VAL_INDICATION, handle,
+                                      notificationBuffer.data());
+    sendPacket(notificationBuffer.constData(), size);
 }
 
-void QLowEnergyControllerPrivate::sendNotificationOrIndication(
-        quint8 opCode,
-        QLowEnergyHandle handle)
+/*
+ * Writes a notification or indication of the current value of the attribute at handle
+ * into buffer, which must be able to hold ATT_MAX_LE_MTU bytes. Returns the packet size.
+ */
+int QLowEnergyControllerPrivate::buildValuePacket(quint8 opCode, QLowEnergyHandle handle,
+                                                  char *buffer) const
 {
     Q_ASSERT(handle <= lastLocalHandle);
     const Attribute &attribute = localAttributes.at(handle);
-    const int maxValueLength = qMin(attribute.value.count(), mtuSize - 3);
-    QByteArray packet(3 + maxValueLength, Qt::Uninitialized);
-    packet[0] = opCode;
-    putBtData(handle, packet.data() + 1);
+    const int maxValueLength = qMin(attribute.value.count(), activeLink->mtuSize - 3);
+    buffer[0] = opCode;
+    putBtData(handle, buffer + 1);
     using namespace std;
-    memcpy(packet.data() + 3, attribute.value.constData(), maxValueLength);
-    qCDebug(QT_BT_BLUEZ) << "sending notification/indication:" << packet.toHex();
-    sendPacket(packet);
+    memcpy(buffer + 3, attribute.value.constData(), maxValueLength);
+    if (QT_BT_BLUEZ().isDebugEnabled()) {
+        qCDebug(QT_BT_BLUEZ) << "sending notification/indication:"
+                             << QByteArray::fromRawData(buffer, 3 + maxValueLength).toHex();
+    }
+    return 3 + maxValueLength;
 }
 
 void QLowEnergyControllerPrivate::sendNextIndication()
 {
-    if (!scheduledIndications.isEmpty())
-        sendIndication(scheduledIndications.takeFirst());
+    if (!activeLink->scheduledIndications.isEmpty())
+        sendIndication(activeLink->scheduledIndications.dequeue());
+}
+
+/*
+ * Sends the notifications held back by a batch or a full socket buffer. As many of them
+ * as possible are handed to the kernel per system call.
+ */
+void QLowEnergyControllerPrivate::sendPendingNotifications()
+{
+    if (notificationBatchDepth > 0 || activeLink->pendingNotifications.isEmpty())
+        return;
+    if (!activeLink->l2cpSocket || activeLink->l2cpSocket->state() != QBluetoothSocket::ConnectedState) {
+        activeLink->pendingNotifications.clear();
+        return;
+    }
+    if (activeLink->waitingForWritableSocket)
+        return;
+
+    int sent = 0;
+    while (sent < activeLink->pendingNotifications.count()) {
+        const int count = qMin(maxNotificationBatchSize, activeLink->pendingNotifications.count() - sent);
+        const int written = writeNotifications(activeLink->pendingNotifications.constData() + sent, count);
+        if (written == -1) {
+            activeLink->pendingNotifications.clear();
+            return;
+        }
+        sent += written;
+        if (written < count) {
+            waitForWritableSocket();
+            break;
+        }
+    }
+    activeLink->pendingNotifications.remove(0, sent);
+}
+
+/*
+ * Writes notifications for up to maxNotificationBatchSize handles. Returns the number of
+ * notifications accepted by the socket or -1 if an error occurred.
+ */
+int QLowEnergyControllerPrivate::writeNotifications(const QLowEnergyHandle *handles, int count)
+{
+    Q_ASSERT(count <= maxNotificationBatchSize);
+    if (notificationBuffer.size() < maxNotificationBatchSize * ATT_MAX_LE_MTU)
+        notificationBuffer.resize(maxNotificationBatchSize * ATT_MAX_LE_MTU);
+    char * const buffer = notificationBuffer.data();
+    int sizes[maxNotificationBatchSize];
+    for (int i = 0; i < count; ++i) {
+        sizes[i] = buildValuePacket(ATT_OP_HANDLE_VAL_NOTIFICATION, handles[i],
+                                    buffer + i * ATT_MAX_LE_MTU);
+    }
+
+    int sent = 0;
+#ifdef QT_BT_HAVE_SENDMMSG
+    // One ATT PDU per message on the SOCK_SEQPACKET socket.
+    mmsghdr messages[maxNotificationBatchSize];
+    iovec vectors[maxNotificationBatchSize];
+    using namespace std;
+    memset(messages, 0, count * sizeof(mmsghdr));
+    for (int i = 0; i < count; ++i) {
+        vectors[i].iov_base = buffer + i * ATT_MAX_LE_MTU;
+        vectors[i].iov_len = size_t(sizes[i]);
+        messages[i].msg_hdr.msg_iov = &vectors[i];
+        messages[i].msg_hdr.msg_iovlen = 1;
+    }
+    const int result = ::sendmmsg(activeLink->l2cpSocket->socketDescriptor(), messages, uint(count),
+                                  MSG_DONTWAIT | MSG_NOSIGNAL);
+    if (result >= 0) {
+        for (; sent < result; ++sent)
+            recordPacketSent(buffer + sent * ATT_MAX_LE_MTU, sizes[sent]);
+        return sent;
+    }
+    if (errno == EAGAIN || errno == EWOULDBLOCK)
+        return 0;
+    if (errno != ENOSYS) {
+        qCDebug(QT_BT_BLUEZ) << "Cannot write notifications:" << qt_error_string(errno);
+        setError(QLowEnergyController::NetworkError);
+        return -1;
+    }
+    // The kernel predates sendmmsg(), write the packets one by one.
+#endif
+    for (; sent < count; ++sent) {
+        const qint64 result = sendPacket(buffer + sent * ATT_MAX_LE_MTU, sizes[sent]);
+        if (result == -1)
+            return -1;
+        if (result == 0)
+            break;
+    }
+    return sent;
+}
+
+void QLowEnergyControllerPrivate::flushNotifications()
+{
+    Link * const previous = activeLink;
+    const QVector<Link *> connections = serverConnections;
+    for (Link * const connection : connections) {
+        if (!serverConnections.contains(connection))
+            continue;
+        activateServerConnection(connection);
+        sendPendingNotifications();
+    }
+    restoreActiveLink(previous);
 }
 
 void QLowEnergyControllerPrivate::handleConnectionRequest()
 {
-    if (state != QLowEnergyController::AdvertisingState) {
+    const bool acceptsFurtherClients = state == QLowEnergyController::ConnectedState
+            && serverConnections.count() < maximumClientCount;
+    if (state != QLowEnergyController::AdvertisingState && !acceptsFurtherClients) {
         qCWarning(QT_BT_BLUEZ) << "Incoming connection request in unexpected state" << state;
         return;
     }
@@ -2751,26 +4376,84 @@ void QLowEnergyControllerPrivate::handleConnectionRequest()
         serverSocketNotifier->setEnabled(true);
         return;
     }
-    remoteDevice = QBluetoothAddress(convertAddress(clientAddr.l2_bdaddr.b));
+
+    if (serverConnections.count() + 1 < maximumClientCount) {
+        // The connection has stopped advertising.
+        serverSocketNotifier->setEnabled(true);
+        advertiser->startAdvertising();
+    } else {
+        closeServerSocket();
+    }
+    addServerConnection(clientSocket, QBluetoothAddress(convertAddress(clientAddr.l2_bdaddr.b)));
+}
+
+/*
+ * Sets up the link of a GATT client which has connected from address
+ * via the accepted socketDescriptor.
+ */
+void QLowEnergyControllerPrivate::addServerConnection(int socketDescriptor,
+                                                      const QBluetoothAddress &address)
+{
+    Link * const connection = new Link;
+    connection->remoteDevice = address;
+    connection->connectionHandle = pendingConnectionHandles.take(address.toUInt64());
+    if (connection->connectionHandle == 0 && pendingConnectionHandles.count() == 1) {
+        // The event may report a different address of the same device.
+        connection->connectionHandle = pendingConnectionHandles.begin().value();
+        pendingConnectionHandles.clear();
+    }
+    serverConnections << connection;
+    activateServerConnection(connection);
     qCDebug(QT_BT_BLUEZ) << "GATT connection from device" << remoteDevice;
-    if (connectionHandle == 0)
+    if (connection->connectionHandle == 0)
         qCWarning(QT_BT_BLUEZ) << "Received client connection, but no connection complete event";
 
-    closeServerSocket();
-    l2cpSocket = new QBluetoothSocket(QBluetoothServiceInfo::L2capProtocol, this);
-    connect(l2cpSocket, &QBluetoothSocket::disconnected,
-            this, &QLowEnergyControllerPrivate::l2cpDisconnected);
-    connect(l2cpSocket, static_cast<void (QBluetoothSocket::*)(QBluetoothSocket::SocketError)>
-            (&QBluetoothSocket::error), this, &QLowEnergyControllerPrivate::l2cpErrorChanged);
-    connect(l2cpSocket, &QIODevice::readyRead, this, &QLowEnergyControllerPrivate::l2cpReadyRead);
-    l2cpSocket->d_ptr->lowEnergySocketType = addressType == QLowEnergyController::PublicAddress
+    // the socket takes ownership of socketDescriptor
+    QBluetoothSocket * const socket = new QBluetoothSocket(this);
+    connection->l2cpSocket = socket;
+    connect(socket, &QBluetoothSocket::disconnected, this, [this, connection]() {
+        removeServerConnection(connection);
+    });
+    connect(socket, static_cast<void (QBluetoothSocket::*)(QBluetoothSocket::SocketError)>
+            (&QBluetoothSocket::error), this, [this, connection](QBluetoothSocket::SocketError e) {
+        if (serverConnections.count() > 1) {
+            qCDebug(QT_BT_BLUEZ) << "Dropping GATT client after socket error" << e;
+            removeServerConnection(connection);
+            return;
+        }
+        l2cpErrorChanged(e);
+    });
+    connect(socket, &QIODevice::readyRead, this, [this, connection]() {
+        activateServerConnection(connection);
+        l2cpReadyRead();
+        activatePrimaryServerConnection();
+    });
+    socket->d_ptr->lowEnergySocketType = addressType == QLowEnergyController::PublicAddress
             ? BDADDR_LE_PUBLIC : BDADDR_LE_RANDOM;
-    l2cpSocket->setSocketDescriptor(clientSocket, QBluetoothServiceInfo::L2capProtocol,
+    socket->setSocketDescriptor(socketDescriptor, QBluetoothServiceInfo::L2capProtocol,
             QBluetoothSocket::ConnectedState, QIODevice::ReadWrite | QIODevice::Unbuffered);
+    startAttReceiver();
     restoreClientConfigurations();
-    loadSigningDataIfNecessary(RemoteSigningKey);
-    setState(QLowEnergyController::ConnectedState);
+    connectionManager->bondStore()->loadSigningData(remoteDevice,
+                                                    LeBondStore::RemoteSigningKey);
+    connection->connectionCounted = true;
+    connectionManager->connectionOpened();
+    if (state != QLowEnergyController::ConnectedState)
+        setState(QLowEnergyController::ConnectedState);
+    requestLinkLayerThroughput();
+
+    activatePrimaryServerConnection();
+    emit q_ptr->clientConnected(address);
+}
+
+#ifdef QT_BUILD_INTERNAL
+Q_AUTOTEST_EXPORT void qt_addLowEnergyControllerClient(QLowEnergyController *controller,
+                                                       int socketDescriptor,
+                                                       const QBluetoothAddress &address)
+{
+    QLowEnergyControllerPrivate::get(controller)->acceptAttSocket(socketDescriptor, address);
 }
+#endif
 
 void QLowEnergyControllerPrivate::closeServerSocket()
 {
@@ -2782,6 +4465,173 @@ void QLowEnergyControllerPrivate::closeServerSocket()
     serverSocketNotifier = nullptr;
 }
 
+void QLowEnergyControllerPrivate::stopAcceptingClients()
+{
+    acceptingClients = false;
+    pendingConnectionHandles.clear();
+    if (!serverSocketNotifier)
+        return;
+
+    // Advertising was resumed for further clients.
+    closeServerSocket();
+    advertiser->stopAdvertising();
+}
+
+/*
+ * Resumes advertising after a client has disconnected if it was stopped because
+ * the maximum number of clients had been connected.
+ */
+void QLowEnergyControllerPrivate::resumeAcceptingClients()
+{
+    if (!acceptingClients || serverSocketNotifier || serverConnections.isEmpty()
+            || serverConnections.count() >= maximumClientCount) {
+        return;
+    }
+    if (!listenForConnections()) {
+        acceptingClients = false;
+        return;
+    }
+    advertiser->startAdvertising();
+}
+
+/*
+ * Makes connection the active GATT client, whose link is used for processing packets.
+ * nullptr activates defaultLink, which is the only link in the central role.
+ */
+void QLowEnergyControllerPrivate::activateServerConnection(Link *connection)
+{
+    activeLink = connection ? connection : &defaultLink;
+    if (connection)
+        remoteDevice = connection->remoteDevice;
+}
+
+void QLowEnergyControllerPrivate::activatePrimaryServerConnection()
+{
+    activateServerConnection(serverConnections.value(0));
+}
+
+/*
+ * Makes previous the active link again, unless its client has disconnected in the meantime.
+ */
+void QLowEnergyControllerPrivate::restoreActiveLink(Link *previous)
+{
+    if (previous == &defaultLink || serverConnections.contains(previous))
+        activateServerConnection(previous == &defaultLink ? nullptr : previous);
+    else
+        activatePrimaryServerConnection();
+}
+
+QLowEnergyControllerPrivate::Link *
+QLowEnergyControllerPrivate::serverConnectionForHandle(quint16 handle) const
+{
+    if (handle == 0)
+        return nullptr;
+    for (Link * const connection : serverConnections) {
+        if (connection->connectionHandle == handle)
+            return connection;
+    }
+    return nullptr;
+}
+
+QLowEnergyControllerPrivate::Link *
+QLowEnergyControllerPrivate::serverConnectionForAttReceiver(const QObject *receiver) const
+{
+    if (!receiver)
+        return nullptr;
+    for (Link * const connection : serverConnections) {
+        if (connection->attReceiver == receiver)
+            return connection;
+    }
+    return nullptr;
+}
+
+bool QLowEnergyControllerPrivate::isConnectedClient(quint64 address) const
+{
+    return std::any_of(serverConnections.constBegin(), serverConnections.constEnd(),
+                       [address](const Link *connection) {
+        return connection->remoteDevice.toUInt64() == address;
+    });
+}
+
+/*
+ * The connection complete event of a client and its ATT connection arrive in no
+ * particular order. The handles of clients that have not been accepted yet are
+ * kept until handleConnectionRequest() picks them up.
+ */
+void QLowEnergyControllerPrivate::assignServerConnectionHandle(quint16 handle,
+                                                               const QBluetoothAddress &peerAddress)
+{
+    for (Link * const connection : qAsConst(serverConnections)) {
+        if (connection->connectionHandle != 0 || connection->remoteDevice != peerAddress)
+            continue;
+        qCDebug(QT_BT_BLUEZ) << "received connection complete event, handle:" << handle;
+        Link * const previous = activeLink;
+        activateServerConnection(connection);
+        connection->connectionHandle = handle;
+        requestLinkLayerThroughput();
+        restoreActiveLink(previous);
+        return;
+    }
+    if (serverSocketNotifier)
+        pendingConnectionHandles.insert(peerAddress.toUInt64(), handle);
+}
+
+/*
+ * Forgets about a client whose connection has been closed or failed, or closes it.
+ * Once the last client is gone, the controller is disconnected as before. Otherwise,
+ * only the state of the client which has left is dropped.
+ */
+void QLowEnergyControllerPrivate::removeServerConnection(Link *connection)
+{
+    Q_Q(QLowEnergyController);
+
+    if (!serverConnections.contains(connection))
+        return;
+    Link * const previous = activeLink;
+    activateServerConnection(connection);
+    const QBluetoothAddress address = remoteDevice;
+    QBluetoothSocket * const socket = connection->l2cpSocket;
+    socket->disconnect(this);
+
+    if (serverConnections.count() == 1) {
+        // The last client's state is reset by the disconnection.
+        defaultLink = *connection;
+        serverConnections.clear();
+        activateServerConnection(nullptr);
+        delete connection;
+        stopAcceptingClients();
+        emit q->clientDisconnected(address);
+        l2cpDisconnected();
+        return;
+    }
+
+    storeClientConfigurations();
+    stopAttReceiver();
+    disconnect(connection->socketWritableConnection);
+    if (connection->connectionCounted)
+        connectionManager->connectionClosed();
+    delete cmacCalculators.take(address.toUInt64());
+    socket->close();
+    socket->deleteLater();
+    serverConnections.removeOne(connection);
+    delete connection;
+    restoreActiveLink(previous);
+    emit q->clientDisconnected(address);
+    resumeAcceptingClients();
+}
+
+/*
+ * Closes the connection to the peer whose packet is being processed. In the peripheral
+ * role, the other clients stay connected.
+ */
+void QLowEnergyControllerPrivate::disconnectPeer()
+{
+    if (serverConnections.count() > 1)
+        removeServerConnection(activeLink);
+    else
+        disconnectFromDevice();
+}
+
 bool QLowEnergyControllerPrivate::isBonded() const
 {
     // Pairing does not necessarily imply bonding, but we don't know whether the
@@ -2813,33 +4663,41 @@ QVector<QLowEnergyControllerPrivate::TempClientConfigurationData> QLowEnergyCont
 
 void QLowEnergyControllerPrivate::storeClientConfigurations()
 {
+    LeBondStore * const bondStore = connectionManager->bondStore();
     if (!isBonded()) {
-        clientConfigData.remove(remoteDevice.toUInt64());
+        bondStore->removeClientConfigurations(remoteDevice);
         return;
     }
-    QVector<ClientConfigurationData> clientConfigs;
+    QVector<LeBondStore::ClientConfiguration> clientConfigs;
     const QVector<TempClientConfigurationData> &tempConfigList = gatherClientConfigData();
     foreach (const auto &tempConfigData, tempConfigList) {
-        Q_ASSERT(tempConfigData.descData->value.count() == 2);
-        const quint16 value = bt_get_le16(tempConfigData.descData->value.constData());
+        const QByteArray configValue
+                = activeLink->clientConfigValues.value(tempConfigData.configHandle);
+        if (configValue.count() != 2)
+            continue;
+        const quint16 value = bt_get_le16(configValue.constData());
         if (value != 0) {
-            clientConfigs << ClientConfigurationData(tempConfigData.charValueHandle,
-                                                     tempConfigData.configHandle, value);
+            clientConfigs << LeBondStore::ClientConfiguration(tempConfigData.charValueHandle,
+                    tempConfigData.configHandle, value,
+                    localAttributes.at(tempConfigData.charValueHandle).type);
         }
     }
-    clientConfigData.insert(remoteDevice.toUInt64(), clientConfigs);
+    bondStore->setClientConfigurations(remoteDevice, clientConfigs);
 }
 
 void QLowEnergyControllerPrivate::restoreClientConfigurations()
 {
     const QVector<TempClientConfigurationData> &tempConfigList = gatherClientConfigData();
-    const QVector<ClientConfigurationData> &restoredClientConfigs = isBonded()
-            ? clientConfigData.value(remoteDevice.toUInt64()) : QVector<ClientConfigurationData>();
+    const QVector<LeBondStore::ClientConfiguration> &restoredClientConfigs = isBonded()
+            ? connectionManager->bondStore()->clientConfigurations(remoteDevice)
+            : QVector<LeBondStore::ClientConfiguration>();
     QVector<QLowEnergyHandle> notifications;
     foreach (const auto &tempConfigData, tempConfigList) {
         bool wasRestored = false;
         foreach (const auto &restoredData, restoredClientConfigs) {
-            if (restoredData.charValueHandle == tempConfigData.charValueHandle) {
+            if (restoredData.charValueHandle == tempConfigData.charValueHandle
+                    && restoredData.charUuid
+                       == localAttributes.at(tempConfigData.charValueHandle).type) {
                 Q_ASSERT(tempConfigData.descData->value.count() == 2);
                 putBtData(restoredData.configValue, tempConfigData.descData->value.data());
                 wasRestored = true;
@@ -2847,7 +4705,7 @@ void QLowEnergyControllerPrivate::restoreClientConfigurations()
                     if (isNotificationEnabled(restoredData.configValue))
                         notifications << restoredData.charValueHandle;
                     else if (isIndicationEnabled(restoredData.configValue))
-                        scheduledIndications << restoredData.charValueHandle;
+                        activeLink->scheduledIndications.enqueue(restoredData.charValueHandle);
                 }
                 break;
             }
@@ -2857,6 +4715,8 @@ void QLowEnergyControllerPrivate::restoreClientConfigurations()
         Q_ASSERT(lastLocalHandle >= tempConfigData.configHandle);
         Q_ASSERT(tempConfigData.configHandle > tempConfigData.charValueHandle);
         localAttributes[tempConfigData.configHandle].value = tempConfigData.descData->value;
+        activeLink->clientConfigValues.insert(tempConfigData.configHandle,
+                                              tempConfigData.descData->value);
     }
 
     foreach (const QLowEnergyHandle handle, notifications)
@@ -2864,68 +4724,186 @@ void QLowEnergyControllerPrivate::restoreClientConfigurations()
     sendNextIndication();
 }
 
-void QLowEnergyControllerPrivate::loadSigningDataIfNecessary(SigningKeyType keyType)
+QString QLowEnergyControllerPrivate::attributeCacheFilePath() const
 {
-    const auto signingDataIt = signingData.constFind(remoteDevice.toUInt64());
-    if (signingDataIt != signingData.constEnd())
-        return; // We are up to date for this device.
-    const QString settingsFilePath = keySettingsFilePath();
-    if (!QFileInfo(settingsFilePath).exists()) {
-        qCDebug(QT_BT_BLUEZ) << "No settings found for peer device.";
-        return;
-    }
-    QSettings settings(settingsFilePath, QSettings::IniFormat);
-    const QString group = signingKeySettingsGroup(keyType);
-    settings.beginGroup(group);
-    const QByteArray keyString = settings.value(QLatin1String("Key")).toByteArray();
-    if (keyString.isEmpty()) {
-        qCDebug(QT_BT_BLUEZ) << "Group" << group << "not found in settings file";
-        return;
+    return QString::fromLatin1("%1/qtbluetooth/gatt/%2/%3")
+            .arg(QStandardPaths::writableLocation(QStandardPaths::GenericCacheLocation),
+                 localAdapter.toString(), remoteDevice.toString());
+}
+
+void QLowEnergyControllerPrivate::processDatabaseHashReply(const QByteArray &response,
+                                                           bool isErrorResponse)
+{
+    /* packet format:
+     *      <opcode><elementLength>[<handle><hash>]
+     *
+     * The hash is always 128 bit.
+     */
+    databaseHash.clear();
+    if (!isErrorResponse && response.size() >= 2 + 2 + 16 && response.at(1) == 2 + 16)
+        databaseHash = response.mid(4, 16);
+
+    qCDebug(QT_BT_BLUEZ) << "Database hash of remote device:" << databaseHash.toHex();
+
+    if (!restoreAttributeCache())
+        sendReadByGroupRequest(0x0001, 0xFFFF, GATT_PRIMARY_SERVICE);
+}
+
+/*!
+    \internal
+
+    Restores the services of the remote device from the attribute cache and returns
+    \c true if the cache is known to be up to date; otherwise \c false.
+
+    The cache is used only if it was stored with the Database Hash just read from
+    the device. Without Database Hash, changes made to the attributes while we were
+    not connected cannot be detected.
+ */
+bool QLowEnergyControllerPrivate::restoreAttributeCache()
+{
+    Q_Q(QLowEnergyController);
+
+    attributeCache.setFilePath(attributeCacheFilePath());
+    QVector<LeAttributeCache::Service> cached;
+    if (!attributeCache.load(databaseHash, &cached))
+        return false;
+
+    qCDebug(QT_BT_BLUEZ) << "Restoring" << cached.count() << "services from attribute cache";
+
+    QSet<QBluetoothUuid> detailedServices;
+    for (const LeAttributeCache::Service &cachedService : qAsConst(cached)) {
+        QSharedPointer<QLowEnergyServicePrivate> service(new QLowEnergyServicePrivate);
+        service->uuid = cachedService.uuid;
+        service->startHandle = cachedService.startHandle;
+        service->endHandle = cachedService.endHandle;
+        service->type = QLowEnergyService::ServiceTypes(cachedService.type);
+        service->includedServices = cachedService.includedServices;
+        for (const LeAttributeCache::Characteristic &cachedChar : cachedService.characteristics) {
+            QLowEnergyServicePrivate::CharData charData;
+            charData.uuid = cachedChar.uuid;
+            charData.valueHandle = cachedChar.valueHandle;
+            charData.properties = cachedChar.properties;
+            for (const LeAttributeCache::Descriptor &cachedDesc : cachedChar.descriptors) {
+                QLowEnergyServicePrivate::DescData descData;
+                descData.uuid = cachedDesc.uuid;
+                charData.descriptorList.insert(cachedDesc.handle, descData);
+            }
+            service->characteristicList.insert(cachedChar.handle, charData);
+        }
+        if (cachedService.detailed)
+            detailedServices.insert(service->uuid);
+
+        service->setController(this);
+        trackServiceForAttributeCache(service.data());
+        serviceList.insert(service->uuid, service);
+        serviceHandleIndexDirty = true;
+        emit q->serviceDiscovered(service->uuid);
     }
-    const QByteArray keyData = QByteArray::fromHex(keyString);
-    if (keyData.count() != int(sizeof(quint128))) {
-        qCWarning(QT_BT_BLUEZ) << "Signing key in settings file has invalid size"
-                               << keyString.count();
-        return;
+    cachedServices = detailedServices;
+
+    setState(QLowEnergyController::DiscoveredState);
+    emit q->discoveryFinished();
+    return true;
+}
+
+/*!
+    \internal
+
+    Stores the services of the remote device and the details of all services
+    whose details are known in the attribute cache. The file is only written
+    if its contents change.
+ */
+void QLowEnergyControllerPrivate::storeAttributeCache()
+{
+    QVector<LeAttributeCache::Service> services;
+    services.reserve(serviceList.count());
+    for (auto it = serviceList.constBegin(); it != serviceList.constEnd(); ++it) {
+        const QSharedPointer<QLowEnergyServicePrivate> &service = it.value();
+        LeAttributeCache::Service cachedService;
+        cachedService.uuid = service->uuid;
+        cachedService.startHandle = service->startHandle;
+        cachedService.endHandle = service->endHandle;
+        cachedService.type = int(service->type);
+        cachedService.detailed = service->state == QLowEnergyService::ServiceDiscovered
+                || cachedServices.contains(service->uuid);
+        if (cachedService.detailed) {
+            cachedService.includedServices = service->includedServices;
+            for (auto charIt = service->characteristicList.constBegin();
+                 charIt != service->characteristicList.constEnd(); ++charIt) {
+                LeAttributeCache::Characteristic cachedChar;
+                cachedChar.handle = charIt.key();
+                cachedChar.valueHandle = charIt.value().valueHandle;
+                cachedChar.uuid = charIt.value().uuid;
+                cachedChar.properties = charIt.value().properties;
+                const auto &descriptorList = charIt.value().descriptorList;
+                for (auto descIt = descriptorList.constBegin();
+                     descIt != descriptorList.constEnd(); ++descIt) {
+                    LeAttributeCache::Descriptor cachedDesc;
+                    cachedDesc.handle = descIt.key();
+                    cachedDesc.uuid = descIt.value().uuid;
+                    cachedChar.descriptors << cachedDesc;
+                }
+                cachedService.characteristics << cachedChar;
+            }
+        }
+        services << cachedService;
     }
-    qCDebug(QT_BT_BLUEZ) << "CSRK of peer device is" << keyString;
-    const quint32 counter = settings.value(QLatin1String("Counter"), 0).toUInt();
-    quint128 csrk;
-    using namespace std;
-    memcpy(csrk.data, keyData.constData(), keyData.count());
-    signingData.insert(remoteDevice.toUInt64(), SigningData(csrk, counter - 1));
+
+    attributeCache.setFilePath(attributeCacheFilePath());
+    attributeCache.store(databaseHash, services);
 }
 
-void QLowEnergyControllerPrivate::storeSignCounter(SigningKeyType keyType) const
+void QLowEnergyControllerPrivate::removeAttributeCache()
 {
-    const auto signingDataIt = signingData.constFind(remoteDevice.toUInt64());
-    if (signingDataIt == signingData.constEnd())
-        return;
-    const QString settingsFilePath = keySettingsFilePath();
-    if (!QFileInfo(settingsFilePath).exists())
-        return;
-    QSettings settings(settingsFilePath, QSettings::IniFormat);
-    if (!settings.isWritable())
-        return;
-    settings.beginGroup(signingKeySettingsGroup(keyType));
-    const QString counterKey = QLatin1String("Counter");
-    if (!settings.allKeys().contains(counterKey))
-        return;
-    const quint32 counterValue = signingDataIt.value().counter + 1;
-    if (counterValue == settings.value(counterKey).toUInt())
-        return;
-    settings.setValue(counterKey, counterValue);
+    attributeCache.setFilePath(attributeCacheFilePath());
+    attributeCache.remove();
 }
 
-QString QLowEnergyControllerPrivate::signingKeySettingsGroup(SigningKeyType keyType) const
+/*!
+    \internal
+
+    Handles a Service Changed indication. Services overlapping the affected handle
+    range \a start to \a end are invalidated and, if discovery had finished,
+    rediscovered. The attribute cache can no longer be trusted.
+ */
+void QLowEnergyControllerPrivate::processServiceChanged(QLowEnergyHandle start,
+                                                        QLowEnergyHandle end)
 {
-    return QLatin1String(keyType == LocalSigningKey ? "LocalSignatureKey" : "RemoteSignatureKey");
+    qCDebug(QT_BT_BLUEZ) << "Attribute database of remote device changed between handles"
+                         << hex << start << "and" << end;
+
+    removeAttributeCache();
+    databaseHash.clear();
+
+    for (auto it = serviceList.begin(); it != serviceList.end();) {
+        const QSharedPointer<QLowEnergyServicePrivate> service = it.value();
+        if (service->endHandle < start || service->startHandle > end) {
+            ++it;
+            continue;
+        }
+        qCDebug(QT_BT_BLUEZ) << "Invalidating service" << service->uuid;
+        cachedServices.remove(service->uuid);
+        sweptServices.remove(service->uuid);
+        sweepServices.removeAll(service);
+        it = serviceList.erase(it);
+        service->setController(nullptr);
+        service->setState(QLowEnergyService::InvalidService);
+    }
+    updateServiceHandleIndex();
+
+    if (state == QLowEnergyController::DiscoveredState) {
+        setState(QLowEnergyController::DiscoveringState);
+        sendReadByGroupRequest(0x0001, 0xFFFF, GATT_PRIMARY_SERVICE);
+    }
 }
 
-QString QLowEnergyControllerPrivate::keySettingsFilePath() const
+void QLowEnergyControllerPrivate::trackServiceForAttributeCache(QLowEnergyServicePrivate *service)
 {
-    return QString::fromLatin1("/var/lib/bluetooth/%1/%2/info")
-            .arg(localAdapter.toString(), remoteDevice.toString());
+    connect(service, &QLowEnergyServicePrivate::stateChanged,
+            this, [this](QLowEnergyService::ServiceState newState) {
+        if (newState == QLowEnergyService::ServiceDiscovered)
+            storeAttributeCache();
+    });
 }
 
 static QByteArray uuidToByteArray(const QBluetoothUuid &uuid)
@@ -3052,52 +5030,95 @@ void QLowEnergyControllerPrivate::addToGenericAttributeList(const QLowEnergyServ
     }
     serviceAttribute.groupEndHandle = currentHandle;
     localAttributes[serviceAttribute.handle] = serviceAttribute;
+
+    // Services are added in ascending handle order, so appending keeps the index sorted.
+    for (int handle = startHandle; handle <= currentHandle; ++handle)
+        localAttributesByType[localAttributes.at(handle).type] << QLowEnergyHandle(handle);
 }
 
-void QLowEnergyControllerPrivate::ensureUniformAttributes(QVector<Attribute> &attributes,
+void QLowEnergyControllerPrivate::ensureUniformAttributes(QVector<QLowEnergyHandle> &handles,
         const std::function<int (const Attribute &)> &getSize)
 {
-    if (attributes.isEmpty())
+    if (handles.isEmpty())
         return;
-    const int firstSize = getSize(attributes.first());
-    const auto it = std::find_if(attributes.begin() + 1, attributes.end(),
-            [firstSize, getSize](const Attribute &attr) { return getSize(attr) != firstSize; });
-    if (it != attributes.end())
-        attributes.erase(it, attributes.end());
+    const int firstSize = getSize(localAttributes.at(handles.first()));
+    const auto it = std::find_if(handles.begin() + 1, handles.end(),
+            [this, firstSize, getSize](QLowEnergyHandle handle) {
+        return getSize(localAttributes.at(handle)) != firstSize;
+    });
+    if (it != handles.end())
+        handles.erase(it, handles.end());
 
 }
 
-void QLowEnergyControllerPrivate::ensureUniformUuidSizes(QVector<Attribute> &attributes)
+void QLowEnergyControllerPrivate::ensureUniformUuidSizes(QVector<QLowEnergyHandle> &handles)
 {
-    ensureUniformAttributes(attributes,
+    ensureUniformAttributes(handles,
                             [](const Attribute &attr) { return getUuidSize(attr.type); });
 }
 
-void QLowEnergyControllerPrivate::ensureUniformValueSizes(QVector<Attribute> &attributes)
+void QLowEnergyControllerPrivate::ensureUniformValueSizes(QVector<QLowEnergyHandle> &handles)
 {
-    ensureUniformAttributes(attributes,
+    ensureUniformAttributes(handles,
                             [](const Attribute &attr) { return attr.value.count(); });
 }
 
-QVector<QLowEnergyControllerPrivate::Attribute> QLowEnergyControllerPrivate::getAttributes(QLowEnergyHandle startHandle,
-        QLowEnergyHandle endHandle, const AttributePredicate &attributePredicate)
+/*
+ * The number of list elements that can at most be part of a response with the given
+ * prefix size, assuming each element has at least minElemSize bytes. Used to stop
+ * collecting attributes that could not be sent anyway.
+ */
+int QLowEnergyControllerPrivate::maxListResponseCount(int prefixSize, int minElemSize) const
+{
+    return qMax(0, (activeLink->mtuSize - prefixSize) / minElemSize);
+}
+
+QVector<QLowEnergyHandle> QLowEnergyControllerPrivate::getAttributeHandles(
+        QLowEnergyHandle startHandle, QLowEnergyHandle endHandle, int maxCount) const
 {
-    QVector<Attribute> results;
+    QVector<QLowEnergyHandle> results;
     if (startHandle > lastLocalHandle)
         return results;
     if (lastLocalHandle == 0) // We have no services at all.
         return results;
     Q_ASSERT(startHandle <= endHandle); // Must have been checked before.
-    const QLowEnergyHandle firstHandle = qMin(startHandle, lastLocalHandle);
+
+    // Local handles are contiguous, so there is nothing to look up.
     const QLowEnergyHandle lastHandle = qMin(endHandle, lastLocalHandle);
-    for (QLowEnergyHandle i = firstHandle; i <= lastHandle; ++i) {
-        const Attribute &attr = localAttributes.at(i);
-        if (attributePredicate(attr))
-            results << attr;
-    }
+    const int count = qMin(int(lastHandle - startHandle) + 1, maxCount);
+    results.reserve(count);
+    for (int i = 0; i < count; ++i)
+        results << QLowEnergyHandle(startHandle + i);
+    return results;
+}
+
+QVector<QLowEnergyHandle> QLowEnergyControllerPrivate::getAttributeHandles(
+        const QBluetoothUuid &type, QLowEnergyHandle startHandle, QLowEnergyHandle endHandle,
+        int maxCount) const
+{
+    const auto range = attributeTypeRange(type, startHandle, endHandle);
+    const int count = qMin(int(range.second - range.first), maxCount);
+    QVector<QLowEnergyHandle> results;
+    results.reserve(count);
+    std::copy(range.first, range.first + count, std::back_inserter(results));
     return results;
 }
 
+QPair<QVector<QLowEnergyHandle>::const_iterator, QVector<QLowEnergyHandle>::const_iterator>
+QLowEnergyControllerPrivate::attributeTypeRange(const QBluetoothUuid &type,
+        QLowEnergyHandle startHandle, QLowEnergyHandle endHandle) const
+{
+    Q_ASSERT(startHandle <= endHandle); // Must have been checked before.
+    const auto typeIt = localAttributesByType.constFind(type);
+    if (typeIt == localAttributesByType.constEnd())
+        return qMakePair(QVector<QLowEnergyHandle>::const_iterator(),
+                         QVector<QLowEnergyHandle>::const_iterator());
+    const QVector<QLowEnergyHandle> &handles = typeIt.value();
+    const auto first = std::lower_bound(handles.constBegin(), handles.constEnd(), startHandle);
+    const auto last = std::upper_bound(first, handles.constEnd(), endHandle);
+    return qMakePair(first, last);
+}
+
 int QLowEnergyControllerPrivate::checkPermissions(const Attribute &attr,
                                                   QLowEnergyCharacteristic::PropertyType type)
 {
@@ -3137,9 +5158,9 @@ int QLowEnergyControllerPrivate::checkReadPermissions(const Attribute &attr)
     return checkPermissions(attr, QLowEnergyCharacteristic::Read);
 }
 
-int QLowEnergyControllerPrivate::checkReadPermissions(QVector<Attribute> &attributes)
+int QLowEnergyControllerPrivate::checkReadPermissions(QVector<QLowEnergyHandle> &handles)
 {
-    if (attributes.isEmpty())
+    if (handles.isEmpty())
         return 0;
 
     // The logic prescribed in the spec is as follows:
@@ -3147,23 +5168,34 @@ int QLowEnergyControllerPrivate::checkReadPermissions(QVector<Attribute> &attrib
     //       then that error is returned via an error response.
     //    2) If any other element of that list would cause a permissions error, then all
     //       attributes from this one on are not part of the result set, but no error is returned.
-    const int error = checkReadPermissions(attributes.first());
+    const int error = checkReadPermissions(localAttributes.at(handles.first()));
     if (error)
         return error;
-    const auto it = std::find_if(attributes.begin() + 1, attributes.end(),
-            [this](const Attribute &attr) { return checkReadPermissions(attr) != 0; });
-    if (it != attributes.end())
-        attributes.erase(it, attributes.end());
+    const auto it = std::find_if(handles.begin() + 1, handles.end(),
+            [this](QLowEnergyHandle handle) {
+        return checkReadPermissions(localAttributes.at(handle)) != 0;
+    });
+    if (it != handles.end())
+        handles.erase(it, handles.end());
     return 0;
 }
 
-bool QLowEnergyControllerPrivate::verifyMac(const QByteArray &message, const quint128 &csrk,
+/*
+ * Returns the CMAC calculator for \a device. It is kept for the lifetime of the
+ * controller, so the per-key setup is only done once per device.
+ */
+LeCmacCalculator *QLowEnergyControllerPrivate::cmacCalculator(const QBluetoothAddress &device)
+{
+    LeCmacCalculator *&calculator = cmacCalculators[device.toUInt64()];
+    if (!calculator)
+        calculator = new LeCmacCalculator;
+    return calculator;
+}
+
+bool QLowEnergyControllerPrivate::verifyMac(const char *message, int size, const quint128 &csrk,
                                              quint32 signCounter, quint64 expectedMac)
 {
-    if (!cmacCalculator)
-        cmacCalculator = new LeCmacCalculator;
-    return cmacCalculator->verify(LeCmacCalculator::createFullMessage(message, signCounter), csrk,
-                                expectedMac);
+    return cmacCalculator(remoteDevice)->verify(message, size, signCounter, csrk, expectedMac);
 }
 
 QT_END_NAMESPACE
@@ -53,6 +53,8 @@
 
 #include <QtCore/qloggingcategory.h>
 #include <QtCore/qsharedpointer.h>
+#include <QtCore/qdatetime.h>
+#include <QtCore/qtimer.h>
 #include <QtCore/qbytearray.h>
 #include <QtCore/qglobal.h>
 #include <QtCore/qstring.h>
@@ -72,6 +74,7 @@ static void registerQLowEnergyControllerMetaType()
         qRegisterMetaType<QLowEnergyController::Error>();
         qRegisterMetaType<QLowEnergyHandle>("QLowEnergyHandle");
         qRegisterMetaType<QSharedPointer<QLowEnergyServicePrivate> >();
+        qRegisterMetaType<QLowEnergyControllerStatistics>();
         initDone = true;
     }
 }
@@ -399,16 +402,24 @@ void QLowEnergyControllerPrivateOSX::_q_characteristicUpdated(QLowEnergyHandle c
         return;
     }
 
+    ++statistics->notifications;
     QLowEnergyCharacteristic characteristic(characteristicForHandle(charHandle));
     if (!characteristic.isValid()) {
         qCWarning(QT_BT_OSX) << "unknown characteristic";
         return;
     }
 
-    if (characteristic.properties() & QLowEnergyCharacteristic::Read)
-        updateValueOfCharacteristic(charHandle, value, false);
+    if (service->deliverNotification(characteristic, value.constData(), value.size()))
+        emit service->characteristicChanged(characteristic, value);
+}
 
-    emit service->characteristicChanged(characteristic, value);
+QLowEnergyControllerStatistics QLowEnergyControllerPrivateOSX::statisticsSnapshot() const
+{
+    // Core Bluetooth does not expose the requests and the MTU.
+    QLowEnergyControllerStatistics snapshot(statistics);
+    QLowEnergyControllerStatisticsPrivate * const data = snapshot.d.data();
+    data->duration = data->clock.elapsed();
+    return snapshot;
 }
 
 void QLowEnergyControllerPrivateOSX::_q_descriptorRead(QLowEnergyHandle dHandle,
@@ -1162,6 +1173,25 @@ void QLowEnergyController::discoverServices()
     osx_d_ptr->discoverServices();
 }
 
+void QLowEnergyController::discoverAllServiceDetails()
+{
+    if (role() == PeripheralRole) {
+        qCWarning(QT_BT_OSX) << "invalid role (peripheral)";
+        return;
+    }
+
+    if (state() != DiscoveredState)
+        return;
+
+    OSX_D_PTR;
+
+    for (auto it = osx_d_ptr->discoveredServices.constBegin();
+         it != osx_d_ptr->discoveredServices.constEnd(); ++it) {
+        if (it.value()->state == QLowEnergyService::DiscoveryRequired)
+            osx_d_ptr->discoverServiceDetails(it.key());
+    }
+}
+
 QList<QBluetoothUuid> QLowEnergyController::services() const
 {
     OSX_D_PTR;
@@ -1277,6 +1307,15 @@ void QLowEnergyController::stopAdvertising()
 #endif
 }
 
+bool QLowEnergyController::updateAdvertisingData(const QLowEnergyAdvertisingData &advertisingData,
+                                                 const QLowEnergyAdvertisingData &scanResponseData)
+{
+    Q_UNUSED(advertisingData);
+    Q_UNUSED(scanResponseData);
+    qCWarning(QT_BT_OSX) << "Updating the advertising data not implemented on your platform";
+    return false;
+}
+
 QLowEnergyService *QLowEnergyController::addService(const QLowEnergyServiceData &data,
                                                     QObject *parent)
 {
@@ -1326,6 +1365,145 @@ void QLowEnergyController::requestConnectionUpdate(const QLowEnergyConnectionPar
     qCWarning(QT_BT_OSX) << "Connection update not implemented on your platform";
 }
 
+void QLowEnergyController::setPreferredMtu(int mtu)
+{
+    OSX_D_PTR;
+
+    osx_d_ptr->preferredMtu = qMax(0, mtu);
+}
+
+int QLowEnergyController::preferredMtu() const
+{
+    OSX_D_PTR;
+
+    return osx_d_ptr->preferredMtu;
+}
+
+int QLowEnergyController::mtu() const
+{
+    // The MTU is negotiated by Core Bluetooth and not exposed.
+    return -1;
+}
+
+void QLowEnergyController::setIoThreadEnabled(bool enabled)
+{
+    OSX_D_PTR;
+
+    // Core Bluetooth delivers its callbacks on a dispatch queue anyway.
+    osx_d_ptr->ioThreadEnabled = enabled;
+}
+
+bool QLowEnergyController::isIoThreadEnabled() const
+{
+    OSX_D_PTR;
+
+    return osx_d_ptr->ioThreadEnabled;
+}
+
+void QLowEnergyController::setRequestTimeout(int msecs)
+{
+    OSX_D_PTR;
+
+    // Core Bluetooth applies its own timeouts.
+    osx_d_ptr->requestTimeout = qMax(0, msecs);
+}
+
+int QLowEnergyController::requestTimeout() const
+{
+    OSX_D_PTR;
+
+    return osx_d_ptr->requestTimeout;
+}
+
+void QLowEnergyController::setReadRetryCount(int count)
+{
+    OSX_D_PTR;
+
+    osx_d_ptr->readRetryCount = qMax(0, count);
+}
+
+int QLowEnergyController::readRetryCount() const
+{
+    OSX_D_PTR;
+
+    return osx_d_ptr->readRetryCount;
+}
+
+void QLowEnergyController::setMaximumClientCount(int count)
+{
+    OSX_D_PTR;
+
+    // Core Bluetooth manages the connections of the peripheral itself.
+    osx_d_ptr->maximumClientCount = qMax(1, count);
+}
+
+int QLowEnergyController::maximumClientCount() const
+{
+    OSX_D_PTR;
+
+    return osx_d_ptr->maximumClientCount;
+}
+
+QLowEnergyControllerStatistics QLowEnergyController::statistics() const
+{
+    OSX_D_PTR;
+
+    return osx_d_ptr->statisticsSnapshot();
+}
+
+void QLowEnergyController::resetStatistics()
+{
+    OSX_D_PTR;
+
+    osx_d_ptr->statistics = new QLowEnergyControllerStatisticsPrivate;
+}
+
+void QLowEnergyController::setStatisticsInterval(int msecs)
+{
+    OSX_D_PTR;
+
+    if (msecs <= 0) {
+        delete osx_d_ptr->statisticsTimer;
+        osx_d_ptr->statisticsTimer = nullptr;
+        return;
+    }
+
+    if (!osx_d_ptr->statisticsTimer) {
+        osx_d_ptr->statisticsTimer = new QTimer(this);
+        connect(osx_d_ptr->statisticsTimer, &QTimer::timeout, this, [this]() {
+            emit statisticsUpdated(statistics());
+        });
+    }
+    osx_d_ptr->statisticsTimer->start(msecs);
+}
+
+int QLowEnergyController::statisticsInterval() const
+{
+    OSX_D_PTR;
+
+    return osx_d_ptr->statisticsTimer ? osx_d_ptr->statisticsTimer->interval() : 0;
+}
+
+bool QLowEnergyController::startPacketCapture(const QString &fileName)
+{
+    Q_UNUSED(fileName);
+    qCWarning(QT_BT_OSX) << "Packet capture not implemented on your platform";
+    return false;
+}
+
+void QLowEnergyController::stopPacketCapture()
+{
+}
+
+void QLowEnergyController::beginNotificationBatch()
+{
+    // Core Bluetooth queues the notifications itself.
+}
+
+void QLowEnergyController::endNotificationBatch()
+{
+}
+
 QT_END_NAMESPACE
 
 #include "moc_qlowenergycontroller_osx_p.cpp"
@@ -56,6 +56,7 @@
 #include "osx/osxbtcentralmanager_p.h"
 #include "qlowenergycontroller_p.h"
 #include "qlowenergycontroller.h"
+#include "qlowenergycontrollerstatistics_p.h"
 #include "osx/osxbtnotifier_p.h"
 #include "osx/osxbtutility_p.h"
 #include "qbluetoothaddress.h"
@@ -77,6 +78,7 @@ class LECBManagerNotifier;
 }
 
 class QByteArray;
+class QTimer;
 
 // Suffix 'OSX' is a legacy, it's also iOS.
 class QLowEnergyControllerPrivateOSX : public QLowEnergyControllerPrivate
@@ -163,6 +165,16 @@ private:
 
     QLowEnergyController::ControllerState controllerState;
     QLowEnergyController::RemoteAddressType addressType;
+    int preferredMtu = 0;
+    bool ioThreadEnabled = false;
+    int requestTimeout = 30000;
+    int readRetryCount = 0;
+    int maximumClientCount = 1;
+
+    QSharedDataPointer<QLowEnergyControllerStatisticsPrivate> statistics {
+        new QLowEnergyControllerStatisticsPrivate };
+    QTimer *statisticsTimer = nullptr;
+    QLowEnergyControllerStatistics statisticsSnapshot() const;
 
     typedef QT_MANGLE_NAMESPACE(OSXBTCentralManager) ObjCCentralManager;
     typedef OSXBluetooth::ObjCScopedPointer<ObjCCentralManager> CentralManager;
@@ -92,6 +92,11 @@ void QLowEnergyControllerPrivate::discoverServiceDetails(const QBluetoothUuid &/
 
 }
 
+void QLowEnergyControllerPrivate::discoverAllServiceDetails(const QList<QBluetoothUuid> &/*services*/)
+{
+
+}
+
 void QLowEnergyControllerPrivate::readCharacteristic(const QSharedPointer<QLowEnergyServicePrivate> /*service*/,
                         const QLowEnergyHandle /*charHandle*/)
 {
@@ -132,10 +137,56 @@ void QLowEnergyControllerPrivate::stopAdvertising()
 {
 }
 
+bool QLowEnergyControllerPrivate::updateAdvertisingData(
+        const QLowEnergyAdvertisingData &/* advertisingData */,
+        const QLowEnergyAdvertisingData &/* scanResponseData */)
+{
+    return false;
+}
+
 void QLowEnergyControllerPrivate::requestConnectionUpdate(const QLowEnergyConnectionParameters & /* params */)
 {
 }
 
+int QLowEnergyControllerPrivate::mtu() const
+{
+    return -1;
+}
+
+bool QLowEnergyControllerPrivate::beginReliableWrite(
+        const QSharedPointer<QLowEnergyServicePrivate> &/*service*/)
+{
+    return false;
+}
+
+void QLowEnergyControllerPrivate::executeReliableWrite(
+        const QSharedPointer<QLowEnergyServicePrivate> &/*service*/)
+{
+}
+
+void QLowEnergyControllerPrivate::abortReliableWrite(
+        const QSharedPointer<QLowEnergyServicePrivate> &/*service*/)
+{
+}
+
+void QLowEnergyControllerPrivate::cancelRequests(
+        const QSharedPointer<QLowEnergyServicePrivate> &/*service*/)
+{
+}
+
+bool QLowEnergyControllerPrivate::startPacketCapture(const QString &/*fileName*/)
+{
+    return false;
+}
+
+void QLowEnergyControllerPrivate::stopPacketCapture()
+{
+}
+
+void QLowEnergyControllerPrivate::flushNotifications()
+{
+}
+
 void QLowEnergyControllerPrivate::addToGenericAttributeList(const QLowEnergyServiceData &/* service */,
                                                             QLowEnergyHandle /* startHandle */)
 {
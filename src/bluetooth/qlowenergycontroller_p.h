@@ -70,15 +70,20 @@ QT_END_NAMESPACE
 #else
 
 #include <qglobal.h>
+#include <QtCore/QHash>
 #include <QtCore/QQueue>
+#include <QtCore/QSet>
 #include <QtCore/QVector>
 #include <QtBluetooth/qbluetooth.h>
 #include <QtBluetooth/qlowenergycharacteristic.h>
 #include "qlowenergycontroller.h"
+#include "qlowenergycontrollerstatistics_p.h"
 #include "qlowenergyserviceprivate_p.h"
 
 #if defined(QT_BLUEZ_BLUETOOTH) && !defined(QT_BLUEZ_NO_BTLE)
+#include <QtCore/QElapsedTimer>
 #include <QtBluetooth/QBluetoothSocket>
+#include "leattributecache_p.h"
 #elif defined(QT_ANDROID_BLUETOOTH)
 #include <QtAndroidExtras/QAndroidJniObject>
 #include "android/lowenergynotificationhub_p.h"
@@ -107,10 +112,15 @@ class QWinRTLowEnergyServiceHandler;
 QT_BEGIN_NAMESPACE
 
 class QLowEnergyServiceData;
+class QTimer;
 
 #if defined(QT_BLUEZ_BLUETOOTH) && !defined(QT_BLUEZ_NO_BTLE)
+class BtSnoopWriter;
 class HciManager;
+class LeAttReceiver;
 class LeCmacCalculator;
+class LeConnectionManager;
+class QLowEnergyCharacteristicWriter;
 class QSocketNotifier;
 #elif defined(QT_ANDROID_BLUETOOTH)
 class LowEnergyNotificationHub;
@@ -129,6 +139,9 @@ public:
     QLowEnergyControllerPrivate();
     ~QLowEnergyControllerPrivate();
 
+    static QLowEnergyControllerPrivate *get(QLowEnergyController *controller)
+    { return controller->d_func(); }
+
     void init();
 
     void setError(QLowEnergyController::Error newError);
@@ -141,15 +154,33 @@ public:
 
     void discoverServices();
     void invalidateServices();
+    void updateServiceHandleIndex();
 
     void discoverServiceDetails(const QBluetoothUuid &service);
+    void discoverAllServiceDetails(const QList<QBluetoothUuid> &services);
 
     void startAdvertising(const QLowEnergyAdvertisingParameters &params,
                           const QLowEnergyAdvertisingData &advertisingData,
                           const QLowEnergyAdvertisingData &scanResponseData);
     void stopAdvertising();
+    bool updateAdvertisingData(const QLowEnergyAdvertisingData &advertisingData,
+                               const QLowEnergyAdvertisingData &scanResponseData);
 
     void requestConnectionUpdate(const QLowEnergyConnectionParameters &params);
+    int mtu() const;
+
+    bool beginReliableWrite(const QSharedPointer<QLowEnergyServicePrivate> &service);
+    void executeReliableWrite(const QSharedPointer<QLowEnergyServicePrivate> &service);
+    void abortReliableWrite(const QSharedPointer<QLowEnergyServicePrivate> &service);
+
+    // drops the queued reads and writes issued via the last object for service
+    void cancelRequests(const QSharedPointer<QLowEnergyServicePrivate> &service);
+
+    bool startPacketCapture(const QString &fileName);
+    void stopPacketCapture();
+
+    // sends the notifications held back while notificationBatchDepth was > 0
+    void flushNotifications();
 
     // misc helpers
     QSharedPointer<QLowEnergyServicePrivate> serviceForHandle(
@@ -186,6 +217,23 @@ public:
     void addToGenericAttributeList(const QLowEnergyServiceData &service,
                                    QLowEnergyHandle startHandle);
 
+#if defined(QT_BLUEZ_BLUETOOTH) && !defined(QT_BLUEZ_NO_BTLE)
+    // write commands, sent as fast as the socket accepts them
+    void enqueueWriteCommand(QLowEnergyCharacteristicWriter *writer,
+                             QLowEnergyHandle valueHandle, const char *data, int size);
+    void sendQueuedWriteCommands();
+    bool writeQueuedCommands(int maxCommands);
+
+#ifdef QT_BUILD_INTERNAL
+    // acts as if connectToDevice() had connected the already connected ATT socket,
+    // which lets autotests talk to a fake peer on the other end of a socket pair
+    void connectToAttSocket(int socketDescriptor);
+    // acts as if a GATT client had connected from address, for autotests as well
+    void acceptAttSocket(int socketDescriptor, const QBluetoothAddress &address)
+    { addServerConnection(socketDescriptor, address); }
+#endif
+#endif
+
     QBluetoothAddress remoteDevice;
     QBluetoothAddress localAdapter;
     QLowEnergyController::Role role;
@@ -198,6 +246,10 @@ public:
 
     // list of all found service uuids
     ServiceDataMap serviceList;
+    // services of serviceList sorted by handle, rebuilt once the discovery has finished.
+    // Whenever serviceList changes, the index is marked dirty until the next rebuild.
+    QVector<QSharedPointer<QLowEnergyServicePrivate> > serviceHandleIndex;
+    bool serviceHandleIndexDirty = true;
 
     QLowEnergyHandle lastLocalHandle;
     ServiceDataMap localServices;
@@ -216,23 +268,74 @@ public:
         int maxLength;
     };
     QVector<Attribute> localAttributes;
+    // Handles of all local attributes of a given type, in ascending order.
+    QHash<QBluetoothUuid, QVector<QLowEnergyHandle>> localAttributesByType;
 
     QLowEnergyController::RemoteAddressType addressType;
+    // 0 -> largest MTU supported by the platform
+    int preferredMtu = 0;
+    bool ioThreadEnabled = false;
+    // ATT transaction timeout, Core spec v4.2, Vol 3, Part F, 3.3.3
+    int requestTimeout = 30000;
+    int readRetryCount = 0;
+    // number of GATT clients accepted at the same time in the peripheral role
+    int maximumClientCount = 1;
+    // > 0 between QLowEnergyController::beginNotificationBatch() and endNotificationBatch()
+    int notificationBatchDepth = 0;
+
+    // always collected, see QLowEnergyController::statistics()
+    QSharedDataPointer<QLowEnergyControllerStatisticsPrivate> statistics {
+        new QLowEnergyControllerStatisticsPrivate };
+    QTimer *statisticsTimer = nullptr;
+    QLowEnergyControllerStatistics statisticsSnapshot() const;
 
 private:
 #if defined(QT_BLUEZ_BLUETOOTH) && !defined(QT_BLUEZ_NO_BTLE)
-    quint16 connectionHandle = 0;
-    QBluetoothSocket *l2cpSocket;
+    // reused for every incoming ATT PDU
+    QByteArray receiveBuffer;
+    enum RequestPriority {
+        BackgroundPriority, // service and service detail discovery
+        UserPriority        // reads and writes triggered via QLowEnergyService
+    };
+
     struct Request {
         quint8 command;
+        RequestPriority priority = BackgroundPriority;
         QByteArray payload;
         // TODO reference below is ugly but until we know all commands and their
         // requirements this is WIP
         QVariant reference;
         QVariant reference2;
+        // requestClock time of the enqueueing, -1 until queued or sent
+        qint64 enqueueTime = -1;
+        int retries = 0;
     };
     QQueue<Request> openRequests;
 
+    // Only one request can be in flight. A single coarse timer checks its
+    // deadline rather than arming a timer for each request.
+    QElapsedTimer requestClock;
+    qint64 requestSentTime = 0;
+    QTimer *requestTimer = nullptr;
+    void checkRequestTimeout();
+    bool retryRequest(const QByteArray &response);
+
+    // reads waiting for the backoff of their next attempt, see retryRequest()
+    struct DelayedRetry {
+        qint64 dueTime;
+        Request request;
+    };
+    QVector<DelayedRetry> delayedRetries;
+    QTimer *retryTimer = nullptr;
+    void requeueDelayedRetries();
+    bool passLastValueToRetry(const QSharedPointer<QLowEnergyServicePrivate> &service);
+
+    void recordRequestCompleted(const Request &request);
+
+    // first -> attribute handle to read, second -> handle data as in Request::reference
+    typedef QList<QPair<QLowEnergyHandle, quint32> > ReadTargetList;
+    bool readMultipleVariableSupported = true;
+
     struct WriteRequest {
         WriteRequest() {}
         WriteRequest(quint16 h, quint16 o, const QByteArray &v)
@@ -241,11 +344,71 @@ private:
         quint16 valueOffset;
         QByteArray value;
     };
-    QVector<WriteRequest> openPrepareWriteRequests;
+    // first -> characteristic or descriptor handle, second -> new value
+    typedef QVector<QPair<QLowEnergyHandle, QByteArray> > PreparedWriteList;
+    QPointer<QLowEnergyServicePrivate> reliableWriteService;
+    PreparedWriteList reliableWrites;
+
+    struct WriteCommand {
+        QPointer<QLowEnergyCharacteristicWriter> writer;
+        QByteArray packet;
+    };
+    QQueue<WriteCommand> writeCommandQueue;
+    void waitForWritableSocket();
+    bool sendingWriteCommands = false;
+    void failQueuedWriteCommands();
+
+    // Services whose details are discovered by sweeping across all of them at once.
+    // sweepServices is sorted by start handle; sweptServices contains the services
+    // whose descriptors are known and only require their values to be read.
+    QVector<QSharedPointer<QLowEnergyServicePrivate>> sweepServices;
+    QSet<QBluetoothUuid> sweptServices;
+
+    // Services whose attributes were restored from the on-disk attribute cache
+    QSet<QBluetoothUuid> cachedServices;
+    QByteArray databaseHash;
+    LeAttributeCache attributeCache;
+
+    // Value handles waiting to be indicated in a ring buffer. A handle is queued only
+    // once, as its indication carries the value current at the time of sending.
+    class IndicationQueue
+    {
+    public:
+        bool isEmpty() const { return m_count == 0; }
+        void enqueue(QLowEnergyHandle handle)
+        {
+            for (int i = 0; i < m_count; ++i) {
+                if (m_ring.at((m_head + i) % m_ring.count()) == handle)
+                    return;
+            }
+            if (m_count == m_ring.count()) {
+                // unwrap into a larger buffer
+                QVector<QLowEnergyHandle> ring(qMax(8, 2 * m_count));
+                for (int i = 0; i < m_count; ++i)
+                    ring[i] = m_ring.at((m_head + i) % m_ring.count());
+                m_ring = ring;
+                m_head = 0;
+            }
+            m_ring[(m_head + m_count++) % m_ring.count()] = handle;
+        }
+        QLowEnergyHandle dequeue()
+        {
+            Q_ASSERT(m_count > 0);
+            const QLowEnergyHandle handle = m_ring.at(m_head);
+            m_head = (m_head + 1) % m_ring.count();
+            --m_count;
+            return handle;
+        }
+        void clear() { m_head = m_count = 0; }
+
+    private:
+        QVector<QLowEnergyHandle> m_ring;
+        int m_head = 0;
+        int m_count = 0;
+    };
 
-    // Invariant: !scheduledIndications.isEmpty => indicationInFlight == true
-    QVector<QLowEnergyHandle> scheduledIndications;
-    bool indicationInFlight = false;
+    // preallocated space for the packets of one sendPendingNotifications() round
+    QByteArray notificationBuffer;
 
     struct TempClientConfigurationData {
         TempClientConfigurationData(QLowEnergyServicePrivate::DescData *dd = nullptr,
@@ -257,54 +420,97 @@ private:
         QLowEnergyHandle configHandle;
     };
 
-    struct ClientConfigurationData {
-        ClientConfigurationData(QLowEnergyHandle chHndl = 0, QLowEnergyHandle coHndl = 0,
-                                quint16 val = 0)
-            : charValueHandle(chHndl), configHandle(coHndl), configValue(val) {}
-
-        QLowEnergyHandle charValueHandle;
-        QLowEnergyHandle configHandle;
-        quint16 configValue;
-        bool charValueWasUpdated = false;
-    };
-    QHash<quint64, QVector<ClientConfigurationData>> clientConfigData;
-
-    struct SigningData {
-        SigningData() = default;
-        SigningData(const quint128 &csrk, quint32 signCounter = quint32(-1))
-            : key(csrk), counter(signCounter) {}
-
-        quint128 key;
-        quint32 counter = quint32(-1);
-    };
-    QHash<quint64, SigningData> signingData;
-    LeCmacCalculator *cmacCalculator = nullptr;
+    // one per connected bonded device, so that each keeps the state for its key
+    QHash<quint64, LeCmacCalculator *> cmacCalculators;
 
     bool requestPending;
-    quint16 mtuSize;
-    int securityLevelValue;
     bool encryptionChangePending;
-    bool receivedMtuExchangeRequest = false;
 
+    // shared with the other controllers of the same adapter
+    QSharedPointer<LeConnectionManager> connectionManager;
     HciManager *hciManager;
+    // nullptr unless a packet capture is running
+    BtSnoopWriter *packetCapture = nullptr;
     QLeAdvertiser *advertiser;
+    // the advertising set of the advertiser, unique among the adapter's controllers
+    int advertisingHandle = -1;
     QSocketNotifier *serverSocketNotifier;
+    // set while connectable advertising is requested
+    bool acceptingClients = false;
+
+    // The state of an ATT bearer. The central role only uses defaultLink. In the peripheral
+    // role, each connected GATT client has a link of its own, and activeLink points to the
+    // one whose packets are being processed, see activateServerConnection(). Outside of that
+    // the first client's link is the active one. remoteDevice is kept up to date for the
+    // active client.
+    struct Link {
+        Link();
+
+        QBluetoothSocket *l2cpSocket = nullptr;
+        QBluetoothAddress remoteDevice;
+        quint16 connectionHandle = 0;
+        quint16 mtuSize;
+        int securityLevelValue = -1;
+        bool receivedMtuExchangeRequest = false;
+        bool linkLayerThroughputRequested = false;
+        bool connectionCounted = false;
+
+        // Invariant: !scheduledIndications.isEmpty => indicationInFlight == true
+        IndicationQueue scheduledIndications;
+        bool indicationInFlight = false;
+        // Notifications held back by a batch or a full socket. Each handle is listed once
+        // and sent with its value at the time of sending, so stale values are dropped.
+        QVector<QLowEnergyHandle> pendingNotifications;
+
+        // set while writeCommandQueue or pendingNotifications is blocked by a full socket
+        bool waitingForWritableSocket = false;
+        QMetaObject::Connection socketWritableConnection;
+        QVector<WriteRequest> openPrepareWriteRequests;
+        // reads the L2CP socket in the manager's I/O thread if ioThreadEnabled is set
+        LeAttReceiver *attReceiver = nullptr;
+        // Client characteristic configuration descriptor handle -> value written by this
+        // client. The shared localAttributes hold the value last written by any client.
+        QHash<QLowEnergyHandle, QByteArray> clientConfigValues;
+    };
+    Link defaultLink;
+    Link *activeLink = &defaultLink;
+    QVector<Link *> serverConnections;
+    // connection complete events of clients whose ATT connection has not been accepted yet
+    QHash<quint64, quint16> pendingConnectionHandles;
 
     void handleConnectionRequest();
+    void addServerConnection(int socketDescriptor, const QBluetoothAddress &address);
     void closeServerSocket();
+    bool listenForConnections();
+    void stopAcceptingClients();
+    void resumeAcceptingClients();
+    void activateServerConnection(Link *connection);
+    void activatePrimaryServerConnection();
+    void restoreActiveLink(Link *previous);
+    Link *serverConnectionForHandle(quint16 handle) const;
+    Link *serverConnectionForAttReceiver(const QObject *receiver) const;
+    bool isConnectedClient(quint64 address) const;
+    void assignServerConnectionHandle(quint16 handle, const QBluetoothAddress &peerAddress);
+    void removeServerConnection(Link *connection);
+    void disconnectPeer();
 
     bool isBonded() const;
     QVector<TempClientConfigurationData> gatherClientConfigData();
     void storeClientConfigurations();
     void restoreClientConfigurations();
-
-    enum SigningKeyType { LocalSigningKey, RemoteSigningKey };
-    void loadSigningDataIfNecessary(SigningKeyType keyType);
-    void storeSignCounter(SigningKeyType keyType) const;
-    QString signingKeySettingsGroup(SigningKeyType keyType) const;
-    QString keySettingsFilePath() const;
+    QString attributeCacheFilePath() const;
+    void processDatabaseHashReply(const QByteArray &response, bool isErrorResponse);
+    bool restoreAttributeCache();
+    void storeAttributeCache();
+    void removeAttributeCache();
+    void processServiceChanged(QLowEnergyHandle start, QLowEnergyHandle end);
+    void trackServiceForAttributeCache(QLowEnergyServicePrivate *service);
 
     void sendPacket(const QByteArray &packet);
+    qint64 sendPacket(const char *data, int size);
+    void recordPacketSent(const char *data, int size);
+    bool isSupersedableWrite(const Request &request);
+    void enqueueRequest(const Request &request);
     void sendNextPendingRequest();
     void processReply(const Request &request, const QByteArray &reply);
 
@@ -313,24 +519,35 @@ private:
     void sendReadByTypeRequest(QSharedPointer<QLowEnergyServicePrivate> serviceData,
                                QLowEnergyHandle nextHandle, quint16 attributeType);
     void sendReadValueRequest(QLowEnergyHandle attributeHandle, bool isDescriptor);
+    void sendServiceSweepRequest(quint8 command, QLowEnergyHandle start,
+                                 quint16 attributeType = 0);
+    void processServiceSweepReply(const Request &request, const QByteArray &response,
+                                  bool isErrorResponse);
+    QSharedPointer<QLowEnergyServicePrivate> sweepServiceForHandle(
+            QLowEnergyHandle handle) const;
+    void finishServiceSweep();
     void readServiceValues(const QBluetoothUuid &service,
                            bool readCharacteristics);
     void readServiceValuesByOffset(uint handleData, quint16 offset,
                                    bool isLastValue);
+    void appendReadRequests(QList<Request> *requests,
+                            const QSharedPointer<QLowEnergyServicePrivate> &service,
+                            const ReadTargetList &targets, bool allowBatching) const;
+    void processReadMultipleReply(const Request &request, const QByteArray &response,
+                                  bool isErrorResponse);
 
     void discoverServiceDescriptors(const QBluetoothUuid &serviceUuid);
     void discoverNextDescriptor(QSharedPointer<QLowEnergyServicePrivate> serviceData,
                                 const QList<QLowEnergyHandle> pendingCharHandles,
                                 QLowEnergyHandle startingHandle);
-    void processUnsolicitedReply(const QByteArray &msg);
+    void processUnsolicitedReply(const char *data, int size);
     void exchangeMTU();
+    quint16 localRxMtu() const;
+    void requestLinkLayerThroughput();
     bool setSecurityLevel(int level);
     int securityLevel() const;
-    void sendExecuteWriteRequest(const QLowEnergyHandle attrHandle,
-                                 const QByteArray &newValue,
-                                 bool isCancelation);
-    void sendNextPrepareWriteRequest(const QLowEnergyHandle handle,
-                                     const QByteArray &newValue, quint16 offset);
+    void enqueueLongWrite(const PreparedWriteList &writes);
+    void cancelLongWrite();
     bool increaseEncryptLevelfRequired(quint8 errorCode);
 
     void resetController();
@@ -356,28 +573,42 @@ private:
 
     void sendErrorResponse(quint8 request, quint16 handle, quint8 code);
 
+    void processIncomingPacket(const char *data, int size);
+    void startAttReceiver();
+    void stopAttReceiver();
+
     using ElemWriter = std::function<void(const Attribute &, char *&)>;
     void sendListResponse(const QByteArray &packetStart, int elemSize,
-                          const QVector<Attribute> &attributes, const ElemWriter &elemWriter);
+                          const QVector<QLowEnergyHandle> &handles, const ElemWriter &elemWriter);
 
     void sendNotification(QLowEnergyHandle handle);
     void sendIndication(QLowEnergyHandle handle);
-    void sendNotificationOrIndication(quint8 opCode, QLowEnergyHandle handle);
+    int buildValuePacket(quint8 opCode, QLowEnergyHandle handle, char *buffer) const;
     void sendNextIndication();
-
-    void ensureUniformAttributes(QVector<Attribute> &attributes, const std::function<int(const Attribute &)> &getSize);
-    void ensureUniformUuidSizes(QVector<Attribute> &attributes);
-    void ensureUniformValueSizes(QVector<Attribute> &attributes);
-
-    using AttributePredicate = std::function<bool(const Attribute &)>;
-    QVector<Attribute> getAttributes(QLowEnergyHandle startHandle, QLowEnergyHandle endHandle,
-            const AttributePredicate &attributePredicate = [](const Attribute &) { return true; });
+    void sendPendingNotifications();
+    int writeNotifications(const QLowEnergyHandle *handles, int count);
+
+    void ensureUniformAttributes(QVector<QLowEnergyHandle> &handles, const std::function<int(const Attribute &)> &getSize);
+    void ensureUniformUuidSizes(QVector<QLowEnergyHandle> &handles);
+    void ensureUniformValueSizes(QVector<QLowEnergyHandle> &handles);
+
+    int maxListResponseCount(int prefixSize, int minElemSize) const;
+    QVector<QLowEnergyHandle> getAttributeHandles(QLowEnergyHandle startHandle,
+                                                  QLowEnergyHandle endHandle, int maxCount) const;
+    QVector<QLowEnergyHandle> getAttributeHandles(const QBluetoothUuid &type,
+                                                  QLowEnergyHandle startHandle,
+                                                  QLowEnergyHandle endHandle, int maxCount) const;
+    QPair<QVector<QLowEnergyHandle>::const_iterator, QVector<QLowEnergyHandle>::const_iterator>
+    attributeTypeRange(const QBluetoothUuid &type, QLowEnergyHandle startHandle,
+                       QLowEnergyHandle endHandle) const;
 
     int checkPermissions(const Attribute &attr, QLowEnergyCharacteristic::PropertyType type);
     int checkReadPermissions(const Attribute &attr);
-    int checkReadPermissions(QVector<Attribute> &attributes);
+    QByteArray localAttributeValue(const Attribute &attr) const;
+    int checkReadPermissions(QVector<QLowEnergyHandle> &handles);
 
-    bool verifyMac(const QByteArray &message, const quint128 &csrk, quint32 signCounter,
+    LeCmacCalculator *cmacCalculator(const QBluetoothAddress &device);
+    bool verifyMac(const char *message, int size, const quint128 &csrk, quint32 signCounter,
                    quint64 expectedMac);
 
     void updateLocalAttributeValue(
@@ -410,6 +641,8 @@ private slots:
     void l2cpDisconnected();
     void l2cpErrorChanged(QBluetoothSocket::SocketError);
     void l2cpReadyRead();
+    void attPacketsAvailable();
+    void attSocketClosed();
     void encryptionChangedEvent(const QBluetoothAddress&, bool);
 #elif defined(QT_ANDROID_BLUETOOTH)
     LowEnergyNotificationHub *hub;
@@ -457,6 +457,7 @@ void QLowEnergyControllerPrivate::obtainIncludedServices(QSharedPointer<QLowEner
 
             includedPointer = QSharedPointer<QLowEnergyServicePrivate>(priv);
             serviceList.insert(includedUuid, includedPointer);
+            serviceHandleIndexDirty = true;
         }
         includedPointer->type |= QLowEnergyService::IncludedService;
         servicePointer->includedServices.append(includedUuid);
@@ -497,6 +498,7 @@ void QLowEnergyControllerPrivate::discoverServices()
 
             pointer = QSharedPointer<QLowEnergyServicePrivate>(priv);
             serviceList.insert(service, pointer);
+            serviceHandleIndexDirty = true;
         }
         pointer->type |= QLowEnergyService::PrimaryService;
 
@@ -584,6 +586,12 @@ void QLowEnergyControllerPrivate::discoverServiceDetails(const QBluetoothUuid &s
     thread->start();
 }
 
+void QLowEnergyControllerPrivate::discoverAllServiceDetails(const QList<QBluetoothUuid> &services)
+{
+    for (const QBluetoothUuid &service : services)
+        discoverServiceDetails(service);
+}
+
 void QLowEnergyControllerPrivate::startAdvertising(const QLowEnergyAdvertisingParameters &, const QLowEnergyAdvertisingData &, const QLowEnergyAdvertisingData &)
 {
     Q_UNIMPLEMENTED();
@@ -594,11 +602,62 @@ void QLowEnergyControllerPrivate::stopAdvertising()
     Q_UNIMPLEMENTED();
 }
 
+bool QLowEnergyControllerPrivate::updateAdvertisingData(const QLowEnergyAdvertisingData &, const QLowEnergyAdvertisingData &)
+{
+    Q_UNIMPLEMENTED();
+    return false;
+}
+
 void QLowEnergyControllerPrivate::requestConnectionUpdate(const QLowEnergyConnectionParameters &)
 {
     Q_UNIMPLEMENTED();
 }
 
+int QLowEnergyControllerPrivate::mtu() const
+{
+    return -1;
+}
+
+bool QLowEnergyControllerPrivate::beginReliableWrite(
+        const QSharedPointer<QLowEnergyServicePrivate> &)
+{
+    Q_UNIMPLEMENTED();
+    return false;
+}
+
+void QLowEnergyControllerPrivate::executeReliableWrite(
+        const QSharedPointer<QLowEnergyServicePrivate> &)
+{
+    Q_UNIMPLEMENTED();
+}
+
+void QLowEnergyControllerPrivate::abortReliableWrite(
+        const QSharedPointer<QLowEnergyServicePrivate> &)
+{
+    Q_UNIMPLEMENTED();
+}
+
+void QLowEnergyControllerPrivate::cancelRequests(
+        const QSharedPointer<QLowEnergyServicePrivate> &)
+{
+    // requests are not queued
+}
+
+bool QLowEnergyControllerPrivate::startPacketCapture(const QString &)
+{
+    Q_UNIMPLEMENTED();
+    return false;
+}
+
+void QLowEnergyControllerPrivate::stopPacketCapture()
+{
+}
+
+void QLowEnergyControllerPrivate::flushNotifications()
+{
+    // notifications are not held back
+}
+
 void QLowEnergyControllerPrivate::readCharacteristic(const QSharedPointer<QLowEnergyServicePrivate> service,
                         const QLowEnergyHandle charHandle)
 {
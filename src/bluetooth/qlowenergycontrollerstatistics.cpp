@@ -0,0 +1,322 @@
+/****************************************************************************
+**
+** Copyright (C) 2017 The Qt Company Ltd.
+** Contact: https://www.qt.io/licensing/
+**
+** This file is part of the QtBluetooth module of the Qt Toolkit.
+**
+** $QT_BEGIN_LICENSE:LGPL$
+** Commercial License Usage
+** Licensees holding valid commercial Qt licenses may use this file in
+** accordance with the commercial license agreement provided with the
+** Software or, alternatively, in accordance with the terms contained in
+** a written agreement between you and The Qt Company. For licensing terms
+** and conditions see https://www.qt.io/terms-conditions. For further
+** information use the contact form at https://www.qt.io/contact-us.
+**
+** GNU Lesser General Public License Usage
+** Alternatively, this file may be used under the terms of the GNU Lesser
+** General Public License version 3 as published by the Free Software
+** Foundation and appearing in the file LICENSE.LGPL3 included in the
+** packaging of this file. Please review the following information to
+** ensure the GNU Lesser General Public License version 3 requirements
+** will be met: https://www.gnu.org/licenses/lgpl-3.0.html.
+**
+** GNU General Public License Usage
+** Alternatively, this file may be used under the terms of the GNU
+** General Public License version 2.0 or (at your option) the GNU General
+** Public license version 3 or any later version approved by the KDE Free
+** Qt Foundation. The licenses are as published by the Free Software
+** Foundation and appearing in the file LICENSE.GPL2 and LICENSE.GPL3
+** included in the packaging of this file. Please review the following
+** information to ensure the GNU General Public License requirements will
+** be met: https://www.gnu.org/licenses/gpl-2.0.html and
+** https://www.gnu.org/licenses/gpl-3.0.html.
+**
+** $QT_END_LICENSE$
+**
+****************************************************************************/
+
+#include "qlowenergycontrollerstatistics.h"
+#include "qlowenergycontrollerstatistics_p.h"
+
+#include <algorithm>
+
+QT_BEGIN_NAMESPACE
+
+/*!
+    \since 5.10
+    \class QLowEnergyControllerStatistics
+    \brief The QLowEnergyControllerStatistics class is a snapshot of the statistics
+           collected by a QLowEnergyController.
+
+    The controller counts the requests sent to the remote device, the time it took to
+    receive their responses, the amount of data transferred and the notifications
+    received. The values are collected since the creation of the controller or since
+    the last call to \l QLowEnergyController::resetStatistics(), across connections.
+
+    The latency of a request is measured from the moment it was queued by the controller
+    until its response arrived. It therefore includes the time spent waiting for
+    previously queued requests.
+
+    \note Currently, request and byte counts are only collected on Linux.
+
+    \inmodule QtBluetooth
+    \ingroup shared
+
+    \sa QLowEnergyController::statistics(), QLowEnergyController::statisticsUpdated()
+*/
+
+/*!
+   Constructs empty statistics.
+ */
+QLowEnergyControllerStatistics::QLowEnergyControllerStatistics()
+    : d(new QLowEnergyControllerStatisticsPrivate)
+{
+}
+
+/*!
+    \internal
+ */
+QLowEnergyControllerStatistics::QLowEnergyControllerStatistics(
+        const QSharedDataPointer<QLowEnergyControllerStatisticsPrivate> &data)
+    : d(data)
+{
+}
+
+/*! Constructs a new object of this class that is a copy of \a other. */
+QLowEnergyControllerStatistics::QLowEnergyControllerStatistics(
+        const QLowEnergyControllerStatistics &other)
+    : d(other.d)
+{
+}
+
+/*! Destroys this object. */
+QLowEnergyControllerStatistics::~QLowEnergyControllerStatistics()
+{
+}
+
+/*! Makes this object a copy of \a other and returns the new value of this object. */
+QLowEnergyControllerStatistics &QLowEnergyControllerStatistics::operator=(
+        const QLowEnergyControllerStatistics &other)
+{
+    d = other.d;
+    return *this;
+}
+
+/*!
+    Returns the time at which the collection of the statistics started.
+ */
+QDateTime QLowEnergyControllerStatistics::startTime() const
+{
+    return QDateTime::fromMSecsSinceEpoch(d->startTime);
+}
+
+/*!
+    Returns the time in milliseconds over which the statistics were collected.
+    It is measured by a monotonic clock and thus unaffected by changes of the
+    system time.
+ */
+qint64 QLowEnergyControllerStatistics::duration() const
+{
+    return d->duration;
+}
+
+/*!
+    Returns the number of requests which received a response from the remote device.
+ */
+int QLowEnergyControllerStatistics::requestCount() const
+{
+    int count = 0;
+    for (int value : d->requestCounts)
+        count += value;
+    return count;
+}
+
+/*!
+    Returns the number of requests with the ATT \a opcode which received a response
+    from the remote device.
+
+    \sa requestOpcodes()
+ */
+int QLowEnergyControllerStatistics::requestCount(quint8 opcode) const
+{
+    return d->requestCounts.value(opcode);
+}
+
+/*!
+    Returns the ATT opcodes of all requests which received a response, in ascending order.
+
+    \sa requestCount()
+ */
+QList<quint8> QLowEnergyControllerStatistics::requestOpcodes() const
+{
+    return d->requestCounts.keys();
+}
+
+/*!
+    Returns the number of reads which were repeated after a temporary failure.
+
+    \sa QLowEnergyController::setReadRetryCount()
+ */
+int QLowEnergyControllerStatistics::retriedRequestCount() const
+{
+    return d->retriedRequests;
+}
+
+/*!
+    Returns the number of queued requests which were dropped because their
+    QLowEnergyService object was destroyed.
+ */
+int QLowEnergyControllerStatistics::cancelledRequestCount() const
+{
+    return d->cancelledRequests;
+}
+
+/*!
+    Returns the number of requests which did not receive a response in time.
+
+    \sa QLowEnergyController::setRequestTimeout()
+ */
+int QLowEnergyControllerStatistics::timedOutRequestCount() const
+{
+    return d->timedOutRequests;
+}
+
+/*!
+    Returns the largest number of requests which were queued at the same time.
+ */
+int QLowEnergyControllerStatistics::maximumQueueDepth() const
+{
+    return d->maxQueueDepth;
+}
+
+/*!
+    Returns the number of buckets of the latency histogram.
+
+    \sa latencyHistogram(), latencyBucketLimit()
+ */
+int QLowEnergyControllerStatistics::latencyBucketCount()
+{
+    return QLowEnergyControllerStatisticsPrivate::LatencyBuckets;
+}
+
+/*!
+    Returns the exclusive upper limit in milliseconds of the latencies counted by
+    \a bucket of the latency histogram. Each bucket starts at the limit of the
+    previous one. The limits double from bucket to bucket. The last bucket has no
+    limit and \c -1 is returned.
+
+    \sa latencyHistogram()
+ */
+int QLowEnergyControllerStatistics::latencyBucketLimit(int bucket)
+{
+    if (bucket < 0 || bucket >= QLowEnergyControllerStatisticsPrivate::LatencyBuckets - 1)
+        return -1;
+    return 1 << bucket;
+}
+
+/*!
+    Returns the number of requests per latency bucket.
+
+    \sa latencyBucketLimit()
+ */
+QVector<int> QLowEnergyControllerStatistics::latencyHistogram() const
+{
+    QVector<int> histogram(QLowEnergyControllerStatisticsPrivate::LatencyBuckets);
+    std::copy(d->latencyHistogram, d->latencyHistogram + histogram.size(), histogram.begin());
+    return histogram;
+}
+
+/*!
+    Returns the average latency of the requests in milliseconds.
+ */
+int QLowEnergyControllerStatistics::averageLatency() const
+{
+    const int count = requestCount();
+    return count ? int(d->totalLatency / count) : 0;
+}
+
+/*!
+    Returns the largest latency of any request in milliseconds.
+ */
+int QLowEnergyControllerStatistics::maximumLatency() const
+{
+    return int(d->maxLatency);
+}
+
+/*!
+    Returns the number of bytes of ATT packets sent to the remote device.
+ */
+qint64 QLowEnergyControllerStatistics::bytesSent() const
+{
+    return d->bytesSent;
+}
+
+/*!
+    Returns the number of bytes of ATT packets received from the remote device.
+ */
+qint64 QLowEnergyControllerStatistics::bytesReceived() const
+{
+    return d->bytesReceived;
+}
+
+/*!
+    Returns the ATT MTU at the time of the snapshot.
+
+    \sa QLowEnergyController::mtu()
+ */
+int QLowEnergyControllerStatistics::mtu() const
+{
+    return d->mtu;
+}
+
+/*!
+    Returns the number of notifications and indications received.
+ */
+int QLowEnergyControllerStatistics::notificationCount() const
+{
+    return d->notifications;
+}
+
+/*!
+    Returns the average number of notifications and indications received per second.
+ */
+double QLowEnergyControllerStatistics::notificationRate() const
+{
+    return d->duration > 0 ? d->notifications * 1000.0 / d->duration : 0.0;
+}
+
+/*!
+    Returns the number of connections of all controllers using the same local
+    adapter in the same thread, or \c -1 if it is unknown on the current platform.
+ */
+int QLowEnergyControllerStatistics::adapterConnectionCount() const
+{
+    return d->adapterConnections;
+}
+
+/*!
+    Returns the number of bytes sent by all controllers using the same local
+    adapter in the same thread, or \c -1 if it is unknown on the current platform.
+ */
+qint64 QLowEnergyControllerStatistics::adapterBytesSent() const
+{
+    return d->adapterBytesSent;
+}
+
+/*!
+    Returns the number of bytes received by all controllers using the same local
+    adapter in the same thread, or \c -1 if it is unknown on the current platform.
+ */
+qint64 QLowEnergyControllerStatistics::adapterBytesReceived() const
+{
+    return d->adapterBytesReceived;
+}
+
+/*!
+    \fn void QLowEnergyControllerStatistics::swap(QLowEnergyControllerStatistics &other)
+    Swaps this object with \a other.
+ */
+
+QT_END_NAMESPACE
@@ -0,0 +1,108 @@
+/****************************************************************************
+**
+** Copyright (C) 2017 The Qt Company Ltd.
+** Contact: https://www.qt.io/licensing/
+**
+** This file is part of the QtBluetooth module of the Qt Toolkit.
+**
+** $QT_BEGIN_LICENSE:LGPL$
+** Commercial License Usage
+** Licensees holding valid commercial Qt licenses may use this file in
+** accordance with the commercial license agreement provided with the
+** Software or, alternatively, in accordance with the terms contained in
+** a written agreement between you and The Qt Company. For licensing terms
+** and conditions see https://www.qt.io/terms-conditions. For further
+** information use the contact form at https://www.qt.io/contact-us.
+**
+** GNU Lesser General Public License Usage
+** Alternatively, this file may be used under the terms of the GNU Lesser
+** General Public License version 3 as published by the Free Software
+** Foundation and appearing in the file LICENSE.LGPL3 included in the
+** packaging of this file. Please review the following information to
+** ensure the GNU Lesser General Public License version 3 requirements
+** will be met: https://www.gnu.org/licenses/lgpl-3.0.html.
+**
+** GNU General Public License Usage
+** Alternatively, this file may be used under the terms of the GNU
+** General Public License version 2.0 or (at your option) the GNU General
+** Public license version 3 or any later version approved by the KDE Free
+** Qt Foundation. The licenses are as published by the Free Software
+** Foundation and appearing in the file LICENSE.GPL2 and LICENSE.GPL3
+** included in the packaging of this file. Please review the following
+** information to ensure the GNU General Public License requirements will
+** be met: https://www.gnu.org/licenses/gpl-2.0.html and
+** https://www.gnu.org/licenses/gpl-3.0.html.
+**
+** $QT_END_LICENSE$
+**
+****************************************************************************/
+
+#ifndef QLOWENERGYCONTROLLERSTATISTICS_H
+#define QLOWENERGYCONTROLLERSTATISTICS_H
+
+#include <QtBluetooth/qbluetoothglobal.h>
+#include <QtCore/qlist.h>
+#include <QtCore/qmetatype.h>
+#include <QtCore/qshareddata.h>
+#include <QtCore/qvector.h>
+
+QT_BEGIN_NAMESPACE
+
+class QDateTime;
+class QLowEnergyControllerStatisticsPrivate;
+
+class Q_BLUETOOTH_EXPORT QLowEnergyControllerStatistics
+{
+public:
+    QLowEnergyControllerStatistics();
+    QLowEnergyControllerStatistics(const QLowEnergyControllerStatistics &other);
+    ~QLowEnergyControllerStatistics();
+
+    QLowEnergyControllerStatistics &operator=(const QLowEnergyControllerStatistics &other);
+
+    QDateTime startTime() const;
+    qint64 duration() const;
+
+    int requestCount() const;
+    int requestCount(quint8 opcode) const;
+    QList<quint8> requestOpcodes() const;
+    int retriedRequestCount() const;
+    int cancelledRequestCount() const;
+    int timedOutRequestCount() const;
+    int maximumQueueDepth() const;
+
+    static int latencyBucketCount();
+    static int latencyBucketLimit(int bucket);
+    QVector<int> latencyHistogram() const;
+    int averageLatency() const;
+    int maximumLatency() const;
+
+    qint64 bytesSent() const;
+    qint64 bytesReceived() const;
+    int mtu() const;
+
+    int notificationCount() const;
+    double notificationRate() const;
+
+    int adapterConnectionCount() const;
+    qint64 adapterBytesSent() const;
+    qint64 adapterBytesReceived() const;
+
+    void swap(QLowEnergyControllerStatistics &other) Q_DECL_NOTHROW { qSwap(d, other.d); }
+
+private:
+    friend class QLowEnergyControllerPrivate;
+    friend class QLowEnergyControllerPrivateOSX;
+    explicit QLowEnergyControllerStatistics(
+            const QSharedDataPointer<QLowEnergyControllerStatisticsPrivate> &data);
+
+    QSharedDataPointer<QLowEnergyControllerStatisticsPrivate> d;
+};
+
+Q_DECLARE_SHARED(QLowEnergyControllerStatistics)
+
+QT_END_NAMESPACE
+
+Q_DECLARE_METATYPE(QLowEnergyControllerStatistics)
+
+#endif // Include guard
@@ -0,0 +1,119 @@
+/****************************************************************************
+**
+** Copyright (C) 2017 The Qt Company Ltd.
+** Contact: https://www.qt.io/licensing/
+**
+** This file is part of the QtBluetooth module of the Qt Toolkit.
+**
+** $QT_BEGIN_LICENSE:LGPL$
+** Commercial License Usage
+** Licensees holding valid commercial Qt licenses may use this file in
+** accordance with the commercial license agreement provided with the
+** Software or, alternatively, in accordance with the terms contained in
+** a written agreement between you and The Qt Company. For licensing terms
+** and conditions see https://www.qt.io/terms-conditions. For further
+** information use the contact form at https://www.qt.io/contact-us.
+**
+** GNU Lesser General Public License Usage
+** Alternatively, this file may be used under the terms of the GNU Lesser
+** General Public License version 3 as published by the Free Software
+** Foundation and appearing in the file LICENSE.LGPL3 included in the
+** packaging of this file. Please review the following information to
+** ensure the GNU Lesser General Public License version 3 requirements
+** will be met: https://www.gnu.org/licenses/lgpl-3.0.html.
+**
+** GNU General Public License Usage
+** Alternatively, this file may be used under the terms of the GNU
+** General Public License version 2.0 or (at your option) the GNU General
+** Public license version 3 or any later version approved by the KDE Free
+** Qt Foundation. The licenses are as published by the Free Software
+** Foundation and appearing in the file LICENSE.GPL2 and LICENSE.GPL3
+** included in the packaging of this file. Please review the following
+** information to ensure the GNU General Public License requirements will
+** be met: https://www.gnu.org/licenses/gpl-2.0.html and
+** https://www.gnu.org/licenses/gpl-3.0.html.
+**
+** $QT_END_LICENSE$
+**
+****************************************************************************/
+
+#ifndef QLOWENERGYCONTROLLERSTATISTICS_P_H
+#define QLOWENERGYCONTROLLERSTATISTICS_P_H
+
+//
+//  W A R N I N G
+//  -------------
+//
+// This file is not part of the Qt API.  It exists purely as an
+// implementation detail.  This header file may change from version to
+// version without notice, or even be removed.
+//
+// We mean it.
+//
+
+#include "qlowenergycontrollerstatistics.h"
+
+#include <QtCore/QDateTime>
+#include <QtCore/QElapsedTimer>
+#include <QtCore/QMap>
+#include <QtCore/qalgorithms.h>
+
+QT_BEGIN_NAMESPACE
+
+/*
+ * Updated in place by the controller backends. A snapshot is a detached copy
+ * completed by the fields which are only determined on request.
+ */
+class QLowEnergyControllerStatisticsPrivate : public QSharedData
+{
+public:
+    // bucket i counts latencies below 2^i ms, the last one all remaining ones
+    enum { LatencyBuckets = 16 };
+
+    QLowEnergyControllerStatisticsPrivate()
+        : startTime(QDateTime::currentMSecsSinceEpoch())
+    {
+        clock.start();
+    }
+
+    static int latencyBucket(qint64 latency)
+    {
+        if (latency <= 0)
+            return 0;
+        return qMin(int(LatencyBuckets) - 1, 64 - int(qCountLeadingZeroBits(quint64(latency))));
+    }
+
+    void recordRequest(quint8 opcode, qint64 latency)
+    {
+        ++requestCounts[opcode];
+        ++latencyHistogram[latencyBucket(latency)];
+        totalLatency += latency;
+        maxLatency = qMax(maxLatency, latency);
+    }
+
+    // wall clock time of the start, the duration is measured by the monotonic clock
+    qint64 startTime;
+    QElapsedTimer clock;
+    QMap<quint8, int> requestCounts;
+    int latencyHistogram[LatencyBuckets] = {};
+    qint64 totalLatency = 0;
+    qint64 maxLatency = 0;
+    int retriedRequests = 0;
+    int cancelledRequests = 0;
+    int timedOutRequests = 0;
+    int maxQueueDepth = 0;
+    qint64 bytesSent = 0;
+    qint64 bytesReceived = 0;
+    int notifications = 0;
+
+    // set when the snapshot is taken
+    qint64 duration = 0;
+    int mtu = -1;
+    int adapterConnections = -1;
+    qint64 adapterBytesSent = -1;
+    qint64 adapterBytesReceived = -1;
+};
+
+QT_END_NAMESPACE
+
+#endif // QLOWENERGYCONTROLLERSTATISTICS_P_H
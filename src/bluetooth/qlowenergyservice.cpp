@@ -47,6 +47,10 @@
 #include "qlowenergycontroller_p.h"
 #include "qlowenergyserviceprivate_p.h"
 
+#if defined(QT_BLUEZ_BLUETOOTH) && !defined(QT_BLUEZ_NO_BTLE)
+#include "qlowenergycharacteristicwriter_p.h"
+#endif
+
 QT_BEGIN_NAMESPACE
 
 /*!
@@ -131,6 +135,8 @@ QT_BEGIN_NAMESPACE
     All requests are serialised based on First-In First-Out principle.
     For example, issuing a second write request, before the previous
     write request has finished, is delayed until the first write request has finished.
+    On Linux with BlueZ, reads and writes issued via this class are processed
+    ahead of pending service discovery requests.
 
     \note Currently, it is not possible to send signed write or reliable write requests.
 
@@ -151,6 +157,11 @@ QT_BEGIN_NAMESPACE
     are provided by the
     \l {https://developer.bluetooth.org/gatt/descriptors/Pages/DescriptorViewer.aspx?u=org.bluetooth.descriptor.gatt.client_characteristic_configuration.xml}{Bluetooth Specification}.
 
+    Characteristics which notify at a high rate can be consumed via
+    \l setNotificationCallback() instead. The callback receives each value
+    without it being copied, and the cached value of the characteristic as
+    well as the \l characteristicChanged() signal can be skipped.
+
     \section1 Service Data Sharing
 
     Each QLowEnergyService instance shares its internal states and information
@@ -270,6 +281,58 @@ QT_BEGIN_NAMESPACE
                                 3.7 or newer.
  */
 
+/*!
+    \enum QLowEnergyService::NotificationOption
+    \since 5.10
+
+    This enum describes how notified and indicated characteristic values are
+    processed in addition to being passed to a callback registered via
+    \l setNotificationCallback().
+
+    \value NoNotificationOption       The value is only passed to the callback.
+    \value UpdateCachedValue          The value returned by \l QLowEnergyCharacteristic::value()
+                                      is updated, provided the characteristic is readable.
+    \value EmitCharacteristicChanged  The \l characteristicChanged() signal is emitted.
+ */
+
+/*!
+    \enum QLowEnergyService::NotificationPolicy
+    \since 5.10
+
+    This enum describes how notified and indicated characteristic values are
+    reported by the service.
+
+    \value DeliverAllValues     \l characteristicChanged() is emitted for every value.
+    \value DeliverLatestValue   \l characteristicChanged() is emitted at most once per
+                                interval with the most recent value.
+    \value DeliverValueBatches  \l characteristicValuesChanged() reports all values received
+                                within an interval at once.
+
+    With either coalescing policy, the first value received after an interval without
+    values is reported immediately.
+
+    \sa setNotificationPolicy()
+ */
+
+/*!
+    \typedef QLowEnergyService::TimestampedValue
+    \since 5.10
+
+    Synonym for \c {QPair<qint64, QByteArray>}. The first member is the time at
+    which the value was received in milliseconds since the epoch.
+ */
+
+/*!
+    \typedef QLowEnergyService::NotificationCallback
+    \since 5.10
+
+    Synonym for \c {std::function<void(const QLowEnergyCharacteristic &characteristic,
+    const char *data, int size)>}. The \a data pointer is only valid for the
+    duration of the call.
+
+    \sa setNotificationCallback()
+ */
+
 /*!
     \fn void QLowEnergyService::stateChanged(QLowEnergyService::ServiceState newState)
 
@@ -352,6 +415,18 @@ QT_BEGIN_NAMESPACE
     \since 5.5
  */
 
+/*!
+    \fn void QLowEnergyService::characteristicValuesChanged(const QLowEnergyCharacteristic &characteristic, const QVector<QLowEnergyService::TimestampedValue> &values)
+    \since 5.10
+
+    This signal is emitted instead of \l characteristicChanged() if the
+    \l notificationPolicy() of \a characteristic is \l DeliverValueBatches.
+    \a values contains all values notified since the last emission in the order
+    they were received.
+
+    \sa setNotificationPolicy()
+ */
+
 /*!
     \fn void QLowEnergyService::descriptorWritten(const QLowEnergyDescriptor &descriptor, const QByteArray &newValue)
 
@@ -376,10 +451,13 @@ QLowEnergyService::QLowEnergyService(QSharedPointer<QLowEnergyServicePrivate> p,
     : QObject(parent),
       d_ptr(p)
 {
+    ++d_ptr->serviceObjectCount;
     qRegisterMetaType<QLowEnergyService::ServiceState>();
     qRegisterMetaType<QLowEnergyService::ServiceError>();
     qRegisterMetaType<QLowEnergyService::ServiceType>();
     qRegisterMetaType<QLowEnergyService::WriteMode>();
+    qRegisterMetaType<QLowEnergyService::NotificationPolicy>();
+    qRegisterMetaType<QVector<QLowEnergyService::TimestampedValue> >();
 
     connect(p.data(), SIGNAL(error(QLowEnergyService::ServiceError)),
             this, SIGNAL(error(QLowEnergyService::ServiceError)));
@@ -387,6 +465,10 @@ QLowEnergyService::QLowEnergyService(QSharedPointer<QLowEnergyServicePrivate> p,
             this, SIGNAL(stateChanged(QLowEnergyService::ServiceState)));
     connect(p.data(), SIGNAL(characteristicChanged(QLowEnergyCharacteristic,QByteArray)),
             this, SIGNAL(characteristicChanged(QLowEnergyCharacteristic,QByteArray)));
+    connect(p.data(), SIGNAL(characteristicValuesChanged(QLowEnergyCharacteristic,
+                                                         QVector<QLowEnergyService::TimestampedValue>)),
+            this, SIGNAL(characteristicValuesChanged(QLowEnergyCharacteristic,
+                                                     QVector<QLowEnergyService::TimestampedValue>)));
     connect(p.data(), SIGNAL(characteristicWritten(QLowEnergyCharacteristic,QByteArray)),
             this, SIGNAL(characteristicWritten(QLowEnergyCharacteristic,QByteArray)));
     connect(p.data(), SIGNAL(descriptorWritten(QLowEnergyDescriptor,QByteArray)),
@@ -402,6 +484,9 @@ QLowEnergyService::QLowEnergyService(QSharedPointer<QLowEnergyServicePrivate> p,
  */
 QLowEnergyService::~QLowEnergyService()
 {
+    // nobody is left to receive the results of pending reads and writes
+    if (--d_ptr->serviceObjectCount == 0 && !d_ptr->controller.isNull())
+        d_ptr->controller->cancelRequests(d_ptr);
 }
 
 /*!
@@ -658,9 +743,16 @@ void QLowEnergyService::readCharacteristic(
 
     All descriptor and characteristic write requests towards the same remote device are
     serialised. A queue is employed when issuing multiple write requests at the same time.
-    The queue does not eliminate duplicated write requests for the same characteristic.
-    For example, if the same descriptor is set to the value A and immediately afterwards
-    to B, the two write request are executed in the given order.
+    On Linux with BlueZ, a write request for a readable characteristic which is still
+    waiting in the queue is replaced by a subsequent write request for the same
+    characteristic. For example, if the characteristic is set to the value A and
+    immediately afterwards to B, only B is written and the \l characteristicWritten()
+    signal is emitted once. A write request which has already been sent to the remote
+    device is never replaced, and neither are write requests for characteristics
+    without the \l QLowEnergyCharacteristic::Read property, since such characteristics,
+    for example control points, may interpret each write as a separate command.
+    Write commands (\l WriteWithoutResponse and \l WriteSigned) are never replaced.
+    On the other platforms, the write requests are executed in the given order.
 
     \note Currently, it is not possible to use signed or reliable writes as defined by the
     Bluetooth specification.
@@ -781,9 +873,12 @@ void QLowEnergyService::readDescriptor(
 
     All descriptor and characteristic requests towards the same remote device are
     serialised. A queue is employed when issuing multiple write requests at the same time.
-    The queue does not eliminate duplicated write requests for the same descriptor.
-    For example, if the same descriptor is set to the value A and immediately afterwards
-    to B, the two write request are executed in the given order.
+    On Linux with BlueZ, a write request which is still waiting in the queue is replaced
+    by a subsequent write request for the same descriptor. For example, if the descriptor
+    is set to the value A and immediately afterwards to B, only B is written and the
+    \l descriptorWritten() signal is emitted once. A write request which has already
+    been sent to the remote device is never replaced. On the other platforms, the write
+    requests are executed in the given order.
 
     A descriptor can only be written if this service is in the \l ServiceDiscovered state,
     belongs to the service. If one of these conditions is
@@ -815,4 +910,227 @@ void QLowEnergyService::writeDescriptor(const QLowEnergyDescriptor &descriptor,
                                    newValue);
 }
 
+/*!
+    Registers \a callback to be invoked for every notification or indication
+    of \a characteristic. The callback receives a pointer to the new value
+    and its size. The pointer refers to the receive buffer of the connection
+    which is reused for the next packet; the callback must copy any data it
+    intends to keep. The callback is invoked on the thread of the associated
+    \l QLowEnergyController.
+
+    \a options determines whether the cached value of \a characteristic is
+    updated and whether \l characteristicChanged() is emitted as well. By
+    default both are skipped, which avoids all copies of the value on
+    platforms supporting it.
+
+    Registering a callback does not enable notifications. They still have
+    to be activated via the
+    \l {QBluetoothUuid::ClientCharacteristicConfiguration}{ClientCharacteristicConfiguration}
+    descriptor of \a characteristic. A previously registered callback for
+    \a characteristic is replaced.
+
+    Returns \c false if \a characteristic does not belong to this service
+    or if \a callback is empty.
+
+    \note On Linux the payload is passed without being copied. The
+    remaining platforms deliver the values as \l QByteArray and the callback
+    merely avoids the signal emission and the cache update.
+
+    \sa clearNotificationCallback()
+    \since 5.10
+ */
+bool QLowEnergyService::setNotificationCallback(const QLowEnergyCharacteristic &characteristic,
+                                                const NotificationCallback &callback,
+                                                NotificationOptions options)
+{
+    Q_D(QLowEnergyService);
+
+    if (!callback || !contains(characteristic))
+        return false;
+
+    QLowEnergyServicePrivate::NotificationSubscription subscription;
+    subscription.callback = callback;
+    subscription.options = options;
+    d->notificationSubscriptions.insert(characteristic.attributeHandle(), subscription);
+    return true;
+}
+
+/*!
+    Removes the notification callback of \a characteristic. Afterwards its
+    changed values are reported via \l characteristicChanged() again.
+
+    \sa setNotificationCallback()
+    \since 5.10
+ */
+void QLowEnergyService::clearNotificationCallback(const QLowEnergyCharacteristic &characteristic)
+{
+    Q_D(QLowEnergyService);
+    d->notificationSubscriptions.remove(characteristic.attributeHandle());
+}
+
+/*!
+    Starts a reliable write transaction. Until \l executeReliableWrite() or
+    \l abortReliableWrite() is called, the values passed to \l writeCharacteristic()
+    using \l WriteWithResponse and to \l writeDescriptor() are collected rather
+    than written.
+
+    Returns \c false if the transaction cannot be started. This happens
+    if the service is not discovered or the associated controller is not
+    in the \l {QLowEnergyController::CentralRole}{central} role. It also
+    happens if another service of the same device has a transaction in
+    progress.
+
+    Only characteristics whose Characteristic Extended Properties descriptor
+    has the Reliable Write bit set can be part of the transaction. Writing
+    any other characteristic emits \l error() with \l CharacteristicWriteError.
+
+    \note Currently, this functionality is only implemented on Linux.
+
+    \sa executeReliableWrite(), abortReliableWrite()
+    \since 5.10
+ */
+bool QLowEnergyService::beginReliableWrite()
+{
+    Q_D(QLowEnergyService);
+
+    if (d->controller == Q_NULLPTR || d->controller->role != QLowEnergyController::CentralRole
+            || state() != ServiceDiscovered) {
+        return false;
+    }
+
+    return d->controller->beginReliableWrite(d_ptr);
+}
+
+/*!
+    Writes all values collected since \l beginReliableWrite() and ends the
+    transaction. The values are transferred using prepare write requests.
+    Each request is verified against the data echoed by the remote device.
+    The values are committed together by a single execute write request.
+
+    Once committed, \l characteristicWritten() or \l descriptorWritten() is
+    emitted for each value. If any part of the transaction fails, none of
+    the values is written and \l error() is emitted with
+    \l CharacteristicWriteError or \l DescriptorWriteError.
+
+    \sa beginReliableWrite()
+    \since 5.10
+ */
+void QLowEnergyService::executeReliableWrite()
+{
+    Q_D(QLowEnergyService);
+
+    if (d->controller == Q_NULLPTR)
+        return;
+
+    d->controller->executeReliableWrite(d_ptr);
+}
+
+/*!
+    Discards all values collected since \l beginReliableWrite() and ends
+    the transaction.
+
+    \sa beginReliableWrite()
+    \since 5.10
+ */
+void QLowEnergyService::abortReliableWrite()
+{
+    Q_D(QLowEnergyService);
+
+    if (d->controller == Q_NULLPTR)
+        return;
+
+    d->controller->abortReliableWrite(d_ptr);
+}
+
+/*!
+    Creates a write-only QIODevice which streams the written data to
+    \a characteristic using \l WriteWithoutResponse. The device has the given
+    \a parent and remains usable while the service is connected.
+
+    The data is split into chunks which fit into a single packet. Unlike repeated
+    calls to \l writeCharacteristic(), no chunk is dropped when the local
+    Bluetooth stack cannot accept further packets. Instead, the data is
+    queued and QIODevice::bytesWritten() is emitted as the chunks are sent.
+    QIODevice::bytesToWrite() returns the amount of queued data. While too
+    much data is queued, QIODevice::write() accepts fewer bytes than requested.
+    Callers should therefore continue writing from a slot connected to
+    QIODevice::bytesWritten().
+
+    Returns \c nullptr if \a characteristic does not belong to this service, does
+    not have the \l QLowEnergyCharacteristic::WriteNoResponse property, or if the
+    associated controller is not in the \l {QLowEnergyController::CentralRole}{central}
+    role.
+
+    \note Currently, this functionality is only implemented on Linux.
+
+    \sa writeCharacteristic()
+    \since 5.10
+ */
+QIODevice *QLowEnergyService::createCharacteristicWriter(
+        const QLowEnergyCharacteristic &characteristic, QObject *parent)
+{
+    Q_D(QLowEnergyService);
+
+    if (d->controller == Q_NULLPTR || d->controller->role != QLowEnergyController::CentralRole
+            || state() != ServiceDiscovered || !contains(characteristic)
+            || !(characteristic.properties() & QLowEnergyCharacteristic::WriteNoResponse)) {
+        return nullptr;
+    }
+
+#if defined(QT_BLUEZ_BLUETOOTH) && !defined(QT_BLUEZ_NO_BTLE)
+    return new QLowEnergyCharacteristicWriter(d_ptr, characteristic.handle(), parent);
+#else
+    Q_UNUSED(parent);
+    qWarning("QLowEnergyService::createCharacteristicWriter() is not supported on this platform");
+    return nullptr;
+#endif
+}
+
+/*!
+    Sets the \a policy by which changes of \a characteristic caused by
+    notifications or indications are reported.
+
+    With \l DeliverLatestValue the \l characteristicChanged() signal is emitted
+    at most once per \a interval milliseconds and carries the latest received value.
+    With \l DeliverValueBatches all values received within \a interval are
+    reported at once via \l characteristicValuesChanged(). An \a interval of
+    \c 0 delivers the values collected until control returns to the event loop.
+    The first value received after a quiet \a interval is reported immediately.
+
+    Values which are still pending when the policy changes are delivered
+    immediately. The policy does not affect callbacks registered via
+    \l setNotificationCallback().
+
+    \sa notificationPolicy()
+    \since 5.10
+ */
+void QLowEnergyService::setNotificationPolicy(const QLowEnergyCharacteristic &characteristic,
+                                              NotificationPolicy policy, int interval)
+{
+    Q_D(QLowEnergyService);
+
+    if (!contains(characteristic))
+        return;
+
+    d->setNotificationPolicy(characteristic.attributeHandle(), policy, interval);
+}
+
+/*!
+    Returns the policy by which notified values of \a characteristic are reported.
+    The default is \l DeliverAllValues.
+
+    \sa setNotificationPolicy()
+    \since 5.10
+ */
+QLowEnergyService::NotificationPolicy QLowEnergyService::notificationPolicy(
+        const QLowEnergyCharacteristic &characteristic) const
+{
+    Q_D(const QLowEnergyService);
+
+    const auto it = d->notificationCoalescing.constFind(characteristic.attributeHandle());
+    if (it == d->notificationCoalescing.constEnd())
+        return DeliverAllValues;
+    return it->policy;
+}
+
 QT_END_NAMESPACE
@@ -43,9 +43,14 @@
 #include <QtBluetooth/QBluetoothAddress>
 #include <QtBluetooth/QBluetoothUuid>
 #include <QtBluetooth/QLowEnergyCharacteristic>
+#include <QtCore/QPair>
+#include <QtCore/QVector>
+
+#include <functional>
 
 QT_BEGIN_NAMESPACE
 
+class QIODevice;
 class QLowEnergyServicePrivate;
 class QLowEnergyControllerPrivate;
 class Q_BLUETOOTH_EXPORT QLowEnergyService : public QObject
@@ -87,6 +92,26 @@ public:
     };
     Q_ENUM(WriteMode)
 
+    enum NotificationOption {
+        NoNotificationOption = 0x0,
+        UpdateCachedValue = 0x1,
+        EmitCharacteristicChanged = 0x2
+    };
+    Q_ENUM(NotificationOption)
+    Q_DECLARE_FLAGS(NotificationOptions, NotificationOption)
+
+    typedef std::function<void(const QLowEnergyCharacteristic &characteristic,
+                               const char *data, int size)> NotificationCallback;
+
+    enum NotificationPolicy {
+        DeliverAllValues = 0,
+        DeliverLatestValue,
+        DeliverValueBatches
+    };
+    Q_ENUM(NotificationPolicy)
+
+    typedef QPair<qint64, QByteArray> TimestampedValue;
+
     ~QLowEnergyService();
 
     QList<QBluetoothUuid> includedServices() const;
@@ -114,10 +139,28 @@ public:
     void writeDescriptor(const QLowEnergyDescriptor &descriptor,
                          const QByteArray &newValue);
 
+    bool setNotificationCallback(const QLowEnergyCharacteristic &characteristic,
+                                 const NotificationCallback &callback,
+                                 NotificationOptions options = NoNotificationOption);
+    void clearNotificationCallback(const QLowEnergyCharacteristic &characteristic);
+
+    bool beginReliableWrite();
+    void executeReliableWrite();
+    void abortReliableWrite();
+
+    QIODevice *createCharacteristicWriter(const QLowEnergyCharacteristic &characteristic,
+                                          QObject *parent = nullptr);
+
+    void setNotificationPolicy(const QLowEnergyCharacteristic &characteristic,
+                               NotificationPolicy policy, int interval = 0);
+    NotificationPolicy notificationPolicy(const QLowEnergyCharacteristic &characteristic) const;
+
 Q_SIGNALS:
     void stateChanged(QLowEnergyService::ServiceState newState);
     void characteristicChanged(const QLowEnergyCharacteristic &info,
                                const QByteArray &value);
+    void characteristicValuesChanged(const QLowEnergyCharacteristic &info,
+                                     const QVector<QLowEnergyService::TimestampedValue> &values);
     void characteristicRead(const QLowEnergyCharacteristic &info,
                             const QByteArray &value);
     void characteristicWritten(const QLowEnergyCharacteristic &info,
@@ -140,6 +183,7 @@ private:
 };
 
 Q_DECLARE_OPERATORS_FOR_FLAGS(QLowEnergyService::ServiceTypes)
+Q_DECLARE_OPERATORS_FOR_FLAGS(QLowEnergyService::NotificationOptions)
 
 QT_END_NAMESPACE
 
@@ -147,5 +191,7 @@ Q_DECLARE_METATYPE(QLowEnergyService::ServiceError)
 Q_DECLARE_METATYPE(QLowEnergyService::ServiceState)
 Q_DECLARE_METATYPE(QLowEnergyService::ServiceType)
 Q_DECLARE_METATYPE(QLowEnergyService::WriteMode)
+Q_DECLARE_METATYPE(QLowEnergyService::NotificationPolicy)
+Q_DECLARE_METATYPE(QVector<QLowEnergyService::TimestampedValue>)
 
 #endif // QLOWENERGYSERVICE_H
@@ -71,6 +71,7 @@ QLowEnergyService::QLowEnergyService(QSharedPointer<QLowEnergyServicePrivate> d,
 {
     qRegisterMetaType<QLowEnergyService::ServiceState>();
     qRegisterMetaType<QLowEnergyService::ServiceError>();
+    qRegisterMetaType<QVector<QLowEnergyService::TimestampedValue> >();
 
     connect(d.data(), SIGNAL(error(QLowEnergyService::ServiceError)),
             this, SIGNAL(error(QLowEnergyService::ServiceError)));
@@ -78,6 +79,10 @@ QLowEnergyService::QLowEnergyService(QSharedPointer<QLowEnergyServicePrivate> d,
             this, SIGNAL(stateChanged(QLowEnergyService::ServiceState)));
     connect(d.data(), SIGNAL(characteristicChanged(QLowEnergyCharacteristic, QByteArray)),
             this, SIGNAL(characteristicChanged(QLowEnergyCharacteristic, QByteArray)));
+    connect(d.data(), SIGNAL(characteristicValuesChanged(QLowEnergyCharacteristic,
+                                                         QVector<QLowEnergyService::TimestampedValue>)),
+            this, SIGNAL(characteristicValuesChanged(QLowEnergyCharacteristic,
+                                                     QVector<QLowEnergyService::TimestampedValue>)));
     connect(d.data(), SIGNAL(characteristicWritten(QLowEnergyCharacteristic, QByteArray)),
             this, SIGNAL(characteristicWritten(QLowEnergyCharacteristic, QByteArray)));
     connect(d.data(), SIGNAL(descriptorWritten(QLowEnergyDescriptor, QByteArray)),
@@ -274,4 +279,64 @@ void QLowEnergyService::writeDescriptor(const QLowEnergyDescriptor &descriptor,
     }
 }
 
+bool QLowEnergyService::setNotificationCallback(const QLowEnergyCharacteristic &characteristic,
+                                                const NotificationCallback &callback,
+                                                NotificationOptions options)
+{
+    if (!callback || !contains(characteristic))
+        return false;
+
+    QLowEnergyServicePrivate::NotificationSubscription subscription;
+    subscription.callback = callback;
+    subscription.options = options;
+    d_ptr->notificationSubscriptions.insert(characteristic.attributeHandle(), subscription);
+    return true;
+}
+
+void QLowEnergyService::clearNotificationCallback(const QLowEnergyCharacteristic &characteristic)
+{
+    d_ptr->notificationSubscriptions.remove(characteristic.attributeHandle());
+}
+
+bool QLowEnergyService::beginReliableWrite()
+{
+    qWarning("QLowEnergyService::beginReliableWrite() is not supported on this platform");
+    return false;
+}
+
+void QLowEnergyService::executeReliableWrite()
+{
+}
+
+void QLowEnergyService::abortReliableWrite()
+{
+}
+
+QIODevice *QLowEnergyService::createCharacteristicWriter(
+        const QLowEnergyCharacteristic &characteristic, QObject *parent)
+{
+    Q_UNUSED(characteristic);
+    Q_UNUSED(parent);
+    qWarning("QLowEnergyService::createCharacteristicWriter() is not supported on this platform");
+    return nullptr;
+}
+
+void QLowEnergyService::setNotificationPolicy(const QLowEnergyCharacteristic &characteristic,
+                                              NotificationPolicy policy, int interval)
+{
+    if (!contains(characteristic))
+        return;
+
+    d_ptr->setNotificationPolicy(characteristic.attributeHandle(), policy, interval);
+}
+
+QLowEnergyService::NotificationPolicy QLowEnergyService::notificationPolicy(
+        const QLowEnergyCharacteristic &characteristic) const
+{
+    const auto it = d_ptr->notificationCoalescing.constFind(characteristic.attributeHandle());
+    if (it == d_ptr->notificationCoalescing.constEnd())
+        return DeliverAllValues;
+    return it->policy;
+}
+
 QT_END_NAMESPACE
@@ -41,6 +41,11 @@
 
 #include "qlowenergycontroller_p.h"
 
+#include <QtCore/QDateTime>
+#include <QtCore/QTimer>
+
+#include <algorithm>
+
 QT_BEGIN_NAMESPACE
 
 QLowEnergyServicePrivate::QLowEnergyServicePrivate(QObject *parent) :
@@ -79,7 +84,160 @@ void QLowEnergyServicePrivate::setState(QLowEnergyService::ServiceState newState
         return;
 
     state = newState;
+
+    if (state == QLowEnergyService::InvalidService) {
+        // values of a disconnected service are not delivered anymore
+        for (auto it = notificationCoalescing.begin(); it != notificationCoalescing.end(); ++it) {
+            it->timer->stop();
+            it->latestValue.clear();
+            it->values.clear();
+        }
+    }
+
+    characteristicHandles.clear();
+    if (state == QLowEnergyService::ServiceDiscovered) {
+        characteristicHandles.reserve(characteristicList.size());
+        for (auto it = characteristicList.constBegin(); it != characteristicList.constEnd(); ++it)
+            characteristicHandles.append(it.key());
+        std::sort(characteristicHandles.begin(), characteristicHandles.end());
+    }
+
     emit stateChanged(newState);
 }
 
+/*!
+    Hands a notified or indicated value of \a characteristic to a registered
+    notification callback and updates the cached value of the characteristic.
+    The value is passed as \a data and \a size and may point into a
+    buffer that is reused for the next incoming packet.
+
+    Returns \c true if characteristicChanged() must be emitted.
+ */
+bool QLowEnergyServicePrivate::deliverNotification(
+        const QLowEnergyCharacteristic &characteristic, const char *data, int size)
+{
+    QLowEnergyService::NotificationOptions options =
+            QLowEnergyService::UpdateCachedValue | QLowEnergyService::EmitCharacteristicChanged;
+
+    if (!notificationSubscriptions.isEmpty()) {
+        const auto it = notificationSubscriptions.constFind(characteristic.attributeHandle());
+        if (it != notificationSubscriptions.constEnd()) {
+            // copy as the callback may unregister itself
+            const NotificationSubscription subscription = it.value();
+            subscription.callback(characteristic, data, size);
+            options = subscription.options;
+        }
+    }
+
+    // only update cache when property is readable. Otherwise it remains empty.
+    if ((options & QLowEnergyService::UpdateCachedValue)
+            && (characteristic.properties() & QLowEnergyCharacteristic::Read)) {
+        CharacteristicDataMap::iterator charIt =
+                characteristicList.find(characteristic.attributeHandle());
+        if (charIt != characteristicList.end())
+            charIt.value().value = QByteArray(data, size);
+    }
+
+    if (!(options & QLowEnergyService::EmitCharacteristicChanged))
+        return false;
+
+    if (notificationCoalescing.isEmpty())
+        return true;
+
+    const auto coalescingIt = notificationCoalescing.find(characteristic.attributeHandle());
+    if (coalescingIt == notificationCoalescing.end())
+        return true;
+
+    // The first value after a quiet interval is delivered right away, values
+    // arriving while the timer runs are held back until it expires.
+    NotificationCoalescing &coalescing = coalescingIt.value();
+    if (!coalescing.timer->isActive()) {
+        coalescing.timer->start();
+        if (coalescing.policy == QLowEnergyService::DeliverLatestValue)
+            return true;
+        const QVector<QLowEnergyService::TimestampedValue> values(
+                1, qMakePair(QDateTime::currentMSecsSinceEpoch(), QByteArray(data, size)));
+        emit characteristicValuesChanged(characteristic, values);
+        return false;
+    }
+
+    if (coalescing.policy == QLowEnergyService::DeliverLatestValue) {
+        coalescing.latestValue = QByteArray(data, size);
+        coalescing.latestValuePending = true;
+    } else {
+        coalescing.values.append(qMakePair(QDateTime::currentMSecsSinceEpoch(),
+                                           QByteArray(data, size)));
+    }
+    coalescing.characteristic = characteristic;
+    return false;
+}
+
+void QLowEnergyServicePrivate::setNotificationPolicy(QLowEnergyHandle charHandle,
+        QLowEnergyService::NotificationPolicy policy, int interval)
+{
+    auto it = notificationCoalescing.find(charHandle);
+    if (it != notificationCoalescing.end() && it->timer->isActive()) {
+        // deliver what has been collected under the previous policy
+        it->timer->stop();
+        flushCoalescedNotifications(charHandle);
+        it = notificationCoalescing.find(charHandle);
+    }
+
+    if (policy == QLowEnergyService::DeliverAllValues) {
+        if (it != notificationCoalescing.end()) {
+            // the timer might be the sender of the current signal emission
+            it->timer->deleteLater();
+            notificationCoalescing.erase(it);
+        }
+        return;
+    }
+
+    if (it == notificationCoalescing.end()) {
+        NotificationCoalescing coalescing;
+        coalescing.timer = new QTimer(this);
+        coalescing.timer->setSingleShot(true);
+        connect(coalescing.timer, &QTimer::timeout, this, [this, charHandle]() {
+            if (!flushCoalescedNotifications(charHandle))
+                return;
+            // keep the rate limited until an interval passes without values
+            const auto it = notificationCoalescing.constFind(charHandle);
+            if (it != notificationCoalescing.constEnd() && !it->timer->isActive())
+                it->timer->start();
+        });
+        it = notificationCoalescing.insert(charHandle, coalescing);
+    }
+
+    it->policy = policy;
+    it->timer->setInterval(qMax(0, interval));
+}
+
+/*!
+    Delivers the values of the characteristic with \a charHandle that were held back.
+    Returns \c true if there were any.
+ */
+bool QLowEnergyServicePrivate::flushCoalescedNotifications(QLowEnergyHandle charHandle)
+{
+    const auto it = notificationCoalescing.find(charHandle);
+    if (it == notificationCoalescing.end())
+        return false;
+
+    // receivers may change the policy, don't touch the entry after emitting
+    const QLowEnergyCharacteristic characteristic = it->characteristic;
+    if (it->policy == QLowEnergyService::DeliverLatestValue) {
+        if (!it->latestValuePending)
+            return false;
+        it->latestValuePending = false;
+        QByteArray value;
+        value.swap(it->latestValue);
+        emit characteristicChanged(characteristic, value);
+    } else {
+        if (it->values.isEmpty())
+            return false;
+        QVector<QLowEnergyService::TimestampedValue> values;
+        values.swap(it->values);
+        emit characteristicValuesChanged(characteristic, values);
+    }
+    return true;
+}
+
 QT_END_NAMESPACE
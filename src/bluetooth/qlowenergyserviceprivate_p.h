@@ -53,6 +53,7 @@
 
 #include <QtCore/QObject>
 #include <QtCore/QPointer>
+#include <QtCore/QVector>
 #include <QtBluetooth/qbluetooth.h>
 #include <QtBluetooth/QLowEnergyService>
 #include <QtBluetooth/QLowEnergyCharacteristic>
@@ -60,8 +61,9 @@
 QT_BEGIN_NAMESPACE
 
 class QLowEnergyControllerPrivate;
+class QTimer;
 
-class QLowEnergyServicePrivate : public QObject
+class Q_AUTOTEST_EXPORT QLowEnergyServicePrivate : public QObject
 {
     Q_OBJECT
 public:
@@ -81,6 +83,21 @@ public:
         QHash<QLowEnergyHandle, DescData> descriptorList;
     };
 
+    struct NotificationSubscription {
+        QLowEnergyService::NotificationCallback callback;
+        QLowEnergyService::NotificationOptions options;
+    };
+
+    struct NotificationCoalescing {
+        QLowEnergyService::NotificationPolicy policy = QLowEnergyService::DeliverAllValues;
+        // single shot, running for an interval after each delivery
+        QTimer *timer = nullptr;
+        QLowEnergyCharacteristic characteristic;
+        QByteArray latestValue;
+        bool latestValuePending = false;
+        QVector<QLowEnergyService::TimestampedValue> values;
+    };
+
     enum GattAttributeTypes {
         PrimaryService = 0x2800,
         SecondaryService = 0x2801,
@@ -91,12 +108,19 @@ public:
     void setController(QLowEnergyControllerPrivate* control);
     void setError(QLowEnergyService::ServiceError newError);
     void setState(QLowEnergyService::ServiceState newState);
+    bool deliverNotification(const QLowEnergyCharacteristic &characteristic,
+                             const char *data, int size);
+    void setNotificationPolicy(QLowEnergyHandle charHandle,
+                               QLowEnergyService::NotificationPolicy policy, int interval);
+    bool flushCoalescedNotifications(QLowEnergyHandle charHandle);
 
 signals:
     void stateChanged(QLowEnergyService::ServiceState newState);
     void error(QLowEnergyService::ServiceError error);
     void characteristicChanged(const QLowEnergyCharacteristic &characteristic,
                                const QByteArray &newValue);
+    void characteristicValuesChanged(const QLowEnergyCharacteristic &characteristic,
+                                     const QVector<QLowEnergyService::TimestampedValue> &values);
     void characteristicRead(const QLowEnergyCharacteristic &info,
                             const QByteArray &value);
     void characteristicWritten(const QLowEnergyCharacteristic &characteristic,
@@ -117,6 +141,15 @@ public:
     QLowEnergyService::ServiceError lastError;
 
     QHash<QLowEnergyHandle, CharData> characteristicList;
+    // Sorted keys of characteristicList, only maintained in ServiceDiscovered state
+    QVector<QLowEnergyHandle> characteristicHandles;
+    // characteristic handle -> callback receiving notifications without copying them
+    QHash<QLowEnergyHandle, NotificationSubscription> notificationSubscriptions;
+    // characteristic handle -> delayed delivery of characteristicChanged()
+    QHash<QLowEnergyHandle, NotificationCoalescing> notificationCoalescing;
+
+    // number of QLowEnergyService instances referring to this service
+    int serviceObjectCount = 0;
 
     QPointer<QLowEnergyControllerPrivate> controller;
 };
@@ -144,6 +144,15 @@ void addCustomService()
     charData.setValue("initial");
     serviceData.addCharacteristic(charData);
 
+    charData.setUuid(QBluetoothUuid(quint16(0x5005)));
+    charData.setProperties(QLowEnergyCharacteristic::Read | QLowEnergyCharacteristic::Write
+                           | QLowEnergyCharacteristic::WriteNoResponse
+                           | QLowEnergyCharacteristic::ExtendedProperty);
+    // Reliable Write bit
+    charData.addDescriptor(QLowEnergyDescriptorData(QBluetoothUuid::CharacteristicExtendedProperties,
+                                                    QByteArray::fromHex("0100")));
+    serviceData.addCharacteristic(charData);
+
     addService(serviceData);
 
     // service with full 128 bit custom uuids
@@ -43,15 +43,200 @@
 #include <QtTest/qsignalspy.h>
 #include <QtTest/QtTest>
 
+#include <QtBluetooth/private/qlowenergyserviceprivate_p.h>
+
 #ifdef Q_OS_LINUX
+#include <QtBluetooth/private/btsnoopwriter_p.h>
+#include <QtBluetooth/private/lebondstore_p.h>
+#include <QtBluetooth/private/leattreceiver_p.h>
+#include <QtBluetooth/private/leattributecache_p.h>
 #include <QtBluetooth/private/lecmaccalculator_p.h>
 #endif
 
 #include <algorithm>
 #include <cstring>
+#include <numeric>
+
+#ifdef Q_OS_LINUX
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#endif
 
 using namespace QBluetooth;
 
+#if defined(QT_BUILD_INTERNAL) && defined(CONFIG_BLUEZ_LE)
+QT_BEGIN_NAMESPACE
+void qt_connectLowEnergyControllerToAttSocket(QLowEnergyController *controller,
+                                              int socketDescriptor);
+void qt_addLowEnergyControllerClient(QLowEnergyController *controller, int socketDescriptor,
+                                     const QBluetoothAddress &address);
+QObject *qt_createLowEnergyAdvertiser(const QLowEnergyAdvertisingParameters &params,
+                                      const QLowEnergyAdvertisingData &advertisingData,
+                                      const QLowEnergyAdvertisingData &scanResponseData);
+QByteArray qt_lowEnergyAdvertiserData(QObject *advertiser, bool isScanResponseData,
+                                      int *powerLevelOffset, int *manufacturerDataOffset);
+bool qt_updateLowEnergyAdvertiserData(QObject *advertiser,
+                                      const QLowEnergyAdvertisingData &advertisingData,
+                                      const QLowEnergyAdvertisingData &scanResponseData);
+QObject *qt_createLowEnergyRawScanner(int duplicateFilterInterval);
+QVariantList qt_dispatchLowEnergyRawScannerPackets(QObject *scanner,
+                                                   const QVector<QByteArray> &packets);
+QT_END_NAMESPACE
+
+// Returns the next PDU the controller has sent to socketDescriptor, or an empty
+// array if nothing arrives within timeout milliseconds.
+static QByteArray receivePdu(int socketDescriptor, int timeout = 5000)
+{
+    QElapsedTimer timer;
+    timer.start();
+    char buffer[512];
+    forever {
+        const ssize_t size = ::read(socketDescriptor, buffer, sizeof buffer);
+        if (size > 0)
+            return QByteArray(buffer, int(size));
+        if (timer.hasExpired(timeout))
+            return QByteArray();
+        QTest::qWait(5);
+    }
+}
+
+static QByteArray attTransaction(int socketDescriptor, const QByteArray &request)
+{
+    if (::write(socketDescriptor, request.constData(), request.size()) != request.size())
+        return QByteArray();
+    return receivePdu(socketDescriptor);
+}
+
+// A minimal GATT server on one end of a socket pair. It serves a battery service
+// whose level characteristic can be read and written, at handles 1 to 3.
+class FakeAttServer
+{
+public:
+    explicit FakeAttServer(int socketDescriptor)
+        : m_socket(socketDescriptor), m_notifier(socketDescriptor, QSocketNotifier::Read)
+    {
+        QObject::connect(&m_notifier, &QSocketNotifier::activated, [this]() { readRequests(); });
+    }
+    ~FakeAttServer() { ::close(m_socket); }
+
+    QVector<QByteArray> requests;
+    QByteArray level = QByteArray(1, char(100));
+    QByteArray powerState = QByteArray(1, char(0x2f));
+    // errors returned in turn instead of the next reads of the level
+    QVector<quint8> readErrors;
+    // responses returned in turn to the next Read Multiple Variable requests,
+    // afterwards they are not supported
+    QVector<QByteArray> readMultipleReplies;
+    // false -> requests are received but never answered
+    bool answering = true;
+
+    // answers the last request received, e.g. the one held back while not answering
+    void answerLast() { answer(requests.last()); }
+
+    void notify(quint16 handle, const QByteArray &value)
+    {
+        QByteArray pdu(3, Qt::Uninitialized);
+        pdu[0] = char(0x1b);
+        qToLittleEndian(handle, reinterpret_cast<uchar *>(pdu.data() + 1));
+        send(pdu + value);
+    }
+
+private:
+    void readRequests()
+    {
+        char buffer[512];
+        forever {
+            const ssize_t size = ::read(m_socket, buffer, sizeof buffer);
+            if (size <= 0) {
+                if (size == 0)
+                    m_notifier.setEnabled(false);
+                return;
+            }
+            requests.append(QByteArray(buffer, int(size)));
+            if (answering)
+                answer(requests.last());
+        }
+    }
+
+    void send(const QByteArray &pdu)
+    {
+        QCOMPARE(::write(m_socket, pdu.constData(), pdu.size()), ssize_t(pdu.size()));
+    }
+    void sendError(quint8 opcode, quint16 handle, quint8 error)
+    {
+        QByteArray pdu(5, Qt::Uninitialized);
+        pdu[0] = char(0x01);
+        pdu[1] = char(opcode);
+        qToLittleEndian(handle, reinterpret_cast<uchar *>(pdu.data() + 2));
+        pdu[4] = char(error);
+        send(pdu);
+    }
+
+    void answer(const QByteArray &request)
+    {
+        const quint8 opcode = quint8(request.at(0));
+        const quint16 handle = request.size() >= 3
+                ? qFromLittleEndian<quint16>(reinterpret_cast<const uchar *>(request.constData() + 1))
+                : 0;
+        const quint16 type = request.size() == 7
+                ? qFromLittleEndian<quint16>(reinterpret_cast<const uchar *>(request.constData() + 5))
+                : 0;
+        switch (opcode) {
+        case 0x02: // Exchange MTU
+            send(QByteArray::fromHex("031700"));
+            return;
+        case 0x10: // Read By Group Type
+            if (type == 0x2800 && handle <= 1)
+                send(QByteArray::fromHex("1106" "0100" "0500" "0f18"));
+            else
+                sendError(opcode, handle, 0x0a); // Attribute Not Found
+            return;
+        case 0x08: // Read By Type
+            if (type == 0x2803 && handle <= 2)
+                send(QByteArray::fromHex("0907" "0200" "0a" "0300" "192a"
+                                                 "0400" "02" "0500" "1a2a"));
+            else
+                sendError(opcode, handle, 0x0a);
+            return;
+        case 0x04: // Find Information
+            sendError(opcode, handle, 0x0a);
+            return;
+        case 0x0a: // Read
+            if (handle == 5)
+                send(char(0x0b) + powerState);
+            else if (handle != 3)
+                sendError(opcode, handle, 0x01); // Invalid Handle
+            else if (!readErrors.isEmpty())
+                sendError(opcode, handle, readErrors.takeFirst());
+            else
+                send(char(0x0b) + level);
+            return;
+        case 0x20: // Read Multiple Variable
+            if (!readMultipleReplies.isEmpty())
+                send(readMultipleReplies.takeFirst());
+            else
+                sendError(opcode, handle, 0x06);
+            return;
+        case 0x12: // Write
+            if (handle != 3) {
+                sendError(opcode, handle, 0x01);
+                return;
+            }
+            level = request.mid(3);
+            send(QByteArray(1, char(0x13)));
+            return;
+        default:
+            sendError(opcode, handle, 0x06); // Request Not Supported
+            return;
+        }
+    }
+
+    const int m_socket;
+    QSocketNotifier m_notifier;
+};
+#endif // QT_BUILD_INTERNAL && CONFIG_BLUEZ_LE
+
 class TestQLowEnergyControllerGattServer : public QObject
 {
     Q_OBJECT
@@ -62,11 +247,23 @@ private slots:
     // Static, local stuff goes here.
     void advertisingParameters();
     void advertisingData();
+    void attReceiver();
+    void attributeCache();
+    void bondStore();
     void cmacVerifier();
     void cmacVerifier_data();
+    void compiledAdvertisingData();
     void connectionParameters();
     void controllerType();
+    void notificationPolicies();
+    void packetCapture();
+    void rawScanner();
+    void readMultiple();
+    void readMultiple_data();
+    void requestQueue();
+    void serverClients();
     void serviceData();
+    void statistics();
 
     // Interaction with actual GATT server goes here. Order is relevant.
     void advertisedData();
@@ -97,6 +294,8 @@ void TestQLowEnergyControllerGattServer::advertisingParameters()
     QCOMPARE(params.minimumInterval(), 1280);
     QCOMPARE(params.maximumInterval(), 1280);
     QCOMPARE(params.mode(), QLowEnergyAdvertisingParameters::AdvInd);
+    QCOMPARE(params.primaryPhy(), QLowEnergyAdvertisingParameters::Phy1M);
+    QCOMPARE(params.secondaryPhy(), QLowEnergyAdvertisingParameters::Phy1M);
     QVERIFY(params.whiteList().isEmpty());
 
     params.setInterval(100, 200);
@@ -109,6 +308,24 @@ void TestQLowEnergyControllerGattServer::advertisingParameters()
     params.setMode(QLowEnergyAdvertisingParameters::AdvScanInd);
     QCOMPARE(params.mode(), QLowEnergyAdvertisingParameters::AdvScanInd);
 
+    params.setPrimaryPhy(QLowEnergyAdvertisingParameters::PhyCoded);
+    QCOMPARE(params.primaryPhy(), QLowEnergyAdvertisingParameters::PhyCoded);
+    params.setPrimaryPhy(QLowEnergyAdvertisingParameters::Phy2M);
+    QCOMPARE(params.primaryPhy(), QLowEnergyAdvertisingParameters::Phy1M);
+    params.setSecondaryPhy(QLowEnergyAdvertisingParameters::Phy2M);
+    QCOMPARE(params.secondaryPhy(), QLowEnergyAdvertisingParameters::Phy2M);
+    QVERIFY(params != QLowEnergyAdvertisingParameters());
+    params.setSecondaryPhy(QLowEnergyAdvertisingParameters::Phy1M);
+
+    // parameters differing in nothing but a PHY
+    QLowEnergyAdvertisingParameters phyParams;
+    phyParams.setPrimaryPhy(QLowEnergyAdvertisingParameters::PhyCoded);
+    QVERIFY(phyParams != QLowEnergyAdvertisingParameters());
+    phyParams.setPrimaryPhy(QLowEnergyAdvertisingParameters::Phy1M);
+    QCOMPARE(phyParams, QLowEnergyAdvertisingParameters());
+    phyParams.setSecondaryPhy(QLowEnergyAdvertisingParameters::Phy2M);
+    QVERIFY(phyParams != QLowEnergyAdvertisingParameters());
+
     const auto whiteList = QList<QLowEnergyAdvertisingParameters::AddressInfo>()
             << QLowEnergyAdvertisingParameters::AddressInfo(QBluetoothAddress(),
                                                             QLowEnergyController::PublicAddress);
@@ -159,9 +376,273 @@ void TestQLowEnergyControllerGattServer::advertisingData()
     QVERIFY(data != QLowEnergyAdvertisingData());
 }
 
+void TestQLowEnergyControllerGattServer::attReceiver()
+{
+#if defined(QT_BUILD_INTERNAL) && defined(CONFIG_BLUEZ_LE)
+    // SOCK_SEQPACKET preserves the PDU boundaries like an L2CAP socket does
+    int fds[2];
+    QCOMPARE(::socketpair(AF_UNIX, SOCK_SEQPACKET | SOCK_NONBLOCK | SOCK_CLOEXEC, 0, fds), 0);
+    const int peer = fds[1];
+
+    QThread ioThread;
+    ioThread.start();
+    LeAttReceiver * const receiver = new LeAttReceiver(fds[0]);
+    ::close(fds[0]); // the receiver works on its own duplicate
+    QVERIFY(receiver->isValid());
+
+    // queued to this thread, like the controller receives the batches
+    QVector<QByteArray> packets;
+    bool socketClosed = false;
+    const QMetaObject::Connection packetsConnection = connect(
+                receiver, &LeAttReceiver::packetsAvailable, this, [&packets, receiver]() {
+        QVERIFY(QThread::currentThread() != receiver->thread());
+        const LeAttReceiver::PacketBatch &batch = receiver->takePackets();
+        QVERIFY(!batch.isEmpty());
+        for (int i = 0; i < batch.count(); ++i)
+            packets.append(QByteArray(batch.packet(i), batch.packetSize(i)));
+    });
+    const QMetaObject::Connection closedConnection = connect(
+                receiver, &LeAttReceiver::socketClosed, this, [&socketClosed]() {
+        socketClosed = true;
+    });
+    receiver->moveToThread(&ioThread);
+    QMetaObject::invokeMethod(receiver, "start", Qt::QueuedConnection);
+
+    const QByteArray notification = QByteArray::fromHex("1b0300aabb");
+    const QByteArray indication = QByteArray::fromHex("1d0500cc");
+    const QByteArray response = QByteArray::fromHex("0b01");
+    QCOMPARE(::write(peer, notification.constData(), notification.size()),
+             ssize_t(notification.size()));
+    QCOMPARE(::write(peer, indication.constData(), indication.size()),
+             ssize_t(indication.size()));
+    QCOMPARE(::write(peer, response.constData(), response.size()), ssize_t(response.size()));
+
+    // The indication is confirmed by the I/O thread while this thread does not
+    // process events.
+    pollfd pfd = { peer, POLLIN, 0 };
+    QCOMPARE(::poll(&pfd, 1, 5000), 1);
+    char confirmation = 0;
+    QCOMPARE(::read(peer, &confirmation, 1), ssize_t(1));
+    QCOMPARE(quint8(confirmation), quint8(0x1e));
+
+    // the PDUs reach this thread in order, with their boundaries intact
+    QTRY_COMPARE(packets.count(), 3);
+    QCOMPARE(packets.at(0), notification);
+    QCOMPARE(packets.at(1), indication);
+    QCOMPARE(packets.at(2), response);
+
+    ::close(peer);
+    QTRY_VERIFY(socketClosed);
+
+    disconnect(packetsConnection);
+    disconnect(closedConnection);
+    QMetaObject::invokeMethod(receiver, "deleteLater", Qt::QueuedConnection);
+    ioThread.quit();
+    QVERIFY(ioThread.wait(5000));
+#else // QT_BUILD_INTERNAL && CONFIG_BLUEZ_LE
+    QSKIP("ATT receiver test only applicable for developer builds on Linux with BlueZ");
+#endif // QT_BUILD_INTERNAL && CONFIG_BLUEZ_LE
+}
+
+void TestQLowEnergyControllerGattServer::attributeCache()
+{
+#if defined(QT_BUILD_INTERNAL) && defined(CONFIG_BLUEZ_LE)
+    QTemporaryDir dir;
+    QVERIFY(dir.isValid());
+    const QString filePath = dir.path() + QLatin1String("/gatt/00:11:22:33:44:55");
+    const QByteArray hash = QByteArray::fromHex("00112233445566778899aabbccddeeff");
+
+    LeAttributeCache::Service battery;
+    battery.uuid = QBluetoothUuid(QBluetoothUuid::BatteryService);
+    battery.startHandle = 0x10;
+    battery.endHandle = 0x15;
+    battery.type = QLowEnergyService::PrimaryService;
+    battery.detailed = true;
+    battery.includedServices << QBluetoothUuid(QBluetoothUuid::DeviceInformation);
+    LeAttributeCache::Characteristic level;
+    level.handle = 0x11;
+    level.valueHandle = 0x12;
+    level.uuid = QBluetoothUuid(QBluetoothUuid::BatteryLevel);
+    level.properties = QLowEnergyCharacteristic::Read | QLowEnergyCharacteristic::Notify;
+    LeAttributeCache::Descriptor cccd;
+    cccd.handle = 0x13;
+    cccd.uuid = QBluetoothUuid(QBluetoothUuid::ClientCharacteristicConfiguration);
+    level.descriptors << cccd;
+    battery.characteristics << level;
+    LeAttributeCache::Service deviceInfo;
+    deviceInfo.uuid = QBluetoothUuid(QBluetoothUuid::DeviceInformation);
+    deviceInfo.startHandle = 0x20;
+    deviceInfo.endHandle = 0x2f;
+    deviceInfo.type = QLowEnergyService::PrimaryService | QLowEnergyService::IncludedService;
+    const QVector<LeAttributeCache::Service> services
+            = QVector<LeAttributeCache::Service>() << battery << deviceInfo;
+
+    LeAttributeCache cache;
+    cache.setFilePath(filePath);
+    QVector<LeAttributeCache::Service> loaded;
+    QVERIFY(!cache.load(hash, &loaded));
+    QVERIFY(cache.store(hash, services));
+    QVERIFY(QFileInfo(filePath).exists());
+    const QDateTime written = QFileInfo(filePath).lastModified();
+
+    // unchanged contents are not written again
+    QVERIFY(!cache.store(hash, services));
+    QCOMPARE(QFileInfo(filePath).lastModified(), written);
+
+    LeAttributeCache otherCache;
+    otherCache.setFilePath(filePath);
+    QVERIFY(!otherCache.load(QByteArray(), &loaded));
+    QVERIFY(!otherCache.load(QByteArray(16, 0), &loaded));
+    QVERIFY(otherCache.load(hash, &loaded));
+    QCOMPARE(loaded.count(), 2);
+    QCOMPARE(loaded.at(0).uuid, battery.uuid);
+    QCOMPARE(loaded.at(0).startHandle, battery.startHandle);
+    QCOMPARE(loaded.at(0).endHandle, battery.endHandle);
+    QCOMPARE(loaded.at(0).type, battery.type);
+    QVERIFY(loaded.at(0).detailed);
+    QCOMPARE(loaded.at(0).includedServices, battery.includedServices);
+    QCOMPARE(loaded.at(0).characteristics.count(), 1);
+    QCOMPARE(loaded.at(0).characteristics.at(0).handle, level.handle);
+    QCOMPARE(loaded.at(0).characteristics.at(0).valueHandle, level.valueHandle);
+    QCOMPARE(loaded.at(0).characteristics.at(0).uuid, level.uuid);
+    QCOMPARE(loaded.at(0).characteristics.at(0).properties, level.properties);
+    QCOMPARE(loaded.at(0).characteristics.at(0).descriptors.count(), 1);
+    QCOMPARE(loaded.at(0).characteristics.at(0).descriptors.at(0).handle, cccd.handle);
+    QCOMPARE(loaded.at(0).characteristics.at(0).descriptors.at(0).uuid, cccd.uuid);
+    QCOMPARE(loaded.at(1).uuid, deviceInfo.uuid);
+    QVERIFY(!loaded.at(1).detailed);
+    QVERIFY(loaded.at(1).characteristics.isEmpty());
+    // the file was loaded, storing the same services again is a no-op
+    QVERIFY(!otherCache.store(hash, services));
+
+    // a new hash invalidates the cache
+    const QByteArray newHash = QByteArray::fromHex("ffeeddccbbaa99887766554433221100");
+    QVERIFY(otherCache.store(newHash, services));
+    QVERIFY(!cache.load(hash, &loaded));
+    QVERIFY(cache.load(newHash, &loaded));
+
+    // a device without Database Hash has no usable cache
+    QVERIFY(!cache.store(QByteArray(), services));
+    QVERIFY(!QFileInfo(filePath).exists());
+
+    QVERIFY(cache.store(hash, services));
+    cache.remove();
+    QVERIFY(!QFileInfo(filePath).exists());
+    QVERIFY(!cache.load(hash, &loaded));
+#else // QT_BUILD_INTERNAL && CONFIG_BLUEZ_LE
+    QSKIP("Attribute cache test only applicable for developer builds on Linux with BlueZ");
+#endif // QT_BUILD_INTERNAL && CONFIG_BLUEZ_LE
+}
+
+void TestQLowEnergyControllerGattServer::bondStore()
+{
+#if defined(QT_BUILD_INTERNAL) && defined(CONFIG_BLUEZ_LE)
+    QStandardPaths::setTestModeEnabled(true);
+    const QBluetoothAddress adapter("00:11:22:33:44:55");
+    const QBluetoothAddress crashedAdapter("00:11:22:33:44:56");
+    const QBluetoothAddress device("11:22:33:44:55:66");
+    const QString dirPath = QStandardPaths::writableLocation(QStandardPaths::GenericDataLocation)
+            + QLatin1String("/qtbluetooth/bonds/");
+    const QString filePath = dirPath + adapter.toString();
+    const QString crashedFilePath = dirPath + crashedAdapter.toString();
+    QFile::remove(filePath);
+    quint128 localKey;
+    quint128 remoteKey;
+    for (int i = 0; i < 16; ++i) {
+        localKey.data[i] = quint8(i);
+        remoteKey.data[i] = quint8(0xff - i);
+    }
+    const QBluetoothUuid levelUuid(QBluetoothUuid::BatteryLevel);
+    const QBluetoothUuid measurementUuid(QBluetoothUuid::HeartRateMeasurement);
+    LeBondStore::SigningData signingData;
+
+    // Loads a copy of the store on disk, as if the process had crashed. The copy
+    // belongs to another adapter, so that closing it leaves the store itself alone.
+    const auto loadAfterCrash = [&](LeBondStore::SigningKeyType keyType,
+                                    LeBondStore::SigningData *data) {
+        QFile::remove(crashedFilePath);
+        if (!QFile::copy(filePath, crashedFilePath))
+            return false;
+        LeBondStore crashed(crashedAdapter);
+        return crashed.signingData(device, keyType, data);
+    };
+
+    QScopedPointer<LeBondStore> store(new LeBondStore(adapter));
+    QVERIFY(store->clientConfigurations(device).isEmpty());
+    QVERIFY(!store->signingData(device, LeBondStore::LocalSigningKey, &signingData));
+    store->setClientConfigurations(device, QVector<LeBondStore::ClientConfiguration>()
+            << LeBondStore::ClientConfiguration(3, 4, 0x0001, levelUuid)
+            << LeBondStore::ClientConfiguration(6, 7, 0x0002, measurementUuid));
+    store->setSigningKey(device, LeBondStore::LocalSigningKey, localKey);
+    store->setSigningKey(device, LeBondStore::RemoteSigningKey, remoteKey);
+    QVERIFY(store->signingData(device, LeBondStore::LocalSigningKey, &signingData));
+    QCOMPARE(signingData.counter, quint32(-1));
+    QVERIFY(!QFileInfo(filePath).exists()); // the changes so far are batched
+
+    // Every counter value handed out is covered by the reserve on disk, so that a
+    // restart after a crash continues behind it.
+    for (quint32 counter = 0; counter < 200; ++counter) {
+        store->setSignCounter(device, LeBondStore::LocalSigningKey, counter);
+        QVERIFY(loadAfterCrash(LeBondStore::LocalSigningKey, &signingData));
+        QVERIFY(std::memcmp(signingData.key.data, localKey.data, sizeof localKey) == 0);
+        QVERIFY(signingData.counter >= counter);
+    }
+
+    // The signing keys are readable for the user only.
+    QVERIFY(!(QFile::permissions(filePath) & (QFileDevice::ReadGroup | QFileDevice::ReadOther)));
+    QVERIFY(!(QFile::permissions(dirPath) & (QFileDevice::ReadGroup | QFileDevice::ReadOther)));
+
+    // Accepted remote counters reach the disk in the background. After a crash, the
+    // counters are continued far enough behind the one on disk that replays fail.
+    for (quint32 counter = 5; counter < 200; ++counter) {
+        store->setSignCounter(device, LeBondStore::RemoteSigningKey, counter);
+        QVERIFY(loadAfterCrash(LeBondStore::RemoteSigningKey, &signingData));
+        QVERIFY(std::memcmp(signingData.key.data, remoteKey.data, sizeof remoteKey) == 0);
+        QVERIFY(signingData.counter >= counter);
+    }
+
+    store->markCharacteristicUpdated(3, 0x0001, QVector<quint64>());
+    store->markCharacteristicUpdated(6, 0x0002, QVector<quint64>() << device.toUInt64());
+    store.reset(); // writes the last changes
+    store.reset(new LeBondStore(adapter));
+    const QVector<LeBondStore::ClientConfiguration> configs
+            = store->clientConfigurations(device);
+    QCOMPARE(configs.count(), 2);
+    QCOMPARE(configs.at(0).charUuid, levelUuid);
+    QCOMPARE(configs.at(0).charValueHandle, QLowEnergyHandle(3));
+    QCOMPARE(configs.at(0).configHandle, QLowEnergyHandle(4));
+    QCOMPARE(configs.at(0).configValue, quint16(0x0001));
+    QVERIFY(configs.at(0).charValueWasUpdated);
+    QCOMPARE(configs.at(1).charUuid, measurementUuid);
+    QCOMPARE(configs.at(1).charValueHandle, QLowEnergyHandle(6));
+    QCOMPARE(configs.at(1).configHandle, QLowEnergyHandle(7));
+    QCOMPARE(configs.at(1).configValue, quint16(0x0002));
+    QVERIFY(!configs.at(1).charValueWasUpdated);
+    QVERIFY(store->signingData(device, LeBondStore::LocalSigningKey, &signingData));
+    QVERIFY(signingData.counter >= 199);
+    // After a clean shutdown, the remote counter continues where it stopped.
+    QVERIFY(store->signingData(device, LeBondStore::RemoteSigningKey, &signingData));
+    QCOMPARE(signingData.counter, quint32(199));
+    store->setSignCounter(device, LeBondStore::RemoteSigningKey, 200);
+    QVERIFY(loadAfterCrash(LeBondStore::RemoteSigningKey, &signingData));
+    QVERIFY(signingData.counter >= 200);
+
+    store->removeClientConfigurations(device);
+    store.reset();
+    store.reset(new LeBondStore(adapter));
+    QVERIFY(store->clientConfigurations(device).isEmpty());
+    QVERIFY(store->signingData(device, LeBondStore::RemoteSigningKey, &signingData));
+    store.reset();
+    QFile::remove(filePath);
+    QFile::remove(crashedFilePath);
+#else // QT_BUILD_INTERNAL && CONFIG_BLUEZ_LE
+    QSKIP("Bond store test only applicable for developer builds on Linux with BlueZ");
+#endif // QT_BUILD_INTERNAL && CONFIG_BLUEZ_LE
+}
+
 void TestQLowEnergyControllerGattServer::cmacVerifier()
 {
-#if defined(CONFIG_LINUX_CRYPTO_API) && defined(QT_BUILD_INTERNAL) && defined(CONFIG_BLUEZ_LE)
+#if defined(QT_BUILD_INTERNAL) && defined(CONFIG_BLUEZ_LE)
     // Test data comes from spec v4.2, Vol 3, Part H, Appendix D.1
     const quint128 csrk = {
         { 0x3c, 0x4f, 0xcf, 0x09, 0x88, 0x15, 0xf7, 0xab,
@@ -169,12 +650,34 @@ void TestQLowEnergyControllerGattServer::cmacVerifier()
     };
     QFETCH(QByteArray, message);
     QFETCH(quint64, expectedMac);
-    const bool success = LeCmacCalculator().verify(message, csrk, expectedMac);
-    QVERIFY(success);
-#else // CONFIG_LINUX_CRYPTO_API
+
+    // The built-in implementation is only available with AES-NI.
+    LeCmacCalculator softwareCalculator(LeCmacCalculator::SoftwareBackend);
+    if (softwareCalculator.isValid()) {
+        QVERIFY(softwareCalculator.verify(message, csrk, expectedMac));
+        if (message.count() >= 4) {
+            // same message, with the last four bytes passed as sign counter
+            const int size = message.count() - 4;
+            const quint32 signCounter = qFromLittleEndian<quint32>(
+                        reinterpret_cast<const uchar *>(message.constData() + size));
+            QVERIFY(softwareCalculator.verify(message.constData(), size, signCounter, csrk,
+                                              expectedMac));
+        }
+    } else {
+        QTest::ignoreMessage(QtWarningMsg, "CMAC calculation failed due to missing AES-NI.");
+        QVERIFY(!softwareCalculator.calculateMac(message, csrk));
+    }
+
+#ifdef CONFIG_LINUX_CRYPTO_API
+    LeCmacCalculator kernelCalculator(LeCmacCalculator::KernelBackend);
+    QVERIFY(kernelCalculator.verify(message, csrk, expectedMac));
+    // the second message reuses the state set up for the key
+    QVERIFY(kernelCalculator.verify(message, csrk, expectedMac));
+#endif
+#else // QT_BUILD_INTERNAL && CONFIG_BLUEZ_LE
     QSKIP("CMAC verification test only applicable for developer builds on Linux "
-          "with BlueZ and crypto API");
-#endif // Q_OS_LINUX
+          "with BlueZ");
+#endif // QT_BUILD_INTERNAL && CONFIG_BLUEZ_LE
 }
 
 void TestQLowEnergyControllerGattServer::cmacVerifier_data()
@@ -196,6 +699,72 @@ void TestQLowEnergyControllerGattServer::cmacVerifier_data()
     QTest::newRow("D1.4") << messageD14 << Q_UINT64_C(0x51f0bebf7e3b9d92);
 }
 
+void TestQLowEnergyControllerGattServer::compiledAdvertisingData()
+{
+#if defined(QT_BUILD_INTERNAL) && defined(CONFIG_BLUEZ_LE)
+    QLowEnergyAdvertisingData advData;
+    advData.setDiscoverability(QLowEnergyAdvertisingData::DiscoverabilityGeneral);
+    advData.setIncludePowerLevel(true);
+    advData.setManufacturerData(0x004c, QByteArray::fromHex("0215aabb"));
+    QLowEnergyAdvertisingData responseData;
+    responseData.setLocalName(QStringLiteral("beacon"));
+    const QScopedPointer<QObject> advertiser(qt_createLowEnergyAdvertiser(
+            QLowEnergyAdvertisingParameters(), advData, responseData));
+
+    // TX power level, flags, manufacturer specific data
+    int powerLevelOffset;
+    int manufacturerDataOffset;
+    QCOMPARE(qt_lowEnergyAdvertiserData(advertiser.data(), false, &powerLevelOffset,
+                                        &manufacturerDataOffset).toHex(),
+             QByteArray("020a00" "020106" "07ff4c000215aabb"));
+    QCOMPARE(powerLevelOffset, 2);
+    QCOMPARE(manufacturerDataOffset, 10);
+    const QByteArray compiledResponseData = qt_lowEnergyAdvertiserData(advertiser.data(), true,
+            &powerLevelOffset, &manufacturerDataOffset);
+    QCOMPARE(compiledResponseData.toHex(), QByteArray("0709") + QByteArray("beacon").toHex());
+    QCOMPARE(powerLevelOffset, -1);
+    QCOMPARE(manufacturerDataOffset, -1);
+
+    // Manufacturer data of the same length overwrites the old bytes.
+    advData.setManufacturerData(0x004c, QByteArray::fromHex("0215ccdd"));
+    QVERIFY(qt_updateLowEnergyAdvertiserData(advertiser.data(), advData, responseData));
+    QCOMPARE(qt_lowEnergyAdvertiserData(advertiser.data(), false, &powerLevelOffset,
+                                        &manufacturerDataOffset).toHex(),
+             QByteArray("020a00" "020106" "07ff4c000215ccdd"));
+    QCOMPARE(powerLevelOffset, 2);
+    QCOMPARE(manufacturerDataOffset, 10);
+
+    // Other changes compile the data again.
+    advData.setManufacturerData(0x004c, QByteArray::fromHex("02"));
+    QVERIFY(qt_updateLowEnergyAdvertiserData(advertiser.data(), advData, responseData));
+    QCOMPARE(qt_lowEnergyAdvertiserData(advertiser.data(), false, &powerLevelOffset,
+                                        &manufacturerDataOffset).toHex(),
+             QByteArray("020a00" "020106" "04ff4c0002"));
+    QCOMPARE(manufacturerDataOffset, 10);
+
+    // Data that does not fit is rejected, the old data stays.
+    QLowEnergyAdvertisingData oversizedData = advData;
+    oversizedData.setManufacturerData(0x004c, QByteArray(30, 'x'));
+    QVERIFY(!qt_updateLowEnergyAdvertiserData(advertiser.data(), oversizedData, responseData));
+    QCOMPARE(qt_lowEnergyAdvertiserData(advertiser.data(), false, &powerLevelOffset,
+                                        &manufacturerDataOffset).toHex(),
+             QByteArray("020a00" "020106" "04ff4c0002"));
+    QCOMPARE(powerLevelOffset, 2);
+    QCOMPARE(manufacturerDataOffset, 10);
+    QCOMPARE(qt_lowEnergyAdvertiserData(advertiser.data(), true, &powerLevelOffset,
+                                        &manufacturerDataOffset), compiledResponseData);
+
+    // The old data is also what an update is compared against.
+    advData.setManufacturerData(0x004c, QByteArray::fromHex("03"));
+    QVERIFY(qt_updateLowEnergyAdvertiserData(advertiser.data(), advData, responseData));
+    QCOMPARE(qt_lowEnergyAdvertiserData(advertiser.data(), false, &powerLevelOffset,
+                                        &manufacturerDataOffset).toHex(),
+             QByteArray("020a00" "020106" "04ff4c0003"));
+#else // QT_BUILD_INTERNAL && CONFIG_BLUEZ_LE
+    QSKIP("Advertising data test only applicable for developer builds on Linux with BlueZ");
+#endif // QT_BUILD_INTERNAL && CONFIG_BLUEZ_LE
+}
+
 void TestQLowEnergyControllerGattServer::connectionParameters()
 {
     QLowEnergyConnectionParameters connParams;
@@ -356,7 +925,7 @@ void TestQLowEnergyControllerGattServer::serverCommunication()
         QVERIFY(spy->wait(5000));
     }
     QCOMPARE(customService->includedServices().count(), 0);
-    QCOMPARE(customService->characteristics().count(), 5);
+    QCOMPARE(customService->characteristics().count(), 6);
     QLowEnergyCharacteristic customChar
             = customService->characteristic(QBluetoothUuid(quint16(0x5000)));
     QVERIFY(customChar.isValid());
@@ -397,6 +966,40 @@ void TestQLowEnergyControllerGattServer::serverCommunication()
     QCOMPARE(customChar5.descriptors().count(), 0);
     QCOMPARE(customChar5.value(), QByteArray("initial"));
 
+    QLowEnergyCharacteristic customChar6
+            = customService->characteristic(QBluetoothUuid(quint16(0x5005)));
+    QVERIFY(customChar6.isValid());
+    QCOMPARE(customChar6.properties(), QLowEnergyCharacteristic::Read
+             | QLowEnergyCharacteristic::Write | QLowEnergyCharacteristic::WriteNoResponse
+             | QLowEnergyCharacteristic::ExtendedProperty);
+    QCOMPARE(customChar6.descriptors().count(), 1);
+    QCOMPARE(customChar6.descriptor(QBluetoothUuid::CharacteristicExtendedProperties).value(),
+             QByteArray::fromHex("0100"));
+    QCOMPARE(customChar6.value(), QByteArray("initial"));
+
+#ifdef CONFIG_BLUEZ_LE
+    // Enough write commands to fill the socket buffer, followed by a write request
+    // which must not overtake them.
+    QScopedPointer<QIODevice> writer(customService->createCharacteristicWriter(customChar6));
+    QVERIFY(!writer.isNull());
+    QSignalSpy writerSpy(writer.data(), &QIODevice::bytesWritten);
+    const QByteArray commandData(16 * 1024, 'c');
+    QCOMPARE(writer->write(commandData), qint64(commandData.size()));
+    customService->writeCharacteristic(customChar6, "request");
+    spy.reset(new QSignalSpy(customService.data(), &QLowEnergyService::characteristicWritten));
+    QVERIFY(spy->wait(10000));
+    QCOMPARE(writer->bytesToWrite(), qint64(0));
+    qint64 bytesWritten = 0;
+    for (const QList<QVariant> &arguments : qAsConst(writerSpy))
+        bytesWritten += arguments.first().toLongLong();
+    QCOMPARE(bytesWritten, qint64(commandData.size()));
+    customService->readCharacteristic(customChar6);
+    spy.reset(new QSignalSpy(customService.data(), &QLowEnergyService::characteristicRead));
+    QVERIFY(spy->wait(3000));
+    QCOMPARE(customChar6.value(), QByteArray("request"));
+    writer.reset();
+#endif // CONFIG_BLUEZ_LE
+
     customService->writeCharacteristic(customChar, "whatever");
     spy.reset(new QSignalSpy(customService.data(), static_cast<void (QLowEnergyService::*)
                              (QLowEnergyService::ServiceError)>(&QLowEnergyService::error)));
@@ -438,6 +1041,20 @@ void TestQLowEnergyControllerGattServer::serverCommunication()
     spy.reset(new QSignalSpy(customService.data(), &QLowEnergyService::descriptorWritten));
     QVERIFY(spy->wait(3000));
 
+    QByteArray notifiedValue;
+    const auto notificationCallback = [&notifiedValue](const QLowEnergyCharacteristic &,
+                                                       const char *data, int size) {
+        notifiedValue = QByteArray(data, size);
+    };
+    QVERIFY(!customService->setNotificationCallback(QLowEnergyCharacteristic(),
+                                                    notificationCallback));
+    QVERIFY(customService->setNotificationCallback(customChar4, notificationCallback,
+            QLowEnergyService::UpdateCachedValue
+            | QLowEnergyService::EmitCharacteristicChanged));
+    QCOMPARE(customService->notificationPolicy(customChar3), QLowEnergyService::DeliverAllValues);
+    customService->setNotificationPolicy(customChar3, QLowEnergyService::DeliverLatestValue);
+    QCOMPARE(customService->notificationPolicy(customChar3), QLowEnergyService::DeliverLatestValue);
+
     // Server now changes the characteristic values.
 
     spy.reset(new QSignalSpy(customService.data(), &QLowEnergyService::characteristicChanged));
@@ -446,6 +1063,46 @@ void TestQLowEnergyControllerGattServer::serverCommunication()
         QVERIFY(spy->wait(3000));
     QCOMPARE(customChar3.value().constData(), "indicated");
     QCOMPARE(customChar4.value().constData(), "notified");
+    QCOMPARE(notifiedValue.constData(), "notified");
+    customService->clearNotificationCallback(customChar4);
+    customService->setNotificationPolicy(customChar3, QLowEnergyService::DeliverAllValues);
+    QCOMPARE(customService->notificationPolicy(customChar3), QLowEnergyService::DeliverAllValues);
+
+    // A characteristic without the Reliable Write extended property is rejected.
+    QVERIFY(genericAccessService->beginReliableWrite());
+    spy.reset(new QSignalSpy(genericAccessService.data(), static_cast<void (QLowEnergyService::*)
+                             (QLowEnergyService::ServiceError)>(&QLowEnergyService::error)));
+    genericAccessService->writeCharacteristic(deviceNameChar, "reliable");
+    QCOMPARE(spy->count(), 1);
+    QCOMPARE(genericAccessService->error(), QLowEnergyService::CharacteristicWriteError);
+    genericAccessService->abortReliableWrite();
+
+    // Both client configurations are switched off, together with a characteristic
+    // value, by a single execute write request.
+    const QByteArray disabledValue(2, 0);
+    QVERIFY(customService->beginReliableWrite());
+    customService->writeDescriptor(cc3ClientConfig, disabledValue);
+    customService->writeDescriptor(cc4ClientConfig, disabledValue);
+    customService->writeCharacteristic(customChar6, "reliable");
+    spy.reset(new QSignalSpy(customService.data(), &QLowEnergyService::descriptorWritten));
+    QSignalSpy reliableCharSpy(customService.data(), &QLowEnergyService::characteristicWritten);
+    customService->executeReliableWrite();
+    QVERIFY(spy->wait(3000));
+    if (spy->count() == 1)
+        QVERIFY(spy->wait(3000));
+    QCOMPARE(spy->count(), 2);
+    QTRY_COMPARE(reliableCharSpy.count(), 1);
+    QCOMPARE(cc3ClientConfig.value(), disabledValue);
+    QCOMPARE(cc4ClientConfig.value(), disabledValue);
+    QCOMPARE(customChar6.value(), QByteArray("reliable"));
+
+    // restore the configurations, they are checked after reconnecting
+    customService->writeDescriptor(cc3ClientConfig, indicateValue);
+    spy.reset(new QSignalSpy(customService.data(), &QLowEnergyService::descriptorWritten));
+    QVERIFY(spy->wait(3000));
+    customService->writeDescriptor(cc4ClientConfig, notifyValue);
+    spy.reset(new QSignalSpy(customService.data(), &QLowEnergyService::descriptorWritten));
+    QVERIFY(spy->wait(3000));
 
     // signal requires root privileges on Linux
     spy.reset(new QSignalSpy(m_leController.data(), &QLowEnergyController::connectionUpdated));
@@ -516,6 +1173,547 @@ void TestQLowEnergyControllerGattServer::controllerType()
     const QScopedPointer<QLowEnergyController> controller(QLowEnergyController::createPeripheral());
     QVERIFY(!controller.isNull());
     QCOMPARE(controller->role(), QLowEnergyController::PeripheralRole);
+
+    // nothing to update before advertising has been started
+    QVERIFY(!controller->updateAdvertisingData(QLowEnergyAdvertisingData()));
+}
+
+void TestQLowEnergyControllerGattServer::notificationPolicies()
+{
+#ifdef QT_BUILD_INTERNAL
+    typedef QVector<QLowEnergyService::TimestampedValue> TimestampedValues;
+    qRegisterMetaType<TimestampedValues>();
+
+    QLowEnergyServicePrivate service;
+    const QLowEnergyCharacteristic characteristic;
+    QSignalSpy batchSpy(&service, &QLowEnergyServicePrivate::characteristicValuesChanged);
+    QSignalSpy changedSpy(&service, &QLowEnergyServicePrivate::characteristicChanged);
+    service.setNotificationPolicy(characteristic.attributeHandle(),
+                                  QLowEnergyService::DeliverValueBatches, 100);
+
+    // the first value is not held back
+    QVERIFY(!service.deliverNotification(characteristic, "\x01", 1));
+    QCOMPARE(batchSpy.count(), 1);
+    TimestampedValues values = batchSpy.takeFirst().at(1).value<TimestampedValues>();
+    QCOMPARE(values.count(), 1);
+    QCOMPARE(values.at(0).second, QByteArray("\x01"));
+
+    QVERIFY(!service.deliverNotification(characteristic, "\x02", 1));
+    QVERIFY(!service.deliverNotification(characteristic, "\x03", 1));
+    QCOMPARE(batchSpy.count(), 0);
+    QTRY_COMPARE(batchSpy.count(), 1);
+    values = batchSpy.takeFirst().at(1).value<TimestampedValues>();
+    QCOMPARE(values.count(), 2);
+    QCOMPARE(values.at(0).second, QByteArray("\x02"));
+    QCOMPARE(values.at(1).second, QByteArray("\x03"));
+    QVERIFY(values.at(0).first <= values.at(1).first);
+
+    // after an interval without values, the next one is delivered right away again
+    QTest::qWait(300);
+    QCOMPARE(batchSpy.count(), 0);
+    QVERIFY(!service.deliverNotification(characteristic, "\x04", 1));
+    QCOMPARE(batchSpy.count(), 1);
+    batchSpy.clear();
+
+    service.setNotificationPolicy(characteristic.attributeHandle(),
+                                  QLowEnergyService::DeliverLatestValue, 100);
+    QVERIFY(service.deliverNotification(characteristic, "\x05", 1));
+    QVERIFY(!service.deliverNotification(characteristic, "\x06", 1));
+    QVERIFY(!service.deliverNotification(characteristic, "\x07", 1));
+    QTRY_COMPARE(changedSpy.count(), 1);
+    QCOMPARE(changedSpy.takeFirst().at(1).toByteArray(), QByteArray("\x07"));
+    QCOMPARE(batchSpy.count(), 0);
+
+    service.setNotificationPolicy(characteristic.attributeHandle(),
+                                  QLowEnergyService::DeliverAllValues, 0);
+    QVERIFY(service.deliverNotification(characteristic, "\x08", 1));
+#else
+    QSKIP("Notification policy test only applicable for developer builds");
+#endif // QT_BUILD_INTERNAL
+}
+
+void TestQLowEnergyControllerGattServer::packetCapture()
+{
+#if defined(QT_BUILD_INTERNAL) && defined(CONFIG_BLUEZ_LE)
+    QTemporaryDir dir;
+    QVERIFY(dir.isValid());
+    const QString fileName = dir.path() + QLatin1String("/att.btsnoop");
+    const QByteArray request = QByteArray::fromHex("0a0300");
+    const QByteArray response = QByteArray::fromHex("0b64");
+    // enough records to hand some of them to the worker thread before the destruction
+    const QByteArray bulk(200, 'x');
+    const int bulkCount = 100;
+
+    // microseconds since 0 AD
+    const qint64 epochDelta = Q_INT64_C(0x00dcddb30f2f8000);
+    const qint64 startTime = QDateTime::currentMSecsSinceEpoch() * 1000 + epochDelta;
+    {
+        BtSnoopWriter writer;
+        QVERIFY(!writer.open(dir.path() + QLatin1String("/missing/att.btsnoop")));
+        QVERIFY(!writer.errorString().isEmpty());
+    }
+    {
+        BtSnoopWriter writer;
+        QVERIFY2(writer.open(fileName), qPrintable(writer.errorString()));
+        writer.writeL2capPacket(BtSnoopWriter::Sent, 0x0040, 0x0004,
+                                request.constData(), request.size());
+        writer.writeL2capPacket(BtSnoopWriter::Received, 0x0040, 0x0004,
+                                response.constData(), response.size());
+        for (int i = 0; i < bulkCount; ++i) {
+            writer.writeL2capPacket(BtSnoopWriter::Received, 0x0fff, 0x0004,
+                                    bulk.constData(), bulk.size());
+        }
+    }
+    const qint64 endTime = QDateTime::currentMSecsSinceEpoch() * 1000 + epochDelta;
+
+    QFile file(fileName);
+    QVERIFY(file.open(QIODevice::ReadOnly));
+    const QByteArray contents = file.readAll();
+    const int recordHeaderSize = 24;
+    const int packetHeaderSize = 9;
+    QCOMPARE(contents.size(), 16 + (bulkCount + 2) * (recordHeaderSize + packetHeaderSize)
+             + request.size() + response.size() + bulkCount * bulk.size());
+
+    // file header: magic, version 1, H4 datalink
+    QCOMPARE(contents.left(16),
+             QByteArray("btsnoop\0", 8) + QByteArray::fromHex("00000001" "000003ea"));
+
+    const auto checkRecord = [&](int offset, quint32 flags, quint16 handle,
+                                 const QByteArray &payload) {
+        const uchar *record = reinterpret_cast<const uchar *>(contents.constData() + offset);
+        const quint32 length = quint32(packetHeaderSize + payload.size());
+        QCOMPARE(qFromBigEndian<quint32>(record), length);      // original length
+        QCOMPARE(qFromBigEndian<quint32>(record + 4), length);  // included length
+        QCOMPARE(qFromBigEndian<quint32>(record + 8), flags);
+        QCOMPARE(qFromBigEndian<quint32>(record + 12), quint32(0)); // drops
+        const qint64 timestamp = qFromBigEndian<qint64>(record + 16);
+        QVERIFY(timestamp >= startTime - 1000);
+        QVERIFY(timestamp <= endTime + 1000);
+
+        // H4 ACL packet with a complete L2CAP PDU
+        const uchar *packet = record + recordHeaderSize;
+        QCOMPARE(packet[0], uchar(0x02));
+        QCOMPARE(qFromLittleEndian<quint16>(packet + 1), quint16(handle | 0x2000));
+        QCOMPARE(qFromLittleEndian<quint16>(packet + 3), quint16(payload.size() + 4));
+        QCOMPARE(qFromLittleEndian<quint16>(packet + 5), quint16(payload.size()));
+        QCOMPARE(qFromLittleEndian<quint16>(packet + 7), quint16(0x0004));
+        QCOMPARE(contents.mid(offset + recordHeaderSize + packetHeaderSize, payload.size()),
+                 payload);
+    };
+
+    int offset = 16;
+    checkRecord(offset, 0, 0x0040, request);
+    if (QTest::currentTestFailed())
+        return;
+    offset += recordHeaderSize + packetHeaderSize + request.size();
+    checkRecord(offset, 1, 0x0040, response);
+    if (QTest::currentTestFailed())
+        return;
+    offset += recordHeaderSize + packetHeaderSize + response.size();
+    for (int i = 0; i < bulkCount; ++i) {
+        checkRecord(offset, 1, 0x0fff, bulk);
+        if (QTest::currentTestFailed())
+            return;
+        offset += recordHeaderSize + packetHeaderSize + bulk.size();
+    }
+#else // QT_BUILD_INTERNAL && CONFIG_BLUEZ_LE
+    QSKIP("Packet capture test only applicable for developer builds on Linux with BlueZ");
+#endif // QT_BUILD_INTERNAL && CONFIG_BLUEZ_LE
+}
+
+void TestQLowEnergyControllerGattServer::rawScanner()
+{
+#if defined(QT_BUILD_INTERNAL) && defined(CONFIG_BLUEZ_LE)
+    // LE Meta event with two LE Advertising Reports: ADV_IND from a random address with
+    // the flags, then SCAN_RSP from a public address with manufacturer data.
+    const QByteArray twoReports = QByteArray::fromHex("043e1f" "0202"
+            "00" "01" "01eeddccbbaa" "03" "020106" "c4"
+            "04" "00" "665544332211" "06" "05ff4c000215" "b0");
+    // the first device again, with the same and with changed data
+    const QByteArray sameData = QByteArray::fromHex("043e0f" "0201"
+            "00" "01" "01eeddccbbaa" "03" "020106" "c6");
+    const QByteArray changedData = QByteArray::fromHex("043e0f" "0201"
+            "00" "01" "01eeddccbbaa" "03" "020105" "c8");
+
+    QScopedPointer<QObject> scanner(qt_createLowEnergyRawScanner(-1));
+    QSignalSpy errorSpy(scanner.data(), SIGNAL(errorOccurred()));
+    QElapsedTimer clock;
+    clock.start();
+    const qint64 dispatchStart = clock.msecsSinceReference();
+    QVariantList reports = qt_dispatchLowEnergyRawScannerPackets(scanner.data(),
+            QVector<QByteArray>() << twoReports << sameData);
+    const qint64 dispatchEnd = clock.msecsSinceReference();
+    QCOMPARE(reports.count(), 2);
+    QVariantMap report = reports.at(0).toMap();
+    QCOMPARE(report.value("address").toString(), QString("AA:BB:CC:DD:EE:01"));
+    QCOMPARE(report.value("addressType").toInt(), 1);
+    QCOMPARE(report.value("eventType").toInt(), 0);
+    QCOMPARE(report.value("rssi").toInt(), -60);
+    QCOMPARE(report.value("data").toByteArray(), QByteArray::fromHex("020106"));
+    const qint64 timestamp = report.value("timestamp").toLongLong();
+    QVERIFY(timestamp >= dispatchStart && timestamp <= dispatchEnd);
+    report = reports.at(1).toMap();
+    QCOMPARE(report.value("address").toString(), QString("11:22:33:44:55:66"));
+    QCOMPARE(report.value("addressType").toInt(), 0);
+    QCOMPARE(report.value("eventType").toInt(), 4);
+    QCOMPARE(report.value("rssi").toInt(), -80);
+    QCOMPARE(report.value("data").toByteArray(), QByteArray::fromHex("05ff4c000215"));
+    QCOMPARE(report.value("timestamp").toLongLong(), timestamp);
+
+    // Each payload of a device is reported once.
+    reports = qt_dispatchLowEnergyRawScannerPackets(scanner.data(),
+            QVector<QByteArray>() << sameData << changedData);
+    QCOMPARE(reports.count(), 1);
+    QCOMPARE(reports.first().toMap().value("data").toByteArray(), QByteArray::fromHex("020105"));
+    QCOMPARE(reports.first().toMap().value("rssi").toInt(), -56);
+
+    // A truncated event keeps the reports in front of the truncated one.
+    QByteArray truncated = twoReports;
+    truncated.chop(1);
+    truncated[2] = char(truncated.size() - 3);
+    scanner.reset(qt_createLowEnergyRawScanner(0));
+    QTest::ignoreMessage(QtWarningMsg, "Unexpected LE advertising report size");
+    reports = qt_dispatchLowEnergyRawScannerPackets(scanner.data(),
+            QVector<QByteArray>() << truncated << sameData);
+    QCOMPARE(reports.count(), 2);
+    QCOMPARE(reports.at(0).toMap().value("address").toString(), QString("AA:BB:CC:DD:EE:01"));
+    QCOMPARE(reports.at(1).toMap().value("rssi").toInt(), -58);
+
+    // "Command Disallowed" for disabling a scan that does not run is harmless, for
+    // enabling the scan it is not.
+    errorSpy.clear();
+    const QByteArray disallowedScanEnable = QByteArray::fromHex("040e04" "01" "0c20" "0c");
+    const QByteArray scanParametersSet = QByteArray::fromHex("040e04" "01" "0b20" "00");
+    reports = qt_dispatchLowEnergyRawScannerPackets(scanner.data(), QVector<QByteArray>()
+            << disallowedScanEnable << scanParametersSet << sameData);
+    QCOMPARE(reports.count(), 1);
+    QCOMPARE(errorSpy.count(), 0);
+    reports = qt_dispatchLowEnergyRawScannerPackets(scanner.data(), QVector<QByteArray>()
+            << disallowedScanEnable << sameData);
+    QCOMPARE(errorSpy.count(), 1);
+    QVERIFY(reports.isEmpty());
+#else // QT_BUILD_INTERNAL && CONFIG_BLUEZ_LE
+    QSKIP("Raw scanner test only applicable for developer builds on Linux with BlueZ");
+#endif // QT_BUILD_INTERNAL && CONFIG_BLUEZ_LE
+}
+
+void TestQLowEnergyControllerGattServer::readMultiple_data()
+{
+    QTest::addColumn<QByteArray>("reply");
+    QTest::addColumn<QVector<QByteArray> >("followingRequests");
+
+    const QByteArray readLevel = QByteArray::fromHex("0a0300");
+    const QByteArray readPowerState = QByteArray::fromHex("0a0500");
+    QTest::newRow("all values") << QByteArray::fromHex("21" "0100" "64" "0100" "2f")
+                                << QVector<QByteArray>();
+    QTest::newRow("incomplete last value") << QByteArray::fromHex("21" "0100" "64" "0100")
+                                           << (QVector<QByteArray>() << readPowerState);
+    QTest::newRow("missing last value") << QByteArray::fromHex("21" "0100" "64")
+                                        << (QVector<QByteArray>() << readPowerState);
+    QTest::newRow("not supported") << QByteArray::fromHex("01" "20" "0300" "06")
+                                   << (QVector<QByteArray>() << readLevel << readPowerState);
+    QTest::newRow("truncated error") << QByteArray::fromHex("01" "20" "0300")
+                                     << (QVector<QByteArray>() << readLevel << readPowerState);
+}
+
+void TestQLowEnergyControllerGattServer::readMultiple()
+{
+#if defined(QT_BUILD_INTERNAL) && defined(CONFIG_BLUEZ_LE)
+    QFETCH(QByteArray, reply);
+    QFETCH(QVector<QByteArray>, followingRequests);
+
+    int fds[2];
+    QCOMPARE(::socketpair(AF_UNIX, SOCK_SEQPACKET | SOCK_NONBLOCK | SOCK_CLOEXEC, 0, fds), 0);
+    FakeAttServer peer(fds[1]);
+    peer.readMultipleReplies << reply;
+
+    QLowEnergyController controller(QBluetoothAddress("11:22:33:44:55:66"));
+    qt_connectLowEnergyControllerToAttSocket(&controller, fds[0]);
+    controller.discoverServices();
+    QTRY_COMPARE(controller.state(), QLowEnergyController::DiscoveredState);
+    QScopedPointer<QLowEnergyService> service(
+                controller.createServiceObject(QBluetoothUuid(QBluetoothUuid::BatteryService)));
+    QVERIFY(service);
+    service->discoverDetails();
+    QTRY_COMPARE(service->state(), QLowEnergyService::ServiceDiscovered);
+
+    // The values of both characteristics are requested at once. Whatever the
+    // response lacks is read individually.
+    const QByteArray readBoth = QByteArray::fromHex("20" "0300" "0500");
+    const int batchIndex = peer.requests.indexOf(readBoth);
+    QVERIFY(batchIndex >= 0);
+    QVector<QByteArray> reads;
+    for (int i = batchIndex + 1; i < peer.requests.count(); ++i) {
+        if (peer.requests.at(i).at(0) == 0x0a)
+            reads.append(peer.requests.at(i));
+    }
+    QCOMPARE(reads, followingRequests);
+    QCOMPARE(peer.requests.count(readBoth), 1);
+    QCOMPARE(service->characteristic(QBluetoothUuid(QBluetoothUuid::BatteryLevel)).value(),
+             peer.level);
+    QCOMPARE(service->characteristic(QBluetoothUuid(quint16(0x2a1a))).value(), peer.powerState);
+    QCOMPARE(service->error(), QLowEnergyService::NoError);
+#else // QT_BUILD_INTERNAL && CONFIG_BLUEZ_LE
+    QSKIP("Read multiple test only applicable for developer builds on Linux with BlueZ");
+#endif // QT_BUILD_INTERNAL && CONFIG_BLUEZ_LE
+}
+
+void TestQLowEnergyControllerGattServer::requestQueue()
+{
+#if defined(QT_BUILD_INTERNAL) && defined(CONFIG_BLUEZ_LE)
+    int fds[2];
+    QCOMPARE(::socketpair(AF_UNIX, SOCK_SEQPACKET | SOCK_NONBLOCK | SOCK_CLOEXEC, 0, fds), 0);
+    FakeAttServer peer(fds[1]);
+
+    QLowEnergyController controller(QBluetoothAddress("11:22:33:44:55:66"));
+    controller.setReadRetryCount(1);
+    controller.setRequestTimeout(300);
+    qt_connectLowEnergyControllerToAttSocket(&controller, fds[0]);
+    QCOMPARE(controller.state(), QLowEnergyController::ConnectedState);
+
+    controller.discoverServices();
+    QTRY_COMPARE(controller.state(), QLowEnergyController::DiscoveredState);
+    QCOMPARE(controller.services(), QList<QBluetoothUuid>()
+             << QBluetoothUuid(QBluetoothUuid::BatteryService));
+    QScopedPointer<QLowEnergyService> service(
+                controller.createServiceObject(QBluetoothUuid(QBluetoothUuid::BatteryService)));
+    QVERIFY(service);
+
+    // The discovery waits for the retry of a value read failing with Unlikely Error,
+    // even if the value is not the last one of the service.
+    QByteArray levelOnDiscovery;
+    connect(service.data(), &QLowEnergyService::stateChanged,
+            [&service, &levelOnDiscovery](QLowEnergyService::ServiceState state) {
+        if (state == QLowEnergyService::ServiceDiscovered) {
+            levelOnDiscovery = service->characteristic(
+                        QBluetoothUuid(QBluetoothUuid::BatteryLevel)).value();
+        }
+    });
+    peer.readErrors << 0x0e;
+    service->discoverDetails();
+    QTRY_COMPARE(service->state(), QLowEnergyService::ServiceDiscovered);
+    QCOMPARE(levelOnDiscovery, peer.level);
+    QCOMPARE(service->characteristic(QBluetoothUuid(quint16(0x2a1a))).value(), peer.powerState);
+    QCOMPARE(controller.statistics().retriedRequestCount(), 1);
+    const QLowEnergyCharacteristic levelChar
+            = service->characteristic(QBluetoothUuid(QBluetoothUuid::BatteryLevel));
+    QVERIFY(levelChar.isValid());
+    QCOMPARE(levelChar.value(), peer.level);
+
+    // A read failing with Unlikely Error is repeated once, after a backoff.
+    QSignalSpy readSpy(service.data(), &QLowEnergyService::characteristicRead);
+    peer.readErrors << 0x0e;
+    peer.level = QByteArray(1, char(42));
+    int readRequests = peer.requests.count();
+    QElapsedTimer retryClock;
+    retryClock.start();
+    service->readCharacteristic(levelChar);
+    QTRY_COMPARE(readSpy.count(), 1);
+    QVERIFY(retryClock.elapsed() >= 100);
+    QCOMPARE(readSpy.first().at(1).toByteArray(), peer.level);
+    QCOMPARE(peer.requests.count() - readRequests, 2);
+    QCOMPARE(service->error(), QLowEnergyService::NoError);
+    QCOMPARE(controller.statistics().retriedRequestCount(), 2);
+
+    // A write which has not been sent yet is superseded by later writes to the
+    // same attribute and keeps its position. Reads are never merged.
+    QSignalSpy writtenSpy(service.data(), &QLowEnergyService::characteristicWritten);
+    readSpy.clear();
+    peer.answering = false;
+    readRequests = peer.requests.count();
+    service->readCharacteristic(levelChar);
+    QTRY_COMPARE(peer.requests.count() - readRequests, 1);
+    service->writeCharacteristic(levelChar, QByteArray(1, char(1)));
+    service->readCharacteristic(levelChar);
+    service->writeCharacteristic(levelChar, QByteArray(1, char(2)));
+    service->writeCharacteristic(levelChar, QByteArray(1, char(3)));
+    service->readCharacteristic(levelChar);
+    peer.answering = true;
+    peer.answerLast();
+    QTRY_COMPARE(readSpy.count(), 3);
+    QCOMPARE(peer.requests.mid(readRequests), QVector<QByteArray>()
+             << QByteArray::fromHex("0a0300") << QByteArray::fromHex("12030003")
+             << QByteArray::fromHex("0a0300") << QByteArray::fromHex("0a0300"));
+    QCOMPARE(writtenSpy.count(), 1);
+    QCOMPARE(writtenSpy.first().at(1).toByteArray(), QByteArray(1, char(3)));
+    QCOMPARE(readSpy.at(0).at(1).toByteArray(), QByteArray(1, char(42)));
+    QCOMPARE(readSpy.at(1).at(1).toByteArray(), QByteArray(1, char(3)));
+    QCOMPARE(readSpy.at(2).at(1).toByteArray(), QByteArray(1, char(3)));
+    QCOMPARE(service->error(), QLowEnergyService::NoError);
+
+    // Without any service object, the queued requests behind the one in flight
+    // are cancelled. Nobody is left to report their failure to.
+    QSignalSpy errorSpy(&controller, static_cast<void (QLowEnergyController::*)(
+                            QLowEnergyController::Error)>(&QLowEnergyController::error));
+    peer.answering = false;
+    readRequests = peer.requests.count();
+    service->readCharacteristic(levelChar);
+    service->writeCharacteristic(levelChar, QByteArray(1, char(7)));
+    service->readCharacteristic(levelChar);
+    QTRY_COMPARE(peer.requests.count() - readRequests, 1);
+    service.reset();
+    QCOMPARE(controller.statistics().cancelledRequestCount(), 2);
+    service.reset(controller.createServiceObject(QBluetoothUuid(QBluetoothUuid::BatteryService)));
+    QVERIFY(service);
+    QCOMPARE(service->error(), QLowEnergyService::NoError);
+
+    // The read in flight never gets a response.
+    QTRY_COMPARE(controller.state(), QLowEnergyController::UnconnectedState);
+    QCOMPARE(controller.error(), QLowEnergyController::NetworkError);
+    QCOMPARE(errorSpy.count(), 1);
+    QCOMPARE(controller.statistics().timedOutRequestCount(), 1);
+    QCOMPARE(peer.requests.count() - readRequests, 1);
+#else // QT_BUILD_INTERNAL && CONFIG_BLUEZ_LE
+    QSKIP("Request queue test only applicable for developer builds on Linux with BlueZ");
+#endif // QT_BUILD_INTERNAL && CONFIG_BLUEZ_LE
+}
+
+void TestQLowEnergyControllerGattServer::serverClients()
+{
+#if defined(QT_BUILD_INTERNAL) && defined(CONFIG_BLUEZ_LE)
+    QLowEnergyServiceData serviceData;
+    serviceData.setType(QLowEnergyServiceData::ServiceTypePrimary);
+    serviceData.setUuid(QBluetoothUuid(quint16(0x2000)));
+    QLowEnergyCharacteristicData charData;
+    charData.setUuid(QBluetoothUuid(quint16(0x5000)));
+    charData.setProperties(QLowEnergyCharacteristic::Read | QLowEnergyCharacteristic::Write
+                           | QLowEnergyCharacteristic::Notify);
+    charData.setValue(QByteArray(60, 'a'));
+    charData.addDescriptor(QLowEnergyDescriptorData(
+                               QBluetoothUuid::ClientCharacteristicConfiguration,
+                               QByteArray(2, 0)));
+    serviceData.addCharacteristic(charData);
+
+    // Handles: 1 service, 2 characteristic declaration, 3 value, 4 client configuration
+    const QScopedPointer<QLowEnergyController> controller(QLowEnergyController::createPeripheral());
+    const QScopedPointer<QLowEnergyService> service(controller->addService(serviceData));
+    QVERIFY(service);
+
+    int fdsA[2];
+    int fdsB[2];
+    QCOMPARE(::socketpair(AF_UNIX, SOCK_SEQPACKET | SOCK_NONBLOCK | SOCK_CLOEXEC, 0, fdsA), 0);
+    QCOMPARE(::socketpair(AF_UNIX, SOCK_SEQPACKET | SOCK_NONBLOCK | SOCK_CLOEXEC, 0, fdsB), 0);
+    const int clientA = fdsA[1];
+    const int clientB = fdsB[1];
+    QSignalSpy connectedSpy(controller.data(), &QLowEnergyController::clientConnected);
+    QSignalSpy disconnectedSpy(controller.data(), &QLowEnergyController::clientDisconnected);
+    const QBluetoothAddress addressA("11:22:33:44:55:66");
+    const QBluetoothAddress addressB("11:22:33:44:55:77");
+    qt_addLowEnergyControllerClient(controller.data(), fdsA[0], addressA);
+    qt_addLowEnergyControllerClient(controller.data(), fdsB[0], addressB);
+    QCOMPARE(connectedSpy.count(), 2);
+    QCOMPARE(controller->state(), QLowEnergyController::ConnectedState);
+
+    // Only client A raises its MTU and enables notifications.
+    QCOMPARE(attTransaction(clientA, QByteArray::fromHex("024100")).left(1).toHex(),
+             QByteArray("03"));
+    QCOMPARE(attTransaction(clientA, QByteArray::fromHex("1204000100")).toHex(),
+             QByteArray("13"));
+    QCOMPARE(attTransaction(clientA, QByteArray::fromHex("0a0400")).toHex(),
+             QByteArray("0b0100"));
+    QCOMPARE(attTransaction(clientB, QByteArray::fromHex("0a0400")).toHex(),
+             QByteArray("0b0000"));
+    QCOMPARE(attTransaction(clientA, QByteArray::fromHex("0a0300")),
+             char(0x0b) + QByteArray(60, 'a'));
+    QCOMPARE(attTransaction(clientB, QByteArray::fromHex("0a0300")),
+             char(0x0b) + QByteArray(22, 'a'));
+
+    const QLowEnergyCharacteristic characteristic
+            = service->characteristic(QBluetoothUuid(quint16(0x5000)));
+    QVERIFY(characteristic.isValid());
+    service->writeCharacteristic(characteristic, QByteArray(60, 'b'));
+    QCOMPARE(receivePdu(clientA), QByteArray::fromHex("1b0300") + QByteArray(60, 'b'));
+    QVERIFY(receivePdu(clientB, 100).isEmpty());
+
+    // The other client's link and settings survive the disconnection of client B.
+    ::close(clientB);
+    QTRY_COMPARE(disconnectedSpy.count(), 1);
+    QCOMPARE(disconnectedSpy.first().first().value<QBluetoothAddress>(), addressB);
+    QCOMPARE(controller->state(), QLowEnergyController::ConnectedState);
+    QCOMPARE(attTransaction(clientA, QByteArray::fromHex("0a0400")).toHex(),
+             QByteArray("0b0100"));
+    service->writeCharacteristic(characteristic, QByteArray(60, 'c'));
+    QCOMPARE(receivePdu(clientA), QByteArray::fromHex("1b0300") + QByteArray(60, 'c'));
+    ::close(clientA);
+#else // QT_BUILD_INTERNAL && CONFIG_BLUEZ_LE
+    QSKIP("Multiple client test only applicable for developer builds on Linux with BlueZ");
+#endif // QT_BUILD_INTERNAL && CONFIG_BLUEZ_LE
+}
+
+void TestQLowEnergyControllerGattServer::statistics()
+{
+#if defined(QT_BUILD_INTERNAL) && defined(CONFIG_BLUEZ_LE)
+    int fds[2];
+    QCOMPARE(::socketpair(AF_UNIX, SOCK_SEQPACKET | SOCK_NONBLOCK | SOCK_CLOEXEC, 0, fds), 0);
+    FakeAttServer peer(fds[1]);
+
+    QLowEnergyController controller(QBluetoothAddress("11:22:33:44:55:66"));
+    const QDateTime before = QDateTime::currentDateTime();
+    controller.resetStatistics();
+    const QLowEnergyControllerStatistics initial = controller.statistics();
+    QVERIFY(initial.startTime() >= before.addMSecs(-1));
+    QVERIFY(initial.startTime() <= QDateTime::currentDateTime());
+    QCOMPARE(initial.requestCount(), 0);
+    QCOMPARE(initial.bytesSent(), 0);
+    QCOMPARE(initial.bytesReceived(), 0);
+    QCOMPARE(initial.notificationCount(), 0);
+
+    qt_connectLowEnergyControllerToAttSocket(&controller, fds[0]);
+    controller.discoverServices();
+    QTRY_COMPARE(controller.state(), QLowEnergyController::DiscoveredState);
+    QScopedPointer<QLowEnergyService> service(
+                controller.createServiceObject(QBluetoothUuid(QBluetoothUuid::BatteryService)));
+    QVERIFY(service);
+    service->discoverDetails();
+    QTRY_COMPARE(service->state(), QLowEnergyService::ServiceDiscovered);
+    const QLowEnergyCharacteristic levelChar
+            = service->characteristic(QBluetoothUuid(QBluetoothUuid::BatteryLevel));
+    QVERIFY(levelChar.isValid());
+
+    const QLowEnergyControllerStatistics discovered = controller.statistics();
+    const int readCount = discovered.requestCount(0x0a);
+    QCOMPARE(discovered.requestCount(0x02), 1); // MTU exchange
+    QVERIFY(readCount >= 1);
+    QCOMPARE(discovered.requestCount(0x12), 0);
+
+    QSignalSpy writeSpy(service.data(), &QLowEnergyService::characteristicWritten);
+    service->readCharacteristic(levelChar);
+    service->writeCharacteristic(levelChar, QByteArray(1, char(50)));
+    QTRY_COMPARE(writeSpy.count(), 1);
+    QSignalSpy changedSpy(service.data(), &QLowEnergyService::characteristicChanged);
+    peer.notify(3, QByteArray(1, char(49)));
+    QTRY_COMPARE(changedSpy.count(), 1);
+
+    QTest::qWait(20);
+    const QLowEnergyControllerStatistics current = controller.statistics();
+    QCOMPARE(current.startTime(), initial.startTime());
+    QVERIFY(current.duration() >= 20);
+    QVERIFY(current.duration() > discovered.duration());
+    QCOMPARE(current.requestCount(), discovered.requestCount() + 2);
+    QCOMPARE(current.requestCount(0x0a), readCount + 1);
+    QCOMPARE(current.requestCount(0x12), 1);
+    QVERIFY(current.maximumQueueDepth() >= 2);
+    const QVector<int> histogram = current.latencyHistogram();
+    QCOMPARE(std::accumulate(histogram.cbegin(), histogram.cend(), 0), current.requestCount());
+    QCOMPARE(current.mtu(), 23);
+    QCOMPARE(current.notificationCount(), 1);
+
+    // every PDU sent to the peer is counted
+    qint64 sent = 0;
+    for (const QByteArray &request : qAsConst(peer.requests))
+        sent += request.size();
+    QCOMPARE(current.bytesSent(), sent);
+    QVERIFY(current.bytesReceived() > discovered.bytesReceived());
+
+    controller.resetStatistics();
+    const QLowEnergyControllerStatistics reset = controller.statistics();
+    QVERIFY(reset.startTime() >= current.startTime());
+    QCOMPARE(reset.requestCount(), 0);
+    QCOMPARE(reset.notificationCount(), 0);
+    QVERIFY(reset.duration() < current.duration());
+#else // QT_BUILD_INTERNAL && CONFIG_BLUEZ_LE
+    QSKIP("Statistics test only applicable for developer builds on Linux with BlueZ");
+#endif // QT_BUILD_INTERNAL && CONFIG_BLUEZ_LE
 }
 
 void TestQLowEnergyControllerGattServer::serviceData()
@@ -76,6 +76,7 @@ private slots:
     void tst_emptyCtor();
     void tst_connect();
     void tst_concurrentDiscovery();
+    void tst_discoverAllServiceDetails();
     void tst_defaultBehavior();
     void tst_writeCharacteristic();
     void tst_writeCharacteristicNoResponse();
@@ -207,6 +208,32 @@ void tst_QLowEnergyController::tst_emptyCtor()
         QSignalSpy stateSpy(&control, SIGNAL(stateChanged(QLowEnergyController::ControllerState)));
         QSignalSpy errorSpy(&control, SIGNAL(error(QLowEnergyController::Error)));
         QCOMPARE(control.error(), QLowEnergyController::NoError);
+        QCOMPARE(control.mtu(), -1);
+        QCOMPARE(control.preferredMtu(), 0);
+        control.setPreferredMtu(100);
+        QCOMPARE(control.preferredMtu(), 100);
+        QVERIFY(!control.isIoThreadEnabled());
+        control.setIoThreadEnabled(true);
+        QVERIFY(control.isIoThreadEnabled());
+        QCOMPARE(control.requestTimeout(), 30000);
+        control.setRequestTimeout(5000);
+        QCOMPARE(control.requestTimeout(), 5000);
+        QCOMPARE(control.readRetryCount(), 0);
+        control.setReadRetryCount(2);
+        QCOMPARE(control.readRetryCount(), 2);
+        QCOMPARE(control.statistics().requestCount(), 0);
+        QCOMPARE(control.statistics().bytesSent(), 0);
+        QCOMPARE(control.statisticsInterval(), 0);
+        control.setStatisticsInterval(1000);
+        QCOMPARE(control.statisticsInterval(), 1000);
+        control.setStatisticsInterval(0);
+        QCOMPARE(control.maximumClientCount(), 1);
+        control.setMaximumClientCount(4);
+        QCOMPARE(control.maximumClientCount(), 4);
+        control.setMaximumClientCount(0);
+        QCOMPARE(control.maximumClientCount(), 1);
+        control.beginNotificationBatch();
+        control.endNotificationBatch();
         control.connectToDevice();
 
         QTRY_VERIFY_WITH_TIMEOUT(!errorSpy.isEmpty(), 10000);
@@ -578,6 +605,62 @@ void tst_QLowEnergyController::tst_concurrentDiscovery()
     control.disconnectFromDevice();
 }
 
+void tst_QLowEnergyController::tst_discoverAllServiceDetails()
+{
+#if !defined(Q_OS_MAC) && !defined(Q_OS_WINRT)
+    QList<QBluetoothHostInfo> localAdapters = QBluetoothLocalDevice::allDevices();
+    if (localAdapters.isEmpty())
+        QSKIP("No local Bluetooth device found. Skipping test.");
+#endif
+
+    if (!remoteDeviceInfo.isValid())
+        QSKIP("No remote BTLE device found. Skipping test.");
+    QLowEnergyController control(remoteDeviceInfo);
+
+    // no-op while not discovered
+    control.discoverAllServiceDetails();
+    QCOMPARE(control.state(), QLowEnergyController::UnconnectedState);
+
+    control.connectToDevice();
+    {
+        QTRY_IMPL(control.state() != QLowEnergyController::ConnectingState,
+              30000);
+    }
+
+    if (control.state() == QLowEnergyController::ConnectingState
+            || control.error() != QLowEnergyController::NoError) {
+        // default BTLE backend forever hangs in ConnectingState
+        QSKIP("Cannot connect to remote device");
+    }
+
+    QSignalSpy discoveryFinishedSpy(&control, SIGNAL(discoveryFinished()));
+    control.discoverServices();
+    QTRY_VERIFY_WITH_TIMEOUT(discoveryFinishedSpy.count() == 1, 20000);
+
+    QList<QLowEnergyService *> savedReferences;
+    foreach (const QBluetoothUuid &uuid, foundServices) {
+        QLowEnergyService *service = control.createServiceObject(uuid, &control);
+        QVERIFY2(service, uuid.toString().toLatin1());
+        QCOMPARE(service->state(), QLowEnergyService::DiscoveryRequired);
+        savedReferences.append(service);
+    }
+
+    control.discoverAllServiceDetails();
+    foreach (QLowEnergyService *service, savedReferences)
+        QVERIFY(service->state() != QLowEnergyService::DiscoveryRequired);
+
+    foreach (QLowEnergyService *service, savedReferences) {
+        QTRY_VERIFY_WITH_TIMEOUT(
+                    service->state() == QLowEnergyService::ServiceDiscovered, 20000);
+        QCOMPARE(service->error(), QLowEnergyService::NoError);
+        verifyServiceProperties(service);
+    }
+
+    control.disconnectFromDevice();
+    QTRY_VERIFY_WITH_TIMEOUT(control.state() == QLowEnergyController::UnconnectedState,
+                             30000);
+}
+
 void tst_QLowEnergyController::verifyServiceProperties(
         const QLowEnergyService *info)
 {